@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMVideoCacheEntry.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMVideoCacheEvictionPolicy.h
\ No newline at end of file
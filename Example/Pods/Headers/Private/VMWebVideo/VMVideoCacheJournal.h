@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMVideoCacheJournal.h
\ No newline at end of file
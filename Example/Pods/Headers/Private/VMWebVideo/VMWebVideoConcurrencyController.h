@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoConcurrencyController.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoDownloadScheduler.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoFailedURLCache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoMetrics.h
\ No newline at end of file
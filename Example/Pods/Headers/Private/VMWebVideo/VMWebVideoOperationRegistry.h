@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoOperationRegistry.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoProgressiveFile.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoServer.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../../Pod/Classes/VMWebVideoWeakProxy.h
\ No newline at end of file
@@ -2,12 +2,23 @@
 
 #import "VMSingleton.h"
 #import "VMVideoCache.h"
+#import "VMVideoCacheEntry.h"
+#import "VMVideoCacheEvictionPolicy.h"
+#import "VMVideoCacheJournal.h"
 #import "VMWebVideoCompat.h"
+#import "VMWebVideoConcurrencyController.h"
+#import "VMWebVideoDownloadScheduler.h"
 #import "VMWebVideoDownloader.h"
 #import "VMWebVideoDownloaderOperation.h"
+#import "VMWebVideoFailedURLCache.h"
 #import "VMWebVideoManager.h"
+#import "VMWebVideoMetrics.h"
 #import "VMWebVideoOperation.h"
+#import "VMWebVideoOperationRegistry.h"
 #import "VMWebVideoPrefetcher.h"
+#import "VMWebVideoProgressiveFile.h"
+#import "VMWebVideoServer.h"
+#import "VMWebVideoWeakProxy.h"
 
 FOUNDATION_EXPORT double VMWebVideoVersionNumber;
 FOUNDATION_EXPORT const unsigned char VMWebVideoVersionString[];
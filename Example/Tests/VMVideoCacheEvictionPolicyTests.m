@@ -0,0 +1,92 @@
+//
+//  VMVideoCacheEvictionPolicyTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMVideoCacheEvictionPolicy.h>
+#import <VMWebVideo/VMVideoCacheEntry.h>
+
+@interface VMVideoCacheEvictionPolicyTests : XCTestCase
+
+@end
+
+@implementation VMVideoCacheEvictionPolicyTests
+
+- (VMVideoCacheEntry *)entryNamed:(NSString *)fileName sizeMB:(double)sizeMB lastAccessTime:(NSTimeInterval)lastAccessTime accessCount:(NSUInteger)accessCount
+{
+    VMVideoCacheEntry *entry = [VMVideoCacheEntry entryWithPath:fileName size:(unsigned long long)(sizeMB * 1024 * 1024) modificationTime:0];
+    entry.lastAccessTime = lastAccessTime;
+    entry.accessCount = accessCount;
+    return entry;
+}
+
+// The file names of the entries, lowest priority (evicted first) first
+- (NSArray *)evictionOrderOfEntries:(NSArray *)entries policy:(id <VMVideoCacheEvictionPolicy>)policy
+{
+    for (VMVideoCacheEntry *entry in entries) {
+        entry.evictionPriority = [policy priorityForEntry:entry];
+    }
+    NSArray *sortedEntries = [entries sortedArrayUsingComparator:^NSComparisonResult(VMVideoCacheEntry *entry1, VMVideoCacheEntry *entry2) {
+        return [@(entry1.evictionPriority) compare:@(entry2.evictionPriority)];
+    }];
+    return [sortedEntries valueForKey:@"fileName"];
+}
+
+- (void)testLRUEvictsLeastRecentlyUsedFirst
+{
+    NSArray *entries = @[[self entryNamed:@"recent" sizeMB:1 lastAccessTime:3000 accessCount:0],
+                         [self entryNamed:@"old" sizeMB:1 lastAccessTime:1000 accessCount:50],
+                         [self entryNamed:@"middle" sizeMB:100 lastAccessTime:2000 accessCount:1]];
+    NSArray *order = [self evictionOrderOfEntries:entries policy:[VMVideoCacheLRUEvictionPolicy new]];
+    XCTAssertEqualObjects(order, (@[@"old", @"middle", @"recent"]));
+}
+
+- (void)testLFUEvictsLeastFrequentlyUsedFirst
+{
+    NSArray *entries = @[[self entryNamed:@"popular" sizeMB:1 lastAccessTime:1000 accessCount:10],
+                         [self entryNamed:@"rare" sizeMB:1 lastAccessTime:3000 accessCount:1],
+                         [self entryNamed:@"unused" sizeMB:1 lastAccessTime:4000 accessCount:0]];
+    NSArray *order = [self evictionOrderOfEntries:entries policy:[VMVideoCacheLFUEvictionPolicy new]];
+    XCTAssertEqualObjects(order, (@[@"unused", @"rare", @"popular"]));
+}
+
+- (void)testLFUBreaksTiesByRecency
+{
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSArray *entries = @[[self entryNamed:@"newer" sizeMB:1 lastAccessTime:now accessCount:2],
+                         [self entryNamed:@"older" sizeMB:1 lastAccessTime:now - 60 accessCount:2],
+                         [self entryNamed:@"frequent" sizeMB:1 lastAccessTime:now - 3600 accessCount:3]];
+    NSArray *order = [self evictionOrderOfEntries:entries policy:[VMVideoCacheLFUEvictionPolicy new]];
+    XCTAssertEqualObjects(order, (@[@"older", @"newer", @"frequent"]));
+}
+
+- (void)testGDSFFavorsSmallFrequentlyUsedVideos
+{
+    NSArray *entries = @[[self entryNamed:@"large" sizeMB:100 lastAccessTime:3000 accessCount:10],
+                         [self entryNamed:@"small" sizeMB:1 lastAccessTime:1000 accessCount:0],
+                         [self entryNamed:@"smallPopular" sizeMB:1 lastAccessTime:1000 accessCount:5]];
+    NSArray *order = [self evictionOrderOfEntries:entries policy:[VMVideoCacheGDSFEvictionPolicy new]];
+    XCTAssertEqualObjects(order, (@[@"large", @"small", @"smallPopular"]));
+}
+
+- (void)testGDSFAgesOutFormerlyPopularVideos
+{
+    VMVideoCacheGDSFEvictionPolicy *policy = [VMVideoCacheGDSFEvictionPolicy new];
+    VMVideoCacheEntry *formerlyPopular = [self entryNamed:@"formerlyPopular" sizeMB:1 lastAccessTime:1000 accessCount:9];
+    formerlyPopular.evictionPriority = [policy priorityForEntry:formerlyPopular];
+    
+    // Evicting an entry raises the priority of everything ranked afterwards
+    VMVideoCacheEntry *evicted = [self entryNamed:@"evicted" sizeMB:1 lastAccessTime:1000 accessCount:9];
+    evicted.evictionPriority = [policy priorityForEntry:evicted];
+    [policy didEvictEntry:evicted];
+    
+    VMVideoCacheEntry *newcomer = [self entryNamed:@"newcomer" sizeMB:1 lastAccessTime:2000 accessCount:0];
+    newcomer.evictionPriority = [policy priorityForEntry:newcomer];
+    XCTAssertLessThan(formerlyPopular.evictionPriority, newcomer.evictionPriority);
+}
+
+@end
@@ -0,0 +1,159 @@
+//
+//  VMVideoCacheEvictionTraceTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMVideoCacheEvictionPolicy.h>
+#import <VMWebVideo/VMVideoCacheEntry.h>
+#import "VMWebVideoBenchmarkResults.h"
+
+static const NSUInteger kTraceVideoCount = 500;
+static const NSUInteger kTraceRequestCount = 20000;
+static const double kTraceZipfExponent = 0.8;
+// The share of the bytes of all the videos the simulated cache holds
+static const double kTraceCacheShare = 0.1;
+
+@interface VMVideoCacheEvictionTraceTests : XCTestCase
+
+// The size of every video, and the index of the video of every request
+@property (strong, nonatomic) NSArray *videoSizes;
+@property (strong, nonatomic) NSArray *trace;
+
+@end
+
+@implementation VMVideoCacheEvictionTraceTests
+
+- (void)setUp
+{
+    [super setUp];
+    // The same trace on every run, so that the hit ratios can be compared across changes
+    srand48(42);
+    
+    // Clips of 1 to 50 MB, spread evenly on a log scale
+    NSMutableArray *videoSizes = [NSMutableArray arrayWithCapacity:kTraceVideoCount];
+    for (NSUInteger i = 0; i < kTraceVideoCount; i++) {
+        [videoSizes addObject:@((unsigned long long)(exp(drand48() * log(50.0)) * 1024 * 1024))];
+    }
+    self.videoSizes = videoSizes;
+    
+    // Zipf popularity, reshuffled halfway through the trace like a feed moving on to new content
+    double cumulativeWeights[kTraceVideoCount];
+    double totalWeight = 0;
+    for (NSUInteger rank = 0; rank < kTraceVideoCount; rank++) {
+        totalWeight += 1.0 / pow(rank + 1, kTraceZipfExponent);
+        cumulativeWeights[rank] = totalWeight;
+    }
+    NSUInteger videoOfRank[kTraceVideoCount];
+    for (NSUInteger rank = 0; rank < kTraceVideoCount; rank++) {
+        videoOfRank[rank] = rank;
+    }
+    
+    NSMutableArray *trace = [NSMutableArray arrayWithCapacity:kTraceRequestCount];
+    for (NSUInteger i = 0; i < kTraceRequestCount; i++) {
+        if (i == kTraceRequestCount / 2) {
+            for (NSUInteger rank = kTraceVideoCount - 1; rank > 0; rank--) {
+                NSUInteger other = (NSUInteger)(drand48() * (rank + 1));
+                NSUInteger video = videoOfRank[rank];
+                videoOfRank[rank] = videoOfRank[other];
+                videoOfRank[other] = video;
+            }
+        }
+        
+        double weight = drand48() * totalWeight;
+        NSUInteger low = 0, high = kTraceVideoCount - 1;
+        while (low < high) {
+            NSUInteger middle = (low + high) / 2;
+            if (cumulativeWeights[middle] < weight) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        [trace addObject:@(videoOfRank[low])];
+    }
+    self.trace = trace;
+}
+
+// Replays the trace against a cache that evicts like VMVideoCache does after a store: the lowest priority first,
+// never the video just stored, until it fits again. Returns the share of requests and of bytes served from the cache.
+- (double)hitRatioOfPolicy:(id <VMVideoCacheEvictionPolicy>)policy byteHitRatio:(double *)byteHitRatio
+{
+    unsigned long long totalBytes = 0;
+    for (NSNumber *size in self.videoSizes) {
+        totalBytes += size.unsignedLongLongValue;
+    }
+    unsigned long long capacity = (unsigned long long)(totalBytes * kTraceCacheShare);
+    
+    NSMutableDictionary *entries = [NSMutableDictionary new];
+    unsigned long long cachedBytes = 0;
+    NSUInteger hits = 0;
+    unsigned long long requestedBytes = 0, hitBytes = 0;
+    NSTimeInterval time = 0;
+    for (NSNumber *video in self.trace) {
+        time += 1;
+        unsigned long long size = [self.videoSizes[video.unsignedIntegerValue] unsignedLongLongValue];
+        requestedBytes += size;
+        
+        VMVideoCacheEntry *entry = entries[video];
+        if (entry) {
+            hits++;
+            hitBytes += size;
+            entry.lastAccessTime = time;
+            entry.accessCount++;
+            entry.evictionPriority = [policy priorityForEntry:entry];
+            continue;
+        }
+        
+        entry = [VMVideoCacheEntry entryWithPath:video.stringValue size:size modificationTime:time];
+        entry.lastAccessTime = time;
+        entry.evictionPriority = [policy priorityForEntry:entry];
+        entries[video] = entry;
+        cachedBytes += size;
+        
+        while (cachedBytes > capacity) {
+            VMVideoCacheEntry *victim = nil;
+            for (VMVideoCacheEntry *candidate in [entries objectEnumerator]) {
+                if (candidate != entry && (!victim || candidate.evictionPriority < victim.evictionPriority)) {
+                    victim = candidate;
+                }
+            }
+            if (!victim) {
+                break;
+            }
+            [entries removeObjectForKey:@(victim.fileName.integerValue)];
+            cachedBytes -= victim.size;
+            if ([policy respondsToSelector:@selector(didEvictEntry:)]) {
+                [policy didEvictEntry:victim];
+            }
+        }
+    }
+    
+    if (byteHitRatio) {
+        *byteHitRatio = (double)hitBytes / requestedBytes;
+    }
+    return (double)hits / self.trace.count;
+}
+
+- (void)testHitRatiosOfThePolicies
+{
+    NSDictionary *policies = @{@"LRU": [VMVideoCacheLRUEvictionPolicy new],
+                               @"LFU": [VMVideoCacheLFUEvictionPolicy new],
+                               @"GDSF": [VMVideoCacheGDSFEvictionPolicy new]};
+    NSMutableDictionary *metrics = [NSMutableDictionary new];
+    for (NSString *name in @[@"LRU", @"LFU", @"GDSF"]) {
+        double byteHitRatio = 0;
+        double hitRatio = [self hitRatioOfPolicy:policies[name] byteHitRatio:&byteHitRatio];
+        metrics[[name stringByAppendingString:@"HitRatio"]] = @(hitRatio);
+        metrics[[name stringByAppendingString:@"ByteHitRatio"]] = @(byteHitRatio);
+        XCTAssertGreaterThan(hitRatio, 0.0);
+        XCTAssertLessThan(hitRatio, 1.0);
+    }
+    [VMWebVideoBenchmarkResults recordMetrics:metrics forBenchmark:@"cache.evictionTrace"];
+}
+
+@end
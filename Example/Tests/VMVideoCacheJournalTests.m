@@ -0,0 +1,170 @@
+//
+//  VMVideoCacheJournalTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMVideoCacheJournal.h>
+#import <VMWebVideo/VMVideoCacheEntry.h>
+
+@interface VMVideoCacheJournalTests : XCTestCase
+
+@property (strong, nonatomic) NSString *path;
+@property (strong, nonatomic) VMVideoCacheJournal *journal;
+
+@end
+
+@implementation VMVideoCacheJournalTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    self.journal = [[VMVideoCacheJournal alloc] initWithPath:self.path];
+}
+
+- (void)tearDown
+{
+    self.journal = nil;
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+    [super tearDown];
+}
+
+- (VMVideoCacheEntry *)entryNamed:(NSString *)fileName size:(unsigned long long)size
+{
+    VMVideoCacheEntry *entry = [VMVideoCacheEntry entryWithPath:[@"/cache" stringByAppendingPathComponent:fileName] size:size modificationTime:100];
+    entry.key = [@"http://example.com/" stringByAppendingString:fileName];
+    entry.eTag = @"\"v1\"";
+    return entry;
+}
+
+- (NSDictionary *)replayedEntriesOfJournal:(VMVideoCacheJournal *)journal
+{
+    NSMutableDictionary *entries = [NSMutableDictionary dictionary];
+    for (VMVideoCacheEntry *entry in [journal replayEntries]) {
+        entries[entry.fileName] = entry;
+    }
+    return entries;
+}
+
+- (void)appendString:(NSString *)string
+{
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingAtPath:self.path];
+    [handle seekToEndOfFile];
+    [handle writeData:[string dataUsingEncoding:NSUTF8StringEncoding]];
+    [handle closeFile];
+}
+
+- (void)testReplayWithoutJournal
+{
+    XCTAssertNil([self.journal replayEntries]);
+}
+
+- (void)testReplayRestoresEntries
+{
+    VMVideoCacheEntry *first = [self entryNamed:@"a.mov" size:1024];
+    VMVideoCacheEntry *second = [self entryNamed:@"b.mov" size:2048];
+    [self.journal recordEntry:first];
+    [self.journal recordEntry:second];
+    first.lastAccessTime = 200;
+    first.accessCount = 1;
+    [self.journal recordAccessesOfEntries:@[first]];
+    [self.journal recordRemovalOfFileName:@"b.mov"];
+    
+    VMVideoCacheJournal *journal = [[VMVideoCacheJournal alloc] initWithPath:self.path];
+    NSDictionary *entries = [self replayedEntriesOfJournal:journal];
+    XCTAssertEqual(entries.count, (NSUInteger)1);
+    XCTAssertEqual(journal.recordCount, (NSUInteger)4);
+    
+    VMVideoCacheEntry *entry = entries[@"a.mov"];
+    XCTAssertEqual(entry.size, 1024ull);
+    XCTAssertEqualWithAccuracy(entry.modificationTime, 100, 0.001);
+    XCTAssertEqualWithAccuracy(entry.lastAccessTime, 200, 0.001);
+    XCTAssertEqual(entry.accessCount, (NSUInteger)1);
+    XCTAssertEqualObjects(entry.key, @"http://example.com/a.mov");
+    XCTAssertEqualObjects(entry.eTag, @"\"v1\"");
+    XCTAssertNil(entry.lastModified);
+    XCTAssertNil(entry.path);
+}
+
+- (void)testReplayCutsOffTornLastRecord
+{
+    [self.journal recordEntry:[self entryNamed:@"a.mov" size:1024]];
+    [self appendString:@"+\tb.mov\t20"];
+    
+    VMVideoCacheJournal *journal = [[VMVideoCacheJournal alloc] initWithPath:self.path];
+    NSDictionary *entries = [self replayedEntriesOfJournal:journal];
+    XCTAssertEqualObjects([entries allKeys], @[@"a.mov"]);
+    
+    // The fragment is gone, so the next record starts on a line of its own
+    [journal recordEntry:[self entryNamed:@"c.mov" size:4096]];
+    entries = [self replayedEntriesOfJournal:[[VMVideoCacheJournal alloc] initWithPath:self.path]];
+    XCTAssertEqual(entries.count, (NSUInteger)2);
+    VMVideoCacheEntry *entry = entries[@"c.mov"];
+    XCTAssertEqual(entry.size, 4096ull);
+    XCTAssertNil(entries[@"b.mov"]);
+}
+
+- (void)testReplayOfOnlyATornRecord
+{
+    [[@"+\ta.mo" dataUsingEncoding:NSUTF8StringEncoding] writeToFile:self.path atomically:YES];
+    
+    XCTAssertEqual([[self.journal replayEntries] count], (NSUInteger)0);
+    XCTAssertEqual([[[NSFileManager defaultManager] attributesOfItemAtPath:self.path error:nil] fileSize], 0ull);
+}
+
+- (void)testReplayOfAccessRecords
+{
+    VMVideoCacheEntry *entry = [self entryNamed:@"a.mov" size:1024];
+    [self.journal recordEntry:entry];
+    entry.lastAccessTime = 300;
+    entry.accessCount = 7;
+    [self.journal recordAccessesOfEntries:@[entry]];
+    [self.journal recordAccessesOfEntries:@[entry]];
+    
+    // Older journals count one access per record
+    [self appendString:@"+\tb.mov\t10\t100.000\t100.000\t2\tkey\t\t\n"];
+    [self appendString:@"a\tb.mov\t400.000\n"];
+    
+    NSDictionary *entries = [self replayedEntriesOfJournal:self.journal];
+    VMVideoCacheEntry *recordedEntry = entries[@"a.mov"];
+    XCTAssertEqual(recordedEntry.accessCount, (NSUInteger)7);
+    XCTAssertEqualWithAccuracy(recordedEntry.lastAccessTime, 300, 0.001);
+    VMVideoCacheEntry *olderEntry = entries[@"b.mov"];
+    XCTAssertEqual(olderEntry.accessCount, (NSUInteger)3);
+    XCTAssertEqualWithAccuracy(olderEntry.lastAccessTime, 400, 0.001);
+}
+
+- (void)testReplaySkipsRecordsThatDontParse
+{
+    [self.journal recordEntry:[self entryNamed:@"a.mov" size:1024]];
+    [self appendString:@"+\tb.mov\t-5\t100.000\t100.000\t0\tkey\t\t\n"];
+    [self appendString:@"+\tc.mov\t12x\t100.000\t100.000\t0\tkey\t\t\n"];
+    [self appendString:@"+\td.mov\t10\tnan\t100.000\t0\tkey\t\t\n"];
+    [self appendString:@"+\t\t10\t100.000\t100.000\t0\tkey\t\t\n"];
+    [self appendString:@"a\ta.mov\tlater\n"];
+    
+    VMVideoCacheEntry *entry = [self replayedEntriesOfJournal:self.journal][@"a.mov"];
+    XCTAssertEqual([[self.journal replayEntries] count], (NSUInteger)1);
+    XCTAssertEqualWithAccuracy(entry.lastAccessTime, 100, 0.001);
+    XCTAssertEqual(entry.accessCount, (NSUInteger)0);
+}
+
+- (void)testCompaction
+{
+    VMVideoCacheEntry *entry = [self entryNamed:@"a.mov" size:1024];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [self.journal recordEntry:entry];
+    }
+    XCTAssertTrue([self.journal compactWithEntries:@[entry]]);
+    XCTAssertEqual(self.journal.recordCount, (NSUInteger)1);
+    
+    VMVideoCacheJournal *journal = [[VMVideoCacheJournal alloc] initWithPath:self.path];
+    XCTAssertEqual([[journal replayEntries] count], (NSUInteger)1);
+    XCTAssertEqual(journal.recordCount, (NSUInteger)1);
+}
+
+@end
@@ -0,0 +1,221 @@
+//
+//  VMVideoCacheTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMVideoCache.h>
+#import <VMWebVideo/VMVideoCacheEvictionPolicy.h>
+#import <VMWebVideo/VMVideoCacheEntry.h>
+#import <mach/mach.h>
+#import "VMWebVideoBenchmarkResults.h"
+
+static const NSUInteger kLargeVideoLength = 8 * 1024 * 1024;
+
+@interface VMVideoCache (Tests)
+
+- (NSData *)videoDataForKey:(NSString *)key;
+
+@end
+
+// Remembers the entries it was told about, only called on the index queue
+@interface VMVideoCacheRecordingEvictionPolicy : VMVideoCacheLRUEvictionPolicy
+
+@property (strong, nonatomic) NSMutableArray *evictedFileNames;
+
+@end
+
+@implementation VMVideoCacheRecordingEvictionPolicy
+
+- (id)init {
+    if ((self = [super init])) {
+        _evictedFileNames = [NSMutableArray new];
+    }
+    return self;
+}
+
+- (void)didEvictEntry:(VMVideoCacheEntry *)entry {
+    [self.evictedFileNames addObject:entry.fileName];
+}
+
+@end
+
+@interface VMVideoCacheTests : XCTestCase
+
+@property (strong, nonatomic) VMVideoCache *cache;
+
+@end
+
+@implementation VMVideoCacheTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.cache = [[VMVideoCache alloc] initWithNamespace:[[NSUUID UUID] UUIDString]];
+}
+
+- (void)tearDown
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"clearDisk"];
+    [self.cache clearDiskOnCompletion:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    self.cache = nil;
+    [super tearDown];
+}
+
+- (NSData *)videoDataOfLength:(NSUInteger)length byte:(uint8_t)byte
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    memset(data.mutableBytes, byte, length);
+    return data;
+}
+
+- (unsigned long long)residentSize
+{
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+}
+
+- (void)removeVideoForKey:(NSString *)key
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"removeVideoForKey"];
+    [self.cache removeVideoForKey:key completion:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testMappedDataOutlivesReplacementAndRemoval
+{
+    NSString *key = @"http://example.com/large.mp4";
+    NSData *original = [self videoDataOfLength:kLargeVideoLength byte:1];
+    [self.cache storeVideoDataToDisk:original forKey:key];
+    
+    NSData *mapped = [self.cache videoDataForKey:key];
+    XCTAssertEqualObjects(mapped, original);
+    
+    // Stores replace the file by a rename, so the pages we mapped still hold the old video
+    NSData *replacement = [self videoDataOfLength:kLargeVideoLength byte:2];
+    [self.cache storeVideoDataToDisk:replacement forKey:key];
+    XCTAssertEqualObjects(mapped, original);
+    XCTAssertEqualObjects([self.cache videoDataForKey:key], replacement);
+    
+    [self removeVideoForKey:key];
+    XCTAssertEqualObjects(mapped, original);
+    XCTAssertNil([self.cache videoDataForKey:key]);
+}
+
+- (void)testStoringAFileDropsTheVideoFromMemory
+{
+    NSString *key = @"http://example.com/small.mp4";
+    NSData *original = [self videoDataOfLength:1024 byte:1];
+    [self.cache storeVideoDataToDisk:original forKey:key];
+    XCTAssertEqualObjects([self.cache videoDataFromMemoryCacheForKey:key], original);
+    
+    NSData *replacement = [self videoDataOfLength:2048 byte:2];
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+    [replacement writeToURL:fileURL atomically:YES];
+    XCTAssertNotNil([self.cache storeVideoFileToDisk:fileURL forKey:key]);
+    
+    // Waits for the index, which drops the stale video from memory in the same barrier
+    XCTAssertTrue([self.cache videoExistsWithKey:key]);
+    XCTAssertNil([self.cache videoDataFromMemoryCacheForKey:key]);
+    XCTAssertEqualObjects([self.cache videoDataForKey:key], replacement);
+    XCTAssertEqualObjects([self.cache videoDataFromMemoryCacheForKey:key], replacement);
+}
+
+- (void)testRemovingAVideoDropsItFromMemory
+{
+    NSString *key = @"http://example.com/small.mp4";
+    [self.cache storeVideoDataToDisk:[self videoDataOfLength:1024 byte:1] forKey:key];
+    [self removeVideoForKey:key];
+    XCTAssertNil([self.cache videoDataFromMemoryCacheForKey:key]);
+    XCTAssertNil([self.cache videoDataForKey:key]);
+}
+
+- (void)testCleanDiskReportsEvictionsToThePolicy
+{
+    VMVideoCacheRecordingEvictionPolicy *policy = [VMVideoCacheRecordingEvictionPolicy new];
+    self.cache.evictionPolicy = policy;
+    for (NSUInteger i = 0; i < 4; i++) {
+        [self.cache storeVideoDataToDisk:[self videoDataOfLength:1024 byte:(uint8_t)i] forKey:[NSString stringWithFormat:@"http://example.com/%lu.mp4", (unsigned long)i]];
+    }
+    // Lowered after the stores, so that only cleanDisk evicts. It goes down to half of it, keeping one video.
+    self.cache.maxCacheSize = 2560;
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"cleanDisk"];
+    [self.cache cleanDiskWithCompletionBlock:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    // Waits for the index, which reports the evictions in its barriers
+    [self.cache videoExistsWithKey:@"http://example.com/0.mp4"];
+    XCTAssertEqual(policy.evictedFileNames.count, (NSUInteger)3);
+}
+
+- (void)testMappedLookupAgainstReadingIntoTheHeap
+{
+    NSString *key = @"http://example.com/large.mp4";
+    [self.cache storeVideoDataToDisk:[self videoDataOfLength:kLargeVideoLength byte:1] forKey:key];
+    NSString *path = [[self.cache videoDataFilePathFromCacheForKey:key] path];
+    XCTAssertNotNil(path);
+    
+    // Every hit is held on to, like cells keeping their video around, and only its first byte is read
+    const NSUInteger hitCount = 10;
+    NSMutableArray *hits = [NSMutableArray arrayWithCapacity:hitCount];
+    unsigned long long residentBefore = [self residentSize];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < hitCount; i++) {
+        NSData *data = [self.cache videoDataForKey:key];
+        XCTAssertEqual(((const uint8_t *)data.bytes)[0], (uint8_t)1);
+        [hits addObject:data];
+    }
+    NSTimeInterval mappedSeconds = CFAbsoluteTimeGetCurrent() - start;
+    unsigned long long mappedGrowth = [self residentSize] - MIN(residentBefore, [self residentSize]);
+    [hits removeAllObjects];
+    
+    residentBefore = [self residentSize];
+    start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < hitCount; i++) {
+        NSData *data = [NSData dataWithContentsOfFile:path];
+        XCTAssertEqual(((const uint8_t *)data.bytes)[0], (uint8_t)1);
+        [hits addObject:data];
+    }
+    NSTimeInterval heapSeconds = CFAbsoluteTimeGetCurrent() - start;
+    unsigned long long heapGrowth = [self residentSize] - MIN(residentBefore, [self residentSize]);
+    [hits removeAllObjects];
+    
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"videoBytes": @(kLargeVideoLength),
+                                                @"hits": @(hitCount),
+                                                @"mappedSeconds": @(mappedSeconds),
+                                                @"mappedResidentGrowthBytes": @(mappedGrowth),
+                                                @"heapSeconds": @(heapSeconds),
+                                                @"heapResidentGrowthBytes": @(heapGrowth)}
+                                 forBenchmark:@"cache.mappedLookup"];
+}
+
+- (void)testPerformanceOfLargeVideoLookup
+{
+    NSString *key = @"http://example.com/large.mp4";
+    [self.cache storeVideoDataToDisk:[self videoDataOfLength:kLargeVideoLength byte:1] forKey:key];
+    
+    // Only the first page is touched, which is all a mapped lookup should pay for
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100; i++) {
+            NSData *data = [self.cache videoDataForKey:key];
+            XCTAssertEqual(((const uint8_t *)data.bytes)[0], (uint8_t)1);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,33 @@
+//
+//  VMWebVideoBenchmarkResults.h
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Collects the numbers of the benchmarks in a JSON file, so that a script can compare them run over run.
+ *
+ * The file maps the name of every benchmark to its latest metrics and the date they were recorded. It is
+ * `VMWebVideoBenchmarks.json` in the temporary directory, unless the `VMWEBVIDEO_BENCHMARK_RESULTS` environment
+ * variable names another path.
+ */
+@interface VMWebVideoBenchmarkResults : NSObject
+
+/**
+ * The path of the results file.
+ */
++ (NSString *)resultsPath;
+
+/**
+ * Replaces the metrics of a benchmark in the results file, and logs them.
+ *
+ * @param metrics Numbers keyed by metric name, e.g. `@{@"p99Microseconds": @(120)}`
+ * @param name    The name of the benchmark, e.g. `download.concurrency`
+ */
++ (void)recordMetrics:(NSDictionary *)metrics forBenchmark:(NSString *)name;
+
+@end
@@ -0,0 +1,44 @@
+//
+//  VMWebVideoBenchmarkResults.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoBenchmarkResults.h"
+
+@implementation VMWebVideoBenchmarkResults
+
++ (NSString *)resultsPath {
+    NSString *path = [[NSProcessInfo processInfo] environment][@"VMWEBVIDEO_BENCHMARK_RESULTS"];
+    return path.length > 0 ? path : [NSTemporaryDirectory() stringByAppendingPathComponent:@"VMWebVideoBenchmarks.json"];
+}
+
++ (void)recordMetrics:(NSDictionary *)metrics forBenchmark:(NSString *)name {
+    NSLog(@"Benchmark %@: %@", name, metrics);
+    
+    @synchronized (self) {
+        NSString *path = [self resultsPath];
+        NSMutableDictionary *results = nil;
+        NSData *data = [NSData dataWithContentsOfFile:path];
+        if (data) {
+            id object = [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:NULL];
+            if ([object isKindOfClass:[NSMutableDictionary class]]) {
+                results = object;
+            }
+        }
+        if (!results) {
+            results = [NSMutableDictionary new];
+        }
+        
+        NSMutableDictionary *result = [metrics mutableCopy];
+        result[@"recordedAt"] = @([[NSDate date] timeIntervalSince1970]);
+        results[name] = result;
+        
+        NSData *json = [NSJSONSerialization dataWithJSONObject:results options:NSJSONWritingPrettyPrinted error:NULL];
+        [json writeToFile:path atomically:YES];
+    }
+}
+
+@end
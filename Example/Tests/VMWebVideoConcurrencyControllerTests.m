@@ -0,0 +1,131 @@
+//
+//  VMWebVideoConcurrencyControllerTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoConcurrencyController.h>
+
+@interface VMWebVideoConcurrencyControllerTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoConcurrencyController *controller;
+@property (assign, nonatomic) NSTimeInterval time;
+
+@end
+
+@implementation VMWebVideoConcurrencyControllerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.controller = [[VMWebVideoConcurrencyController alloc] initWithMinimumConcurrency:1 maximumConcurrency:8];
+    
+    // The first update only opens a window
+    self.time = 100;
+    XCTAssertFalse([self.controller updateAtTime:self.time saturated:YES]);
+}
+
+// Closes a window of sampleInterval in which the given number of bytes arrived
+- (BOOL)closeWindowWithReceivedBytes:(NSUInteger)length saturated:(BOOL)saturated
+{
+    [self.controller recordReceivedBytes:length];
+    self.time += self.controller.sampleInterval;
+    return [self.controller updateAtTime:self.time saturated:saturated];
+}
+
+- (void)testStartsHalfWayBetweenTheBounds
+{
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)4);
+}
+
+- (void)testAdditiveIncreaseWhileSaturated
+{
+    XCTAssertTrue([self closeWindowWithReceivedBytes:1000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)5);
+    XCTAssertTrue([self closeWindowWithReceivedBytes:1000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)6);
+}
+
+- (void)testNoIncreaseWithoutWaitingDownloads
+{
+    XCTAssertFalse([self closeWindowWithReceivedBytes:1000 saturated:NO]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)4);
+}
+
+- (void)testNoIncreaseWhileIdle
+{
+    XCTAssertFalse([self closeWindowWithReceivedBytes:0 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)4);
+}
+
+- (void)testWindowsShorterThanTheSampleIntervalAreKeptOpen
+{
+    [self.controller recordReceivedBytes:1000];
+    XCTAssertFalse([self.controller updateAtTime:self.time + self.controller.sampleInterval / 2 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)4);
+}
+
+- (void)testIncreaseStopsAtTheMaximum
+{
+    for (NSInteger i = 0; i < 10; i++) {
+        [self closeWindowWithReceivedBytes:1000 saturated:YES];
+    }
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)8);
+}
+
+- (void)testMultiplicativeDecreaseOnSlowResponses
+{
+    [self.controller recordTimeToFirstByte:self.controller.maximumTimeToFirstByte * 2];
+    XCTAssertTrue([self closeWindowWithReceivedBytes:1000 saturated:NO]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)2);
+    
+    // The next window starts over
+    XCTAssertTrue([self closeWindowWithReceivedBytes:1000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)3);
+}
+
+- (void)testMultiplicativeDecreaseWhenThroughputDrops
+{
+    XCTAssertTrue([self closeWindowWithReceivedBytes:10000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)5);
+    XCTAssertTrue([self closeWindowWithReceivedBytes:5000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)2);
+}
+
+- (void)testThroughputDropWithoutWaitingDownloadsIsIgnored
+{
+    [self closeWindowWithReceivedBytes:10000 saturated:NO];
+    XCTAssertFalse([self closeWindowWithReceivedBytes:5000 saturated:NO]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)4);
+}
+
+- (void)testIdleWindowsDontResetTheThroughputBaseline
+{
+    [self closeWindowWithReceivedBytes:10000 saturated:YES];
+    [self closeWindowWithReceivedBytes:0 saturated:NO];
+    XCTAssertTrue([self closeWindowWithReceivedBytes:5000 saturated:YES]);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)2);
+}
+
+- (void)testDecreaseStopsAtTheMinimum
+{
+    for (NSInteger i = 0; i < 5; i++) {
+        [self.controller recordTimeToFirstByte:self.controller.maximumTimeToFirstByte * 2];
+        [self closeWindowWithReceivedBytes:1000 saturated:YES];
+    }
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)1);
+}
+
+- (void)testLoweringTheMaximumClampsTheConcurrency
+{
+    self.controller.maximumConcurrency = 3;
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)3);
+    self.controller.maximumConcurrency = 0;
+    XCTAssertEqual(self.controller.maximumConcurrency, (NSInteger)1);
+    XCTAssertEqual(self.controller.concurrency, (NSInteger)1);
+}
+
+@end
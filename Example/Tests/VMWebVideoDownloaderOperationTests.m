@@ -0,0 +1,146 @@
+//
+//  VMWebVideoDownloaderOperationTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoDownloaderOperation.h>
+
+@interface VMWebVideoDownloaderOperation (Tests)
+
+@property (strong, nonatomic) NSMutableArray *segments;
+@property (assign, nonatomic) long long resumeOffset;
+
+- (long long)contentRangeStartOfResponse:(NSHTTPURLResponse *)response totalLength:(long long *)totalLength;
+- (long long)contiguousLength;
+
+@end
+
+@interface VMWebVideoDownloaderOperationTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoDownloaderOperation *operation;
+
+@end
+
+@implementation VMWebVideoDownloaderOperationTests
+
+- (void)setUp
+{
+    [super setUp];
+    NSURL *url = [NSURL URLWithString:@"http://example.com/video.mp4"];
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+    self.operation = [[VMWebVideoDownloaderOperation alloc] initWithRequest:[NSURLRequest requestWithURL:url]
+                                                                    options:VMWebVideoDownloaderSegmentedDownload
+                                                           temporaryFileURL:fileURL
+                                                                   progress:nil
+                                                                  completed:nil
+                                                                  cancelled:nil];
+}
+
+- (void)tearDown
+{
+    self.operation = nil;
+    [super tearDown];
+}
+
+- (NSHTTPURLResponse *)responseWithContentRange:(NSString *)contentRange
+{
+    NSDictionary *headers = contentRange ? @{@"Content-Range": contentRange} : @{};
+    return [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://example.com/video.mp4"] statusCode:206 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+}
+
+// The segment class is private to the operation
+- (id)segmentFrom:(long long)start to:(long long)limit written:(long long)written
+{
+    id segment = [NSClassFromString(@"VMWebVideoDownloadSegment") new];
+    [segment setValue:@(start) forKey:@"start"];
+    [segment setValue:@(limit) forKey:@"limit"];
+    [segment setValue:@(start + written) forKey:@"offset"];
+    return segment;
+}
+
+- (void)testContentRangeWithTotalLength
+{
+    long long total = -1;
+    XCTAssertEqual([self.operation contentRangeStartOfResponse:[self responseWithContentRange:@"bytes 100-199/1000"] totalLength:&total], 100LL);
+    XCTAssertEqual(total, 1000LL);
+}
+
+- (void)testContentRangeWithUnknownTotalLength
+{
+    long long total = -1;
+    XCTAssertEqual([self.operation contentRangeStartOfResponse:[self responseWithContentRange:@"bytes 0-99/*"] totalLength:&total], 0LL);
+    XCTAssertEqual(total, -1LL);
+}
+
+- (void)testMissingOrMalformedContentRange
+{
+    long long total = -1;
+    XCTAssertEqual([self.operation contentRangeStartOfResponse:[self responseWithContentRange:nil] totalLength:&total], -1LL);
+    XCTAssertEqual([self.operation contentRangeStartOfResponse:[self responseWithContentRange:@"bytes */1000"] totalLength:&total], -1LL);
+    XCTAssertEqual([self.operation contentRangeStartOfResponse:[self responseWithContentRange:@"items 0-99/1000"] totalLength:&total], -1LL);
+    XCTAssertEqual(total, -1LL);
+}
+
+- (void)testPrefixOnDiskCompletesOutsideTheLock
+{
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+    [[NSMutableData dataWithLength:2048] writeToURL:fileURL atomically:YES];
+    [@{@"ETag": @"\"v1\""} writeToURL:[fileURL URLByAppendingPathExtension:@"plist"] atomically:YES];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"prefix"];
+    __block __weak VMWebVideoDownloaderOperation *weakOperation;
+    VMWebVideoDownloaderOperation *operation = [[VMWebVideoDownloaderOperation alloc] initWithRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://example.com/video.mp4"]]
+                                                                                              options:0
+                                                                                     temporaryFileURL:fileURL
+                                                                                             progress:nil
+                                                                                            completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+                                                                                                XCTAssertNil(videoFileURL);
+                                                                                                XCTAssertTrue(finished);
+                                                                                                // Another thread calling into the operation must not wait for this block
+                                                                                                dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                                                                                                    [weakOperation setSuspended:YES];
+                                                                                                });
+                                                                                                [expectation fulfill];
+                                                                                            }
+                                                                                            cancelled:nil];
+    weakOperation = operation;
+    operation.prefixLength = 1024;
+    [operation start];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    
+    [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+    [[NSFileManager defaultManager] removeItemAtURL:[fileURL URLByAppendingPathExtension:@"plist"] error:nil];
+}
+
+- (void)testContiguousLengthRunsThroughFinishedSegments
+{
+    self.operation.segments = [NSMutableArray arrayWithObjects:
+                               [self segmentFrom:1000 to:1500 written:200],
+                               [self segmentFrom:0 to:500 written:500],
+                               [self segmentFrom:500 to:1000 written:500], nil];
+    XCTAssertEqual([self.operation contiguousLength], 1200LL);
+}
+
+- (void)testContiguousLengthStopsAtTheFirstHole
+{
+    self.operation.segments = [NSMutableArray arrayWithObjects:
+                               [self segmentFrom:0 to:500 written:500],
+                               [self segmentFrom:500 to:1000 written:100],
+                               [self segmentFrom:1000 to:1500 written:500], nil];
+    XCTAssertEqual([self.operation contiguousLength], 600LL);
+}
+
+- (void)testContiguousLengthStartsAtTheResumeOffset
+{
+    self.operation.resumeOffset = 300;
+    self.operation.segments = [NSMutableArray arrayWithObjects:
+                               [self segmentFrom:300 to:800 written:0],
+                               [self segmentFrom:800 to:1300 written:500], nil];
+    XCTAssertEqual([self.operation contiguousLength], 300LL);
+}
+
+@end
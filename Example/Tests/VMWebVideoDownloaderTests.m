@@ -0,0 +1,144 @@
+//
+//  VMWebVideoDownloaderTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoDownloader.h>
+#import "VMWebVideoTestServer.h"
+
+@interface VMWebVideoDownloaderTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoTestServer *server;
+@property (strong, nonatomic) VMWebVideoDownloader *downloader;
+@property (strong, nonatomic) NSData *videoData;
+@property (strong, nonatomic) NSURL *url;
+
+@end
+
+@implementation VMWebVideoDownloaderTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.server = [VMWebVideoTestServer new];
+    XCTAssertTrue([self.server start]);
+    NSMutableData *videoData = [NSMutableData dataWithLength:256 * 1024];
+    for (NSUInteger i = 0; i < videoData.length; i++) {
+        ((uint8_t *)videoData.mutableBytes)[i] = (uint8_t)i;
+    }
+    self.videoData = videoData;
+    // A path of its own for every test, so no partial download of an earlier test is resumed
+    NSString *path = [NSString stringWithFormat:@"/%@.mp4", [[NSUUID UUID] UUIDString]];
+    [self.server setVideoData:self.videoData eTag:@"\"v2\"" forPath:path];
+    self.url = [self.server URLForPath:path];
+    self.downloader = [VMWebVideoDownloader new];
+}
+
+- (void)tearDown
+{
+    self.downloader = nil;
+    [self.server stop];
+    self.server = nil;
+    [super tearDown];
+}
+
+- (void)testChangedVideoIsDownloadedWithItsValidators
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download"];
+    [self.downloader downloadVideoToFileWithURL:self.url options:0 validators:@{@"ETag": @"\"v1\""} progress:nil completed:^(NSURL *videoFileURL, NSDictionary *validators, NSError *error, BOOL finished) {
+        XCTAssertNil(error);
+        XCTAssertTrue(finished);
+        // The file goes away once the block returns
+        XCTAssertEqualObjects([NSData dataWithContentsOfURL:videoFileURL], self.videoData);
+        XCTAssertEqualObjects(validators[@"ETag"], @"\"v2\"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    NSDictionary *headers = [[self.server requestHeadersForPath:self.url.path] lastObject];
+    XCTAssertEqualObjects(headers[@"if-none-match"], @"\"v1\"");
+}
+
+- (void)testNotModifiedVideoCompletesWithoutFile
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download"];
+    [self.downloader downloadVideoToFileWithURL:self.url options:0 validators:@{@"ETag": @"\"v2\""} progress:nil completed:^(NSURL *videoFileURL, NSDictionary *validators, NSError *error, BOOL finished) {
+        XCTAssertNil(videoFileURL);
+        XCTAssertNil(error);
+        XCTAssertTrue(finished);
+        XCTAssertEqualObjects(validators[@"ETag"], @"\"v2\"");
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testConditionalDownloadRunsNextToTheSharedOne
+{
+    // Both requests are in flight at the same time, each has to get its own response
+    self.server.latency = 0.3;
+    XCTestExpectation *sharedExpectation = [self expectationWithDescription:@"shared"];
+    [self.downloader downloadVideoToFileWithURL:self.url options:0 progress:nil completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        if (!finished) return;
+        XCTAssertEqualObjects([NSData dataWithContentsOfURL:videoFileURL], self.videoData);
+        [sharedExpectation fulfill];
+    }];
+    XCTestExpectation *conditionalExpectation = [self expectationWithDescription:@"conditional"];
+    [self.downloader downloadVideoToFileWithURL:self.url options:0 validators:@{@"ETag": @"\"v2\""} progress:nil completed:^(NSURL *videoFileURL, NSDictionary *validators, NSError *error, BOOL finished) {
+        XCTAssertNil(videoFileURL);
+        XCTAssertNil(error);
+        XCTAssertTrue(finished);
+        [conditionalExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    NSArray *requests = [self.server requestHeadersForPath:self.url.path];
+    XCTAssertEqual(requests.count, (NSUInteger)2);
+    XCTAssertTrue([[requests valueForKey:@"if-none-match"] containsObject:@"\"v2\""]);
+    // Both operations gave their slot back
+    XCTAssertEqual(self.downloader.currentDownloadCount, (NSUInteger)0);
+}
+
+- (void)testCancellingThePrefixRequestKeepsTheJoinedDownload
+{
+    // Slow enough for the whole video to be requested while the prefix is still coming in
+    self.server.bytesPerSecond = 256 * 1024;
+    id <VMWebVideoOperation> prefixOperation = [self.downloader downloadVideoPrefixWithURL:self.url length:128 * 1024 options:0 progress:nil completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        XCTFail(@"A cancelled request must not be called back");
+    }];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"full"];
+    id <VMWebVideoOperation> fullOperation = [self.downloader downloadVideoToFileWithURL:self.url options:0 progress:nil completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        if (!finished) return;
+        XCTAssertNil(error);
+        XCTAssertEqualObjects([NSData dataWithContentsOfURL:videoFileURL], self.videoData);
+        [expectation fulfill];
+    }];
+    XCTAssertNotNil(fullOperation);
+    [prefixOperation cancel];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testExtendedPrefixWithUnknownTotalLengthGetsTheWholeVideo
+{
+    // The prefix response ends in "/*", its length is only that of the prefix
+    self.server.reportsTotalLength = NO;
+    self.server.bytesPerSecond = 256 * 1024;
+    [self.downloader downloadVideoPrefixWithURL:self.url length:128 * 1024 options:0 progress:nil completed:nil];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"full"];
+    [self.downloader downloadVideoToFileWithURL:self.url options:0 progress:nil completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        if (!finished) return;
+        XCTAssertNil(error);
+        XCTAssertEqualObjects([NSData dataWithContentsOfURL:videoFileURL], self.videoData);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    // The rest was asked for with an open ended range
+    NSDictionary *headers = [[self.server requestHeadersForPath:self.url.path] lastObject];
+    XCTAssertEqualObjects(headers[@"range"], @"bytes=131072-");
+}
+
+@end
@@ -0,0 +1,125 @@
+//
+//  VMWebVideoFailedURLCacheTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoFailedURLCache.h>
+#import <errno.h>
+
+@interface VMWebVideoFailedURLCacheTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoFailedURLCache *cache;
+
+@end
+
+@implementation VMWebVideoFailedURLCacheTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.cache = [VMWebVideoFailedURLCache new];
+}
+
+- (void)tearDown
+{
+    self.cache = nil;
+    [super tearDown];
+}
+
+- (NSURL *)URLWithIndex:(NSUInteger)index
+{
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://example.com/video%lu.mp4", (unsigned long)index]];
+}
+
+- (void)testFailedURLIsBlockedUntilRemoved
+{
+    NSURL *url = [self URLWithIndex:0];
+    XCTAssertFalse([self.cache isBlockedURL:url]);
+    
+    [self.cache recordFailureOfURL:url];
+    XCTAssertTrue([self.cache isBlockedURL:url]);
+    XCTAssertFalse([self.cache isBlockedURL:[self URLWithIndex:1]]);
+    
+    [self.cache removeURL:url];
+    XCTAssertFalse([self.cache isBlockedURL:url]);
+}
+
+- (void)testBlockExpires
+{
+    NSURL *url = [self URLWithIndex:0];
+    self.cache.initialBackoff = 0.1;
+    [self.cache recordFailureOfURL:url];
+    XCTAssertTrue([self.cache isBlockedURL:url]);
+    
+    [NSThread sleepForTimeInterval:0.2];
+    XCTAssertFalse([self.cache isBlockedURL:url]);
+}
+
+- (void)testBackoffDoublesWithEveryFailure
+{
+    NSURL *url = [self URLWithIndex:0];
+    self.cache.initialBackoff = 0.2;
+    [self.cache recordFailureOfURL:url];
+    [self.cache recordFailureOfURL:url];
+    
+    // Blocked for 0.4s by the second failure
+    [NSThread sleepForTimeInterval:0.3];
+    XCTAssertTrue([self.cache isBlockedURL:url]);
+    
+    [NSThread sleepForTimeInterval:0.2];
+    XCTAssertFalse([self.cache isBlockedURL:url]);
+}
+
+- (void)testBackoffIsCappedByMaximumBackoff
+{
+    NSURL *url = [self URLWithIndex:0];
+    self.cache.initialBackoff = 0.1;
+    self.cache.maximumBackoff = 0.2;
+    for (NSUInteger i = 0; i < 5; i++) {
+        [self.cache recordFailureOfURL:url];
+    }
+    
+    [NSThread sleepForTimeInterval:0.3];
+    XCTAssertFalse([self.cache isBlockedURL:url]);
+}
+
+- (void)testTrimDropsTheURLsUnblockedFirst
+{
+    self.cache.countLimit = 10;
+    // The first two URLs failed once, the others twice and are blocked for longer
+    [self.cache recordFailureOfURL:[self URLWithIndex:0]];
+    [self.cache recordFailureOfURL:[self URLWithIndex:1]];
+    for (NSUInteger i = 2; i <= 10; i++) {
+        [self.cache recordFailureOfURL:[self URLWithIndex:i]];
+        [self.cache recordFailureOfURL:[self URLWithIndex:i]];
+    }
+    
+    // The 11th URL goes over the limit, trimming down to 9
+    XCTAssertFalse([self.cache isBlockedURL:[self URLWithIndex:0]]);
+    XCTAssertFalse([self.cache isBlockedURL:[self URLWithIndex:1]]);
+    for (NSUInteger i = 2; i <= 10; i++) {
+        XCTAssertTrue([self.cache isBlockedURL:[self URLWithIndex:i]]);
+    }
+}
+
+- (void)testOnlyFailuresOfTheURLAreRecorded
+{
+    XCTAssertTrue([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:404 userInfo:nil]]);
+    XCTAssertTrue([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:500 userInfo:nil]]);
+    XCTAssertTrue([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotFindHost userInfo:nil]]);
+    XCTAssertTrue([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:nil]]);
+    
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:nil]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:416 userInfo:nil]]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNotConnectedToInternet userInfo:nil]]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil]]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSPOSIXErrorDomain code:ENOSPC userInfo:nil]]);
+    XCTAssertFalse([VMWebVideoFailedURLCache isURLFailureError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteOutOfSpaceError userInfo:nil]]);
+}
+
+@end
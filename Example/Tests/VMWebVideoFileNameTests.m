@@ -0,0 +1,48 @@
+//
+//  VMWebVideoFileNameTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoCompat.h>
+
+@interface VMWebVideoFileNameTests : XCTestCase
+
+@end
+
+@implementation VMWebVideoFileNameTests
+
+// MurmurHash3 x64-128 with a seed of 0, h1 then h2, each written most significant byte first
+- (void)testMurmurHash3ReferenceVectors
+{
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(@""), @"00000000000000000000000000000000");
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(@"hello"), @"cbd8a7b341bd9b025b1e906a48ae1d19");
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(@"The quick brown fox jumps over the lazy dog"), @"e34bbc7bbc071b6c7a433ca9c49a9347");
+}
+
+- (void)testBlocksAndTails
+{
+    // 28 bytes: one full block and a tail that reaches into the second half
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(@"http://example.com/video.mp4"), @"05220bc1f8102f2011eb607d247f8e39");
+}
+
+- (void)testNonASCIIKeysAreHashedAsUTF8
+{
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(@"héllo wörld"), @"6b757453f10a333b4432d052f7788963");
+}
+
+- (void)testNilKeyHashesLikeEmptyKey
+{
+    XCTAssertEqualObjects(VMWebVideoFileNameForKey(nil), VMWebVideoFileNameForKey(@""));
+}
+
+- (void)testLegacyFileNamesAreMD5
+{
+    XCTAssertEqualObjects(VMWebVideoLegacyFileNameForKey(@""), @"d41d8cd98f00b204e9800998ecf8427e");
+    XCTAssertEqualObjects(VMWebVideoLegacyFileNameForKey(@"hello"), @"5d41402abc4b2a76b9719d911017c592");
+}
+
+@end
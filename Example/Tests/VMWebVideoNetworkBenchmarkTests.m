@@ -0,0 +1,355 @@
+//
+//  VMWebVideoNetworkBenchmarkTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoDownloader.h>
+#import <VMWebVideo/VMWebVideoDownloaderOperation.h>
+#import <VMWebVideo/VMWebVideoManager.h>
+#import <VMWebVideo/VMWebVideoPrefetcher.h>
+#import <VMWebVideo/VMWebVideoServer.h>
+#import "VMWebVideoTestServer.h"
+#import "VMWebVideoBenchmarkResults.h"
+#import <mach/mach.h>
+
+static const NSUInteger kBenchmarkVideoCount = 8;
+static const NSUInteger kBenchmarkVideoLength = 512 * 1024;
+
+@interface VMWebVideoNetworkBenchmarkTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoTestServer *server;
+@property (strong, nonatomic) NSData *videoData;
+
+@end
+
+@implementation VMWebVideoNetworkBenchmarkTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.server = [VMWebVideoTestServer new];
+    XCTAssertTrue([self.server start]);
+    self.videoData = [self videoDataOfLength:kBenchmarkVideoLength];
+    
+    // A mobile network as seen from the device: a round trip of 50 ms, and 4 MB/s per connection
+    self.server.latency = 0.05;
+    self.server.bytesPerSecond = 4 * 1024 * 1024;
+}
+
+- (void)tearDown
+{
+    [self.server stop];
+    self.server = nil;
+    [super tearDown];
+}
+
+- (NSData *)videoDataOfLength:(NSUInteger)length
+{
+    NSMutableData *videoData = [NSMutableData dataWithLength:length];
+    for (NSUInteger i = 0; i < videoData.length; i++) {
+        ((uint8_t *)videoData.mutableBytes)[i] = (uint8_t)i;
+    }
+    return videoData;
+}
+
+// Videos at paths nobody requested before, so that no partial download is resumed and nothing is cached yet
+- (NSArray *)freshURLsOfCount:(NSUInteger)count
+{
+    NSMutableArray *urls = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *path = [NSString stringWithFormat:@"/%@.mp4", [[NSUUID UUID] UUIDString]];
+        [self.server setVideoData:self.videoData eTag:@"\"v1\"" forPath:path];
+        [urls addObject:[self.server URLForPath:path]];
+    }
+    return urls;
+}
+
+- (NSUInteger)threadCount
+{
+    thread_act_array_t threads;
+    mach_msg_type_number_t count = 0;
+    if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    for (mach_msg_type_number_t i = 0; i < count; i++) {
+        mach_port_deallocate(mach_task_self(), threads[i]);
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t)threads, sizeof(thread_t) * count);
+    return count;
+}
+
+// Runs the block, sampling the number of threads of the process every 10 ms meanwhile
+- (NSUInteger)peakThreadCountWhileRunning:(void (^)(void))block
+{
+    __block NSUInteger peak = [self threadCount];
+    dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+    dispatch_source_set_timer(timer, DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC, NSEC_PER_MSEC);
+    dispatch_source_set_event_handler(timer, ^{
+        NSUInteger count = [self threadCount];
+        @synchronized (self) {
+            peak = MAX(peak, count);
+        }
+    });
+    dispatch_resume(timer);
+    block();
+    dispatch_source_cancel(timer);
+    @synchronized (self) {
+        return peak;
+    }
+}
+
+// Downloads all the URLs at once and returns the time until the last one is done
+- (NSTimeInterval)downloadURLs:(NSArray *)urls withDownloader:(VMWebVideoDownloader *)downloader options:(VMWebVideoDownloaderOptions)options failureCount:(NSUInteger *)failureCount
+{
+    __block NSUInteger failures = 0;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSURL *url in urls) {
+        XCTestExpectation *expectation = [self expectationWithDescription:url.path];
+        [downloader downloadVideoToFileWithURL:url options:options progress:nil completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+            if (!finished) return;
+            if (error) {
+                failures++;
+            }
+            else {
+                XCTAssertEqualObjects([[[NSFileManager defaultManager] attributesOfItemAtPath:videoFileURL.path error:NULL] objectForKey:NSFileSize], @(self.videoData.length));
+            }
+            [expectation fulfill];
+        }];
+    }
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    if (failureCount) {
+        *failureCount = failures;
+    }
+    return CFAbsoluteTimeGetCurrent() - start;
+}
+
+- (void)testDownloadThroughputByConcurrency
+{
+    NSMutableDictionary *metrics = [NSMutableDictionary new];
+    for (NSNumber *concurrency in @[@1, @2, @4, @8]) {
+        VMWebVideoDownloader *downloader = [VMWebVideoDownloader new];
+        downloader.maxConcurrentDownloads = concurrency.integerValue;
+        NSTimeInterval elapsed = [self downloadURLs:[self freshURLsOfCount:kBenchmarkVideoCount] withDownloader:downloader options:0 failureCount:NULL];
+        double megabytesPerSecond = kBenchmarkVideoCount * kBenchmarkVideoLength / elapsed / (1024 * 1024);
+        metrics[[NSString stringWithFormat:@"concurrency%@MegabytesPerSecond", concurrency]] = @(megabytesPerSecond);
+        XCTAssertEqual(downloader.currentDownloadCount, (NSUInteger)0);
+    }
+    [VMWebVideoBenchmarkResults recordMetrics:metrics forBenchmark:@"download.concurrency"];
+}
+
+- (void)testDownloadThroughputWithServerErrors
+{
+    // Failed downloads give their slot back right away, the others shouldn't wait for them
+    self.server.errorRate = 0.25;
+    VMWebVideoDownloader *downloader = [VMWebVideoDownloader new];
+    NSUInteger failureCount = 0;
+    NSTimeInterval elapsed = [self downloadURLs:[self freshURLsOfCount:kBenchmarkVideoCount * 2] withDownloader:downloader options:0 failureCount:&failureCount];
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"seconds": @(elapsed),
+                                                @"failures": @(failureCount),
+                                                @"requests": @(self.server.requestCount)}
+                                 forBenchmark:@"download.errors"];
+    XCTAssertEqual(downloader.currentDownloadCount, (NSUInteger)0);
+}
+
+- (void)testSharedSessionAgainstSessionPerDownload
+{
+    const NSInteger concurrency = 8;
+    VMWebVideoDownloader *downloader = [VMWebVideoDownloader new];
+    downloader.maxConcurrentDownloads = concurrency;
+    __block NSTimeInterval sharedSeconds = 0;
+    NSUInteger sharedThreads = [self peakThreadCountWhileRunning:^{
+        sharedSeconds = [self downloadURLs:[self freshURLsOfCount:kBenchmarkVideoCount * 2] withDownloader:downloader options:0 failureCount:NULL];
+    }];
+    
+    // Operations that aren't given a session make one of their own, like every download did before the shared session
+    NSOperationQueue *queue = [NSOperationQueue new];
+    queue.maxConcurrentOperationCount = concurrency;
+    NSArray *urls = [self freshURLsOfCount:kBenchmarkVideoCount * 2];
+    NSMutableArray *fileURLs = [NSMutableArray arrayWithCapacity:urls.count];
+    __block NSTimeInterval ownedSeconds = 0;
+    NSUInteger ownedThreads = [self peakThreadCountWhileRunning:^{
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        for (NSURL *url in urls) {
+            NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]]];
+            [fileURLs addObject:fileURL];
+            XCTestExpectation *expectation = [self expectationWithDescription:url.path];
+            VMWebVideoDownloaderOperation *operation = [[VMWebVideoDownloaderOperation alloc] initWithRequest:[NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:15]
+                                                                                                      options:0
+                                                                                             temporaryFileURL:fileURL
+                                                                                                     progress:nil
+                                                                                                    completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+                                                                                                        XCTAssertNil(error);
+                                                                                                        if (finished) [expectation fulfill];
+                                                                                                    }
+                                                                                                    cancelled:nil];
+            [queue addOperation:operation];
+        }
+        [self waitForExpectationsWithTimeout:60 handler:nil];
+        ownedSeconds = CFAbsoluteTimeGetCurrent() - start;
+    }];
+    for (NSURL *fileURL in fileURLs) {
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:[fileURL URLByAppendingPathExtension:@"plist"] error:nil];
+    }
+    
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"sharedSessionSeconds": @(sharedSeconds),
+                                                @"sharedSessionPeakThreads": @(sharedThreads),
+                                                @"sessionPerDownloadSeconds": @(ownedSeconds),
+                                                @"sessionPerDownloadPeakThreads": @(ownedThreads)}
+                                 forBenchmark:@"download.sharedSession"];
+}
+
+- (void)testSegmentedDownloadThroughput
+{
+    // Segments pay off when the bandwidth is limited per connection rather than per device
+    self.videoData = [self videoDataOfLength:8 * 1024 * 1024];
+    VMWebVideoDownloader *downloader = [VMWebVideoDownloader new];
+    NSTimeInterval singleStream = [self downloadURLs:[self freshURLsOfCount:1] withDownloader:downloader options:0 failureCount:NULL];
+    NSTimeInterval segmented = [self downloadURLs:[self freshURLsOfCount:1] withDownloader:downloader options:VMWebVideoDownloaderSegmentedDownload failureCount:NULL];
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"singleStreamSeconds": @(singleStream),
+                                                @"segmentedSeconds": @(segmented),
+                                                @"segments": @(downloader.maxSegmentsPerDownload),
+                                                @"speedup": @(singleStream / segmented)}
+                                 forBenchmark:@"download.segmented"];
+}
+
+// Fetches the URL with that many players at once, and returns the time until the last one has the whole video
+- (NSTimeInterval)readURL:(NSURL *)url withReaderCount:(NSUInteger)readerCount expectedLength:(NSUInteger)expectedLength
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.HTTPMaximumConnectionsPerHost = readerCount;
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < readerCount; i++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"reader %lu", (unsigned long)i]];
+        [[session dataTaskWithURL:url completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+            XCTAssertNil(error);
+            XCTAssertEqual(data.length, expectedLength);
+            [expectation fulfill];
+        }] resume];
+    }
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    [session invalidateAndCancel];
+    return CFAbsoluteTimeGetCurrent() - start;
+}
+
+- (void)testServerThroughputByReaderCount
+{
+    VMWebVideoManager *manager = [VMWebVideoManager sharedManager];
+    VMWebVideoServer *videoServer = [[VMWebVideoServer alloc] initWithManager:manager];
+    XCTAssertTrue([videoServer start:NULL]);
+    NSMutableDictionary *metrics = [NSMutableDictionary new];
+    
+    // A cached video is read from its file by every connection on its own
+    NSData *cachedVideo = [self videoDataOfLength:8 * 1024 * 1024];
+    NSURL *cachedURL = [NSURL URLWithString:[NSString stringWithFormat:@"http://example.invalid/%@.mp4", [[NSUUID UUID] UUIDString]]];
+    [manager.videoCache storeVideoDataToDisk:cachedVideo forKey:[manager cacheKeyForURL:cachedURL]];
+    for (NSNumber *readerCount in @[@1, @4, @8]) {
+        NSTimeInterval elapsed = [self readURL:[videoServer URLForVideoURL:cachedURL] withReaderCount:readerCount.unsignedIntegerValue expectedLength:cachedVideo.length];
+        metrics[[NSString stringWithFormat:@"cached%@ReadersMegabytesPerSecond", readerCount]] = @(readerCount.doubleValue * cachedVideo.length / elapsed / (1024 * 1024));
+    }
+    
+    // A video that isn't cached yet is downloaded once, and streamed to all the readers as it arrives
+    NSURL *remoteURL = [[self freshURLsOfCount:1] firstObject];
+    NSUInteger requestCountBefore = self.server.requestCount;
+    NSTimeInterval elapsed = [self readURL:[videoServer URLForVideoURL:remoteURL] withReaderCount:4 expectedLength:self.videoData.length];
+    metrics[@"downloading4ReadersSeconds"] = @(elapsed);
+    metrics[@"downloading4ReadersOriginRequests"] = @(self.server.requestCount - requestCountBefore);
+    
+    [videoServer stop];
+    [VMWebVideoBenchmarkResults recordMetrics:metrics forBenchmark:@"server.readers"];
+    
+    XCTestExpectation *removal = [self expectationWithDescription:@"remove"];
+    [manager removeCachedVideosForURLs:@[cachedURL, remoteURL] completion:^{
+        [removal fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testPrefetchBatch
+{
+    VMWebVideoPrefetcher *prefetcher = [VMWebVideoPrefetcher new];
+    NSArray *urls = [self freshURLsOfCount:kBenchmarkVideoCount * 2];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"prefetch"];
+    __block NSUInteger skipped = 0;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    [prefetcher prefetchURLs:urls progress:nil completed:^(NSUInteger noOfFinishedUrls, NSUInteger noOfSkippedUrls) {
+        skipped = noOfSkippedUrls;
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - start;
+    XCTAssertEqual(skipped, (NSUInteger)0);
+    
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"seconds": @(elapsed),
+                                                @"videos": @(urls.count),
+                                                @"videosPerSecond": @(urls.count / elapsed),
+                                                @"maxConcurrentDownloads": @(prefetcher.maxConcurrentDownloads)}
+                                 forBenchmark:@"prefetch.batch"];
+    
+    XCTestExpectation *removal = [self expectationWithDescription:@"remove"];
+    [prefetcher.manager removeCachedVideosForURLs:urls completion:^{
+        [removal fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+// Returns the time the prefetcher takes for the whole batch
+- (NSTimeInterval)prefetchURLs:(NSArray *)urls withPrefetcher:(VMWebVideoPrefetcher *)prefetcher
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"prefetch"];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    [prefetcher prefetchURLs:urls progress:nil completed:^(NSUInteger noOfFinishedUrls, NSUInteger noOfSkippedUrls) {
+        XCTAssertEqual(noOfSkippedUrls, (NSUInteger)0);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    return CFAbsoluteTimeGetCurrent() - start;
+}
+
+- (void)testPrefixPrefetchAgainstWholeVideos
+{
+    // Videos long enough for the prefix to be a small part of them
+    self.videoData = [self videoDataOfLength:2 * 1024 * 1024];
+    const long long prefixLength = 256 * 1024;
+    
+    VMWebVideoPrefetcher *wholePrefetcher = [VMWebVideoPrefetcher new];
+    NSArray *wholeURLs = [self freshURLsOfCount:kBenchmarkVideoCount];
+    NSTimeInterval wholeSeconds = [self prefetchURLs:wholeURLs withPrefetcher:wholePrefetcher];
+    
+    VMWebVideoPrefetcher *prefixPrefetcher = [VMWebVideoPrefetcher new];
+    prefixPrefetcher.prefixLength = prefixLength;
+    NSArray *prefixURLs = [self freshURLsOfCount:kBenchmarkVideoCount];
+    NSTimeInterval prefixSeconds = [self prefetchURLs:prefixURLs withPrefetcher:prefixPrefetcher];
+    
+    // Only the prefix of every video is on disk, as a partial download the player's request resumes
+    unsigned long long prefixBytes = 0;
+    for (NSURL *url in prefixURLs) {
+        NSURL *partialURL = [prefixPrefetcher.manager.videoDownloader temporaryFileURLForURL:url];
+        prefixBytes += [[[NSFileManager defaultManager] attributesOfItemAtPath:partialURL.path error:NULL] fileSize];
+        [[NSFileManager defaultManager] removeItemAtURL:partialURL error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:[partialURL URLByAppendingPathExtension:@"plist"] error:nil];
+    }
+    XCTAssertEqual(prefixBytes, (unsigned long long)(prefixLength * kBenchmarkVideoCount));
+    
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"videos": @(kBenchmarkVideoCount),
+                                                @"videoBytes": @(self.videoData.length),
+                                                @"prefixBytes": @(prefixLength),
+                                                @"wholeVideosSeconds": @(wholeSeconds),
+                                                @"prefixesSeconds": @(prefixSeconds),
+                                                @"prefixesDiskBytes": @(prefixBytes)}
+                                 forBenchmark:@"prefetch.prefix"];
+    
+    XCTestExpectation *removal = [self expectationWithDescription:@"remove"];
+    [wholePrefetcher.manager removeCachedVideosForURLs:wholeURLs completion:^{
+        [removal fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+@end
@@ -0,0 +1,164 @@
+//
+//  VMWebVideoPerformanceTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMVideoCache.h>
+#import <VMWebVideo/VMWebVideoCompat.h>
+#import <VMWebVideo/VMWebVideoFailedURLCache.h>
+#import "VMWebVideoBenchmarkResults.h"
+
+static const NSUInteger kEntryCount = 1000;
+
+@interface VMWebVideoPerformanceTests : XCTestCase
+
+@property (strong, nonatomic) VMVideoCache *cache;
+@property (strong, nonatomic) NSArray *keys;
+@property (strong, nonatomic) NSData *videoData;
+// Set while stores and cleanups run next to the measured lookups
+@property (assign, atomic) BOOL writing;
+
+@end
+
+@implementation VMWebVideoPerformanceTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.cache = [[VMVideoCache alloc] initWithNamespace:[[NSUUID UUID] UUIDString]];
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:kEntryCount];
+    for (NSUInteger i = 0; i < kEntryCount; i++) {
+        [keys addObject:[NSString stringWithFormat:@"http://example.com/videos/%lu.mp4", (unsigned long)i]];
+    }
+    self.keys = keys;
+    self.videoData = [NSMutableData dataWithLength:4096];
+}
+
+- (void)tearDown
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"clearDisk"];
+    [self.cache clearDiskOnCompletion:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    self.cache = nil;
+    [super tearDown];
+}
+
+- (void)fillCache
+{
+    for (NSString *key in self.keys) {
+        [self.cache storeVideoDataToDisk:self.videoData forKey:key];
+    }
+}
+
+- (void)testPerformanceOfStore
+{
+    [self measureBlock:^{
+        [self fillCache];
+    }];
+}
+
+- (void)testPerformanceOfLookup
+{
+    [self fillCache];
+    [self.cache clearMemory];
+    
+    // Half of the lookups miss, which the index answers without touching the disk
+    [self measureBlock:^{
+        for (NSString *key in self.keys) {
+            XCTAssertTrue([self.cache videoExistsWithKey:key]);
+            XCTAssertFalse([self.cache videoExistsWithKey:[key stringByAppendingString:@"?missing"]]);
+        }
+    }];
+}
+
+- (void)testPerformanceOfLookupDuringWrites
+{
+    [self fillCache];
+    [self.cache clearMemory];
+    
+    // Stores and cleanups keep the write queue busy, waiting for every cleanup so that they don't pile up
+    self.writing = YES;
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSUInteger round = 0;
+        while (self.writing) {
+            for (NSUInteger i = 0; i < 50; i++) {
+                [self.cache storeVideoDataToDisk:self.videoData forKey:[NSString stringWithFormat:@"http://example.com/writes/%lu/%lu.mp4", (unsigned long)round, (unsigned long)i]];
+            }
+            dispatch_semaphore_t cleaned = dispatch_semaphore_create(0);
+            [self.cache cleanDiskWithCompletionBlock:^{
+                dispatch_semaphore_signal(cleaned);
+            }];
+            dispatch_semaphore_wait(cleaned, DISPATCH_TIME_FOREVER);
+            round++;
+        }
+    });
+    
+    NSMutableArray *latencies = [NSMutableArray arrayWithCapacity:kEntryCount * 10];
+    [self measureBlock:^{
+        for (NSString *key in self.keys) {
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            XCTAssertTrue([self.cache videoExistsWithKey:key]);
+            [latencies addObject:@(CFAbsoluteTimeGetCurrent() - start)];
+        }
+    }];
+    self.writing = NO;
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    // The tail is what a scrolling feed feels, the average hides a lookup stuck behind a write
+    NSArray *sortedLatencies = [latencies sortedArrayUsingSelector:@selector(compare:)];
+    double p50 = [sortedLatencies[sortedLatencies.count / 2] doubleValue];
+    double p99 = [sortedLatencies[sortedLatencies.count * 99 / 100] doubleValue];
+    [VMWebVideoBenchmarkResults recordMetrics:@{@"p50Microseconds": @(p50 * 1e6), @"p99Microseconds": @(p99 * 1e6)} forBenchmark:@"cache.lookupDuringWrites"];
+}
+
+- (void)testPerformanceOfClean
+{
+    [self fillCache];
+    
+    [self measureBlock:^{
+        XCTestExpectation *expectation = [self expectationWithDescription:@"cleanDisk"];
+        [self.cache cleanDiskWithCompletionBlock:^{
+            [expectation fulfill];
+        }];
+        [self waitForExpectationsWithTimeout:30 handler:nil];
+    }];
+}
+
+- (void)testPerformanceOfFileNames
+{
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10; i++) {
+            for (NSString *key in self.keys) {
+                VMWebVideoFileNameForKey(key);
+            }
+        }
+    }];
+}
+
+- (void)testPerformanceOfFailedURLLookup
+{
+    VMWebVideoFailedURLCache *failedURLCache = [VMWebVideoFailedURLCache new];
+    NSMutableArray *urls = [NSMutableArray arrayWithCapacity:kEntryCount];
+    for (NSString *key in self.keys) {
+        NSURL *url = [NSURL URLWithString:key];
+        [urls addObject:url];
+        [failedURLCache recordFailureOfURL:url];
+    }
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10; i++) {
+            for (NSURL *url in urls) {
+                [failedURLCache isBlockedURL:url];
+            }
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,97 @@
+//
+//  VMWebVideoPrefixTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoManager.h>
+#import <VMWebVideo/VMWebVideoCompat.h>
+
+@interface VMWebVideoPrefixTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoManager *manager;
+@property (strong, nonatomic) NSURL *url;
+
+@end
+
+@implementation VMWebVideoPrefixTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.manager = [VMWebVideoManager sharedManager];
+    // Never requested over the network: every test has the video or its prefix on disk already
+    self.url = [NSURL URLWithString:[NSString stringWithFormat:@"http://example.invalid/%@.mp4", [[NSUUID UUID] UUIDString]]];
+}
+
+- (void)tearDown
+{
+    NSString *key = [self.manager cacheKeyForURL:self.url];
+    NSString *partialPath = [self.manager.videoCache.temporaryDirectoryPath stringByAppendingPathComponent:[VMWebVideoFileNameForKey(self.url.absoluteString) stringByAppendingPathExtension:@"partial"]];
+    [[NSFileManager defaultManager] removeItemAtPath:partialPath error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:[partialPath stringByAppendingPathExtension:@"plist"] error:nil];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"removeVideoForKey"];
+    [self.manager.videoCache removeVideoForKey:key completion:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    [super tearDown];
+}
+
+// Where the downloader would have left it, which is also the cache's temporary directory for the shared manager
+- (void)writePartialOfLength:(NSUInteger)length
+{
+    NSString *path = [self.manager.videoDownloader temporaryFileURLForURL:self.url].path;
+    [[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    [[NSMutableData dataWithLength:length] writeToFile:path atomically:YES];
+    [@{@"ETag": @"\"prefix\""} writeToFile:[path stringByAppendingPathExtension:@"plist"] atomically:YES];
+}
+
+- (void)testPartialEntryKeepsItsLength
+{
+    [self writePartialOfLength:2048];
+    XCTAssertEqual([self.manager.videoCache partialLengthForKey:self.url.absoluteString], 2048ULL);
+}
+
+- (void)testPartialWithoutValidatorsIsIgnored
+{
+    [self writePartialOfLength:2048];
+    NSString *partialPath = [self.manager.videoCache.temporaryDirectoryPath stringByAppendingPathComponent:[VMWebVideoFileNameForKey(self.url.absoluteString) stringByAppendingPathExtension:@"partial"]];
+    [[NSFileManager defaultManager] removeItemAtPath:[partialPath stringByAppendingPathExtension:@"plist"] error:nil];
+    XCTAssertEqual([self.manager.videoCache partialLengthForKey:self.url.absoluteString], 0ULL);
+}
+
+- (void)testPrefixOfCachedVideoIsTheCachedFile
+{
+    [self.manager.videoCache storeVideoDataToDisk:[NSMutableData dataWithLength:4096] forKey:[self.manager cacheKeyForURL:self.url]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"prefix"];
+    [self.manager downloadVideoPrefixWithURL:self.url length:1024 options:0 tags:nil progress:nil completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
+        XCTAssertNotNil(videoDataFilePath);
+        XCTAssertNil(error);
+        XCTAssertTrue(finished);
+        XCTAssertEqualObjects(videoURL, self.url);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void)testLongEnoughPartialCompletesWithoutDownloading
+{
+    [self writePartialOfLength:2048];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"prefix"];
+    [self.manager downloadVideoPrefixWithURL:self.url length:1024 options:0 tags:nil progress:nil completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
+        XCTAssertNil(videoDataFilePath);
+        XCTAssertNil(error);
+        XCTAssertTrue(finished);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+@end
@@ -0,0 +1,94 @@
+//
+//  VMWebVideoServerTests.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+@import XCTest;
+#import <VMWebVideo/VMWebVideoServer.h>
+
+@interface VMWebVideoServer (Tests)
+
+- (BOOL)parseRange:(NSString *)range length:(long long)length first:(long long *)first last:(long long *)last;
+
+@end
+
+@interface VMWebVideoServerTests : XCTestCase
+
+@property (strong, nonatomic) VMWebVideoServer *server;
+
+@end
+
+@implementation VMWebVideoServerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.server = [[VMWebVideoServer alloc] initWithManager:nil];
+}
+
+- (void)tearDown
+{
+    self.server = nil;
+    [super tearDown];
+}
+
+- (void)testClosedRange
+{
+    long long first = -1, last = -1;
+    XCTAssertTrue([self.server parseRange:@"bytes=100-199" length:1000 first:&first last:&last]);
+    XCTAssertEqual(first, 100LL);
+    XCTAssertEqual(last, 199LL);
+}
+
+- (void)testOpenEndedRangeEndsWithTheVideo
+{
+    long long first = -1, last = -1;
+    XCTAssertTrue([self.server parseRange:@"bytes=0-" length:1000 first:&first last:&last]);
+    XCTAssertEqual(first, 0LL);
+    XCTAssertEqual(last, 999LL);
+}
+
+- (void)testRangePastTheEndIsClamped
+{
+    long long first = -1, last = -1;
+    XCTAssertTrue([self.server parseRange:@"bytes=900-5000" length:1000 first:&first last:&last]);
+    XCTAssertEqual(first, 900LL);
+    XCTAssertEqual(last, 999LL);
+}
+
+- (void)testSuffixRange
+{
+    long long first = -1, last = -1;
+    XCTAssertTrue([self.server parseRange:@"bytes=-100" length:1000 first:&first last:&last]);
+    XCTAssertEqual(first, 900LL);
+    XCTAssertEqual(last, 999LL);
+    
+    // A suffix longer than the video is the whole video
+    XCTAssertTrue([self.server parseRange:@"bytes=-5000" length:1000 first:&first last:&last]);
+    XCTAssertEqual(first, 0LL);
+    XCTAssertEqual(last, 999LL);
+}
+
+- (void)testUnsatisfiableRanges
+{
+    long long first = -1, last = -1;
+    XCTAssertFalse([self.server parseRange:@"bytes=1000-" length:1000 first:&first last:&last]);
+    XCTAssertFalse([self.server parseRange:@"bytes=500-100" length:1000 first:&first last:&last]);
+    XCTAssertFalse([self.server parseRange:@"bytes=-0" length:1000 first:&first last:&last]);
+    XCTAssertFalse([self.server parseRange:@"bytes=0-" length:0 first:&first last:&last]);
+    XCTAssertEqual(first, -1LL);
+    XCTAssertEqual(last, -1LL);
+}
+
+- (void)testMalformedRanges
+{
+    long long first = -1, last = -1;
+    XCTAssertFalse([self.server parseRange:@"items=0-10" length:1000 first:&first last:&last]);
+    XCTAssertFalse([self.server parseRange:@"bytes=10" length:1000 first:&first last:&last]);
+    XCTAssertFalse([self.server parseRange:@"bytes=-" length:1000 first:&first last:&last]);
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  VMWebVideoTestServer.h
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * A stand-in for a video CDN on the loopback interface, for the tests and benchmarks of the download paths.
+ * Serves the videos it is given with `ETag`, `If-None-Match`, `Range` and `If-Range` support, and can be made
+ * slow, throttled or failing. Every connection is answered on a thread of its own with blocking I/O, and closed
+ * after its response.
+ */
+@interface VMWebVideoTestServer : NSObject
+
+/**
+ * The port the server listens on, 0 until it is started.
+ */
+@property (assign, nonatomic, readonly) uint16_t port;
+
+/**
+ * The time every request waits before its response starts. Default: 0.
+ */
+@property (assign, atomic) NSTimeInterval latency;
+
+/**
+ * The rate each response body is sent at, in bytes per second. 0, the default, sends as fast as the socket takes it.
+ */
+@property (assign, atomic) NSUInteger bytesPerSecond;
+
+/**
+ * The share of requests, between 0 and 1, answered with a 500 instead of the video. Default: 0.
+ */
+@property (assign, atomic) double errorRate;
+
+/**
+ * Whether `Range` requests are answered with a 206. When NO the whole video is always sent. Default: YES.
+ */
+@property (assign, atomic) BOOL supportsRanges;
+
+/**
+ * Whether the `Content-Range` of a 206 tells the length of the whole video. When NO it ends in `/*`. Default: YES.
+ */
+@property (assign, atomic) BOOL reportsTotalLength;
+
+/**
+ * The number of requests received since the server started.
+ */
+@property (assign, atomic, readonly) NSUInteger requestCount;
+
+/**
+ * Listens on an ephemeral port of 127.0.0.1.
+ *
+ * @return NO if the socket couldn't be set up
+ */
+- (BOOL)start;
+
+/**
+ * Stops accepting connections. Responses being sent are cut short.
+ */
+- (void)stop;
+
+/**
+ * The URL of a path on the server, e.g. `/video.mp4`.
+ */
+- (NSURL *)URLForPath:(NSString *)path;
+
+/**
+ * Serves a video at a path, with an `ETag` if one is given. Replaces any video served there before.
+ */
+- (void)setVideoData:(NSData *)data eTag:(NSString *)eTag forPath:(NSString *)path;
+
+/**
+ * The headers of the requests received for a path so far, in order, keyed by lowercase header name.
+ */
+- (NSArray *)requestHeadersForPath:(NSString *)path;
+
+@end
@@ -0,0 +1,279 @@
+//
+//  VMWebVideoTestServer.m
+//  VMWebVideoTests
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoTestServer.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+static const NSUInteger kMaximumRequestHeaderLength = 16 * 1024;
+static const NSUInteger kUnthrottledChunkLength = 64 * 1024;
+
+@interface VMWebVideoTestServer ()
+
+@property (assign, nonatomic, readwrite) uint16_t port;
+@property (assign, atomic, readwrite) NSUInteger requestCount;
+@property (assign, atomic, getter = isStopped) BOOL stopped;
+@property (strong, nonatomic) dispatch_source_t acceptSource;
+// Path -> @{@"data": NSData, @"eTag": NSString}, and path -> array of request headers, both guarded by self
+@property (strong, nonatomic) NSMutableDictionary *videos;
+@property (strong, nonatomic) NSMutableDictionary *requests;
+
+@end
+
+@implementation VMWebVideoTestServer
+
+- (id)init {
+    if ((self = [super init])) {
+        _supportsRanges = YES;
+        _reportsTotalLength = YES;
+        _videos = [NSMutableDictionary new];
+        _requests = [NSMutableDictionary new];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+- (BOOL)start {
+    int listeningSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listeningSocket < 0) {
+        return NO;
+    }
+    int on = 1;
+    setsockopt(listeningSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t addressLength = sizeof(address);
+    if (bind(listeningSocket, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listeningSocket, 64) != 0 ||
+        getsockname(listeningSocket, (struct sockaddr *)&address, &addressLength) != 0) {
+        close(listeningSocket);
+        return NO;
+    }
+    self.port = ntohs(address.sin_port);
+    
+    __weak VMWebVideoTestServer *wself = self;
+    self.acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)listeningSocket, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    dispatch_source_set_event_handler(self.acceptSource, ^{
+        int connection = accept(listeningSocket, NULL, NULL);
+        if (connection < 0) {
+            return;
+        }
+        int noSigPipe = 1;
+        setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [wself serveConnection:connection];
+            close(connection);
+        });
+    });
+    dispatch_source_set_cancel_handler(self.acceptSource, ^{
+        close(listeningSocket);
+    });
+    dispatch_resume(self.acceptSource);
+    return YES;
+}
+
+- (void)stop {
+    self.stopped = YES;
+    if (self.acceptSource) {
+        dispatch_source_cancel(self.acceptSource);
+        self.acceptSource = nil;
+    }
+}
+
+- (NSURL *)URLForPath:(NSString *)path {
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u%@", self.port, path]];
+}
+
+- (void)setVideoData:(NSData *)data eTag:(NSString *)eTag forPath:(NSString *)path {
+    @synchronized (self) {
+        NSMutableDictionary *video = [NSMutableDictionary dictionaryWithObject:[data copy] forKey:@"data"];
+        if (eTag) video[@"eTag"] = eTag;
+        self.videos[path] = video;
+    }
+}
+
+- (NSArray *)requestHeadersForPath:(NSString *)path {
+    @synchronized (self) {
+        return [self.requests[path] copy] ?: @[];
+    }
+}
+
+#pragma mark Connections
+
+- (void)serveConnection:(int)connection {
+    NSString *method = nil, *path = nil;
+    NSDictionary *headers = [self readRequestFromSocket:connection method:&method path:&path];
+    if (!headers) {
+        return;
+    }
+    
+    NSDictionary *video;
+    @synchronized (self) {
+        self.requestCount++;
+        NSMutableArray *requestsForPath = self.requests[path] ?: [NSMutableArray array];
+        [requestsForPath addObject:headers];
+        self.requests[path] = requestsForPath;
+        video = self.videos[path];
+    }
+    
+    NSTimeInterval latency = self.latency;
+    if (latency > 0) {
+        [NSThread sleepForTimeInterval:latency];
+    }
+    
+    NSData *data = video[@"data"];
+    NSString *eTag = video[@"eTag"];
+    NSMutableDictionary *responseHeaders = [NSMutableDictionary dictionaryWithObject:@"close" forKey:@"Connection"];
+    if (!data) {
+        [self sendStatus:404 reason:@"Not Found" headers:responseHeaders body:nil toSocket:connection];
+        return;
+    }
+    if (self.errorRate > 0 && drand48() < self.errorRate) {
+        [self sendStatus:500 reason:@"Internal Server Error" headers:responseHeaders body:nil toSocket:connection];
+        return;
+    }
+    
+    if (eTag) responseHeaders[@"ETag"] = eTag;
+    if (eTag && [headers[@"if-none-match"] isEqualToString:eTag]) {
+        [self sendStatus:304 reason:@"Not Modified" headers:responseHeaders body:nil toSocket:connection];
+        return;
+    }
+    
+    responseHeaders[@"Content-Type"] = @"video/mp4";
+    NSString *range = headers[@"range"];
+    NSString *ifRange = headers[@"if-range"];
+    BOOL rangeApplies = self.supportsRanges && range && (!ifRange || [ifRange isEqualToString:eTag]);
+    if (self.supportsRanges) {
+        responseHeaders[@"Accept-Ranges"] = @"bytes";
+    }
+    
+    NSData *body = data;
+    NSInteger status = 200;
+    NSString *reason = @"OK";
+    if (rangeApplies) {
+        long long first, last;
+        if (![self parseRange:range length:(long long)data.length first:&first last:&last]) {
+            responseHeaders[@"Content-Range"] = [NSString stringWithFormat:@"bytes */%lu", (unsigned long)data.length];
+            [self sendStatus:416 reason:@"Range Not Satisfiable" headers:responseHeaders body:nil toSocket:connection];
+            return;
+        }
+        status = 206;
+        reason = @"Partial Content";
+        NSString *total = self.reportsTotalLength ? [NSString stringWithFormat:@"%lu", (unsigned long)data.length] : @"*";
+        responseHeaders[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lld-%lld/%@", first, last, total];
+        body = [data subdataWithRange:NSMakeRange((NSUInteger)first, (NSUInteger)(last - first + 1))];
+    }
+    responseHeaders[@"Content-Length"] = [NSString stringWithFormat:@"%lu", (unsigned long)body.length];
+    [self sendStatus:status reason:reason headers:responseHeaders body:([method isEqualToString:@"HEAD"] ? nil : body) toSocket:connection];
+}
+
+- (NSDictionary *)readRequestFromSocket:(int)connection method:(NSString **)method path:(NSString **)path {
+    NSMutableData *buffer = [NSMutableData data];
+    NSData *terminator = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+    char bytes[4096];
+    while ([buffer rangeOfData:terminator options:0 range:NSMakeRange(0, buffer.length)].location == NSNotFound) {
+        ssize_t count = recv(connection, bytes, sizeof(bytes), 0);
+        if (count <= 0 || buffer.length + (NSUInteger)count > kMaximumRequestHeaderLength) {
+            return nil;
+        }
+        [buffer appendBytes:bytes length:(NSUInteger)count];
+    }
+    
+    NSString *request = [[NSString alloc] initWithData:buffer encoding:NSISOLatin1StringEncoding];
+    NSArray *lines = [request componentsSeparatedByString:@"\r\n"];
+    NSArray *requestLine = [lines.firstObject componentsSeparatedByString:@" "];
+    if (requestLine.count < 2) {
+        return nil;
+    }
+    *method = requestLine[0];
+    *path = requestLine[1];
+    
+    NSMutableDictionary *headers = [NSMutableDictionary dictionary];
+    for (NSString *line in [lines subarrayWithRange:NSMakeRange(1, lines.count - 1)]) {
+        NSRange colon = [line rangeOfString:@":"];
+        if (colon.location == NSNotFound) continue;
+        NSString *name = [[line substringToIndex:colon.location] lowercaseString];
+        headers[name] = [[line substringFromIndex:colon.location + 1] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    }
+    return headers;
+}
+
+// bytes=<first>-<last>, bytes=<first>- and bytes=-<suffix length>
+- (BOOL)parseRange:(NSString *)range length:(long long)length first:(long long *)first last:(long long *)last {
+    if (![range hasPrefix:@"bytes="] || length == 0) {
+        return NO;
+    }
+    NSArray *bounds = [[range substringFromIndex:6] componentsSeparatedByString:@"-"];
+    if (bounds.count != 2) {
+        return NO;
+    }
+    NSString *start = bounds[0], *end = bounds[1];
+    if (start.length == 0) {
+        long long suffix = end.longLongValue;
+        if (suffix <= 0) return NO;
+        *first = MAX(length - suffix, 0LL);
+        *last = length - 1;
+        return YES;
+    }
+    *first = start.longLongValue;
+    *last = end.length ? MIN(end.longLongValue, length - 1) : length - 1;
+    return *first < length && *first <= *last;
+}
+
+- (void)sendStatus:(NSInteger)status reason:(NSString *)reason headers:(NSDictionary *)headers body:(NSData *)body toSocket:(int)connection {
+    NSMutableString *header = [NSMutableString stringWithFormat:@"HTTP/1.1 %ld %@\r\n", (long)status, reason];
+    if (!headers[@"Content-Length"]) {
+        [header appendString:@"Content-Length: 0\r\n"];
+    }
+    [headers enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSString *value, BOOL *stop) {
+        [header appendFormat:@"%@: %@\r\n", name, value];
+    }];
+    [header appendString:@"\r\n"];
+    if (![self sendData:[header dataUsingEncoding:NSISOLatin1StringEncoding] toSocket:connection] || !body) {
+        return;
+    }
+    
+    // Throttled responses go out in twentieths of a second's worth of bytes
+    NSUInteger bytesPerSecond = self.bytesPerSecond;
+    NSUInteger chunkLength = bytesPerSecond > 0 ? MAX(bytesPerSecond / 20, (NSUInteger)1) : kUnthrottledChunkLength;
+    for (NSUInteger offset = 0; offset < body.length && !self.isStopped; offset += chunkLength) {
+        NSData *chunk = [body subdataWithRange:NSMakeRange(offset, MIN(chunkLength, body.length - offset))];
+        if (![self sendData:chunk toSocket:connection]) {
+            return;
+        }
+        if (bytesPerSecond > 0) {
+            [NSThread sleepForTimeInterval:(double)chunk.length / bytesPerSecond];
+        }
+    }
+}
+
+- (BOOL)sendData:(NSData *)data toSocket:(int)connection {
+    const char *bytes = data.bytes;
+    NSUInteger remaining = data.length;
+    while (remaining > 0) {
+        ssize_t sent = send(connection, bytes, remaining, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        bytes += sent;
+        remaining -= (NSUInteger)sent;
+    }
+    return YES;
+}
+
+@end
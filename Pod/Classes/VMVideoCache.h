@@ -8,6 +8,7 @@
 
 #import <Foundation/Foundation.h>
 #import "VMWebVideoCompat.h"
+#import "VMVideoCacheEvictionPolicy.h"
 
 
 
@@ -18,11 +19,16 @@ typedef NS_ENUM(NSInteger, VMVideoCacheType) {
 	 * The video wasn't available the VMWebVideo caches.
 	 */
 	VMVideoCacheTypeNone,
-
+	
 	/**
 	 * The video was obtained from the disk cache.
 	 */
 	VMVideoCacheTypeDisk,
+	
+	/**
+	 * The video was obtained from the memory cache.
+	 */
+	VMVideoCacheTypeMemory,
 };
 
 
@@ -34,6 +40,16 @@ typedef void(^VMVideoCacheQueryVideoDataCompletionBlock)(NSData *videoData, VMVi
 
 typedef void(^VMWebVideoCheckCacheCompletionBlock)(BOOL isInCache);
 
+/**
+ * `existence` maps each key to an NSNumber, YES if the video is in the cache.
+ */
+typedef void(^VMWebVideoCheckCacheBatchCompletionBlock)(NSDictionary *existence);
+
+/**
+ * `filePaths` maps the key of each cached video to the file URL of the video. Keys that aren't cached are left out.
+ */
+typedef void(^VMVideoCacheQueryFilePathsCompletionBlock)(NSDictionary *filePaths);
+
 typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger totalSize);
 
 
@@ -44,6 +60,22 @@ typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 
 - (instancetype)initWithNamespace:(NSString *)ns;
 
+/**
+ * Whether small videos are kept in memory as well as on disk. Defaults to YES.
+ */
+@property (assign, nonatomic) BOOL shouldCacheVideosInMemory;
+
+/**
+ * The maximum total size of the videos kept in memory, in bytes. Defaults to 20 MB.
+ * Videos that were used the least recently are purged first, and all of them are purged on a memory warning.
+ */
+@property (assign, nonatomic) NSUInteger maxMemoryCost;
+
+/**
+ * Only videos up to this size, in bytes, are kept in memory. Defaults to 1 MB, enough for short looping previews.
+ */
+@property (assign, nonatomic) NSUInteger maxMemoryEntrySize;
+
 /**
  * The maximum length of time to keep an video in the cache, in seconds
  */
@@ -54,6 +86,27 @@ typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 @property (assign, nonatomic) NSUInteger maxCacheSize;
 
+/**
+ * Decides which videos are evicted first when a store pushes the cache over `maxCacheSize`.
+ * Defaults to a VMVideoCacheLRUEvictionPolicy.
+ */
+@property (strong, nonatomic) id <VMVideoCacheEvictionPolicy> evictionPolicy;
+
+/**
+ * Spread the cached files over two levels of subdirectories named after the first hex digits of their file name
+ * (e.g. `ab/cd/abcd….mov`) instead of keeping them all in one directory. Recommended for caches with tens of thousands of videos.
+ *
+ * Changing this migrates the existing files in the background, while the cache stays usable.
+ * The layout is remembered on disk, so it only needs to be set once.
+ */
+@property (assign, atomic) BOOL shardedLayout;
+
+/**
+ * Directory that in-flight downloads are streamed into before being moved into the cache.
+ * It sits next to the disk cache directory so that moving a finished download is a rename on the same volume.
+ */
+@property (strong, nonatomic, readonly) NSString *temporaryDirectoryPath;
+
 + (VMVideoCache *)sharedVideoCache;
 
 - (void)storeVideoDataToDiskInBackground:(NSData *)videoData forKey:(NSString *)key completion:(VMVideoCacheQueryFilePathCompletionBlock)completion;
@@ -61,14 +114,50 @@ typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 //This method is blocking
 - (void)storeVideoDataToDisk:(NSData *)videoData forKey:(NSString *)key;
 
+/**
+ * Move a file that was already written to disk (e.g. a streamed download) into the cache.
+ * The file is renamed into place, so the video data is never loaded into memory.
+ * The validators of the response (`ETag` and `Last-Modified` header values keyed by header name) found in a property
+ * list next to the file, named like the file with a `plist` extension as the downloader saves them, are kept with the video.
+ *
+ * @param fileURL    The file to move. It should live in `temporaryDirectoryPath`.
+ * @param key        The unique video cache key
+ * @param completion Called on the cache's write queue with the file path of the cached video, or nil if the move failed.
+ */
+- (void)storeVideoFileToDiskInBackground:(NSURL *)fileURL forKey:(NSString *)key completion:(VMVideoCacheQueryFilePathCompletionBlock)completion;
+
+//This method is blocking
+- (NSURL *)storeVideoFileToDisk:(NSURL *)fileURL forKey:(NSString *)key;
+
 
 - (NSOperation *)queryCacheForKey:(NSString *)key filePathCompletion:(VMVideoCacheQueryFilePathCompletionBlock)filePathCompletion;
 
+/**
+ * Query the cache asynchronously for the video data.
+ *
+ * The data is memory mapped from the cached file, so only the pages that are actually read get loaded into memory.
+ * If the video is in the memory cache, the completion is called synchronously with VMVideoCacheTypeMemory and nil is returned.
+ */
 - (NSOperation *)queryCacheForKey:(NSString *)key videoDataCompletion:(VMVideoCacheQueryVideoDataCompletionBlock)videoDataCompletion;
 
+/**
+ * Query the cache asynchronously for the file paths of many videos at once.
+ *
+ * All the keys are looked up in one pass on the cache's queue, and the completion is called once on the main queue.
+ */
+- (NSOperation *)queryCacheForKeys:(NSArray *)keys filePathsCompletion:(VMVideoCacheQueryFilePathsCompletionBlock)filePathsCompletion;
+
 /**
  * Query the memory cache synchronously.
  *
+ * @param key The unique key used to store the wanted video
+ * @return The video data, or nil if it isn't in memory (it may still be on disk)
+ */
+- (NSData *)videoDataFromMemoryCacheForKey:(NSString *)key;
+
+/**
+ * Query the cache synchronously. This is answered from an in-memory index of the disk cache and doesn't touch the disk.
+ *
  * @param key The unique key used to store the wanted image
  */
 - (NSURL *)videoDataFilePathFromCacheForKey:(NSString *)key;
@@ -91,6 +180,38 @@ typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)videoExistsWithKey:(NSString *)key completion:(VMWebVideoCheckCacheCompletionBlock)completionBlock;
 
+/**
+ *  Async check of many keys at once, in one pass over the index
+ *
+ *  @param keys            the keys describing the urls
+ *  @param completionBlock the block to be executed when the check is done.
+ *  @note the completion block will be always executed on the main queue
+ */
+- (void)videosExistWithKeys:(NSArray *)keys completion:(VMWebVideoCheckCacheBatchCompletionBlock)completionBlock;
+
+/**
+ * Returns the validators of the response the cached video came from, `ETag` and `Last-Modified` header values keyed
+ * by header name, or nil if there are none. Used to ask the server whether the video changed with a conditional request.
+ */
+- (NSDictionary *)validatorsForKey:(NSString *)key;
+
+/**
+ * Marks the cached video as fresh, as if it was stored now, without touching its data, e.g. after the server
+ * answered a conditional request with 304 Not Modified. Each validator given, e.g. the `ETag` of the 304 response,
+ * replaces the stored one; the others are kept.
+ */
+- (void)refreshVideoForKey:(NSString *)key validators:(NSDictionary *)validators;
+
+/**
+ * Returns the length of the partial entry of a video, 0 if there is none.
+ *
+ * Partial entries are the leading bytes of a video kept in `temporaryDirectoryPath` by a prefix download or an
+ * interrupted one, along with the validators needed to resume them. They are named after the download URL, so `key`
+ * is the URL's absolute string here whatever the cache key filter. A later download of the video resumes from them.
+ * They expire with `maxCacheAge`.
+ */
+- (unsigned long long)partialLengthForKey:(NSString *)key;
+
 /**
  * Remove the video from disk cache
  *
@@ -99,6 +220,16 @@ typedef void(^VMWebVideoCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)removeVideoForKey:(NSString *)key completion:(VMWebVideoNoParamsBlock)completion;
 
+/**
+ * Remove many videos from disk cache in one go. The completion (optional) is called on the main queue once all of them are removed.
+ */
+- (void)removeVideosForKeys:(NSArray *)keys completion:(VMWebVideoNoParamsBlock)completion;
+
+/**
+ * Clear all memory cached videos
+ */
+- (void)clearMemory;
+
 /**
  * Clear all disk cached videos. Non-blocking method - returns immediately.
  * @param completionBlock An block that should be executed after cache expiration completes (optional)
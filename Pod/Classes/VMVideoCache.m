@@ -9,13 +9,43 @@
 #import "VMVideoCache.h"
 
 #import "VMSingleton.h"
-#import <CommonCrypto/CommonDigest.h>
+#import "VMVideoCacheEntry.h"
+#import "VMVideoCacheJournal.h"
+#import "VMWebVideoMetrics.h"
 
 
 
 
 
 static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
+static const NSUInteger kDefaultMaxMemoryCost = 20 * 1024 * 1024; // 20 MB
+static const NSUInteger kDefaultMaxMemoryEntrySize = 1024 * 1024; // 1 MB
+static const NSUInteger kJournalCompactionMinimumRecordCount = 1000;
+static const NSUInteger kEvictionBatchSize = 64;
+static const NSTimeInterval kAccessFlushDelay = 1;
+
+// Present in the cache directory while it uses the sharded layout, and while a layout migration is running
+static NSString *const kShardedLayoutMarkerFileName = @".sharded";
+static NSString *const kLayoutMigrationMarkerFileName = @".migrating";
+
+// Present in the cache directory once no file is named after the legacy MD5 hash of its key anymore
+static NSString *const kFileNameHashMarkerFileName = @".murmur3";
+
+// Validators are keyed by the name of the response header they come from
+static NSString *const kETagValidatorKey = @"ETag";
+static NSString *const kLastModifiedValidatorKey = @"Last-Modified";
+
+// An entry with its eviction priority at the time the index was read, so sorting doesn't race with updates of the priority
+typedef struct {
+    double priority;
+    __unsafe_unretained VMVideoCacheEntry *entry;
+} VMVideoCacheRankedEntry;
+
+static int VMVideoCacheCompareRankedEntries(const void *rankedEntry1, const void *rankedEntry2) {
+    double priority1 = ((const VMVideoCacheRankedEntry *)rankedEntry1)->priority;
+    double priority2 = ((const VMVideoCacheRankedEntry *)rankedEntry2)->priority;
+    return priority1 < priority2 ? -1 : (priority1 > priority2 ? 1 : 0);
+}
 
 
 
@@ -23,14 +53,42 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 
 @interface VMVideoCache ()
 
+// Small videos kept in memory, keyed by the file name of their entry so anything that drops the entry can drop them too
+@property (strong, nonatomic, readonly) NSCache *memCache;
 @property (nonatomic, readonly) NSFileManager *fileManager;
 @property (strong, nonatomic, readonly) NSString *diskCachePath;
 @property (strong, nonatomic, readonly) NSMutableArray *customPaths;
+// Lookups run concurrently on the ioQueue. Anything that writes or deletes files is serialized on the writeQueue,
+// so a long store or cleanup never holds up a lookup.
 @property (VMDispatchQueueSetterSementics, nonatomic, readonly) dispatch_queue_t ioQueue;
+@property (VMDispatchQueueSetterSementics, nonatomic, readonly) dispatch_queue_t writeQueue;
+
+// In-memory index of the files on disk, keyed by file name. Reads are concurrent, updates use barriers.
+@property (strong, nonatomic, readonly) NSMutableDictionary *index;
+@property (strong, nonatomic, readonly) NSMutableDictionary *readOnlyIndex;
+@property (VMDispatchQueueSetterSementics, nonatomic, readonly) dispatch_queue_t indexQueue;
+
+// Persists the index across launches. Replayed by the barrier that loads the index, and only used on the writeQueue afterwards.
+@property (strong, nonatomic, readonly) VMVideoCacheJournal *journal;
+// Lookups recorded since the last flush, with the time of each lookup
+@property (strong, nonatomic, readonly) NSMutableArray *pendingAccessedEntries;
+@property (strong, nonatomic, readonly) NSMutableArray *pendingAccessTimes;
+@property (assign, nonatomic) unsigned long long totalSize;
+// The file stored last, which eviction leaves alone. Only used on the indexQueue.
+@property (copy, nonatomic) NSString *lastStoredFileName;
+// Whether an eviction pass is already queued on the writeQueue
+@property (assign, nonatomic) BOOL evictionScheduled;
+
+// Whether some files may still be named after the legacy MD5 hash of their key
+@property (assign, atomic) BOOL legacyFileNamesRemain;
+// Legacy paths of renamed files, left linked until the next cleanDisk for the lookups that handed them out.
+// Only used on the writeQueue.
+@property (strong, nonatomic, readonly) NSMutableArray *relocatedLegacyPaths;
 
 - (void)addReadOnlyCachePath:(NSString *)path;
 - (NSString *)cachePathForKey:(NSString *)key inPath:(NSString *)path;
 - (NSString *)defaultCachePathForKey:(NSString *)key;
+- (NSString *)cachePathForFileName:(NSString *)fileName sharded:(BOOL)sharded;
 
 - (NSString *)cachedFileNameForKey:(NSString *)key;
 
@@ -45,7 +103,10 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 
 
 
-@implementation VMVideoCache
+@implementation VMVideoCache {
+    // Only used on the indexQueue
+    id <VMVideoCacheEvictionPolicy> _evictionPolicy;
+}
 
 #pragma mark - NSObject
 - (id)init {
@@ -55,6 +116,8 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 - (void)dealloc {
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	VMDispatchQueueRelease(self.ioQueue);
+	VMDispatchQueueRelease(self.writeQueue);
+	VMDispatchQueueRelease(self.indexQueue);
 }
 
 #pragma mark - VMVideoCache
@@ -62,23 +125,57 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
     if ((self = [super init])) {
         NSString *fullNamespace = [@"com.vmlabs.VMWebVideoCache." stringByAppendingString:ns];
         
-        // Create IO serial queue
-        _ioQueue = dispatch_queue_create("com.vmlabs.VMWebVideoCache", DISPATCH_QUEUE_SERIAL);
+        // Create IO concurrent queue and write serial queue
+        _ioQueue = dispatch_queue_create("com.vmlabs.VMWebVideoCache", DISPATCH_QUEUE_CONCURRENT);
+        _writeQueue = dispatch_queue_create("com.vmlabs.VMWebVideoCacheWrite", DISPATCH_QUEUE_SERIAL);
+        
+        // Init the memory cache
+        _memCache = [NSCache new];
+        _memCache.name = fullNamespace;
+        _memCache.totalCostLimit = kDefaultMaxMemoryCost;
         
         // Init default values
         _maxCacheAge = kDefaultCacheMaxCacheAge;
+        _shouldCacheVideosInMemory = YES;
+        _maxMemoryEntrySize = kDefaultMaxMemoryEntrySize;
+        _evictionPolicy = [VMVideoCacheLRUEvictionPolicy new];
         
         // Init the disk cache
         NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
         _diskCachePath = [paths[0] stringByAppendingPathComponent:fullNamespace];
+        _temporaryDirectoryPath = [_diskCachePath stringByAppendingPathExtension:@"tmp"];
+        _shardedLayout = [[NSFileManager defaultManager] fileExistsAtPath:[_diskCachePath stringByAppendingPathComponent:kShardedLayoutMarkerFileName]];
+        _legacyFileNamesRemain = ![[NSFileManager defaultManager] fileExistsAtPath:[_diskCachePath stringByAppendingPathComponent:kFileNameHashMarkerFileName]];
+        _relocatedLegacyPaths = [NSMutableArray new];
         
         dispatch_sync(self.ioQueue, ^{
 			//Performed on
             _fileManager = [NSFileManager new];
         });
         
+        // Load the index once, lookups issued meanwhile wait for it behind the barrier
+        _index = [NSMutableDictionary new];
+        _readOnlyIndex = [NSMutableDictionary new];
+        _indexQueue = dispatch_queue_create("com.vmlabs.VMWebVideoCacheIndex", DISPATCH_QUEUE_CONCURRENT);
+        _journal = [[VMVideoCacheJournal alloc] initWithPath:[_diskCachePath stringByAppendingPathComponent:@".journal"]];
+        _pendingAccessedEntries = [NSMutableArray new];
+        _pendingAccessTimes = [NSMutableArray new];
+        dispatch_barrier_async(_indexQueue, ^{
+            [self loadIndex];
+        });
+        
+        // Finish a layout migration that was interrupted on a previous launch, and rename files stored by earlier versions
+        dispatch_async(_writeQueue, ^{
+            [self migrateLayoutIfNeeded];
+            [self migrateLegacyFileNamesIfNeeded];
+        });
+        
 #if TARGET_OS_IPHONE
         // Subscribe to app events
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(clearMemory)
+                                                     name:UIApplicationDidReceiveMemoryWarningNotification
+                                                   object:nil];
         
         [[NSNotificationCenter defaultCenter] addObserver:self
                                                  selector:@selector(cleanDisk)
@@ -102,6 +199,9 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
     
     if (![self.customPaths containsObject:path]) {
         [self.customPaths addObject:path];
+        dispatch_barrier_async(self.indexQueue, ^{
+            [self indexFilesInPath:path intoIndex:self.readOnlyIndex];
+        });
     }
 }
 
@@ -111,22 +211,607 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 }
 
 - (NSString *)defaultCachePathForKey:(NSString *)key {
-    return [self cachePathForKey:key inPath:self.diskCachePath];
+    return [self cachePathForFileName:[self cachedFileNameForKey:key] sharded:self.shardedLayout];
+}
+
+- (NSString *)cachePathForFileName:(NSString *)fileName sharded:(BOOL)sharded {
+    if (!sharded || fileName.length < 4) {
+        return [self.diskCachePath stringByAppendingPathComponent:fileName];
+    }
+    
+    return [NSString pathWithComponents:@[self.diskCachePath, [fileName substringToIndex:2], [fileName substringWithRange:NSMakeRange(2, 2)], fileName]];
+}
+
+- (void)setShardedLayout:(BOOL)shardedLayout {
+    @synchronized (self) {
+        _shardedLayout = shardedLayout;
+    }
+    dispatch_async(self.writeQueue, ^{
+        [self migrateLayoutIfNeeded];
+    });
+}
+
+- (BOOL)shardedLayout {
+    @synchronized (self) {
+        return _shardedLayout;
+    }
+}
+
+#pragma mark Layout migration
+
+// Must be called on the writeQueue
+- (void)migrateLayoutIfNeeded {
+    BOOL sharded = self.shardedLayout;
+    NSString *markerPath = [self.diskCachePath stringByAppendingPathComponent:kShardedLayoutMarkerFileName];
+    NSString *migrationMarkerPath = [self.diskCachePath stringByAppendingPathComponent:kLayoutMigrationMarkerFileName];
+    if ([self.fileManager fileExistsAtPath:markerPath] == sharded && ![self.fileManager fileExistsAtPath:migrationMarkerPath]) {
+        return;
+    }
+    
+    // Stores already use the new layout, so if we get killed half way through the index can't tell where files live anymore
+    [self.fileManager createDirectoryAtPath:self.diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    [self.fileManager createFileAtPath:migrationMarkerPath contents:nil attributes:nil];
+    
+    for (VMVideoCacheEntry *entry in [self indexedEntries]) {
+        NSString *path = [self cachePathForFileName:entry.fileName sharded:sharded];
+        if (![entry.path isEqualToString:path]) {
+            [self relocateEntry:entry toPath:path key:entry.key];
+        }
+    }
+    
+    if (sharded) {
+        [self.fileManager createFileAtPath:markerPath contents:nil attributes:nil];
+    }
+    else {
+        [self.fileManager removeItemAtPath:markerPath error:nil];
+    }
+    [self.fileManager removeItemAtPath:migrationMarkerPath error:nil];
+}
+
+// Must be called on the writeQueue
+- (void)migrateLegacyFileNamesIfNeeded {
+    if (!self.legacyFileNamesRemain) {
+        return;
+    }
+    
+    // Entries that know their key are renamed right away. The others (only found by walking the directory) can't be,
+    // so lookups keep falling back to the legacy name until they expire.
+    BOOL unknownFileNamesRemain = NO;
+    for (VMVideoCacheEntry *entry in [self indexedEntries]) {
+        if (!entry.key) {
+            unknownFileNamesRemain = YES;
+            continue;
+        }
+        
+        NSString *fileName = [self cachedFileNameForKey:entry.key];
+        if (![entry.fileName isEqualToString:fileName]) {
+            [self relocateEntry:entry toPath:[self cachePathForFileName:fileName sharded:self.shardedLayout] key:entry.key];
+        }
+    }
+    
+    if (!unknownFileNamesRemain) {
+        [self.fileManager createDirectoryAtPath:self.diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+        [self.fileManager createFileAtPath:[self.diskCachePath stringByAppendingPathComponent:kFileNameHashMarkerFileName] contents:nil attributes:nil];
+        self.legacyFileNamesRemain = NO;
+    }
+}
+
+// Must be called on the writeQueue
+// The file is linked at its new path before the index points there, and only unlinked afterwards, so lookups keep working meanwhile
+- (void)relocateEntry:(VMVideoCacheEntry *)entry toPath:(NSString *)path key:(NSString *)key {
+    if ([self linkEntry:entry toPath:path key:key]) {
+        [self.fileManager removeItemAtPath:entry.path error:nil];
+    }
+}
+
+// Must be called on the writeQueue
+// Points the index at a new link of the file, the old path is left to the caller. Returns NO if the file went away.
+- (BOOL)linkEntry:(VMVideoCacheEntry *)entry toPath:(NSString *)path key:(NSString *)key {
+    if (![self.fileManager fileExistsAtPath:path]) {
+        [self.fileManager createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+        if (![self.fileManager linkItemAtPath:entry.path toPath:path error:nil]) {
+            // The file went away behind our back
+            [self removeIndexedEntry:entry];
+            return NO;
+        }
+    }
+    
+    [self moveIndexedEntry:entry toPath:path key:key];
+    return YES;
+}
+
+// Must be called on the writeQueue
+- (void)removeRelocatedLegacyPaths {
+    for (NSString *path in self.relocatedLegacyPaths) {
+        [self.fileManager removeItemAtPath:path error:nil];
+    }
+    [self.relocatedLegacyPaths removeAllObjects];
+}
+
+// Must be called on the indexQueue
+- (NSString *)pathOfReplayedFileName:(NSString *)fileName sharded:(BOOL)sharded migrating:(BOOL)migrating {
+    NSString *path = [self cachePathForFileName:fileName sharded:sharded];
+    if (migrating && ![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+        // An interrupted migration may have left the file in the other layout
+        return [self cachePathForFileName:fileName sharded:!sharded];
+    }
+    return path;
+}
+
+- (void)setMaxMemoryCost:(NSUInteger)maxMemoryCost {
+    self.memCache.totalCostLimit = maxMemoryCost;
+}
+
+- (NSUInteger)maxMemoryCost {
+    return self.memCache.totalCostLimit;
 }
 
 #pragma mark SDImageCache (private)
 
 - (NSString *)cachedFileNameForKey:(NSString *)key {
-    const char *str = [key UTF8String];
-    if (str == NULL) {
-        str = "";
+    return [VMWebVideoFileNameForKey(key) stringByAppendingString:@".mov"];
+}
+
+#pragma mark Index
+
+// Must be called on the indexQueue, with a barrier
+- (void)loadIndex {
+    NSArray *entries = [self.journal replayEntries];
+    if (entries) {
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        BOOL sharded = [fileManager fileExistsAtPath:[self.diskCachePath stringByAppendingPathComponent:kShardedLayoutMarkerFileName]];
+        BOOL migrating = [fileManager fileExistsAtPath:[self.diskCachePath stringByAppendingPathComponent:kLayoutMigrationMarkerFileName]];
+        for (VMVideoCacheEntry *entry in entries) {
+            entry.path = [self pathOfReplayedFileName:entry.fileName sharded:sharded migrating:migrating];
+            self.index[entry.fileName] = entry;
+        }
+    }
+    else {
+        // First launch with a journal, fall back to walking the cache directory once
+        [self indexFilesInPath:self.diskCachePath intoIndex:self.index];
+        NSArray *records = [[NSArray alloc] initWithArray:[self.index allValues] copyItems:YES];
+        dispatch_async(self.writeQueue, ^{
+            [self.journal compactWithEntries:records];
+        });
+    }
+    
+    unsigned long long totalSize = 0;
+    for (VMVideoCacheEntry *entry in [self.index objectEnumerator]) {
+        totalSize += entry.size;
+        entry.evictionPriority = [_evictionPolicy priorityForEntry:entry];
+    }
+    self.totalSize = totalSize;
+}
+
+// Must be called on the indexQueue, with a barrier
+// The record is written on the writeQueue. Changes to the index are serialized by the barriers, so their records land in the same order.
+- (void)journalEntry:(VMVideoCacheEntry *)entry {
+    VMVideoCacheEntry *record = [entry copy];
+    dispatch_async(self.writeQueue, ^{
+        [self.journal recordEntry:record];
+        [self compactJournalIfNeeded];
+    });
+}
+
+// Must be called on the indexQueue, with a barrier
+- (void)journalRemovalOfFileName:(NSString *)fileName {
+    dispatch_async(self.writeQueue, ^{
+        [self.journal recordRemovalOfFileName:fileName];
+        [self compactJournalIfNeeded];
+    });
+}
+
+// Must be called on the writeQueue
+// The index is only read to take a snapshot. Records of changes made after the snapshot may still be queued, they
+// are appended after the compacted journal and replaying them again is harmless.
+- (void)compactJournalIfNeeded {
+    NSUInteger recordCount = self.journal.recordCount;
+    if (recordCount <= kJournalCompactionMinimumRecordCount) {
+        return;
+    }
+    
+    __block NSArray *entries = nil;
+    dispatch_sync(self.indexQueue, ^{
+        if (recordCount > self.index.count * 2) {
+            entries = [[NSArray alloc] initWithArray:[self.index allValues] copyItems:YES];
+        }
+    });
+    if (entries) {
+        [self.journal compactWithEntries:entries];
+    }
+}
+
+// Must be called on the indexQueue, with a barrier
+- (void)indexFilesInPath:(NSString *)path intoIndex:(NSMutableDictionary *)index {
+    NSArray *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLFileSizeKey];
+    
+    // Files at the top level are indexed right away, subdirectories (the shards of a sharded layout) are walked in parallel
+    NSMutableArray *directoryURLs = [NSMutableArray new];
+    NSArray *topLevelURLs = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[NSURL fileURLWithPath:path isDirectory:YES]
+                                                          includingPropertiesForKeys:resourceKeys
+                                                                             options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                               error:NULL];
+    for (NSURL *fileURL in topLevelURLs) {
+        NSDictionary *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:NULL];
+        if ([resourceValues[NSURLIsDirectoryKey] boolValue]) {
+            [directoryURLs addObject:fileURL];
+        }
+        else {
+            [self indexFileAtURL:fileURL resourceValues:resourceValues intoIndex:index];
+        }
     }
-    unsigned char r[CC_MD5_DIGEST_LENGTH];
-    CC_MD5(str, (CC_LONG)strlen(str), r);
-    NSString *filename = [NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-                          r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10], r[11], r[12], r[13], r[14], r[15]];
     
-    return [filename stringByAppendingString:@".mov"];
+    dispatch_apply(directoryURLs.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        // The shared file manager is safe to use off the io queues
+        NSDirectoryEnumerator *fileEnumerator = [[NSFileManager defaultManager] enumeratorAtURL:directoryURLs[i]
+                                                                     includingPropertiesForKeys:resourceKeys
+                                                                                        options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                                   errorHandler:NULL];
+        NSMutableDictionary *shardIndex = [NSMutableDictionary new];
+        for (NSURL *fileURL in fileEnumerator) {
+            NSDictionary *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:NULL];
+            if (![resourceValues[NSURLIsDirectoryKey] boolValue]) {
+                [self indexFileAtURL:fileURL resourceValues:resourceValues intoIndex:shardIndex];
+            }
+        }
+        
+        @synchronized (index) {
+            for (NSString *fileName in shardIndex) {
+                if (!index[fileName]) {
+                    index[fileName] = shardIndex[fileName];
+                }
+            }
+        }
+    });
+}
+
+- (void)indexFileAtURL:(NSURL *)fileURL resourceValues:(NSDictionary *)resourceValues intoIndex:(NSMutableDictionary *)index {
+    VMVideoCacheEntry *entry = [VMVideoCacheEntry entryWithPath:fileURL.path
+                                                           size:[resourceValues[NSURLFileSizeKey] unsignedLongLongValue]
+                                               modificationTime:[resourceValues[NSURLContentModificationDateKey] timeIntervalSinceReferenceDate]];
+    if (!index[entry.fileName]) {
+        index[entry.fileName] = entry;
+    }
+}
+
+// Coalesces the evictions asked for by a burst of stores into a single pass
+- (void)scheduleEviction {
+    @synchronized (self) {
+        if (self.evictionScheduled) {
+            return;
+        }
+        self.evictionScheduled = YES;
+    }
+    
+    dispatch_async(self.writeQueue, ^{
+        @synchronized (self) {
+            self.evictionScheduled = NO;
+        }
+        [self evictEntriesIfNeeded];
+    });
+}
+
+// Must be called on the writeQueue
+// The index is ranked from a snapshot, outside of any barrier, and entries are then removed a batch at a time,
+// so stores and lookups only ever wait for a short barrier.
+- (void)evictEntriesIfNeeded {
+    NSArray *entries = nil;
+    for (NSUInteger location = 0; ; location += kEvictionBatchSize) {
+        __block BOOL overBudget = NO;
+        if (!entries) {
+            dispatch_sync(self.indexQueue, ^{
+                overBudget = self.maxCacheSize > 0 && self.totalSize > self.maxCacheSize;
+            });
+            if (!overBudget) {
+                return;
+            }
+            [self flushAccesses];
+            entries = [self indexedEntries];
+        }
+        if (location >= entries.count) {
+            return;
+        }
+        
+        NSArray *batch = [entries subarrayWithRange:NSMakeRange(location, MIN(kEvictionBatchSize, entries.count - location))];
+        NSMutableArray *evictedEntries = [NSMutableArray arrayWithCapacity:batch.count];
+        dispatch_barrier_sync(self.indexQueue, ^{
+            for (VMVideoCacheEntry *entry in batch) {
+                overBudget = self.maxCacheSize > 0 && self.totalSize > self.maxCacheSize;
+                if (!overBudget) {
+                    break;
+                }
+                // Entries replaced or removed since the snapshot are skipped, and so is the video that was just stored
+                if (self.index[entry.fileName] != entry || [entry.fileName isEqualToString:self.lastStoredFileName]) {
+                    continue;
+                }
+                
+                self.totalSize -= entry.size;
+                [self.index removeObjectForKey:entry.fileName];
+                [self.memCache removeObjectForKey:entry.fileName];
+                [self journalRemovalOfFileName:entry.fileName];
+                if ([_evictionPolicy respondsToSelector:@selector(didEvictEntry:)]) {
+                    [_evictionPolicy didEvictEntry:entry];
+                }
+                [evictedEntries addObject:entry];
+            }
+        });
+        
+        VMWebVideoMetricsCount(VMWebVideoMetricsCounterEvictions, (int64_t)evictedEntries.count);
+        for (VMVideoCacheEntry *entry in evictedEntries) {
+            // The video may have been stored again since it was evicted
+            if (![self indexedEntryForFileName:entry.fileName]) {
+                [self.fileManager removeItemAtPath:entry.path error:nil];
+            }
+        }
+        
+        if (!overBudget) {
+            return;
+        }
+    }
+}
+
+- (id <VMVideoCacheEvictionPolicy>)evictionPolicy {
+    __block id <VMVideoCacheEvictionPolicy> evictionPolicy = nil;
+    dispatch_sync(self.indexQueue, ^{
+        evictionPolicy = _evictionPolicy;
+    });
+    return evictionPolicy;
+}
+
+- (void)setEvictionPolicy:(id <VMVideoCacheEvictionPolicy>)evictionPolicy {
+    dispatch_barrier_async(self.indexQueue, ^{
+        _evictionPolicy = evictionPolicy ?: [VMVideoCacheLRUEvictionPolicy new];
+        for (VMVideoCacheEntry *entry in [self.index objectEnumerator]) {
+            entry.evictionPriority = [_evictionPolicy priorityForEntry:entry];
+        }
+    });
+}
+
+- (VMVideoCacheEntry *)indexedEntryForFileName:(NSString *)fileName {
+    __block VMVideoCacheEntry *entry = nil;
+    dispatch_sync(self.indexQueue, ^{
+        entry = self.index[fileName];
+    });
+    return entry;
+}
+
+- (VMVideoCacheEntry *)indexedEntryForKey:(NSString *)key {
+    NSString *fileName = [self cachedFileNameForKey:key];
+    __block VMVideoCacheEntry *entry = nil;
+    __block BOOL hasReadOnlyEntries = NO;
+    dispatch_sync(self.indexQueue, ^{
+        entry = self.index[fileName] ?: self.readOnlyIndex[fileName];
+        hasReadOnlyEntries = self.readOnlyIndex.count > 0;
+    });
+    if (entry || (!self.legacyFileNamesRemain && !hasReadOnlyEntries)) {
+        return entry;
+    }
+    
+    // Files stored by earlier versions, and read-only caches built by them, are named after the MD5 of the key
+    NSString *legacyFileName = [VMWebVideoLegacyFileNameForKey(key) stringByAppendingString:@".mov"];
+    __block VMVideoCacheEntry *legacyEntry = nil;
+    dispatch_sync(self.indexQueue, ^{
+        entry = self.index[legacyFileName];
+        legacyEntry = entry;
+        if (!entry) {
+            entry = self.readOnlyIndex[legacyFileName];
+        }
+    });
+    
+    if (legacyEntry) {
+        // Now that we know its key, rename it, without making the lookup wait behind the writes. The file is linked under
+        // its new name and the legacy path stays linked until the next cleanDisk, so the entry handed out here stays valid.
+        dispatch_async(self.writeQueue, ^{
+            if ([self indexedEntryForFileName:legacyFileName] != legacyEntry) {
+                return;
+            }
+            if ([self linkEntry:legacyEntry toPath:[self cachePathForFileName:fileName sharded:self.shardedLayout] key:key]) {
+                [self.relocatedLegacyPaths addObject:legacyEntry.path];
+            }
+        });
+    }
+    return entry;
+}
+
+// Looks all the keys up in one pass over the index. Keys without an entry are left out.
+- (NSDictionary *)indexedEntriesForKeys:(NSArray *)keys {
+    NSMutableDictionary *fileNames = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        fileNames[key] = [self cachedFileNameForKey:key];
+    }
+    
+    NSMutableDictionary *entries = [NSMutableDictionary dictionaryWithCapacity:fileNames.count];
+    __block BOOL hasReadOnlyEntries = NO;
+    dispatch_sync(self.indexQueue, ^{
+        [fileNames enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *fileName, BOOL *stop) {
+            VMVideoCacheEntry *entry = self.index[fileName] ?: self.readOnlyIndex[fileName];
+            if (entry) {
+                entries[key] = entry;
+            }
+        }];
+        hasReadOnlyEntries = self.readOnlyIndex.count > 0;
+    });
+    
+    if (self.legacyFileNamesRemain || hasReadOnlyEntries) {
+        // Misses may still be stored under their legacy names
+        for (NSString *key in fileNames) {
+            if (!entries[key]) {
+                VMVideoCacheEntry *entry = [self indexedEntryForKey:key];
+                if (entry) {
+                    entries[key] = entry;
+                }
+            }
+        }
+    }
+    return entries;
+}
+
+// Lookups are buffered and applied to the index in batches, so a cache hit doesn't cost a barrier and a journal write
+- (void)recordAccessOfEntry:(VMVideoCacheEntry *)entry {
+    NSNumber *now = @([NSDate timeIntervalSinceReferenceDate]);
+    BOOL needsFlush = NO;
+    @synchronized (self.pendingAccessedEntries) {
+        needsFlush = self.pendingAccessedEntries.count == 0;
+        [self.pendingAccessedEntries addObject:entry];
+        [self.pendingAccessTimes addObject:now];
+    }
+    
+    if (needsFlush) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kAccessFlushDelay * NSEC_PER_SEC)), self.writeQueue, ^{
+            [self flushAccesses];
+        });
+    }
+}
+
+// Must be called on the writeQueue
+- (void)flushAccesses {
+    NSArray *entries = nil;
+    NSArray *accessTimes = nil;
+    @synchronized (self.pendingAccessedEntries) {
+        entries = [self.pendingAccessedEntries copy];
+        accessTimes = [self.pendingAccessTimes copy];
+        [self.pendingAccessedEntries removeAllObjects];
+        [self.pendingAccessTimes removeAllObjects];
+    }
+    if (entries.count == 0) {
+        return;
+    }
+    
+    dispatch_barrier_async(self.indexQueue, ^{
+        NSMutableOrderedSet *accessedEntries = [NSMutableOrderedSet orderedSetWithCapacity:entries.count];
+        [entries enumerateObjectsUsingBlock:^(VMVideoCacheEntry *entry, NSUInteger i, BOOL *stop) {
+            entry.lastAccessTime = MAX(entry.lastAccessTime, [accessTimes[i] doubleValue]);
+            entry.accessCount++;
+            [accessedEntries addObject:entry];
+        }];
+        
+        NSMutableArray *records = [NSMutableArray arrayWithCapacity:accessedEntries.count];
+        for (VMVideoCacheEntry *entry in accessedEntries) {
+            entry.evictionPriority = [_evictionPolicy priorityForEntry:entry];
+            if (self.index[entry.fileName] == entry) {
+                [records addObject:[entry copy]];
+            }
+        }
+        
+        if (records.count == 0) {
+            return;
+        }
+        
+        // Queued like the records of any other change, so they stay in order with them
+        dispatch_async(self.writeQueue, ^{
+            [self.journal recordAccessesOfEntries:records];
+            [self compactJournalIfNeeded];
+        });
+    });
+}
+
+- (void)indexFileAtPath:(NSString *)path size:(unsigned long long)size key:(NSString *)key validators:(NSDictionary *)validators {
+    VMVideoCacheEntry *entry = [VMVideoCacheEntry entryWithPath:path size:size modificationTime:[NSDate timeIntervalSinceReferenceDate]];
+    entry.key = key;
+    entry.eTag = validators[kETagValidatorKey];
+    entry.lastModified = validators[kLastModifiedValidatorKey];
+    dispatch_barrier_async(self.indexQueue, ^{
+        VMVideoCacheEntry *replacedEntry = self.index[entry.fileName];
+        self.totalSize -= replacedEntry.size;
+        // Whatever is in memory came from the file this one replaces
+        [self.memCache removeObjectForKey:entry.fileName];
+        entry.accessCount = replacedEntry.accessCount;
+        entry.evictionPriority = [_evictionPolicy priorityForEntry:entry];
+        self.index[entry.fileName] = entry;
+        self.totalSize += entry.size;
+        [self journalEntry:entry];
+        
+        // Make room right away rather than waiting for the next cleanDisk
+        self.lastStoredFileName = entry.fileName;
+        if (self.maxCacheSize > 0 && self.totalSize > self.maxCacheSize) {
+            [self scheduleEviction];
+        }
+    });
+}
+
+- (void)removeIndexedEntryForFileName:(NSString *)fileName {
+    [self removeIndexedEntryForFileName:fileName evicted:NO];
+}
+
+// An evicted entry is reported to the eviction policy, like the ones evicted after a store
+- (void)removeIndexedEntryForFileName:(NSString *)fileName evicted:(BOOL)evicted {
+    dispatch_barrier_async(self.indexQueue, ^{
+        VMVideoCacheEntry *entry = self.index[fileName];
+        if (entry) {
+            self.totalSize -= entry.size;
+            [self.index removeObjectForKey:fileName];
+            [self.memCache removeObjectForKey:fileName];
+            [self journalRemovalOfFileName:fileName];
+            if (evicted && [_evictionPolicy respondsToSelector:@selector(didEvictEntry:)]) {
+                [_evictionPolicy didEvictEntry:entry];
+            }
+        }
+    });
+}
+
+// Points the index at the new location (and possibly new file name) of a file, unless the entry was replaced by a newer store in the meantime
+- (void)moveIndexedEntry:(VMVideoCacheEntry *)entry toPath:(NSString *)path key:(NSString *)key {
+    dispatch_barrier_sync(self.indexQueue, ^{
+        if (self.index[entry.fileName] != entry) {
+            return;
+        }
+        
+        // A new entry rather than an update, so that readers holding the old one still see a consistent path
+        VMVideoCacheEntry *movedEntry = [VMVideoCacheEntry entryWithPath:path size:entry.size modificationTime:entry.modificationTime];
+        movedEntry.key = key;
+        movedEntry.lastAccessTime = entry.lastAccessTime;
+        movedEntry.accessCount = entry.accessCount;
+        movedEntry.evictionPriority = entry.evictionPriority;
+        movedEntry.eTag = entry.eTag;
+        movedEntry.lastModified = entry.lastModified;
+        
+        if (![movedEntry.fileName isEqualToString:entry.fileName]) {
+            [self.index removeObjectForKey:entry.fileName];
+            [self journalRemovalOfFileName:entry.fileName];
+            if (self.index[movedEntry.fileName]) {
+                // A newer store under the new name wins
+                self.totalSize -= entry.size;
+                return;
+            }
+            [self journalEntry:movedEntry];
+        }
+        self.index[movedEntry.fileName] = movedEntry;
+    });
+}
+
+// Only removes the entry if it wasn't replaced by a newer store in the meantime
+- (void)removeIndexedEntry:(VMVideoCacheEntry *)entry {
+    dispatch_barrier_async(self.indexQueue, ^{
+        if (self.index[entry.fileName] == entry) {
+            self.totalSize -= entry.size;
+            [self.index removeObjectForKey:entry.fileName];
+            [self.memCache removeObjectForKey:entry.fileName];
+            [self journalRemovalOfFileName:entry.fileName];
+        }
+    });
+}
+
+// Sorted in eviction order. Only the snapshot is taken on the indexQueue, the sort runs on the calling thread.
+- (NSArray *)indexedEntries {
+    __block NSArray *entries = nil;
+    __block VMVideoCacheRankedEntry *rankedEntries = NULL;
+    dispatch_sync(self.indexQueue, ^{
+        entries = [self.index allValues];
+        rankedEntries = malloc(MAX(entries.count, 1) * sizeof(VMVideoCacheRankedEntry));
+        NSUInteger i = 0;
+        for (VMVideoCacheEntry *entry in entries) {
+            rankedEntries[i++] = (VMVideoCacheRankedEntry){entry.evictionPriority, entry};
+        }
+    });
+    
+    // The entries array keeps the ranked entries alive
+    qsort(rankedEntries, entries.count, sizeof(VMVideoCacheRankedEntry), VMVideoCacheCompareRankedEntries);
+    NSMutableArray *sortedEntries = [NSMutableArray arrayWithCapacity:entries.count];
+    for (NSUInteger i = 0; i < entries.count; i++) {
+        [sortedEntries addObject:rankedEntries[i].entry];
+    }
+    free(rankedEntries);
+    return sortedEntries;
 }
 
 #pragma mark ImageCache
@@ -139,15 +824,33 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         return;
     }
     
-    dispatch_async(self.ioQueue, ^{
+    if (self.shouldCacheVideosInMemory && videoData.length <= self.maxMemoryEntrySize) {
+        [self.memCache setObject:videoData forKey:[self cachedFileNameForKey:key] cost:videoData.length];
+    }
+    
+    dispatch_async(self.writeQueue, ^{
         
         if (videoData) {
-            if (![self.fileManager fileExistsAtPath:self.diskCachePath]) {
-                [self.fileManager createDirectoryAtPath:self.diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+            CFAbsoluteTime storeStartTime = VMWebVideoMetricsStartTime();
+            NSString *path = [self defaultCachePathForKey:key];
+            NSString *directoryPath = [path stringByDeletingLastPathComponent];
+            if (![self.fileManager fileExistsAtPath:directoryPath]) {
+                [self.fileManager createDirectoryAtPath:directoryPath withIntermediateDirectories:YES attributes:nil error:NULL];
             }
             
-            NSString *path = [self defaultCachePathForKey:key];
-            [self.fileManager createFileAtPath:path contents:videoData attributes:nil];
+            // Written atomically, so that data mapped from the previous file stays valid
+            if ([videoData writeToFile:path options:NSDataWritingAtomic error:nil]) {
+                [self indexFileAtPath:path size:videoData.length key:key validators:nil];
+                if (self.shouldCacheVideosInMemory && videoData.length <= self.maxMemoryEntrySize) {
+                    // Again once indexed, since indexing drops what memory held for the replaced file
+                    NSString *fileName = [path lastPathComponent];
+                    dispatch_barrier_async(self.indexQueue, ^{
+                        [self.memCache setObject:videoData forKey:fileName cost:videoData.length];
+                    });
+                }
+                VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageDiskStore, storeStartTime);
+                VMWebVideoMetricsCount(VMWebVideoMetricsCounterBytesStored, videoData.length);
+            }
             if(completion) {
                 completion([NSURL fileURLWithPath:path], VMVideoCacheTypeNone);
             }
@@ -164,19 +867,129 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
     dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
 }
 
+- (void)storeVideoFileToDiskInBackground:(NSURL *)fileURL forKey:(NSString *)key completion:(VMVideoCacheQueryFilePathCompletionBlock)completion {
+    if (!fileURL || !key) {
+        if(completion) {
+            completion(nil, VMVideoCacheTypeNone);
+        }
+        return;
+    }
+    
+    dispatch_async(self.writeQueue, ^{
+        CFAbsoluteTime storeStartTime = VMWebVideoMetricsStartTime();
+        NSString *path = [self defaultCachePathForKey:key];
+        NSString *directoryPath = [path stringByDeletingLastPathComponent];
+        if (![self.fileManager fileExistsAtPath:directoryPath]) {
+            [self.fileManager createDirectoryAtPath:directoryPath withIntermediateDirectories:YES attributes:nil error:NULL];
+        }
+        
+        NSURL *cachedFileURL = nil;
+        if ([self.fileManager fileExistsAtPath:fileURL.path]) {
+            // The validators of the response, saved next to the file by the downloader
+            NSURL *validatorsFileURL = [fileURL URLByAppendingPathExtension:@"plist"];
+            NSDictionary *validators = [NSDictionary dictionaryWithContentsOfURL:validatorsFileURL];
+            [self.fileManager removeItemAtPath:path error:nil];
+            if ([self.fileManager moveItemAtPath:fileURL.path toPath:path error:nil]) {
+                [self.fileManager removeItemAtURL:validatorsFileURL error:nil];
+                cachedFileURL = [NSURL fileURLWithPath:path];
+                unsigned long long size = [[self.fileManager attributesOfItemAtPath:path error:nil] fileSize];
+                [self indexFileAtPath:path size:size key:key validators:validators];
+                VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageDiskStore, storeStartTime);
+                VMWebVideoMetricsCount(VMWebVideoMetricsCounterBytesStored, (int64_t)size);
+            }
+            else {
+                // The previous file is gone either way
+                [self removeIndexedEntryForFileName:[path lastPathComponent]];
+            }
+        }
+        else if ([self.fileManager fileExistsAtPath:path]) {
+            // Another subscriber of the same download already moved the file into place
+            cachedFileURL = [NSURL fileURLWithPath:path];
+        }
+        
+        if(completion) {
+            completion(cachedFileURL, VMVideoCacheTypeNone);
+        }
+    });
+}
+
+- (NSURL *)storeVideoFileToDisk:(NSURL *)fileURL forKey:(NSString *)key {
+    __block NSURL *cachedFileURL = nil;
+    dispatch_semaphore_t sema = dispatch_semaphore_create(0);
+    [self storeVideoFileToDiskInBackground:fileURL forKey:key completion:^(NSURL *videoDataFilePath, VMVideoCacheType cacheType) {
+        cachedFileURL = videoDataFilePath;
+        dispatch_semaphore_signal(sema);
+    }];
+    
+    dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+    return cachedFileURL;
+}
+
 - (BOOL)videoExistsWithKey:(NSString *)key {
-    BOOL exists = NO;
+    // Answered from the index, without touching the disk
+    return [self indexedEntryForKey:key] != nil;
+}
+
+- (NSDictionary *)validatorsForKey:(NSString *)key {
+    VMVideoCacheEntry *entry = [self indexedEntryForKey:key];
+    if (!entry) {
+        return nil;
+    }
+    
+    NSMutableDictionary *validators = [NSMutableDictionary dictionary];
+    dispatch_sync(self.indexQueue, ^{
+        if (entry.eTag) validators[kETagValidatorKey] = entry.eTag;
+        if (entry.lastModified) validators[kLastModifiedValidatorKey] = entry.lastModified;
+    });
+    return validators.count ? validators : nil;
+}
+
+- (void)refreshVideoForKey:(NSString *)key validators:(NSDictionary *)validators {
+    VMVideoCacheEntry *entry = [self indexedEntryForKey:key];
+    if (!entry) {
+        return;
+    }
+    
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    dispatch_barrier_async(self.indexQueue, ^{
+        if (self.index[entry.fileName] != entry) {
+            // Replaced in the meantime, or from a read-only cache
+            return;
+        }
+        entry.modificationTime = now;
+        // A 304 may only carry the validators that changed, the others stay
+        if (validators[kETagValidatorKey]) {
+            entry.eTag = validators[kETagValidatorKey];
+        }
+        if (validators[kLastModifiedValidatorKey]) {
+            entry.lastModified = validators[kLastModifiedValidatorKey];
+        }
+        [self journalEntry:entry];
+    });
     
-    // this is an exception to access the filemanager on another queue than ioQueue, but we are using the shared instance
-    // from apple docs on NSFileManager: The methods of the shared NSFileManager object can be called from multiple threads safely.
-    exists = [[NSFileManager defaultManager] fileExistsAtPath:[self defaultCachePathForKey:key]];
+    dispatch_async(self.writeQueue, ^{
+        // So that the age of the file agrees with the entry if the index is ever rebuilt from the directory
+        [self.fileManager setAttributes:@{NSFileModificationDate: [NSDate dateWithTimeIntervalSinceReferenceDate:now]} ofItemAtPath:entry.path error:nil];
+    });
+}
+
+- (unsigned long long)partialLengthForKey:(NSString *)key {
+    if (!key) {
+        return 0;
+    }
     
-    return exists;
+    // Named like the downloads streamed into the temporary directory; without its validators a partial file can't be resumed
+    NSString *path = [self.temporaryDirectoryPath stringByAppendingPathComponent:[VMWebVideoFileNameForKey(key) stringByAppendingPathExtension:@"partial"]];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if (![fileManager fileExistsAtPath:[path stringByAppendingPathExtension:@"plist"]]) {
+        return 0;
+    }
+    return [[fileManager attributesOfItemAtPath:path error:nil] fileSize];
 }
 
 - (void)videoExistsWithKey:(NSString *)key completion:(VMWebVideoCheckCacheCompletionBlock)completionBlock {
     dispatch_async(self.ioQueue, ^{
-        BOOL exists = [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
+        BOOL exists = [self indexedEntryForKey:key] != nil;
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
                 completionBlock(exists);
@@ -185,41 +998,81 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
     });
 }
 
-- (NSURL *)videoDataFilePathFromCacheForKey:(NSString *)key {
-    NSString *defaultPath = [self defaultCachePathForKey:key];
-    NSData *data = [NSData dataWithContentsOfFile:defaultPath];
-    if (data) {
-//        defaultPath = [defaultPath stringByAppendingString:@".mov"];
-        return [NSURL fileURLWithPath:defaultPath];
+- (void)videosExistWithKeys:(NSArray *)keys completion:(VMWebVideoCheckCacheBatchCompletionBlock)completionBlock {
+    if (!completionBlock) {
+        return;
     }
     
-    for (NSString *path in self.customPaths) {
-        NSString *filePath = [self cachePathForKey:key inPath:path];
-        NSData *imageData = [NSData dataWithContentsOfFile:filePath];
-        if (imageData) {
-            return [NSURL fileURLWithPath:filePath];
+    dispatch_async(self.ioQueue, ^{
+        NSDictionary *entries = [self indexedEntriesForKeys:keys];
+        NSMutableDictionary *existence = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+        for (NSString *key in keys) {
+            existence[key] = @(entries[key] != nil);
         }
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(existence);
+        });
+    });
+}
+
+- (NSURL *)videoDataFilePathFromCacheForKey:(NSString *)key {
+    VMVideoCacheEntry *entry = [self indexedEntryForKey:key];
+    if (!entry) {
+        return nil;
     }
     
-    return nil;
+    [self recordAccessOfEntry:entry];
+    return [NSURL fileURLWithPath:entry.path];
+}
+
+- (NSData *)videoDataFromMemoryCacheForKey:(NSString *)key {
+    return key ? [self.memCache objectForKey:[self cachedFileNameForKey:key]] : nil;
+}
+
+// Whether the entry is still the one indexed under its file name
+- (BOOL)isIndexedEntry:(VMVideoCacheEntry *)entry {
+    __block BOOL indexed = NO;
+    dispatch_sync(self.indexQueue, ^{
+        indexed = self.index[entry.fileName] == entry || self.readOnlyIndex[entry.fileName] == entry;
+    });
+    return indexed;
 }
 
 - (NSData *)diskVideoDataBySearchingAllPathsForKey:(NSString *)key {
-    NSString *defaultPath = [self defaultCachePathForKey:key];
-    NSData *data = [NSData dataWithContentsOfFile:defaultPath];
-    if (data) {
-        return data;
+    VMVideoCacheEntry *entry = [self indexedEntryForKey:key];
+    if (!entry) {
+        return nil;
     }
     
-    for (NSString *path in self.customPaths) {
-        NSString *filePath = [self cachePathForKey:key inPath:path];
-        NSData *imageData = [NSData dataWithContentsOfFile:filePath];
-        if (imageData) {
-            return imageData;
+    NSData *data = nil;
+    if (self.shouldCacheVideosInMemory && entry.size <= self.maxMemoryEntrySize) {
+        // Small enough to be kept in memory, read it for real
+        data = [NSData dataWithContentsOfFile:entry.path];
+        if (data) {
+            // Read-only entries may still have a legacy file name, the memory tier always uses the current one
+            NSString *fileName = [self cachedFileNameForKey:key];
+            [self.memCache setObject:data forKey:fileName cost:data.length];
+            
+            // A store or removal may have dropped the entry while we were reading the file it replaced
+            if (![self isIndexedEntry:entry]) {
+                [self.memCache removeObjectForKey:fileName];
+            }
         }
     }
+    else {
+        // Mapped rather than read, pages are only loaded when touched. Cached files are only ever replaced
+        // by a rename or unlinked, never truncated in place, so the mapping stays valid.
+        data = [NSData dataWithContentsOfFile:entry.path options:NSDataReadingMappedAlways error:nil];
+    }
     
-    return nil;
+    if (data) {
+        [self recordAccessOfEntry:entry];
+    }
+    else {
+        // The file went away behind our back
+        [self removeIndexedEntry:entry];
+    }
+    return data;
 }
 
 - (NSData *)videoDataForKey:(NSString *)key {
@@ -259,6 +1112,38 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
     return operation;
 }
 
+- (NSOperation *)queryCacheForKeys:(NSArray *)keys filePathsCompletion:(VMVideoCacheQueryFilePathsCompletionBlock)filePathsCompletion {
+    if (!filePathsCompletion) {
+        return nil;
+    }
+    
+    if (keys.count == 0) {
+        filePathsCompletion(@{});
+        return nil;
+    }
+    
+    NSOperation *operation = [NSOperation new];
+    dispatch_async(self.ioQueue, ^{
+        if (operation.isCancelled) {
+            return;
+        }
+        
+        @autoreleasepool {
+            NSDictionary *entries = [self indexedEntriesForKeys:keys];
+            NSMutableDictionary *filePaths = [NSMutableDictionary dictionaryWithCapacity:entries.count];
+            [entries enumerateKeysAndObjectsUsingBlock:^(NSString *key, VMVideoCacheEntry *entry, BOOL *stop) {
+                [self recordAccessOfEntry:entry];
+                filePaths[key] = [NSURL fileURLWithPath:entry.path];
+            }];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                filePathsCompletion(filePaths);
+            });
+        }
+    });
+    
+    return operation;
+}
+
 - (NSOperation *)queryCacheForKey:(NSString *)key videoDataCompletion:(VMVideoCacheQueryVideoDataCompletionBlock)videoDataCompletion {
     if (!videoDataCompletion) {
         return nil;
@@ -269,6 +1154,13 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         return nil;
     }
     
+    // First check the in-memory cache...
+    NSData *data = [self videoDataFromMemoryCacheForKey:key];
+    if (data) {
+        videoDataCompletion(data, VMVideoCacheTypeMemory);
+        return nil;
+    }
+    
     NSOperation *operation = [NSOperation new];
     dispatch_async(self.ioQueue, ^{
         if (operation.isCancelled) {
@@ -303,8 +1195,31 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         return;
     }
     
-    dispatch_async(self.ioQueue, ^{
-        [self.fileManager removeItemAtPath:[self defaultCachePathForKey:key] error:nil];
+    [self.memCache removeObjectForKey:[self cachedFileNameForKey:key]];
+    
+    dispatch_async(self.writeQueue, ^{
+        [self removeFilesOfKey:key];
+        
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion();
+            });
+        }
+    });
+
+}
+
+- (void)removeVideosForKeys:(NSArray *)keys completion:(VMWebVideoNoParamsBlock)completion {
+    for (NSString *key in keys) {
+        [self.memCache removeObjectForKey:[self cachedFileNameForKey:key]];
+    }
+    
+    dispatch_async(self.writeQueue, ^{
+        for (NSString *key in keys) {
+            @autoreleasepool {
+                [self removeFilesOfKey:key];
+            }
+        }
         
         if (completion) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -312,7 +1227,33 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
             });
         }
     });
+}
+
+// Must be called on the write queue
+- (void)removeFilesOfKey:(NSString *)key {
+    NSString *fileName = [self cachedFileNameForKey:key];
+    NSString *path = [self cachePathForFileName:fileName sharded:self.shardedLayout];
+    [self.fileManager removeItemAtPath:path error:nil];
+    
+    // During a layout migration the file may still live at its previous location
+    VMVideoCacheEntry *entry = [self indexedEntryForFileName:fileName];
+    if (entry && ![entry.path isEqualToString:path]) {
+        [self.fileManager removeItemAtPath:entry.path error:nil];
+    }
+    [self removeIndexedEntryForFileName:fileName];
     
+    if (self.legacyFileNamesRemain) {
+        NSString *legacyFileName = [VMWebVideoLegacyFileNameForKey(key) stringByAppendingString:@".mov"];
+        VMVideoCacheEntry *legacyEntry = [self indexedEntryForFileName:legacyFileName];
+        if (legacyEntry) {
+            [self.fileManager removeItemAtPath:legacyEntry.path error:nil];
+            [self removeIndexedEntry:legacyEntry];
+        }
+    }
+}
+
+- (void)clearMemory {
+    [self.memCache removeAllObjects];
 }
 
 - (void)clearDisk {
@@ -321,18 +1262,36 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 
 - (void)clearDiskOnCompletion:(VMWebVideoNoParamsBlock)completion
 {
-    dispatch_async(self.ioQueue, ^{
+    // Don't serve videos from memory that are gone from disk
+    [self clearMemory];
+    
+    dispatch_async(self.writeQueue, ^{
         [self.fileManager removeItemAtPath:self.diskCachePath error:nil];
         [self.fileManager createDirectoryAtPath:self.diskCachePath
                 withIntermediateDirectories:YES
                                  attributes:nil
                                       error:NULL];
-        
-        if (completion) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                completion();
-            });
+        if (self.shardedLayout) {
+            [self.fileManager createFileAtPath:[self.diskCachePath stringByAppendingPathComponent:kShardedLayoutMarkerFileName] contents:nil attributes:nil];
         }
+        [self.fileManager createFileAtPath:[self.diskCachePath stringByAppendingPathComponent:kFileNameHashMarkerFileName] contents:nil attributes:nil];
+        self.legacyFileNamesRemain = NO;
+        dispatch_barrier_sync(self.indexQueue, ^{
+            [self.index removeAllObjects];
+            self.totalSize = 0;
+            
+            // Records are queued by the barriers that change the index. Compacting after the records of the changes made
+            // before this one keeps them from being appended to the emptied journal, which would revive their entries.
+            dispatch_async(self.writeQueue, ^{
+                [self.journal compactWithEntries:@[]];
+                
+                if (completion) {
+                    dispatch_async(dispatch_get_main_queue(), ^{
+                        completion();
+                    });
+                }
+            });
+        });
     });
 }
 
@@ -341,68 +1300,57 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 }
 
 - (void)cleanDiskWithCompletionBlock:(VMWebVideoNoParamsBlock)completionBlock {
-    dispatch_async(self.ioQueue, ^{
-        NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-        NSArray *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey];
-        
-        // This enumerator prefetches useful properties for our cache files.
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:resourceKeys
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
-        
+    dispatch_async(self.writeQueue, ^{
+        [self removeRelocatedLegacyPaths];
+        // The index knows the size and date of every file, no need to walk the cache directory
+        [self flushAccesses];
+        NSArray *entries = [self indexedEntries];
         NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:-self.maxCacheAge];
-        NSMutableDictionary *cacheFiles = [NSMutableDictionary dictionary];
-        NSUInteger currentCacheSize = 0;
+        NSTimeInterval expirationTime = [expirationDate timeIntervalSinceReferenceDate];
+        NSMutableArray *remainingEntries = [NSMutableArray arrayWithCapacity:entries.count];
+        NSMutableDictionary *expiredEntriesByDirectory = [NSMutableDictionary new];
+        unsigned long long currentCacheSize = 0;
         
-        // Enumerate all of the files in the cache directory.  This loop has two purposes:
+        // Go through all of the entries. This loop has two purposes:
         //
-        //  1. Removing files that are older than the expiration date.
-        //  2. Storing file attributes for the size-based cleanup pass.
-        NSMutableArray *urlsToDelete = [[NSMutableArray alloc] init];
-        for (NSURL *fileURL in fileEnumerator) {
-            NSDictionary *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:NULL];
-            
-            // Skip directories.
-            if ([resourceValues[NSURLIsDirectoryKey] boolValue]) {
-                continue;
-            }
-            
-            // Remove files that are older than the expiration date;
-            NSDate *modificationDate = resourceValues[NSURLContentModificationDateKey];
-            if ([[modificationDate laterDate:expirationDate] isEqualToDate:expirationDate]) {
-                [urlsToDelete addObject:fileURL];
+        //  1. Collecting files that are older than the expiration date, grouped by directory (shard).
+        //  2. Collecting the remaining entries for the size-based cleanup pass, already in eviction order.
+        for (VMVideoCacheEntry *entry in entries) {
+            if (entry.modificationTime < expirationTime) {
+                NSString *directoryPath = [entry.path stringByDeletingLastPathComponent];
+                NSMutableArray *expiredEntries = expiredEntriesByDirectory[directoryPath];
+                if (!expiredEntries) {
+                    expiredEntries = [NSMutableArray new];
+                    expiredEntriesByDirectory[directoryPath] = expiredEntries;
+                }
+                [expiredEntries addObject:entry];
                 continue;
             }
             
-            // Store a reference to this file and account for its total size.
-            NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-            currentCacheSize += [totalAllocatedSize unsignedIntegerValue];
-            [cacheFiles setObject:resourceValues forKey:fileURL];
+            currentCacheSize += entry.size;
+            [remainingEntries addObject:entry];
         }
         
-        for (NSURL *fileURL in urlsToDelete) {
-            [self.fileManager removeItemAtURL:fileURL error:nil];
-        }
+        // Removing files from different directories doesn't contend, so shards are cleaned in parallel
+        NSArray *expiredEntryGroups = [expiredEntriesByDirectory allValues];
+        dispatch_apply(expiredEntryGroups.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+            for (VMVideoCacheEntry *entry in expiredEntryGroups[i]) {
+                [self.fileManager removeItemAtPath:entry.path error:nil];
+                [self removeIndexedEntryForFileName:entry.fileName];
+            }
+        });
         
         // If our remaining disk cache exceeds a configured maximum size, perform a second
-        // size-based cleanup pass.  We delete the oldest files first.
+        // size-based cleanup pass.  We delete the files the eviction policy ranks lowest first.
         if (self.maxCacheSize > 0 && currentCacheSize > self.maxCacheSize) {
             // Target half of our maximum cache size for this cleanup pass.
             const NSUInteger desiredCacheSize = self.maxCacheSize / 2;
             
-            // Sort the remaining cache files by their last modification time (oldest first).
-            NSArray *sortedFiles = [cacheFiles keysSortedByValueWithOptions:NSSortConcurrent
-                                                            usingComparator:^NSComparisonResult(id obj1, id obj2) {
-                                                                return [obj1[NSURLContentModificationDateKey] compare:obj2[NSURLContentModificationDateKey]];
-                                                            }];
-            
             // Delete files until we fall below our desired cache size.
-            for (NSURL *fileURL in sortedFiles) {
-                if ([self.fileManager removeItemAtURL:fileURL error:nil]) {
-                    NSDictionary *resourceValues = cacheFiles[fileURL];
-                    NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-                    currentCacheSize -= [totalAllocatedSize unsignedIntegerValue];
+            for (VMVideoCacheEntry *entry in remainingEntries) {
+                if ([self.fileManager removeItemAtPath:entry.path error:nil]) {
+                    [self removeIndexedEntryForFileName:entry.fileName evicted:YES];
+                    currentCacheSize -= entry.size;
                     
                     if (currentCacheSize < desiredCacheSize) {
                         break;
@@ -410,6 +1358,24 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
                 }
             }
         }
+        
+        // Partial downloads are kept around so they can be resumed, but not forever
+        NSURL *temporaryDirectoryURL = [NSURL fileURLWithPath:self.temporaryDirectoryPath isDirectory:YES];
+        NSDirectoryEnumerator *temporaryFileEnumerator = [self.fileManager enumeratorAtURL:temporaryDirectoryURL
+                                                                includingPropertiesForKeys:@[NSURLContentModificationDateKey]
+                                                                                   options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                              errorHandler:NULL];
+        for (NSURL *fileURL in temporaryFileEnumerator) {
+            NSDate *modificationDate;
+            [fileURL getResourceValue:&modificationDate forKey:NSURLContentModificationDateKey error:NULL];
+            if ([[modificationDate laterDate:expirationDate] isEqualToDate:expirationDate]) {
+                [self.fileManager removeItemAtURL:fileURL error:nil];
+            }
+        }
+        
+        // Files whose key is unknown may have expired by now
+        [self migrateLegacyFileNamesIfNeeded];
+        
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
                 completionBlock();
@@ -436,44 +1402,25 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
 
 - (NSUInteger)getSize {
     __block NSUInteger size = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
-        for (NSString *fileName in fileEnumerator) {
-            NSString *filePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
-            NSDictionary *attrs = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:nil];
-            size += [attrs fileSize];
-        }
+    dispatch_sync(self.indexQueue, ^{
+        size = (NSUInteger)self.totalSize;
     });
     return size;
 }
 
 - (NSUInteger)getDiskCount {
     __block NSUInteger count = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
-        count = [[fileEnumerator allObjects] count];
+    dispatch_sync(self.indexQueue, ^{
+        count = self.index.count;
     });
     return count;
 }
 
 - (void)calculateSizeWithCompletionBlock:(VMWebVideoCalculateSizeBlock)completionBlock {
-    NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-    
     dispatch_async(self.ioQueue, ^{
-        NSUInteger fileCount = 0;
-        NSUInteger totalSize = 0;
-        
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:@[NSFileSize]
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
-        
-        for (NSURL *fileURL in fileEnumerator) {
-            NSNumber *fileSize;
-            [fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
-            totalSize += [fileSize unsignedIntegerValue];
-            fileCount += 1;
-        }
+        // Running totals kept by the index
+        NSUInteger fileCount = [self getDiskCount];
+        NSUInteger totalSize = [self getSize];
         
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -0,0 +1,68 @@
+//
+//  VMVideoCacheEntry.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * The bookkeeping VMVideoCache keeps in memory for every video stored on disk.
+ */
+@interface VMVideoCacheEntry : NSObject <NSCopying>
+
+/**
+ * The name of the cached file, derived from the cache key.
+ */
+@property (copy, nonatomic) NSString *fileName;
+
+/**
+ * The cache key the file was stored for, if known.
+ */
+@property (copy, nonatomic) NSString *key;
+
+/**
+ * The full path of the cached file.
+ */
+@property (copy, nonatomic) NSString *path;
+
+/**
+ * The size of the cached file, in bytes.
+ */
+@property (assign, nonatomic) unsigned long long size;
+
+/**
+ * When the file was written, as an `NSDate` reference date interval.
+ */
+@property (assign, nonatomic) NSTimeInterval modificationTime;
+
+/**
+ * When the video was last looked up, as an `NSDate` reference date interval.
+ */
+@property (assign, nonatomic) NSTimeInterval lastAccessTime;
+
+/**
+ * How many times the video was looked up.
+ */
+@property (assign, nonatomic) NSUInteger accessCount;
+
+/**
+ * The `ETag` of the response the video came from, if any, to revalidate it with `If-None-Match`.
+ */
+@property (copy, nonatomic) NSString *eTag;
+
+/**
+ * The `Last-Modified` date of the response the video came from, if any, to revalidate it with `If-Modified-Since`.
+ */
+@property (copy, nonatomic) NSString *lastModified;
+
+/**
+ * The priority assigned by the cache's eviction policy. Entries with the lowest priority are evicted first.
+ */
+@property (assign, nonatomic) double evictionPriority;
+
++ (instancetype)entryWithPath:(NSString *)path size:(unsigned long long)size modificationTime:(NSTimeInterval)modificationTime;
+
+@end
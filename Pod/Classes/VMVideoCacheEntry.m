@@ -0,0 +1,38 @@
+//
+//  VMVideoCacheEntry.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMVideoCacheEntry.h"
+
+@implementation VMVideoCacheEntry
+
++ (instancetype)entryWithPath:(NSString *)path size:(unsigned long long)size modificationTime:(NSTimeInterval)modificationTime {
+    VMVideoCacheEntry *entry = [self new];
+    entry.fileName = [path lastPathComponent];
+    entry.path = path;
+    entry.size = size;
+    entry.modificationTime = modificationTime;
+    entry.lastAccessTime = modificationTime;
+    return entry;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    VMVideoCacheEntry *entry = [[[self class] allocWithZone:zone] init];
+    entry.fileName = self.fileName;
+    entry.key = self.key;
+    entry.path = self.path;
+    entry.size = self.size;
+    entry.modificationTime = self.modificationTime;
+    entry.lastAccessTime = self.lastAccessTime;
+    entry.accessCount = self.accessCount;
+    entry.eTag = self.eTag;
+    entry.lastModified = self.lastModified;
+    entry.evictionPriority = self.evictionPriority;
+    return entry;
+}
+
+@end
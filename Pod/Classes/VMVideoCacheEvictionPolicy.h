@@ -0,0 +1,55 @@
+//
+//  VMVideoCacheEvictionPolicy.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class VMVideoCacheEntry;
+
+/**
+ * Decides which videos VMVideoCache evicts first when it goes over `maxCacheSize`.
+ *
+ * The cache asks the policy for the priority of an entry whenever the entry is stored or looked up,
+ * and evicts the entries with the lowest priority first.
+ *
+ * @note Policies are only called on the cache's index queue, one call at a time.
+ */
+@protocol VMVideoCacheEvictionPolicy <NSObject>
+
+/**
+ * Returns the eviction priority of an entry. Entries with the lowest priority are evicted first.
+ */
+- (double)priorityForEntry:(VMVideoCacheEntry *)entry;
+
+@optional
+
+/**
+ * Called after an entry was evicted to make room for others.
+ */
+- (void)didEvictEntry:(VMVideoCacheEntry *)entry;
+
+@end
+
+/**
+ * Least recently used: evicts the videos that haven't been looked up for the longest time. This is the default policy.
+ */
+@interface VMVideoCacheLRUEvictionPolicy : NSObject <VMVideoCacheEvictionPolicy>
+@end
+
+/**
+ * Least frequently used: evicts the videos that were looked up the fewest times, the least recently used first among equals.
+ */
+@interface VMVideoCacheLFUEvictionPolicy : NSObject <VMVideoCacheEvictionPolicy>
+@end
+
+/**
+ * Greedy-Dual-Size-Frequency: favors small, frequently used videos, and ages out videos that used to be popular.
+ *
+ * The priority of an entry is `L + accessCount / size`, where L is the priority of the last evicted entry.
+ */
+@interface VMVideoCacheGDSFEvictionPolicy : NSObject <VMVideoCacheEvictionPolicy>
+@end
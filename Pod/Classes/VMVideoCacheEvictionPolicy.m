@@ -0,0 +1,43 @@
+//
+//  VMVideoCacheEvictionPolicy.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMVideoCacheEvictionPolicy.h"
+#import "VMVideoCacheEntry.h"
+
+@implementation VMVideoCacheLRUEvictionPolicy
+
+- (double)priorityForEntry:(VMVideoCacheEntry *)entry {
+    return entry.lastAccessTime;
+}
+
+@end
+
+@implementation VMVideoCacheLFUEvictionPolicy
+
+- (double)priorityForEntry:(VMVideoCacheEntry *)entry {
+    // The access time only breaks ties, it stays well below one access
+    return entry.accessCount + entry.lastAccessTime / 1e10;
+}
+
+@end
+
+@implementation VMVideoCacheGDSFEvictionPolicy {
+    double inflation;
+}
+
+- (double)priorityForEntry:(VMVideoCacheEntry *)entry {
+    // Size in MB, so that the frequency term stays in a sensible range for videos
+    double size = MAX((double)entry.size / (1024 * 1024), 0.001);
+    return inflation + (entry.accessCount + 1) / size;
+}
+
+- (void)didEvictEntry:(VMVideoCacheEntry *)entry {
+    inflation = MAX(inflation, entry.evictionPriority);
+}
+
+@end
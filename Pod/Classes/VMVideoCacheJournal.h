@@ -0,0 +1,55 @@
+//
+//  VMVideoCacheJournal.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class VMVideoCacheEntry;
+
+/**
+ * Append-only journal of the changes made to a VMVideoCache, so its index can be restored at launch
+ * without enumerating the cache directory.
+ *
+ * Every change is appended as a single line. When the journal grows much larger than the set of entries it
+ * describes, it is compacted by rewriting it from the live entries. Replaying the journal after a crash
+ * cuts off a truncated last record, and skips records whose fields don't parse.
+ *
+ * @note VMVideoCacheJournal is not thread safe, callers must serialize access to it.
+ */
+@interface VMVideoCacheJournal : NSObject
+
+@property (strong, nonatomic, readonly) NSString *path;
+
+/**
+ * The number of records in the journal, including the ones superseded by later records.
+ */
+@property (assign, nonatomic, readonly) NSUInteger recordCount;
+
+- (instancetype)initWithPath:(NSString *)path;
+
+/**
+ * Replays the journal.
+ *
+ * @return The live entries, with their `path` unset, or nil if there is no journal to replay.
+ */
+- (NSArray *)replayEntries;
+
+- (void)recordEntry:(VMVideoCacheEntry *)entry;
+
+/**
+ * Records the last access time and access count of the entries, in a single write.
+ */
+- (void)recordAccessesOfEntries:(NSArray *)entries;
+
+- (void)recordRemovalOfFileName:(NSString *)fileName;
+
+/**
+ * Atomically replaces the journal with one record per entry.
+ */
+- (BOOL)compactWithEntries:(NSArray *)entries;
+
+@end
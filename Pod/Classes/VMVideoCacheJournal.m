@@ -0,0 +1,215 @@
+//
+//  VMVideoCacheJournal.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMVideoCacheJournal.h"
+#import "VMVideoCacheEntry.h"
+#import <fcntl.h>
+#import <math.h>
+#import <stdlib.h>
+#import <unistd.h>
+
+// Record formats, one per line, fields separated by tabs:
+//   + <file name> <size> <modification time> <access time> <access count> <key> [<etag> <last modified>]
+//   a <file name> <access time> <access count>
+//   - <file name>
+static NSString *const kJournalStoreRecord = @"+";
+static NSString *const kJournalAccessRecord = @"a";
+static NSString *const kJournalRemoveRecord = @"-";
+
+@interface VMVideoCacheJournal ()
+
+@property (assign, nonatomic, readwrite) NSUInteger recordCount;
+
+@end
+
+static BOOL VMJournalParseUnsigned(NSString *field, unsigned long long *value) {
+    const char *string = field.UTF8String;
+    if (!string || string[0] < '0' || string[0] > '9') {
+        return NO;
+    }
+    char *end = NULL;
+    errno = 0;
+    *value = strtoull(string, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static BOOL VMJournalParseTime(NSString *field, NSTimeInterval *value) {
+    const char *string = field.UTF8String;
+    if (!string || string[0] == '\0') {
+        return NO;
+    }
+    char *end = NULL;
+    *value = strtod(string, &end);
+    return *end == '\0' && isfinite(*value) && *value >= 0;
+}
+
+@implementation VMVideoCacheJournal {
+    int fileDescriptor;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    if ((self = [super init])) {
+        _path = [path copy];
+        fileDescriptor = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeJournal];
+}
+
+#pragma mark Replay
+
+- (NSArray *)replayEntries {
+    NSData *data = [NSData dataWithContentsOfFile:self.path];
+    if (!data) {
+        return nil;
+    }
+    
+    // Only complete records end with a newline. Anything after the last one was cut short by a crash in the
+    // middle of a write, and is cut off so the next record isn't appended to it.
+    NSRange lastNewline = [data rangeOfData:[NSData dataWithBytes:"\n" length:1] options:NSDataSearchBackwards range:NSMakeRange(0, data.length)];
+    NSUInteger completeLength = lastNewline.location == NSNotFound ? 0 : NSMaxRange(lastNewline);
+    if (completeLength < data.length) {
+        [self closeJournal];
+        if (truncate(self.path.fileSystemRepresentation, (off_t)completeLength) != 0) {
+            return nil;
+        }
+    }
+    
+    NSString *contents = [[NSString alloc] initWithBytes:data.bytes length:completeLength encoding:NSUTF8StringEncoding];
+    if (!contents) {
+        return nil;
+    }
+    
+    NSMutableDictionary *entries = [NSMutableDictionary dictionary];
+    __block NSUInteger recordCount = 0;
+    [contents enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        recordCount++;
+        NSArray *fields = [line componentsSeparatedByString:@"\t"];
+        NSString *type = fields.firstObject;
+        
+        // Records that don't parse are skipped rather than restoring entries with bogus sizes or times
+        if ([type isEqualToString:kJournalStoreRecord] && fields.count >= 7) {
+            unsigned long long size, accessCount;
+            NSTimeInterval modificationTime, lastAccessTime;
+            if (![fields[1] length] || !VMJournalParseUnsigned(fields[2], &size) || !VMJournalParseTime(fields[3], &modificationTime) || !VMJournalParseTime(fields[4], &lastAccessTime) || !VMJournalParseUnsigned(fields[5], &accessCount)) {
+                return;
+            }
+            
+            VMVideoCacheEntry *entry = [VMVideoCacheEntry new];
+            entry.fileName = fields[1];
+            entry.size = size;
+            entry.modificationTime = modificationTime;
+            entry.lastAccessTime = lastAccessTime;
+            entry.accessCount = (NSUInteger)accessCount;
+            entry.key = [fields[6] length] ? fields[6] : nil;
+            if (fields.count >= 9) {
+                // Journals written before validators were kept don't have them
+                entry.eTag = [fields[7] length] ? fields[7] : nil;
+                entry.lastModified = [fields[8] length] ? fields[8] : nil;
+            }
+            entries[entry.fileName] = entry;
+        }
+        else if ([type isEqualToString:kJournalAccessRecord] && fields.count >= 3) {
+            NSTimeInterval lastAccessTime;
+            unsigned long long accessCount = 0;
+            if (!VMJournalParseTime(fields[2], &lastAccessTime) || (fields.count >= 4 && !VMJournalParseUnsigned(fields[3], &accessCount))) {
+                return;
+            }
+            
+            VMVideoCacheEntry *entry = entries[fields[1]];
+            entry.lastAccessTime = lastAccessTime;
+            // Records carry the total, so replaying one twice is harmless. Journals written before that count one access per record.
+            entry.accessCount = fields.count >= 4 ? (NSUInteger)accessCount : entry.accessCount + 1;
+        }
+        else if ([type isEqualToString:kJournalRemoveRecord] && fields.count >= 2) {
+            [entries removeObjectForKey:fields[1]];
+        }
+    }];
+    
+    self.recordCount = recordCount;
+    return [entries allValues];
+}
+
+#pragma mark Recording
+
+// Fields are only kept when they can't break the record format. Keys are informational, and a video without validators is simply downloaded again when refreshed.
+- (NSString *)recordFieldForString:(NSString *)string {
+    if (!string || [string rangeOfCharacterFromSet:[NSCharacterSet newlineCharacterSet]].location != NSNotFound || [string rangeOfString:@"\t"].location != NSNotFound) {
+        return @"";
+    }
+    return string;
+}
+
+- (NSString *)recordForEntry:(VMVideoCacheEntry *)entry {
+    return [NSString stringWithFormat:@"%@\t%@\t%llu\t%.3f\t%.3f\t%lu\t%@\t%@\t%@\n", kJournalStoreRecord, entry.fileName, entry.size, entry.modificationTime, entry.lastAccessTime, (unsigned long)entry.accessCount, [self recordFieldForString:entry.key], [self recordFieldForString:entry.eTag], [self recordFieldForString:entry.lastModified]];
+}
+
+- (void)recordEntry:(VMVideoCacheEntry *)entry {
+    [self appendRecords:[self recordForEntry:entry] count:1];
+}
+
+- (void)recordAccessesOfEntries:(NSArray *)entries {
+    if (entries.count == 0) {
+        return;
+    }
+    
+    NSMutableString *records = [NSMutableString string];
+    for (VMVideoCacheEntry *entry in entries) {
+        [records appendFormat:@"%@\t%@\t%.3f\t%lu\n", kJournalAccessRecord, entry.fileName, entry.lastAccessTime, (unsigned long)entry.accessCount];
+    }
+    [self appendRecords:records count:entries.count];
+}
+
+- (void)recordRemovalOfFileName:(NSString *)fileName {
+    [self appendRecords:[NSString stringWithFormat:@"%@\t%@\n", kJournalRemoveRecord, fileName] count:1];
+}
+
+- (void)appendRecords:(NSString *)records count:(NSUInteger)count {
+    if (fileDescriptor < 0) {
+        fileDescriptor = open(self.path.fileSystemRepresentation, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fileDescriptor < 0) {
+            return;
+        }
+    }
+    
+    // A single write per batch of records, so a crash can at worst leave the last record incomplete
+    NSData *data = [records dataUsingEncoding:NSUTF8StringEncoding];
+    if (write(fileDescriptor, data.bytes, data.length) == (ssize_t)data.length) {
+        self.recordCount += count;
+    }
+}
+
+- (void)closeJournal {
+    if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+}
+
+#pragma mark Compaction
+
+- (BOOL)compactWithEntries:(NSArray *)entries {
+    NSMutableString *contents = [NSMutableString string];
+    for (VMVideoCacheEntry *entry in entries) {
+        [contents appendString:[self recordForEntry:entry]];
+    }
+    
+    [self closeJournal];
+    [[NSFileManager defaultManager] createDirectoryAtPath:[self.path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (![contents writeToFile:self.path atomically:YES encoding:NSUTF8StringEncoding error:nil]) {
+        return NO;
+    }
+    
+    self.recordCount = entries.count;
+    return YES;
+}
+
+@end
@@ -52,6 +52,17 @@
 
 typedef void(^VMWebVideoNoParamsBlock)();
 
+/**
+ * Returns the hashed file name (without extension) used to store anything derived from the given key on disk.
+ * This is the 128-bit MurmurHash3 of the key's UTF-8 bytes, as 32 lowercase hex digits.
+ */
+extern NSString *VMWebVideoFileNameForKey(NSString *key);
+
+/**
+ * Returns the MD5 based file name that earlier versions used for the given key, so that files stored by them can be found and renamed.
+ */
+extern NSString *VMWebVideoLegacyFileNameForKey(NSString *key);
+
 #define dispatch_main_sync_safe(block)\
 if ([NSThread isMainThread]) {\
 block();\
@@ -6,6 +6,106 @@
 //  Copyright (c) 2014 VM Labs. All rights reserved.
 //
 
+#import "VMWebVideoCompat.h"
+#import <CommonCrypto/CommonDigest.h>
 
+static const char kHexDigits[] = "0123456789abcdef";
 
+static inline uint64_t VMRotateLeft64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
 
+static inline uint64_t VMFinalizationMix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3_x64_128 by Austin Appleby (public domain), with a seed of 0
+static void VMMurmurHash3_x64_128(const uint8_t *data, size_t length, uint64_t hash[2]) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const size_t blockCount = length / 16;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    
+    for (size_t i = 0; i < blockCount; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(k1));
+        memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+        
+        k1 *= c1; k1 = VMRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = VMRotateLeft64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        
+        k2 *= c2; k2 = VMRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = VMRotateLeft64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    
+    const uint8_t *tail = data + blockCount * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= (uint64_t)tail[14] << 48;
+        case 14: k2 ^= (uint64_t)tail[13] << 40;
+        case 13: k2 ^= (uint64_t)tail[12] << 32;
+        case 12: k2 ^= (uint64_t)tail[11] << 24;
+        case 11: k2 ^= (uint64_t)tail[10] << 16;
+        case 10: k2 ^= (uint64_t)tail[9] << 8;
+        case 9: k2 ^= (uint64_t)tail[8];
+            k2 *= c2; k2 = VMRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+        case 8: k1 ^= (uint64_t)tail[7] << 56;
+        case 7: k1 ^= (uint64_t)tail[6] << 48;
+        case 6: k1 ^= (uint64_t)tail[5] << 40;
+        case 5: k1 ^= (uint64_t)tail[4] << 32;
+        case 4: k1 ^= (uint64_t)tail[3] << 24;
+        case 3: k1 ^= (uint64_t)tail[2] << 16;
+        case 2: k1 ^= (uint64_t)tail[1] << 8;
+        case 1: k1 ^= (uint64_t)tail[0];
+            k1 *= c1; k1 = VMRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = VMFinalizationMix64(h1);
+    h2 = VMFinalizationMix64(h2);
+    h1 += h2;
+    h2 += h1;
+    
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+NSString *VMWebVideoFileNameForKey(NSString *key) {
+    // Most keys are ASCII URLs, for which the string's own buffer can usually be hashed without a copy
+    const char *str = key ? CFStringGetCStringPtr((__bridge CFStringRef)key, kCFStringEncodingUTF8) : NULL;
+    if (str == NULL) {
+        str = [key UTF8String] ?: "";
+    }
+    
+    uint64_t hash[2];
+    VMMurmurHash3_x64_128((const uint8_t *)str, strlen(str), hash);
+    
+    char hex[32];
+    for (int i = 0; i < 16; i++) {
+        uint8_t byte = (uint8_t)(hash[i / 8] >> (56 - 8 * (i % 8)));
+        hex[i * 2] = kHexDigits[byte >> 4];
+        hex[i * 2 + 1] = kHexDigits[byte & 0xf];
+    }
+    return [[NSString alloc] initWithBytes:hex length:sizeof(hex) encoding:NSASCIIStringEncoding];
+}
+
+NSString *VMWebVideoLegacyFileNameForKey(NSString *key) {
+    const char *str = [key UTF8String];
+    if (str == NULL) {
+        str = "";
+    }
+    unsigned char r[CC_MD5_DIGEST_LENGTH];
+    CC_MD5(str, (CC_LONG)strlen(str), r);
+    return [NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
+            r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10], r[11], r[12], r[13], r[14], r[15]];
+}
@@ -0,0 +1,55 @@
+//
+//  VMWebVideoConcurrencyController.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Picks how many downloads should run at the same time from what the network delivers, AIMD style.
+ *
+ * Samples are grouped in windows of `sampleInterval`. At the end of each window:
+ *  - if a response took longer than `maximumTimeToFirstByte` to start, or the aggregate throughput dropped
+ *    noticeably compared to the previous window, the concurrency is halved;
+ *  - otherwise, if downloads were waiting for a slot, the concurrency grows by one.
+ *
+ * The controller only does bookkeeping: time is passed in by the caller, and it isn't thread safe.
+ */
+@interface VMWebVideoConcurrencyController : NSObject
+
+- (instancetype)initWithMinimumConcurrency:(NSInteger)minimumConcurrency maximumConcurrency:(NSInteger)maximumConcurrency;
+
+@property (assign, nonatomic) NSInteger minimumConcurrency;
+@property (assign, nonatomic) NSInteger maximumConcurrency;
+
+/**
+ * The number of downloads that should run at the same time, between the minimum and the maximum.
+ */
+@property (readonly, nonatomic) NSInteger concurrency;
+
+/**
+ * The length of a measurement window, in seconds. Default: 2.
+ */
+@property (assign, nonatomic) NSTimeInterval sampleInterval;
+
+/**
+ * Responses that take longer than this to start, in seconds, are a sign of congestion. Default: 1.5.
+ */
+@property (assign, nonatomic) NSTimeInterval maximumTimeToFirstByte;
+
+- (void)recordReceivedBytes:(NSUInteger)length;
+- (void)recordTimeToFirstByte:(NSTimeInterval)timeToFirstByte;
+
+/**
+ * Closes the current window if it is over and adjusts the concurrency.
+ *
+ * @param time      The current time, in seconds
+ * @param saturated Whether downloads are waiting for a slot, i.e. whether more concurrency would be used
+ * @return YES if the concurrency changed
+ */
+- (BOOL)updateAtTime:(NSTimeInterval)time saturated:(BOOL)saturated;
+
+@end
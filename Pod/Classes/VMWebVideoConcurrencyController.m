@@ -0,0 +1,91 @@
+//
+//  VMWebVideoConcurrencyController.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoConcurrencyController.h"
+
+// A window with less than this fraction of the previous window's throughput counts as congestion
+static const double kThroughputDropRatio = 0.8;
+
+@interface VMWebVideoConcurrencyController ()
+
+@property (assign, nonatomic) NSInteger concurrency;
+@property (assign, nonatomic) NSTimeInterval windowStartTime;
+@property (assign, nonatomic) unsigned long long windowReceivedBytes;
+@property (assign, nonatomic) NSTimeInterval windowWorstTimeToFirstByte;
+@property (assign, nonatomic) double previousThroughput;
+
+@end
+
+@implementation VMWebVideoConcurrencyController
+
+- (instancetype)initWithMinimumConcurrency:(NSInteger)minimumConcurrency maximumConcurrency:(NSInteger)maximumConcurrency {
+    if ((self = [super init])) {
+        _minimumConcurrency = MAX(minimumConcurrency, 1);
+        _maximumConcurrency = MAX(maximumConcurrency, _minimumConcurrency);
+        _concurrency = (_minimumConcurrency + _maximumConcurrency) / 2;
+        _sampleInterval = 2.0;
+        _maximumTimeToFirstByte = 1.5;
+    }
+    return self;
+}
+
+- (void)setMinimumConcurrency:(NSInteger)minimumConcurrency {
+    _minimumConcurrency = MAX(minimumConcurrency, 1);
+    self.concurrency = MAX(self.concurrency, _minimumConcurrency);
+}
+
+- (void)setMaximumConcurrency:(NSInteger)maximumConcurrency {
+    _maximumConcurrency = MAX(maximumConcurrency, self.minimumConcurrency);
+    self.concurrency = MIN(self.concurrency, _maximumConcurrency);
+}
+
+- (void)recordReceivedBytes:(NSUInteger)length {
+    self.windowReceivedBytes += length;
+}
+
+- (void)recordTimeToFirstByte:(NSTimeInterval)timeToFirstByte {
+    self.windowWorstTimeToFirstByte = MAX(self.windowWorstTimeToFirstByte, timeToFirstByte);
+}
+
+- (BOOL)updateAtTime:(NSTimeInterval)time saturated:(BOOL)saturated {
+    if (self.windowStartTime == 0) {
+        self.windowStartTime = time;
+        return NO;
+    }
+    
+    NSTimeInterval elapsed = time - self.windowStartTime;
+    if (elapsed < self.sampleInterval) {
+        return NO;
+    }
+    
+    NSInteger previousConcurrency = self.concurrency;
+    double throughput = self.windowReceivedBytes / elapsed;
+    BOOL slowResponses = self.windowWorstTimeToFirstByte > self.maximumTimeToFirstByte;
+    BOOL throughputDropped = saturated && self.previousThroughput > 0 && throughput < self.previousThroughput * kThroughputDropRatio;
+    
+    if (slowResponses || throughputDropped) {
+        // Multiplicative decrease: we are competing with ourselves for the link
+        self.concurrency = MAX(self.minimumConcurrency, self.concurrency / 2);
+    }
+    else if (saturated && self.windowReceivedBytes > 0) {
+        // Additive increase: probe whether one more download gets more bytes through
+        self.concurrency = MIN(self.maximumConcurrency, self.concurrency + 1);
+    }
+    
+    // Idle windows say nothing about the link
+    if (self.windowReceivedBytes > 0) {
+        self.previousThroughput = throughput;
+    }
+    self.windowStartTime = time;
+    self.windowReceivedBytes = 0;
+    self.windowWorstTimeToFirstByte = 0;
+    
+    return self.concurrency != previousConcurrency;
+}
+
+@end
@@ -0,0 +1,92 @@
+//
+//  VMWebVideoDownloadScheduler.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "VMWebVideoOperation.h"
+
+/**
+ * Operations that can pause their transfer without giving up what they downloaded, so running prefetches can make way
+ * for visible downloads.
+ */
+@protocol VMWebVideoThrottlableOperation <NSObject>
+
+- (void)setThrottled:(BOOL)throttled;
+
+@end
+
+/**
+ * Decides which download operations run, and when, so that the video the user is looking at is never stuck behind prefetches.
+ *
+ * Operations wait in one queue per priority class and are handed to the operation queue, highest class first,
+ * whenever a slot is free. Prefetch operations don't start while a visible operation is running or waiting,
+ * and never take the last free slot, so a visible download can always start right away.
+ *
+ * Running prefetch operations that conform to VMWebVideoThrottlableOperation are paused while a visible operation
+ * is running or waiting, and their slots are lent to the visible operations meanwhile. Visible operations suspended
+ * through `setSuspended:ofOperation:` don't count.
+ */
+@interface VMWebVideoDownloadScheduler : NSObject
+
+- (instancetype)initWithOperationQueue:(NSOperationQueue *)operationQueue;
+
+/**
+ * The maximum number of operations running at the same time. Default: 6.
+ */
+@property (assign, nonatomic) NSInteger maxConcurrentDownloads;
+
+/**
+ * Adjust the number of running operations to the throughput and response times the network delivers,
+ * between 2 and `maxConcurrentDownloads`. Default: NO.
+ *
+ * @see VMWebVideoConcurrencyController
+ */
+@property (assign, nonatomic) BOOL adaptiveConcurrency;
+
+/**
+ * Whether the most recently scheduled operation of a priority class runs first. Default: NO.
+ */
+@property (assign, nonatomic) BOOL lastInFirstOut;
+
+/**
+ * While suspended, no new operation is started.
+ */
+@property (assign, nonatomic, getter = isSuspended) BOOL suspended;
+
+/**
+ * The number of operations waiting or running.
+ */
+@property (readonly, nonatomic) NSUInteger operationCount;
+
+- (void)scheduleOperation:(NSOperation *)operation withPriority:(VMWebVideoDownloadPriority)priority;
+
+/**
+ * Moves a waiting or running operation to another priority class.
+ */
+- (void)setPriority:(VMWebVideoDownloadPriority)priority ofOperation:(NSOperation *)operation;
+
+/**
+ * Tells that a waiting or running operation was paused or resumed by its owner.
+ * A suspended visible operation doesn't hold prefetches back.
+ */
+- (void)setSuspended:(BOOL)suspended ofOperation:(NSOperation *)operation;
+
+/**
+ * Must be called once an operation finished or was cancelled, to free its slot.
+ */
+- (void)operationDidFinish:(NSOperation *)operation;
+
+/**
+ * Operations report how the network performs, for `adaptiveConcurrency`. Ignored while it is off,
+ * and received bytes are added up before they reach the scheduler's queue.
+ */
+- (void)operation:(NSOperation *)operation didReceiveResponseAfter:(NSTimeInterval)timeToFirstByte;
+- (void)operation:(NSOperation *)operation didReceiveDataOfLength:(NSUInteger)length;
+
+- (void)cancelAllOperations;
+
+@end
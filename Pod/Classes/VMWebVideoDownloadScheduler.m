@@ -0,0 +1,351 @@
+//
+//  VMWebVideoDownloadScheduler.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoDownloadScheduler.h"
+#import "VMWebVideoCompat.h"
+#import "VMWebVideoConcurrencyController.h"
+
+static const NSInteger kPriorityClassCount = VMWebVideoDownloadPriorityVisible - VMWebVideoDownloadPriorityPrefetch + 1;
+
+// One slot for what the user is waiting for, one for everything else
+static const NSInteger kMinimumAdaptiveConcurrency = 2;
+
+// Received bytes are added up and handed to the schedulerQueue at most this often, not for every chunk
+static const CFTimeInterval kReceivedBytesReportInterval = 0.25;
+
+@interface VMWebVideoDownloadScheduler ()
+
+@property (strong, nonatomic, readonly) NSOperationQueue *operationQueue;
+// One array of waiting operations per priority class, lowest class first
+@property (strong, nonatomic, readonly) NSArray *waitingOperations;
+@property (strong, nonatomic, readonly) NSMutableSet *runningOperations;
+// Running prefetch operations paused for visible ones, they don't count against the concurrency limit
+@property (strong, nonatomic, readonly) NSMutableSet *throttledOperations;
+// Operations paused by their owner, visible ones among them don't hold prefetches back
+@property (strong, nonatomic, readonly) NSMutableSet *suspendedOperations;
+// Priority of every waiting or running operation
+@property (strong, nonatomic, readonly) NSMapTable *priorities;
+@property (strong, nonatomic, readonly) VMWebVideoConcurrencyController *concurrencyController;
+// All of the above is only used on this queue
+@property (VMDispatchQueueSetterSementics, nonatomic, readonly) dispatch_queue_t schedulerQueue;
+// Guarded by @synchronized(self), bytes received since they were last reported to the concurrencyController
+@property (assign, nonatomic) NSUInteger unreportedBytes;
+@property (assign, nonatomic) CFAbsoluteTime lastBytesReportTime;
+
+@end
+
+@implementation VMWebVideoDownloadScheduler
+
+- (instancetype)initWithOperationQueue:(NSOperationQueue *)operationQueue {
+    if ((self = [super init])) {
+        _operationQueue = operationQueue;
+        _maxConcurrentDownloads = 6;
+        NSMutableArray *waitingOperations = [NSMutableArray arrayWithCapacity:kPriorityClassCount];
+        for (NSInteger i = 0; i < kPriorityClassCount; i++) {
+            [waitingOperations addObject:[NSMutableArray new]];
+        }
+        _waitingOperations = waitingOperations;
+        _runningOperations = [NSMutableSet new];
+        _throttledOperations = [NSMutableSet new];
+        _suspendedOperations = [NSMutableSet new];
+        _priorities = [NSMapTable strongToStrongObjectsMapTable];
+        _concurrencyController = [[VMWebVideoConcurrencyController alloc] initWithMinimumConcurrency:kMinimumAdaptiveConcurrency maximumConcurrency:_maxConcurrentDownloads];
+        _schedulerQueue = dispatch_queue_create("com.vmlabs.VMWebVideoDownloadScheduler", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    VMDispatchQueueRelease(_schedulerQueue);
+}
+
+// Settings are stored right away, so their getters reflect them, and applied on the schedulerQueue
+- (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads {
+    @synchronized (self) {
+        _maxConcurrentDownloads = maxConcurrentDownloads;
+    }
+    dispatch_async(self.schedulerQueue, ^{
+        self.concurrencyController.maximumConcurrency = self.maxConcurrentDownloads;
+        [self startOperationsIfPossible];
+    });
+}
+
+- (NSInteger)maxConcurrentDownloads {
+    @synchronized (self) {
+        return _maxConcurrentDownloads;
+    }
+}
+
+- (void)setAdaptiveConcurrency:(BOOL)adaptiveConcurrency {
+    @synchronized (self) {
+        _adaptiveConcurrency = adaptiveConcurrency;
+    }
+    dispatch_async(self.schedulerQueue, ^{
+        [self startOperationsIfPossible];
+    });
+}
+
+- (BOOL)adaptiveConcurrency {
+    @synchronized (self) {
+        return _adaptiveConcurrency;
+    }
+}
+
+- (void)setSuspended:(BOOL)suspended {
+    @synchronized (self) {
+        _suspended = suspended;
+    }
+    dispatch_async(self.schedulerQueue, ^{
+        [self startOperationsIfPossible];
+    });
+}
+
+- (BOOL)isSuspended {
+    @synchronized (self) {
+        return _suspended;
+    }
+}
+
+- (NSUInteger)operationCount {
+    __block NSUInteger operationCount = 0;
+    dispatch_sync(self.schedulerQueue, ^{
+        operationCount = self.priorities.count;
+    });
+    return operationCount;
+}
+
+- (NSMutableArray *)waitingOperationsWithPriority:(VMWebVideoDownloadPriority)priority {
+    return self.waitingOperations[priority - VMWebVideoDownloadPriorityPrefetch];
+}
+
+- (void)scheduleOperation:(NSOperation *)operation withPriority:(VMWebVideoDownloadPriority)priority {
+    dispatch_async(self.schedulerQueue, ^{
+        [self.priorities setObject:@(priority) forKey:operation];
+        NSMutableArray *waitingOperations = [self waitingOperationsWithPriority:priority];
+        if (self.lastInFirstOut) {
+            [waitingOperations insertObject:operation atIndex:0];
+        }
+        else {
+            [waitingOperations addObject:operation];
+        }
+        [self startOperationsIfPossible];
+    });
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority ofOperation:(NSOperation *)operation {
+    dispatch_async(self.schedulerQueue, ^{
+        NSNumber *previousPriority = [self.priorities objectForKey:operation];
+        if (!previousPriority || previousPriority.integerValue == priority) {
+            return;
+        }
+        
+        [self.priorities setObject:@(priority) forKey:operation];
+        NSMutableArray *waitingOperations = [self waitingOperationsWithPriority:previousPriority.integerValue];
+        if ([waitingOperations containsObject:operation]) {
+            [waitingOperations removeObject:operation];
+            if (self.lastInFirstOut) {
+                [[self waitingOperationsWithPriority:priority] insertObject:operation atIndex:0];
+            }
+            else {
+                [[self waitingOperationsWithPriority:priority] addObject:operation];
+            }
+        }
+        [self startOperationsIfPossible];
+    });
+}
+
+- (void)setSuspended:(BOOL)suspended ofOperation:(NSOperation *)operation {
+    dispatch_async(self.schedulerQueue, ^{
+        if (![self.priorities objectForKey:operation] || suspended == [self.suspendedOperations containsObject:operation]) {
+            return;
+        }
+        
+        if (suspended) {
+            [self.suspendedOperations addObject:operation];
+        }
+        else {
+            [self.suspendedOperations removeObject:operation];
+        }
+        [self startOperationsIfPossible];
+    });
+}
+
+- (void)operationDidFinish:(NSOperation *)operation {
+    dispatch_async(self.schedulerQueue, ^{
+        NSNumber *priority = [self.priorities objectForKey:operation];
+        if (!priority) {
+            return;
+        }
+        
+        [self.priorities removeObjectForKey:operation];
+        [self.runningOperations removeObject:operation];
+        [self.throttledOperations removeObject:operation];
+        [self.suspendedOperations removeObject:operation];
+        [[self waitingOperationsWithPriority:priority.integerValue] removeObject:operation];
+        [self updateConcurrency];
+        [self startOperationsIfPossible];
+    });
+}
+
+- (void)operation:(NSOperation *)operation didReceiveResponseAfter:(NSTimeInterval)timeToFirstByte {
+    if (!self.adaptiveConcurrency) {
+        return;
+    }
+    
+    dispatch_async(self.schedulerQueue, ^{
+        [self.concurrencyController recordTimeToFirstByte:timeToFirstByte];
+        [self updateConcurrency];
+    });
+}
+
+- (void)operation:(NSOperation *)operation didReceiveDataOfLength:(NSUInteger)length {
+    if (!self.adaptiveConcurrency) {
+        return;
+    }
+    
+    NSUInteger receivedBytes = 0;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    @synchronized (self) {
+        self.unreportedBytes += length;
+        if (now - self.lastBytesReportTime < kReceivedBytesReportInterval) {
+            return;
+        }
+        receivedBytes = self.unreportedBytes;
+        self.unreportedBytes = 0;
+        self.lastBytesReportTime = now;
+    }
+    dispatch_async(self.schedulerQueue, ^{
+        [self.concurrencyController recordReceivedBytes:receivedBytes];
+        [self updateConcurrency];
+    });
+}
+
+// Must be called on the schedulerQueue
+- (void)updateConcurrency {
+    if (!self.adaptiveConcurrency) {
+        return;
+    }
+    
+    BOOL saturated = NO;
+    if ([self activeOperationCount] >= [self concurrencyLimit]) {
+        for (NSMutableArray *waitingOperations in self.waitingOperations) {
+            saturated = saturated || waitingOperations.count > 0;
+        }
+    }
+    if ([self.concurrencyController updateAtTime:CFAbsoluteTimeGetCurrent() saturated:saturated]) {
+        [self startOperationsIfPossible];
+    }
+}
+
+// Must be called on the schedulerQueue
+- (NSInteger)concurrencyLimit {
+    if (self.adaptiveConcurrency) {
+        return MIN(self.concurrencyController.concurrency, self.maxConcurrentDownloads);
+    }
+    return self.maxConcurrentDownloads;
+}
+
+- (void)cancelAllOperations {
+    dispatch_async(self.schedulerQueue, ^{
+        NSArray *operations = [[self.priorities keyEnumerator] allObjects];
+        [self.priorities removeAllObjects];
+        [self.runningOperations removeAllObjects];
+        [self.throttledOperations removeAllObjects];
+        [self.suspendedOperations removeAllObjects];
+        for (NSMutableArray *waitingOperations in self.waitingOperations) {
+            [waitingOperations removeAllObjects];
+        }
+        [operations makeObjectsPerformSelector:@selector(cancel)];
+    });
+}
+
+// Must be called on the schedulerQueue
+// Suspended operations don't count, a paused player would otherwise hold prefetches back for as long as it stays paused
+- (BOOL)hasVisibleOperations {
+    for (NSOperation *operation in [self waitingOperationsWithPriority:VMWebVideoDownloadPriorityVisible]) {
+        if (![self.suspendedOperations containsObject:operation]) {
+            return YES;
+        }
+    }
+    for (NSOperation *operation in self.runningOperations) {
+        if ([[self.priorities objectForKey:operation] integerValue] == VMWebVideoDownloadPriorityVisible &&
+            ![self.suspendedOperations containsObject:operation]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// Must be called on the schedulerQueue
+- (NSInteger)activeOperationCount {
+    return (NSInteger)(self.runningOperations.count - self.throttledOperations.count);
+}
+
+// Must be called on the schedulerQueue
+// Running prefetches are paused while the user waits for a video, so they don't compete with it for bandwidth
+- (void)updateThrottling {
+    BOOL throttle = [self hasVisibleOperations];
+    for (NSOperation *operation in self.runningOperations) {
+        if (![operation conformsToProtocol:@protocol(VMWebVideoThrottlableOperation)]) {
+            continue;
+        }
+        
+        BOOL throttled = throttle && [[self.priorities objectForKey:operation] integerValue] == VMWebVideoDownloadPriorityPrefetch;
+        if (throttled == [self.throttledOperations containsObject:operation]) {
+            continue;
+        }
+        if (throttled) {
+            [self.throttledOperations addObject:operation];
+        }
+        else {
+            [self.throttledOperations removeObject:operation];
+        }
+        [(id <VMWebVideoThrottlableOperation>)operation setThrottled:throttled];
+    }
+}
+
+// Must be called on the schedulerQueue
+- (void)startOperationsIfPossible {
+    [self updateThrottling];
+    
+    NSInteger concurrencyLimit = [self concurrencyLimit];
+    while (!self.suspended && [self activeOperationCount] < concurrencyLimit) {
+        NSOperation *operation = nil;
+        for (NSInteger i = kPriorityClassCount - 1; i >= 0 && !operation; i--) {
+            NSMutableArray *waitingOperations = self.waitingOperations[i];
+            
+            // Operations cancelled while waiting will never run
+            while (waitingOperations.count > 0 && [waitingOperations[0] isCancelled]) {
+                [self.priorities removeObjectForKey:waitingOperations[0]];
+                [waitingOperations removeObjectAtIndex:0];
+            }
+            
+            if (waitingOperations.count > 0) {
+                operation = waitingOperations[0];
+            }
+        }
+        
+        if (!operation) {
+            return;
+        }
+        
+        if ([[self.priorities objectForKey:operation] integerValue] == VMWebVideoDownloadPriorityPrefetch) {
+            // Keep the last slot free for the user, and hold prefetches back while they are waiting for a video
+            BOOL lastFreeSlot = concurrencyLimit > 1 && [self activeOperationCount] + 1 >= concurrencyLimit;
+            if (lastFreeSlot || [self hasVisibleOperations]) {
+                return;
+            }
+        }
+        
+        [[self waitingOperationsWithPriority:[[self.priorities objectForKey:operation] integerValue]] removeObject:operation];
+        [self.runningOperations addObject:operation];
+        [self.operationQueue addOperation:operation];
+    }
+}
+
+@end
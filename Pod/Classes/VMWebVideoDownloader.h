@@ -21,7 +21,15 @@
 #import "VMWebVideoCompat.h"
 
 typedef NS_OPTIONS(NSUInteger, VMWebVideoDownloaderOptions) {
+    /**
+     * Schedule the download with `VMWebVideoDownloadPriorityPrefetch`.
+     */
     VMWebVideoDownloaderLowPriority = 1 << 0,
+    
+    /**
+     * Deliver the partial file as soon as `progressiveThreshold` leading bytes are on disk, with `finished` set to NO.
+     * `+[VMWebVideoProgressiveFile progressiveFileForURL:]` then tells how much of it can be read.
+     */
     VMWebVideoDownloaderProgressiveDownload = 1 << 1,
     
     /**
@@ -56,9 +64,15 @@ typedef NS_OPTIONS(NSUInteger, VMWebVideoDownloaderOptions) {
     VMWebVideoDownloaderAllowInvalidSSLCertificates = 1 << 6,
     
     /**
-     * Put the image in the high priority queue.
+     * Schedule the download with `VMWebVideoDownloadPriorityVisible`.
      */
     VMWebVideoDownloaderHighPriority = 1 << 7,
+    
+    /**
+     * Fetch large videos with several concurrent range requests, each written at its offset in the file.
+     * Falls back to a single connection if the server doesn't support ranges or a segment fails.
+     */
+    VMWebVideoDownloaderSegmentedDownload = 1 << 8,
 };
 
 typedef NS_ENUM(NSInteger, VMWebVideoDownloaderExecutionOrder) {
@@ -80,6 +94,10 @@ typedef void(^VMWebVideoDownloaderProgressBlock)(NSInteger receivedSize, NSInteg
 
 typedef void(^VMWebVideoDownloaderCompletedBlock)(NSData *videoData, NSError *error, BOOL finished);
 
+typedef void(^VMWebVideoDownloaderFileCompletedBlock)(NSURL *videoFileURL, NSError *error, BOOL finished);
+
+typedef void(^VMWebVideoDownloaderConditionalCompletedBlock)(NSURL *videoFileURL, NSDictionary *validators, NSError *error, BOOL finished);
+
 typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDictionary *headers);
 
 /**
@@ -89,6 +107,12 @@ typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDi
 
 @property (assign, nonatomic) NSInteger maxConcurrentDownloads;
 
+/**
+ * Adjust the number of concurrent downloads to the network, AIMD style, from the throughput and time-to-first-byte
+ * of the running downloads. `maxConcurrentDownloads` is then the upper bound. Default: NO.
+ */
+@property (assign, nonatomic) BOOL adaptiveConcurrency;
+
 /**
  * Shows the current amount of downloads that still need to be downloaded
  */
@@ -101,17 +125,38 @@ typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDi
  */
 @property (assign, nonatomic) NSTimeInterval downloadTimeout;
 
+/**
+ * Directory that downloads are streamed into while they are received. Defaults to `NSTemporaryDirectory()`.
+ *
+ * Set this to a directory on the same volume as the final destination (e.g. `-[VMVideoCache temporaryDirectoryPath]`)
+ * so that finished downloads can be moved into place with a rename.
+ *
+ * Downloads that fail, time out or are cancelled are kept in this directory along with their ETag/Last-Modified
+ * validators. The next request for the same URL resumes them with a `Range`/`If-Range` request.
+ */
+@property (strong, nonatomic) NSString *temporaryDirectoryPath;
+
+/**
+ * The maximum number of concurrent range requests for one video downloaded with `VMWebVideoDownloaderSegmentedDownload`. Default: 4.
+ */
+@property (assign, nonatomic) NSUInteger maxSegmentsPerDownload;
 
 /**
- * ----------- FOR FUTURE USE --------------
+ * The smallest byte range that gets its own request with `VMWebVideoDownloaderSegmentedDownload`. Default: 1 MB.
  */
+@property (assign, nonatomic) long long minimumSegmentSize;
+
 /**
- * Changes download operations execution order. Default value is `SDWebImageDownloaderFIFOExecutionOrder`.
+ * The number of leading bytes a download with `VMWebVideoDownloaderProgressiveDownload` needs on disk before it is
+ * delivered with `finished` set to NO. Default: 256 KB.
  */
-@property (assign, nonatomic) VMWebVideoDownloaderExecutionOrder executionOrder;
+@property (assign, nonatomic) long long progressiveThreshold;
+
+
 /**
- * -------------------------------------------------------
+ * Changes the execution order of download operations within a priority class. Default value is `VMWebVideoDownloaderFIFOExecutionOrder`.
  */
+@property (assign, nonatomic) VMWebVideoDownloaderExecutionOrder executionOrder;
 
 
 /**
@@ -121,6 +166,16 @@ typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDi
  */
 + (VMWebVideoDownloader *)sharedDownloader;
 
+/**
+ * Creates a downloader whose downloads share one `NSURLSession` made from the given configuration.
+ * The requests pool and reuse their keep-alive connections, within `HTTPMaximumConnectionsPerHost`.
+ *
+ * `-init` uses the default session configuration.
+ *
+ * @param sessionConfiguration The configuration of the session. `timeoutIntervalForRequest` is set to `downloadTimeout`.
+ */
+- (id)initWithSessionConfiguration:(NSURLSessionConfiguration *)sessionConfiguration;
+
 /**
  * Set username
  */
@@ -164,6 +219,12 @@ typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDi
  */
 - (void)setOperationClass:(Class)operationClass;
 
+/**
+ * Returns the file the video at the given URL is downloaded to, in `temporaryDirectoryPath`.
+ * While a progressive download is running, `+[VMWebVideoProgressiveFile progressiveFileForURL:]` finds it with this URL.
+ */
+- (NSURL *)temporaryFileURLForURL:(NSURL *)url;
+
 
 
 /**
@@ -181,17 +242,112 @@ typedef NSDictionary *(^VMWebVideoDownloaderHeadersFilterBlock)(NSURL *url, NSDi
  *                       error parameter is set with the error. The last parameter is always YES
  *                       if VMWebVideoDownloaderProgressiveDownload isn't use. With the
  *                       VMWebVideoDownloaderProgressiveDownload option, this block is called
- *                       repeatedly with the partial image object and the finished argument set to NO
- *                       before to be called a last time with the full image and finished argument
- *                       set to YES. In case of error, the finished argument is always YES.
+ *                       once with the leading `progressiveThreshold` bytes of the video and the finished
+ *                       argument set to NO before to be called a last time with the full video and finished
+ *                       argument set to YES. In case of error, the finished argument is always YES.
  *
- * @return A cancellable VMWebVideoOperation
+ * @return A cancellable VMWebVideoOperation standing for this request. Cancelling it only drops this request's blocks,
+ *         the download itself stops once no request for the URL remains.
  */
 - (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
                                          options:(VMWebVideoDownloaderOptions)options
                                         progress:(VMWebVideoDownloaderProgressBlock)progressBlock
                                        completed:(VMWebVideoDownloaderCompletedBlock)completedBlock;
 
+/**
+ * Creates a VMWebVideoDownloader async downloader instance with a given URL that delivers the downloaded file
+ * instead of its contents.
+ *
+ * The video is streamed into `temporaryDirectoryPath` as it arrives, so memory use stays constant regardless of
+ * the size of the video. Simultaneous requests for the same URL share a single download with the requests made
+ * through `downloadVideoWithURL:options:progress:completed:`.
+ *
+ * @param url            The URL to the video to download
+ * @param options        The options to be used for this download
+ * @param progressBlock  A block called repeatedly while the video is downloading
+ * @param completedBlock A block called once the download is completed.
+ *                       If the download succeeded, the videoFileURL parameter is set, in case of error,
+ *                       error parameter is set with the error.
+ *                       @note the file is deleted once the completed block returns. Move it (e.g. with
+ *                       `-[VMVideoCache storeVideoFileToDisk:forKey:]`) from within the block to keep it.
+ *
+ * @return A cancellable VMWebVideoOperation standing for this request. Cancelling it only drops this request's blocks,
+ *         the download itself stops once no request for the URL remains.
+ */
+- (id <VMWebVideoOperation>)downloadVideoToFileWithURL:(NSURL *)url
+                                               options:(VMWebVideoDownloaderOptions)options
+                                              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                             completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock;
+
+/**
+ * Same as `downloadVideoToFileWithURL:options:progress:completed:`, but only downloads the video if it changed since
+ * the version described by `validators`, with `If-None-Match` and `If-Modified-Since` requests.
+ *
+ * The validators of a downloaded video are saved next to its file, with the `plist` extension, for
+ * `-[VMVideoCache storeVideoFileToDisk:forKey:]` to pick up.
+ *
+ * A conditional download is never shared: it doesn't join a running download of the URL, which would not send the
+ * validators, and other requests don't join it.
+ *
+ * @param validators     The `ETag` and `Last-Modified` headers of the version we have, as returned by
+ *                       `-[VMVideoCache validatorsForKey:]`. May be nil, then the video is always downloaded.
+ * @param completedBlock A block called once the download is completed, with the validators of the response.
+ *                       If the video didn't change, it is called with a nil file URL and no error, and the validators
+ *                       of the 304 response are to be merged into the stored ones with
+ *                       `-[VMVideoCache refreshVideoForKey:validators:]`.
+ *
+ * @return A cancellable VMWebVideoOperation
+ */
+- (id <VMWebVideoOperation>)downloadVideoToFileWithURL:(NSURL *)url
+                                               options:(VMWebVideoDownloaderOptions)options
+                                            validators:(NSDictionary *)validators
+                                              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                             completed:(VMWebVideoDownloaderConditionalCompletedBlock)completedBlock;
+
+/**
+ * Downloads the first `length` bytes of the video at the given URL, with a `Range` request.
+ *
+ * The prefix is kept in `temporaryDirectoryPath` as a partial download, which a later download of the whole video resumes
+ * instead of fetching those bytes again. The completed block is then called with a nil file URL. If the video is no longer
+ * than the prefix, the completed block gets the downloaded file like `downloadVideoToFileWithURL:` would.
+ *
+ * A download of the whole video requested while the prefix download runs turns it into a full download, unless the
+ * prefix is already being handed to the completed block, then the whole video gets a download of its own.
+ *
+ * @param url            The URL to the video to download
+ * @param length         The number of leading bytes to download
+ * @param options        The options to be used for this download
+ * @param progressBlock  A block called repeatedly while the prefix is downloading
+ * @param completedBlock A block called once the prefix is on disk
+ *
+ * @return A cancellable VMWebVideoOperation standing for this request, see `downloadVideoWithURL:options:progress:completed:`
+ */
+- (id <VMWebVideoOperation>)downloadVideoPrefixWithURL:(NSURL *)url
+                                                length:(long long)length
+                                               options:(VMWebVideoDownloaderOptions)options
+                                              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                             completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock;
+
+/**
+ * Moves the download of the given URL to another priority class, whether it is still waiting or already running.
+ *
+ * Downloads are scheduled by priority class: visible first, then near-visible, then prefetch.
+ * Prefetches don't start while a visible download is running or waiting, and never take the last free slot.
+ */
+- (void)setPriority:(VMWebVideoDownloadPriority)priority forURL:(NSURL *)url;
+
+/**
+ * Pauses or resumes the download of the given URL. A paused download keeps what it downloaded and its slot in the queue.
+ */
+- (void)setSuspended:(BOOL)suspended forURL:(NSURL *)url;
+
+/**
+ * Adds options to the download of the given URL, e.g. `VMWebVideoDownloaderProgressiveDownload` for a request that
+ * wants to play the video while an earlier request for it is still downloading.
+ * See `-[VMWebVideoDownloaderOperation addOptions:]` for when each option takes effect.
+ */
+- (void)addOptions:(VMWebVideoDownloaderOptions)options forURL:(NSURL *)url;
+
 /**
  * Sets the download queue suspension state
  */
@@ -9,25 +9,94 @@
 #import "VMWebVideoDownloader.h"
 
 #import "VMWebVideoDownloaderOperation.h"
+#import "VMWebVideoWeakProxy.h"
+#import "VMWebVideoDownloadScheduler.h"
+#import "VMWebVideoProgressiveFile.h"
+#import "VMWebVideoMetrics.h"
 
 NSString *const VMWebVideoDownloadStartNotification = @"VMWebVideoDownloadStartNotification";
 NSString *const VMWebVideoDownloadStopNotification = @"VMWebVideoDownloadStopNotification";
 
 static NSString *const kProgressCallbackKey = @"progress";
 static NSString *const kCompletedCallbackKey = @"completed";
+static NSString *const kFileCompletedCallbackKey = @"fileCompleted";
+static NSString *const kPriorityCallbackKey = @"priority";
+static NSString *const kSuspendedCallbackKey = @"suspended";
 
-@interface VMWebVideoDownloader ()
+@class VMWebVideoDownloadToken;
+
+@interface VMWebVideoDownloader () <NSURLSessionTaskDelegate, NSURLSessionDataDelegate, VMWebVideoDownloaderOperationTaskObserver>
 
 @property (strong, nonatomic) NSOperationQueue *downloadQueue;
-@property (weak, nonatomic) NSOperation *lastAddedOperation;
+// All downloads share the session and its connection pool, the callbacks of their tasks are forwarded to the operations
+@property (strong, nonatomic) NSURLSession *session;
+// Decides when the operations are added to the downloadQueue, which doesn't limit them itself
+@property (strong, nonatomic) VMWebVideoDownloadScheduler *scheduler;
 @property (assign, nonatomic) Class operationClass;
 @property (strong, nonatomic) NSMutableDictionary *URLCallbacks;
+@property (strong, nonatomic) NSMutableDictionary *URLOperations;
+// The operation of every running task in the session, by task identity. Several operations may fetch the same URL,
+// e.g. a conditional download next to the shared one, and segments fetch ranges of it.
+@property (strong, nonatomic) NSMapTable *taskOperations;
 @property (strong, nonatomic) NSMutableDictionary *HTTPHeaders;
 // This queue is used to serialize the handling of the network responses of all the download operation in a single queue
 @property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t barrierQueue;
 
+- (void)cancelToken:(VMWebVideoDownloadToken *)token;
+- (void)setPriority:(VMWebVideoDownloadPriority)priority ofToken:(VMWebVideoDownloadToken *)token;
+- (void)setSuspended:(BOOL)suspended ofToken:(VMWebVideoDownloadToken *)token;
+
+@end
+
+/**
+ * What a request for a shared download gets back. Cancelling it only drops the callbacks of the request, the download
+ * itself is cancelled once no request is waiting for it. The download runs at the highest priority of its requests,
+ * and is paused while all of them are.
+ */
+@interface VMWebVideoDownloadToken : NSObject <VMWebVideoOperation>
+
+@property (weak, nonatomic) VMWebVideoDownloader *downloader;
+@property (strong, nonatomic) NSURL *url;
+@property (strong, nonatomic) VMWebVideoDownloaderOperation *operation;
+// The callbacks of the request, and the callbacks of all the requests for the download, guarded by the barrierQueue.
+// The callbacks are replaced rather than mutated, the snapshots handed to the blocks of the download share them.
+@property (strong, nonatomic) NSDictionary *callbacks;
+@property (strong, nonatomic) NSMutableArray *callbacksOfOperation;
+
+@end
+
+@implementation VMWebVideoDownloadToken
+
+- (void)cancel {
+    [self.downloader cancelToken:self];
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority {
+    [self.downloader setPriority:priority ofToken:self];
+}
+
+- (void)setSuspended:(BOOL)suspended {
+    [self.downloader setSuspended:suspended ofToken:self];
+}
+
+- (void)addOptions:(VMWebVideoDownloaderOptions)options {
+    if ([self.operation respondsToSelector:@selector(addOptions:)]) {
+        [self.operation addOptions:options];
+    }
+}
+
 @end
 
+static VMWebVideoDownloadPriority VMWebVideoDownloadPriorityForOptions(VMWebVideoDownloaderOptions options) {
+    if (options & VMWebVideoDownloaderHighPriority) {
+        return VMWebVideoDownloadPriorityVisible;
+    }
+    if (options & VMWebVideoDownloaderLowPriority) {
+        return VMWebVideoDownloadPriorityPrefetch;
+    }
+    return VMWebVideoDownloadPriorityNearVisible;
+}
+
 @implementation VMWebVideoDownloader
 
 + (void)initialize {
@@ -63,20 +132,42 @@ static NSString *const kCompletedCallbackKey = @"completed";
 }
 
 - (id)init {
+    return [self initWithSessionConfiguration:[NSURLSessionConfiguration defaultSessionConfiguration]];
+}
+
+- (id)initWithSessionConfiguration:(NSURLSessionConfiguration *)sessionConfiguration {
     if ((self = [super init])) {
         _operationClass = [VMWebVideoDownloaderOperation class];
         _executionOrder = VMWebVideoDownloaderFIFOExecutionOrder;
         _downloadQueue = [NSOperationQueue new];
-        _downloadQueue.maxConcurrentOperationCount = 6;
+        _scheduler = [[VMWebVideoDownloadScheduler alloc] initWithOperationQueue:_downloadQueue];
+        _scheduler.maxConcurrentDownloads = 6;
         _URLCallbacks = [NSMutableDictionary new];
+        _URLOperations = [NSMutableDictionary new];
+        _taskOperations = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality) valueOptions:NSPointerFunctionsWeakMemory];
         _HTTPHeaders = [NSMutableDictionary dictionaryWithObject:@"video/*;q=0.8" forKey:@"Accept"];
         _barrierQueue = dispatch_queue_create("com.vmlabs.VMWebVideoDownloaderBarrierQueue", DISPATCH_QUEUE_CONCURRENT);
         _downloadTimeout = 15.0;
+        _maxSegmentsPerDownload = 4;
+        _minimumSegmentSize = 1024 * 1024;
+        _progressiveThreshold = 256 * 1024;
+        
+        // Our own copy, the caller's configuration is left alone
+        NSURLSessionConfiguration *configuration = [sessionConfiguration copy];
+        configuration.timeoutIntervalForRequest = _downloadTimeout;
+        // A serial delegate queue, so the callbacks of an operation's tasks never run concurrently
+        NSOperationQueue *delegateQueue = [NSOperationQueue new];
+        delegateQueue.maxConcurrentOperationCount = 1;
+        delegateQueue.name = @"com.vmlabs.VMWebVideoDownloaderSessionDelegateQueue";
+        // The session retains its delegate until it is invalidated, which only happens in dealloc
+        _session = [NSURLSession sessionWithConfiguration:configuration delegate:[VMWebVideoWeakProxy proxyWithTarget:self] delegateQueue:delegateQueue];
     }
     return self;
 }
 
 - (void)dealloc {
+    [self.session invalidateAndCancel];
+    [self.scheduler cancelAllOperations];
     [self.downloadQueue cancelAllOperations];
     VMDispatchQueueRelease(_barrierQueue);
 }
@@ -95,15 +186,72 @@ static NSString *const kCompletedCallbackKey = @"completed";
 }
 
 - (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads {
-    _downloadQueue.maxConcurrentOperationCount = maxConcurrentDownloads;
+    _scheduler.maxConcurrentDownloads = maxConcurrentDownloads;
 }
 
 - (NSUInteger)currentDownloadCount {
-    return _downloadQueue.operationCount;
+    return _scheduler.operationCount;
 }
 
 - (NSInteger)maxConcurrentDownloads {
-    return _downloadQueue.maxConcurrentOperationCount;
+    return _scheduler.maxConcurrentDownloads;
+}
+
+- (void)setAdaptiveConcurrency:(BOOL)adaptiveConcurrency {
+    _scheduler.adaptiveConcurrency = adaptiveConcurrency;
+}
+
+- (BOOL)adaptiveConcurrency {
+    return _scheduler.adaptiveConcurrency;
+}
+
+- (void)setExecutionOrder:(VMWebVideoDownloaderExecutionOrder)executionOrder {
+    _executionOrder = executionOrder;
+    _scheduler.lastInFirstOut = (executionOrder == VMWebVideoDownloaderLIFOExecutionOrder);
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority forURL:(NSURL *)url {
+    if (!url) {
+        return;
+    }
+    
+    __block VMWebVideoDownloaderOperation *operation;
+    dispatch_sync(self.barrierQueue, ^{
+        operation = self.URLOperations[url];
+    });
+    [operation setPriority:priority];
+}
+
+- (void)setSuspended:(BOOL)suspended forURL:(NSURL *)url {
+    if (!url) {
+        return;
+    }
+    
+    __block VMWebVideoDownloaderOperation *operation;
+    dispatch_sync(self.barrierQueue, ^{
+        operation = self.URLOperations[url];
+    });
+    [operation setSuspended:suspended];
+}
+
+- (void)addOptions:(VMWebVideoDownloaderOptions)options forURL:(NSURL *)url {
+    if (!url) {
+        return;
+    }
+    
+    __block VMWebVideoDownloaderOperation *operation;
+    dispatch_sync(self.barrierQueue, ^{
+        operation = self.URLOperations[url];
+    });
+    if ([operation respondsToSelector:@selector(addOptions:)]) {
+        [operation addOptions:options];
+    }
+}
+
+- (NSURL *)temporaryFileURLForURL:(NSURL *)url {
+    NSString *temporaryDirectoryPath = self.temporaryDirectoryPath ?: NSTemporaryDirectory();
+    NSString *temporaryFileName = [VMWebVideoFileNameForKey(url.absoluteString) stringByAppendingPathExtension:@"partial"];
+    return [NSURL fileURLWithPath:[temporaryDirectoryPath stringByAppendingPathComponent:temporaryFileName]];
 }
 
 - (void)setOperationClass:(Class)operationClass {
@@ -111,121 +259,412 @@ static NSString *const kCompletedCallbackKey = @"completed";
 }
 
 - (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderCompletedBlock)completedBlock {
-    __block VMWebVideoDownloaderOperation *operation;
+    return [self downloadVideoWithURL:url options:options prefixLength:0 validators:nil progress:progressBlock completed:completedBlock fileCompleted:nil];
+}
+
+- (id <VMWebVideoOperation>)downloadVideoToFileWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock {
+    return [self downloadVideoToFileWithURL:url options:options validators:nil progress:progressBlock completed:completedBlock];
+}
+
+- (id <VMWebVideoOperation>)downloadVideoToFileWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options validators:(NSDictionary *)validators progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderConditionalCompletedBlock)completedBlock {
+    if (url && validators.count) {
+        return [self downloadChangedVideoWithURL:url options:options validators:validators progress:progressBlock completed:completedBlock];
+    }
+    return [self downloadVideoWithURL:url options:options prefixLength:0 validators:nil progress:progressBlock completed:nil fileCompleted:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        if (completedBlock) completedBlock(videoFileURL, nil, error, finished);
+    }];
+}
+
+// A conditional download is never shared with the other requests for the URL. Joining a running download would mean
+// not sending the validators, and a request that wants the video can't make do with a 304.
+- (id <VMWebVideoOperation>)downloadChangedVideoWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options validators:(NSDictionary *)validators progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderConditionalCompletedBlock)completedBlock {
+    __block __weak VMWebVideoDownloaderOperation *weakOperation;
     __weak VMWebVideoDownloader *wself = self;
     
-    [self addProgressCallback:progressBlock andCompletedBlock:completedBlock forURL:url createCallback:^{
-        NSTimeInterval timeoutInterval = wself.downloadTimeout;
-        if (timeoutInterval == 0.0) {
-            timeoutInterval = 15.0;
-        }
-        
-        // In order to prevent from potential duplicate caching (NSURLCache + Cache) we disable the cache for image requests if told otherwise
-        NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url cachePolicy:(options & VMWebVideoDownloaderUseNSURLCache ? NSURLRequestUseProtocolCachePolicy : NSURLRequestReloadIgnoringLocalCacheData) timeoutInterval:timeoutInterval];
-        request.HTTPShouldHandleCookies = (options & VMWebVideoDownloaderHandleCookies);
-        request.HTTPShouldUsePipelining = YES;
-        if (wself.headersFilter) {
-            request.allHTTPHeaderFields = wself.headersFilter(url, [wself.HTTPHeaders copy]);
-        }
-        else {
-            request.allHTTPHeaderFields = wself.HTTPHeaders;
-        }
-        operation = [[wself.operationClass alloc] initWithRequest:request
-                                                          options:options
-                                                         progress:^(NSInteger receivedSize, NSInteger expectedSize) {
-                                                             VMWebVideoDownloader *sself = wself;
-                                                             if (!sself) return;
-                                                             NSArray *callbacksForURL = [sself callbacksForURL:url];
-                                                             for (NSDictionary *callbacks in callbacksForURL) {
-                                                                 VMWebVideoDownloaderProgressBlock callback = callbacks[kProgressCallbackKey];
-                                                                 if (callback) callback(receivedSize, expectedSize);
-                                                             }
-                                                         }
-                                                        completed:^(NSData *videoData, NSError *error, BOOL finished) {
-                                                            VMWebVideoDownloader *sself = wself;
-                                                            if (!sself) return;
-                                                            NSArray *callbacksForURL = [sself callbacksForURL:url];
-                                                            if (finished) {
-                                                                [sself removeCallbacksForURL:url];
-                                                            }
-                                                            for (NSDictionary *callbacks in callbacksForURL) {
-                                                                VMWebVideoDownloaderCompletedBlock callback = callbacks[kCompletedCallbackKey];
-                                                                if (callback) callback(videoData, error, finished);
-                                                            }
-                                                        }
-                                                        cancelled:^{
-                                                            VMWebVideoDownloader *sself = wself;
-                                                            if (!sself) return;
-                                                            [sself removeCallbacksForURL:url];
-                                                        }];
-        
-        if (wself.username && wself.password) {
-            operation.credential = [NSURLCredential credentialWithUser:wself.username password:wself.password persistence:NSURLCredentialPersistenceForSession];
+    // Named apart from the shared download of the URL, which may be running at the same time
+    NSString *temporaryFileName = [NSString stringWithFormat:@"%@-%@.partial", VMWebVideoFileNameForKey(url.absoluteString), [[NSUUID UUID] UUIDString]];
+    NSURL *temporaryFileURL = [[[self temporaryFileURLForURL:url] URLByDeletingLastPathComponent] URLByAppendingPathComponent:temporaryFileName];
+    void (^removeTemporaryFile)(void) = ^{
+        // Nobody resumes a conditional download, whatever wasn't moved away goes
+        [[NSFileManager defaultManager] removeItemAtURL:temporaryFileURL error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:[temporaryFileURL URLByAppendingPathExtension:@"plist"] error:nil];
+    };
+    
+    VMWebVideoDownloaderOperation *operation = [self operationWithURL:url options:options prefixLength:0 validators:validators temporaryFileURL:temporaryFileURL progress:progressBlock completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+        if (finished) {
+            [wself.scheduler operationDidFinish:weakOperation];
         }
-        
-        if (options & VMWebVideoDownloaderHighPriority) {
-            operation.queuePriority = NSOperationQueuePriorityHigh;
-        } else if (options & VMWebVideoDownloaderLowPriority) {
-            operation.queuePriority = NSOperationQueuePriorityLow;
+        if (completedBlock) {
+            completedBlock(videoFileURL, weakOperation.responseValidators, error, finished);
         }
-        
-        [wself.downloadQueue addOperation:operation];
-        if (wself.executionOrder == VMWebVideoDownloaderLIFOExecutionOrder) {
-            // Emulate LIFO execution order by systematically adding new operations as last operation's dependency
-            [wself.lastAddedOperation addDependency:operation];
-            wself.lastAddedOperation = operation;
+        if (finished) {
+            removeTemporaryFile();
         }
+    } cancelled:^{
+        [wself.scheduler operationDidFinish:weakOperation];
+        removeTemporaryFile();
     }];
+    weakOperation = operation;
+    [self.scheduler scheduleOperation:operation withPriority:VMWebVideoDownloadPriorityForOptions(options)];
+    return operation;
+}
+
+- (VMWebVideoDownloaderOperation *)operationWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options prefixLength:(long long)prefixLength validators:(NSDictionary *)validators temporaryFileURL:(NSURL *)temporaryFileURL progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock cancelled:(VMWebVideoNoParamsBlock)cancelBlock {
+    NSTimeInterval timeoutInterval = self.downloadTimeout;
+    if (timeoutInterval == 0.0) {
+        timeoutInterval = 15.0;
+    }
+    
+    // In order to prevent from potential duplicate caching (NSURLCache + Cache) we disable the cache for image requests if told otherwise
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:url cachePolicy:(options & VMWebVideoDownloaderUseNSURLCache ? NSURLRequestUseProtocolCachePolicy : NSURLRequestReloadIgnoringLocalCacheData) timeoutInterval:timeoutInterval];
+    request.HTTPShouldHandleCookies = (options & VMWebVideoDownloaderHandleCookies);
+    request.HTTPShouldUsePipelining = YES;
+    if (self.headersFilter) {
+        request.allHTTPHeaderFields = self.headersFilter(url, [self.HTTPHeaders copy]);
+    }
+    else {
+        request.allHTTPHeaderFields = self.HTTPHeaders;
+    }
+    // Lets the server answer with a 304 instead of the video if our copy is still current
+    if (validators[@"ETag"]) {
+        [request setValue:validators[@"ETag"] forHTTPHeaderField:@"If-None-Match"];
+    }
+    if (validators[@"Last-Modified"]) {
+        [request setValue:validators[@"Last-Modified"] forHTTPHeaderField:@"If-Modified-Since"];
+    }
+    
+    [[NSFileManager defaultManager] createDirectoryAtURL:[temporaryFileURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    
+    VMWebVideoDownloaderOperation *operation = [[self.operationClass alloc] initWithRequest:request
+                                                                                  inSession:self.session
+                                                                                    options:options
+                                                                           temporaryFileURL:temporaryFileURL
+                                                                                   progress:progressBlock
+                                                                                  completed:completedBlock
+                                                                                  cancelled:cancelBlock];
+    operation.scheduler = self.scheduler;
+    operation.taskObserver = self;
+    
+    operation.maxSegmentCount = self.maxSegmentsPerDownload;
+    operation.minimumSegmentLength = self.minimumSegmentSize;
+    operation.progressiveThreshold = self.progressiveThreshold;
+    operation.prefixLength = prefixLength;
+    
+    if (self.username && self.password) {
+        operation.credential = [NSURLCredential credentialWithUser:self.username password:self.password persistence:NSURLCredentialPersistenceForSession];
+    }
     
+    if (options & VMWebVideoDownloaderHighPriority) {
+        operation.queuePriority = NSOperationQueuePriorityHigh;
+    } else if (options & VMWebVideoDownloaderLowPriority) {
+        operation.queuePriority = NSOperationQueuePriorityLow;
+    }
     return operation;
 }
 
-- (void)addProgressCallback:(VMWebVideoDownloaderProgressBlock)progressBlock andCompletedBlock:(VMWebVideoDownloaderCompletedBlock)completedBlock forURL:(NSURL *)url createCallback:(VMWebVideoNoParamsBlock)createCallback {
-    // The URL will be used as the key to the callbacks dictionary so it cannot be nil. If it is nil immediately call the completed block with no image or data.
+- (id <VMWebVideoOperation>)downloadVideoPrefixWithURL:(NSURL *)url length:(long long)length options:(VMWebVideoDownloaderOptions)options progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock {
+    return [self downloadVideoWithURL:url options:options prefixLength:MAX(length, 1LL) validators:nil progress:progressBlock completed:nil fileCompleted:completedBlock];
+}
+
+- (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options prefixLength:(long long)prefixLength validators:(NSDictionary *)validators progress:(VMWebVideoDownloaderProgressBlock)progressBlock completed:(VMWebVideoDownloaderCompletedBlock)completedBlock fileCompleted:(VMWebVideoDownloaderFileCompletedBlock)fileCompletedBlock {
+    // The URL will be used as the key to the shared downloads so it cannot be nil. If it is nil immediately call the completed block with no image or data.
     if (url == nil) {
         if (completedBlock != nil) {
             completedBlock(nil, nil, NO);
         }
-        return;
+        if (fileCompletedBlock != nil) {
+            fileCompletedBlock(nil, nil, NO);
+        }
+        return nil;
     }
     
+    VMWebVideoDownloadPriority priority = VMWebVideoDownloadPriorityForOptions(options);
+    NSMutableDictionary *callbacks = [NSMutableDictionary new];
+    if (progressBlock) callbacks[kProgressCallbackKey] = [progressBlock copy];
+    if (completedBlock) callbacks[kCompletedCallbackKey] = [completedBlock copy];
+    if (fileCompletedBlock) callbacks[kFileCompletedCallbackKey] = [fileCompletedBlock copy];
+    callbacks[kPriorityCallbackKey] = @(priority);
+    
+    VMWebVideoDownloadToken *token = [VMWebVideoDownloadToken new];
+    token.downloader = self;
+    token.url = url;
+    token.callbacks = [callbacks copy];
+    
+    __block BOOL created = NO;
     dispatch_barrier_sync(self.barrierQueue, ^{
-        BOOL first = NO;
-        if (!self.URLCallbacks[url]) {
-            self.URLCallbacks[url] = [NSMutableArray new];
-            first = YES;
-        }
-        
         // Handle single download of simultaneous download request for the same URL
-        NSMutableArray *callbacksForURL = self.URLCallbacks[url];
-        NSMutableDictionary *callbacks = [NSMutableDictionary new];
-        if (progressBlock) callbacks[kProgressCallbackKey] = [progressBlock copy];
-        if (completedBlock) callbacks[kCompletedCallbackKey] = [completedBlock copy];
-        [callbacksForURL addObject:callbacks];
-        self.URLCallbacks[url] = callbacksForURL;
-        
-        if (first) {
-            createCallback();
+        VMWebVideoDownloaderOperation *operation = self.URLOperations[url];
+        NSMutableArray *callbacksOfOperation = self.URLCallbacks[url];
+        if (operation && prefixLength == 0 && [operation respondsToSelector:@selector(extendToFullVideo)] && ![operation extendToFullVideo]) {
+            // The running download is handing out its prefix, the whole video needs a download of its own.
+            // The prefix download keeps its subscribers, its blocks don't look them up by URL.
+            operation = nil;
+        }
+        if (!operation) {
+            callbacksOfOperation = [NSMutableArray new];
+            operation = [self sharedOperationWithURL:url options:options prefixLength:prefixLength validators:validators callbacks:callbacksOfOperation];
+            self.URLCallbacks[url] = callbacksOfOperation;
+            self.URLOperations[url] = operation;
+            [self.scheduler scheduleOperation:operation withPriority:priority];
+            created = YES;
         }
+        [callbacksOfOperation addObject:token.callbacks];
+        token.operation = operation;
+        token.callbacksOfOperation = callbacksOfOperation;
     });
+    
+    if (!created) {
+        VMWebVideoMetricsCount(VMWebVideoMetricsCounterDownloadJoins, 1);
+        // Joining a download that was started with a lower priority
+        [self updatePriorityOfToken:token];
+        if ((options & (VMWebVideoDownloaderProgressiveDownload | VMWebVideoDownloaderSegmentedDownload)) && [token.operation respondsToSelector:@selector(addOptions:)]) {
+            // The running download may have been started without them
+            [token.operation addOptions:(options & (VMWebVideoDownloaderProgressiveDownload | VMWebVideoDownloaderSegmentedDownload))];
+        }
+    }
+    return token;
 }
 
-- (NSArray *)callbacksForURL:(NSURL *)url {
-    __block NSArray *callbacksForURL;
-    dispatch_sync(self.barrierQueue, ^{
-        callbacksForURL = self.URLCallbacks[url];
+// Every request for the download gets its callbacks called from callbacksOfOperation, which is captured here
+// rather than looked up by URL: a finishing download and its successor may briefly exist side by side.
+- (VMWebVideoDownloaderOperation *)sharedOperationWithURL:(NSURL *)url options:(VMWebVideoDownloaderOptions)options prefixLength:(long long)prefixLength validators:(NSDictionary *)validators callbacks:(NSMutableArray *)callbacksOfOperation {
+    __block __weak VMWebVideoDownloaderOperation *weakOperation;
+    __weak VMWebVideoDownloader *wself = self;
+    
+    // The file name is derived from the URL so that an interrupted download can be picked up by the next request
+    VMWebVideoDownloaderOperation *operation = [self operationWithURL:url
+                                                              options:options
+                                                         prefixLength:prefixLength
+                                                           validators:validators
+                                                     temporaryFileURL:[self temporaryFileURLForURL:url]
+                                                             progress:^(NSInteger receivedSize, NSInteger expectedSize) {
+                                                                 VMWebVideoDownloader *sself = wself;
+                                                                 if (!sself) return;
+                                                                 for (NSDictionary *callbacks in [sself callbacks:callbacksOfOperation ofOperation:weakOperation forURL:url finished:NO]) {
+                                                                     VMWebVideoDownloaderProgressBlock callback = callbacks[kProgressCallbackKey];
+                                                                     if (callback) callback(receivedSize, expectedSize);
+                                                                 }
+                                                             }
+                                                            completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+                                                                VMWebVideoDownloader *sself = wself;
+                                                                if (!sself) return;
+                                                                NSArray *callbacks = [sself callbacks:callbacksOfOperation ofOperation:weakOperation forURL:url finished:finished];
+                                                                if (finished) {
+                                                                    [sself.scheduler operationDidFinish:weakOperation];
+                                                                }
+                                                                [sself callCompletedBlocks:callbacks withFileURL:videoFileURL error:error finished:finished];
+                                                            }
+                                                            cancelled:^{
+                                                                VMWebVideoDownloader *sself = wself;
+                                                                if (!sself) return;
+                                                                // Not waited for: the operation may be cancelled under its own lock, which a join waits
+                                                                // for inside the barrier when it extends the download
+                                                                VMWebVideoDownloaderOperation *operation = weakOperation;
+                                                                dispatch_barrier_async(sself.barrierQueue, ^{
+                                                                    [sself removeCallbacks:callbacksOfOperation ofOperation:operation forURL:url];
+                                                                });
+                                                                [sself.scheduler operationDidFinish:operation];
+                                                            }];
+    weakOperation = operation;
+    return operation;
+}
+
+- (void)callCompletedBlocks:(NSArray *)callbacksForURL withFileURL:(NSURL *)videoFileURL error:(NSError *)error finished:(BOOL)finished {
+    // Subscribers that want the data are served first, before a file subscriber gets the chance to move the file away.
+    // The data is mapped rather than read so that it doesn't cost a full copy of the video in memory.
+    NSData *videoData = nil;
+    for (NSDictionary *callbacks in callbacksForURL) {
+        VMWebVideoDownloaderCompletedBlock callback = callbacks[kCompletedCallbackKey];
+        if (!callback) continue;
+        if (!videoData && videoFileURL && finished) {
+            videoData = [NSData dataWithContentsOfURL:videoFileURL options:NSDataReadingMappedIfSafe error:nil];
+        }
+        else if (!videoData && videoFileURL) {
+            // A partial file may be preallocated or truncated if the download fails, only its available prefix is copied
+            NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingFromURL:videoFileURL error:nil];
+            long long availableLength = [VMWebVideoProgressiveFile progressiveFileForURL:videoFileURL].availableLength;
+            videoData = [fileHandle readDataOfLength:(NSUInteger)availableLength];
+            [fileHandle closeFile];
+        }
+        callback(videoData, error, finished);
+    }
+    
+    for (NSDictionary *callbacks in callbacksForURL) {
+        VMWebVideoDownloaderFileCompletedBlock callback = callbacks[kFileCompletedCallbackKey];
+        if (callback) callback(videoFileURL, error, finished);
+    }
+    
+    // Anything that wasn't moved away by a subscriber is no longer needed
+    if (finished && videoFileURL) {
+        [[NSFileManager defaultManager] removeItemAtURL:videoFileURL error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:[videoFileURL URLByAppendingPathExtension:@"plist"] error:nil];
+    }
+}
+
+// A snapshot of the callbacks of a download. A finished download is no longer shared under its URL, and lets go of
+// its callbacks, which may hold on to whoever holds its token.
+- (NSArray *)callbacks:(NSMutableArray *)callbacksOfOperation ofOperation:(NSOperation *)operation forURL:(NSURL *)url finished:(BOOL)finished {
+    __block NSArray *callbacks;
+    if (!finished) {
+        dispatch_sync(self.barrierQueue, ^{
+            callbacks = [callbacksOfOperation copy];
+        });
+        return callbacks;
+    }
+    
+    dispatch_barrier_sync(self.barrierQueue, ^{
+        callbacks = [callbacksOfOperation copy];
+        [self removeCallbacks:callbacksOfOperation ofOperation:operation forURL:url];
     });
-    return [callbacksForURL copy];
+    return callbacks;
 }
 
-- (void)removeCallbacksForURL:(NSURL *)url {
-    dispatch_barrier_async(self.barrierQueue, ^{
+// Only called in a barrier block of the barrierQueue
+- (void)removeCallbacks:(NSMutableArray *)callbacksOfOperation ofOperation:(NSOperation *)operation forURL:(NSURL *)url {
+    [callbacksOfOperation removeAllObjects];
+    if (operation && self.URLOperations[url] == operation) {
         [self.URLCallbacks removeObjectForKey:url];
+        [self.URLOperations removeObjectForKey:url];
+    }
+}
+
+- (void)cancelToken:(VMWebVideoDownloadToken *)token {
+    __block BOOL abandoned = NO;
+    dispatch_barrier_sync(self.barrierQueue, ^{
+        NSMutableArray *callbacksOfOperation = token.callbacksOfOperation;
+        if ([callbacksOfOperation indexOfObjectIdenticalTo:token.callbacks] == NSNotFound) {
+            return;
+        }
+        [callbacksOfOperation removeObjectIdenticalTo:token.callbacks];
+        abandoned = (callbacksOfOperation.count == 0);
+        if (abandoned && self.URLOperations[token.url] == token.operation) {
+            // A request arriving from now on starts a download of its own
+            [self.URLCallbacks removeObjectForKey:token.url];
+            [self.URLOperations removeObjectForKey:token.url];
+        }
     });
+    
+    // The download goes on as long as another request is waiting for it
+    if (abandoned) {
+        [token.operation cancel];
+    }
+}
+
+// The download runs at the highest priority of the requests waiting for it
+- (void)updatePriorityOfToken:(VMWebVideoDownloadToken *)token {
+    __block VMWebVideoDownloadPriority priority = VMWebVideoDownloadPriorityPrefetch;
+    __block BOOL waiting = NO;
+    dispatch_sync(self.barrierQueue, ^{
+        for (NSDictionary *callbacks in token.callbacksOfOperation) {
+            priority = MAX(priority, (VMWebVideoDownloadPriority)[callbacks[kPriorityCallbackKey] integerValue]);
+            waiting = YES;
+        }
+    });
+    if (waiting) {
+        [token.operation setPriority:priority];
+    }
+}
+
+// Only called in a barrier block of the barrierQueue
+- (void)setCallbackValue:(id)value forKey:(NSString *)key ofToken:(VMWebVideoDownloadToken *)token {
+    NSMutableDictionary *callbacks = [token.callbacks mutableCopy];
+    callbacks[key] = value;
+    NSUInteger index = [token.callbacksOfOperation indexOfObjectIdenticalTo:token.callbacks];
+    token.callbacks = [callbacks copy];
+    if (index != NSNotFound) {
+        [token.callbacksOfOperation replaceObjectAtIndex:index withObject:token.callbacks];
+    }
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority ofToken:(VMWebVideoDownloadToken *)token {
+    dispatch_barrier_sync(self.barrierQueue, ^{
+        [self setCallbackValue:@(priority) forKey:kPriorityCallbackKey ofToken:token];
+    });
+    [self updatePriorityOfToken:token];
+}
+
+// The download is paused while all the requests waiting for it are
+- (void)setSuspended:(BOOL)suspended ofToken:(VMWebVideoDownloadToken *)token {
+    __block BOOL allSuspended = YES;
+    __block BOOL waiting = NO;
+    dispatch_barrier_sync(self.barrierQueue, ^{
+        [self setCallbackValue:@(suspended) forKey:kSuspendedCallbackKey ofToken:token];
+        for (NSDictionary *callbacks in token.callbacksOfOperation) {
+            allSuspended = allSuspended && [callbacks[kSuspendedCallbackKey] boolValue];
+            waiting = YES;
+        }
+    });
+    if (waiting) {
+        [token.operation setSuspended:allSuspended];
+    }
 }
 
 - (void)setSuspended:(BOOL)suspended {
+    [self.scheduler setSuspended:suspended];
     [self.downloadQueue setSuspended:suspended];
 }
 
+#pragma mark Helper methods
+
+- (VMWebVideoDownloaderOperation *)operationWithTask:(NSURLSessionTask *)task {
+    __block VMWebVideoDownloaderOperation *operation;
+    dispatch_sync(self.barrierQueue, ^{
+        operation = [self.taskOperations objectForKey:task];
+    });
+    return operation;
+}
+
+- (void)operation:(VMWebVideoDownloaderOperation *)operation didCreateTask:(NSURLSessionTask *)task {
+    // Queued before the task is resumed, so it is in the table by the time the first callback looks it up
+    dispatch_barrier_async(self.barrierQueue, ^{
+        [self.taskOperations setObject:operation forKey:task];
+    });
+}
+
+#pragma mark NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler {
+    VMWebVideoDownloaderOperation *operation = [self operationWithTask:dataTask];
+    if (operation) {
+        [operation URLSession:session dataTask:dataTask didReceiveResponse:response completionHandler:completionHandler];
+    }
+    else if (completionHandler) {
+        completionHandler(NSURLSessionResponseCancel);
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    [[self operationWithTask:dataTask] URLSession:session dataTask:dataTask didReceiveData:data];
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask willCacheResponse:(NSCachedURLResponse *)proposedResponse completionHandler:(void (^)(NSCachedURLResponse *cachedResponse))completionHandler {
+    VMWebVideoDownloaderOperation *operation = [self operationWithTask:dataTask];
+    if (operation) {
+        [operation URLSession:session dataTask:dataTask willCacheResponse:proposedResponse completionHandler:completionHandler];
+    }
+    else if (completionHandler) {
+        completionHandler(proposedResponse);
+    }
+}
+
+#pragma mark NSURLSessionTaskDelegate
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+    [[self operationWithTask:task] URLSession:session task:task didCompleteWithError:error];
+    // The last callback of the task
+    dispatch_barrier_async(self.barrierQueue, ^{
+        [self.taskOperations removeObjectForKey:task];
+    });
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition disposition, NSURLCredential *credential))completionHandler {
+    VMWebVideoDownloaderOperation *operation = [self operationWithTask:task];
+    if (operation) {
+        [operation URLSession:session task:task didReceiveChallenge:challenge completionHandler:completionHandler];
+    }
+    else if (completionHandler) {
+        completionHandler(NSURLSessionAuthChallengePerformDefaultHandling, nil);
+    }
+}
+
 @end
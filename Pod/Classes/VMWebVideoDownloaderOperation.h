@@ -10,23 +10,34 @@
 #import "VMWebVideoOperation.h"
 #import "VMWebVideoDownloader.h"
 
-@interface VMWebVideoDownloaderOperation : NSOperation <VMWebVideoOperation>
+@class VMWebVideoDownloadScheduler;
+@class VMWebVideoDownloaderOperation;
 
 /**
- * The request used by the operation's connection.
+ * Told about the tasks an operation creates in a shared session, so that the session's delegate can forward the
+ * callbacks of each task to the operation that owns it.
+ */
+@protocol VMWebVideoDownloaderOperationTaskObserver <NSObject>
+
+- (void)operation:(VMWebVideoDownloaderOperation *)operation didCreateTask:(NSURLSessionTask *)task;
+
+@end
+
+@interface VMWebVideoDownloaderOperation : NSOperation <VMWebVideoOperation, NSURLSessionTaskDelegate, NSURLSessionDataDelegate>
+
+/**
+ * The request used by the operation's task.
  */
 @property (strong, nonatomic, readonly) NSURLRequest *request;
 
 
 /**
- * Whether the URL connection should consult the credential storage for authenticating the connection. `YES` by default.
- *
- * This is the value that is returned in the `NSURLConnectionDelegate` method `-connectionShouldUseCredentialStorage:`.
+ * Whether the credential storage should be consulted for authentication challenges that `credential` doesn't answer. `YES` by default.
  */
 @property (nonatomic, assign) BOOL shouldUseCredentialStorage;
 
 /**
- * The credential used for authentication challenges in `-connection:didReceiveAuthenticationChallenge:`.
+ * The credential used for authentication challenges in `-URLSession:task:didReceiveChallenge:completionHandler:`.
  *
  * This will be overridden by any shared credentials that exist for the username or password of the request URL, if present.
  */
@@ -37,6 +48,67 @@
  */
 @property (assign, nonatomic, readonly) VMWebVideoDownloaderOptions options;
 
+/**
+ * The `ETag` and `Last-Modified` headers of the response, keyed by header name, once it arrived.
+ * After a 304 Not Modified they are the validators of the cached version from then on.
+ */
+@property (strong, atomic, readonly) NSDictionary *responseValidators;
+
+/**
+ * The file the response body is streamed into.
+ */
+@property (strong, nonatomic, readonly) NSURL *temporaryFileURL;
+
+/**
+ * With `VMWebVideoDownloaderSegmentedDownload`, the maximum number of concurrent range requests used for the video. Default: 4.
+ */
+@property (assign, nonatomic) NSUInteger maxSegmentCount;
+
+/**
+ * With `VMWebVideoDownloaderSegmentedDownload`, the smallest range worth its own request, in bytes. Default: 1 MB.
+ */
+@property (assign, nonatomic) long long minimumSegmentLength;
+
+/**
+ * With `VMWebVideoDownloaderProgressiveDownload`, the number of leading bytes that have to be on disk before the
+ * completed block is called with the partial file and `finished` set to NO. Default: 256 KB.
+ *
+ * From then on, `+[VMWebVideoProgressiveFile progressiveFileForURL:]` tells how much of the file is available.
+ */
+@property (assign, nonatomic) long long progressiveThreshold;
+
+/**
+ * When greater than 0, only the first `prefixLength` bytes of the video are downloaded, with a `Range` request.
+ * The prefix is kept as a resumable partial download in the directory of `temporaryFileURL`, and the completed block
+ * is called with a nil file URL. A later download of the whole video resumes after the prefix.
+ * If the video turns out to be shorter than the prefix, it is delivered like any finished download. Default: 0.
+ */
+@property (assign, nonatomic) long long prefixLength;
+
+/**
+ * Turns a prefix download into a download of the whole video, e.g. because a request for the whole video joined it.
+ *
+ * @return NO if the prefix download is already finishing, the whole video then needs a download of its own
+ */
+- (BOOL)extendToFullVideo;
+
+/**
+ * Adds the options of a request that joined the download. `VMWebVideoDownloaderProgressiveDownload` takes effect
+ * at any time before the download finishes; `VMWebVideoDownloaderSegmentedDownload` only until the response arrives,
+ * a download that is already streaming isn't split anymore.
+ */
+- (void)addOptions:(VMWebVideoDownloaderOptions)options;
+
+/**
+ * The scheduler that runs the operation, if any. `setPriority:` and `setSuspended:` are forwarded to it.
+ */
+@property (weak, nonatomic) VMWebVideoDownloadScheduler *scheduler;
+
+/**
+ * Told about every task of the operation before it is resumed, typically the delegate of the shared session.
+ */
+@property (weak, nonatomic) id <VMWebVideoDownloaderOperationTaskObserver> taskObserver;
+
 /**
  *  Initializes a `VMWebVideoDownloaderOperation` object
  *
@@ -44,9 +116,10 @@
  *
  *  @param request        the URL request
  *  @param options        downloader options
+ *  @param fileURL        the file the response body is written to as it arrives
  *  @param progressBlock  the block executed when a new chunk of data arrives.
  *                        @note the progress block is executed on a background queue
- *  @param completedBlock the block executed when the download is done.
+ *  @param completedBlock the block executed when the download is done, with the URL of the downloaded file.
  *                        @note the completed block is executed on the main queue for success. If errors are found, there is a chance the block will be executed on a background queue
  *  @param cancelBlock    the block executed if the download (operation) is cancelled
  *
@@ -54,8 +127,34 @@
  */
 - (id)initWithRequest:(NSURLRequest *)request
               options:(VMWebVideoDownloaderOptions)options
+     temporaryFileURL:(NSURL *)fileURL
+             progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+            completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock
+            cancelled:(VMWebVideoNoParamsBlock)cancelBlock;
+
+/**
+ *  Initializes a `VMWebVideoDownloaderOperation` object whose tasks run in a shared session
+ *
+ *  The session's delegate must forward the task and data task callbacks of the operation's tasks to the operation.
+ *  Pass `nil` to have the operation create a session of its own, with the operation as delegate.
+ *
+ *  @param request        the URL request
+ *  @param session        the session the tasks are created in. It is not retained by the operation
+ *  @param options        downloader options
+ *  @param fileURL        the file the response body is written to as it arrives
+ *  @param progressBlock  the block executed when a new chunk of data arrives.
+ *                        @note the progress block is executed on the session's delegate queue
+ *  @param completedBlock the block executed when the download is done, with the URL of the downloaded file.
+ *  @param cancelBlock    the block executed if the download (operation) is cancelled
+ *
+ *  @return the initialized instance
+ */
+- (id)initWithRequest:(NSURLRequest *)request
+            inSession:(NSURLSession *)session
+              options:(VMWebVideoDownloaderOptions)options
+     temporaryFileURL:(NSURL *)fileURL
              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
-            completed:(VMWebVideoDownloaderCompletedBlock)completedBlock
+            completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock
             cancelled:(VMWebVideoNoParamsBlock)cancelBlock;
 
 @end
@@ -7,20 +7,74 @@
 //
 
 #import "VMWebVideoDownloaderOperation.h"
+#import "VMWebVideoDownloadScheduler.h"
+#import "VMWebVideoProgressiveFile.h"
+#import "VMWebVideoWeakProxy.h"
+#import "VMWebVideoMetrics.h"
 #import <UIKit/UIKit.h>
+#import <fcntl.h>
+#import <unistd.h>
 
-@interface VMWebVideoDownloaderOperation () <NSURLConnectionDataDelegate>
+static NSString *const kETagValidatorKey = @"ETag";
+static NSString *const kLastModifiedValidatorKey = @"Last-Modified";
+
+/**
+ * A byte range of the video fetched by its own task.
+ */
+@interface VMWebVideoDownloadSegment : NSObject
+
+@property (strong, nonatomic) NSURLSessionDataTask *task;
+@property (assign, nonatomic) long long start;  // First byte of the segment
+@property (assign, nonatomic) long long limit;  // One past the last byte of the segment, LLONG_MAX if unknown
+@property (assign, nonatomic) long long offset; // Next byte to be written
+@property (assign, nonatomic, getter = isFinished) BOOL finished;
+
+@end
+
+@implementation VMWebVideoDownloadSegment
+@end
+
+@interface VMWebVideoDownloaderOperation () <VMWebVideoThrottlableOperation>
 
 @property (copy, nonatomic) VMWebVideoDownloaderProgressBlock progressBlock;
-@property (copy, nonatomic) VMWebVideoDownloaderCompletedBlock completedBlock;
+@property (copy, nonatomic) VMWebVideoDownloaderFileCompletedBlock completedBlock;
 @property (copy, nonatomic) VMWebVideoNoParamsBlock cancelBlock;
 
 @property (assign, nonatomic, getter = isExecuting) BOOL executing;
 @property (assign, nonatomic, getter = isFinished) BOOL finished;
 @property (assign, nonatomic) NSInteger expectedSize;
-@property (strong, nonatomic) NSMutableData *videoData;
-@property (strong, nonatomic) NSURLConnection *connection;
-@property (strong, atomic) NSThread *thread;
+@property (assign, nonatomic) NSInteger receivedSize;
+@property (assign, nonatomic) long long resumeOffset;
+@property (assign, nonatomic) BOOL rangeRequested;
+// The request asked for the prefix only, the server stops sending at its end
+@property (assign, nonatomic) BOOL prefixRangeBounded;
+// One past the last byte the bounded request asked for
+@property (assign, nonatomic) long long boundedRangeLength;
+@property (assign, nonatomic) long long totalLength;
+@property (assign, nonatomic) BOOL preallocated;
+@property (assign, nonatomic) BOOL singleStreamFallback;
+// When the main task was last resumed, so the time to first byte leaves out the time it was suspended or throttled
+@property (assign, nonatomic) CFAbsoluteTime resumeTime;
+// Only set while metrics are enabled, see VMWebVideoMetrics
+@property (assign, nonatomic) CFAbsoluteTime queuedTime;
+@property (assign, nonatomic) CFAbsoluteTime responseTime;
+// The downloader's shared session; the operation only creates a session of its own when it isn't given one
+@property (weak, nonatomic) NSURLSession *unownedSession;
+@property (strong, nonatomic) NSURLSession *ownedSession;
+@property (strong, nonatomic) NSURLSessionDataTask *dataTask;
+@property (strong, nonatomic) VMWebVideoDownloadSegment *mainSegment;
+@property (strong, nonatomic) NSMutableArray *segments;
+@property (strong, nonatomic) VMWebVideoProgressiveFile *progressiveFile;
+@property (strong, atomic, readwrite) NSDictionary *responseValidators;
+@property (assign, nonatomic) BOOL partialFileDelivered;
+// Guarded by @synchronized(self): a prefix download either gets extended or hands out its prefix, never both
+@property (assign, nonatomic) BOOL fullVideoRequested;
+@property (assign, nonatomic) BOOL prefixHandedOut;
+// The download was limited to a prefix when a request for the whole video joined it
+@property (assign, nonatomic) BOOL extendedFromPrefix;
+// Set by setSuspended: and by the scheduler through setThrottled:, the tasks are created but not resumed while either is
+@property (assign, nonatomic) BOOL tasksSuspended;
+@property (assign, nonatomic) BOOL tasksThrottled;
 
 #if TARGET_OS_IPHONE && __IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_4_0
 @property (assign, nonatomic) UIBackgroundTaskIdentifier backgroundTaskId;
@@ -33,6 +87,7 @@
     size_t width, height;
     UIImageOrientation orientation;
     BOOL responseFromCached;
+    int fileDescriptor;
 }
 
 @synthesize executing = _executing;
@@ -40,25 +95,51 @@
 
 - (id)initWithRequest:(NSURLRequest *)request
               options:(VMWebVideoDownloaderOptions)options
+     temporaryFileURL:(NSURL *)fileURL
+             progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+            completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock
+            cancelled:(VMWebVideoNoParamsBlock)cancelBlock {
+    return [self initWithRequest:request inSession:nil options:options temporaryFileURL:fileURL progress:progressBlock completed:completedBlock cancelled:cancelBlock];
+}
+
+- (id)initWithRequest:(NSURLRequest *)request
+            inSession:(NSURLSession *)session
+              options:(VMWebVideoDownloaderOptions)options
+     temporaryFileURL:(NSURL *)fileURL
              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
-            completed:(VMWebVideoDownloaderCompletedBlock)completedBlock
+            completed:(VMWebVideoDownloaderFileCompletedBlock)completedBlock
             cancelled:(VMWebVideoNoParamsBlock)cancelBlock {
     if ((self = [super init])) {
         _request = request;
+        _unownedSession = session;
         _shouldUseCredentialStorage = YES;
         _options = options;
+        _temporaryFileURL = fileURL;
+        _maxSegmentCount = 4;
+        _minimumSegmentLength = 1024 * 1024;
+        _progressiveThreshold = 256 * 1024;
         _progressBlock = [progressBlock copy];
         _completedBlock = [completedBlock copy];
         _cancelBlock = [cancelBlock copy];
         _executing = NO;
         _finished = NO;
         _expectedSize = 0;
-        responseFromCached = YES; // Initially wrong until `connection:willCacheResponse:` is called or not called
+        _receivedSize = 0;
+        _totalLength = -1;
+        _queuedTime = VMWebVideoMetricsStartTime();
+        fileDescriptor = -1;
+        responseFromCached = YES; // Initially wrong until `URLSession:dataTask:willCacheResponse:completionHandler:` is called or not called
     }
     return self;
 }
 
+- (void)dealloc {
+    // Only set while running, an operation released without finishing still has to let go of its session
+    [_ownedSession invalidateAndCancel];
+}
+
 - (void)start {
+    BOOL prefixOnDisk = NO;
     @synchronized (self) {
         if (self.isCancelled) {
             self.finished = YES;
@@ -82,52 +163,132 @@
         }
 #endif
         
-        self.executing = YES;
-        self.connection = [[NSURLConnection alloc] initWithRequest:self.request delegate:self startImmediately:NO];
-        self.thread = [NSThread currentThread];
+        // Nothing to download if the prefix is already on disk
+        prefixOnDisk = (self.prefixLength > 0 && !self.fullVideoRequested && [self resumableLength:NULL] >= self.prefixLength);
+        self.prefixHandedOut = prefixOnDisk;
+        if (!prefixOnDisk) {
+            NSURLSession *session = self.unownedSession;
+            if (!session) {
+                NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+                configuration.timeoutIntervalForRequest = self.request.timeoutInterval;
+                // The session retains its delegate until it is invalidated, so an operation that never finishes isn't leaked
+                self.ownedSession = [NSURLSession sessionWithConfiguration:configuration delegate:[VMWebVideoWeakProxy proxyWithTarget:self] delegateQueue:nil];
+                session = self.ownedSession;
+            }
+            
+            self.executing = YES;
+            VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageQueueWait, self.queuedTime);
+            self.dataTask = [session dataTaskWithRequest:[self requestResumingPartialDownload]];
+            if (self.dataTask) {
+                [self.taskObserver operation:self didCreateTask:self.dataTask];
+            }
+            
+            // The first task streams from the resume offset; in segmented mode it is later limited to the first segment
+            self.mainSegment = [VMWebVideoDownloadSegment new];
+            self.mainSegment.task = self.dataTask;
+            self.mainSegment.start = self.resumeOffset;
+            self.mainSegment.offset = self.resumeOffset;
+            self.mainSegment.limit = LLONG_MAX;
+            self.segments = [NSMutableArray arrayWithObject:self.mainSegment];
+        }
     }
     
-    [self.connection start];
-    
-    if (self.connection) {
+    if (prefixOnDisk) {
+        // Called outside the lock like every other completion, the subscribers may call back into the operation
+        if (self.completedBlock) {
+            self.completedBlock(nil, nil, YES);
+        }
+        [self done];
+    }
+    else if (self.dataTask) {
         if (self.progressBlock) {
             self.progressBlock(0, NSURLResponseUnknownLength);
         }
         [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStartNotification object:self];
         
-        if (floor(NSFoundationVersionNumber) <= NSFoundationVersionNumber_iOS_5_1) {
-            // Make sure to run the runloop in our background thread so it can process downloaded data
-            // Note: we use a timeout to work around an issue with NSURLConnection cancel under iOS 5
-            //       not waking up the runloop, leading to dead threads (see https://github.com/rs/SDWebImage/issues/466)
-            CFRunLoopRunInMode(kCFRunLoopDefaultMode, 10, false);
-        }
-        else {
-            CFRunLoopRun();
-        }
-        
-        if (!self.isFinished) {
-            [self.connection cancel];
-            [self connection:self.connection didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:@{NSURLErrorFailingURLErrorKey : self.request.URL}]];
+        // No thread waits for the download, the session calls back on its delegate queue
+        if (!self.tasksSuspended && !self.tasksThrottled) {
+            self.resumeTime = CFAbsoluteTimeGetCurrent();
+            [self.dataTask resume];
         }
     }
     else {
         if (self.completedBlock) {
             self.completedBlock(nil, [NSError errorWithDomain:NSURLErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"Connection can't be initialized"}], YES);
         }
+        [self done];
     }
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority {
+    if (priority == VMWebVideoDownloadPriorityVisible) {
+        self.queuePriority = NSOperationQueuePriorityHigh;
+    } else if (priority == VMWebVideoDownloadPriorityPrefetch) {
+        self.queuePriority = NSOperationQueuePriorityLow;
+    } else {
+        self.queuePriority = NSOperationQueuePriorityNormal;
+    }
+    [self.scheduler setPriority:priority ofOperation:self];
+}
+
+- (void)setSuspended:(BOOL)suspended {
+    [self updateTasks:^{
+        self.tasksSuspended = suspended;
+    }];
+    [self.scheduler setSuspended:suspended ofOperation:self];
+}
+
+- (void)setThrottled:(BOOL)throttled {
+    [self updateTasks:^{
+        self.tasksThrottled = throttled;
+    }];
+}
+
+// Applies a change to tasksSuspended or tasksThrottled, and pauses or resumes the tasks if that changes whether they may run
+- (void)updateTasks:(void (^)(void))change {
+    void (^apply)(void) = ^{
+        BOOL wasPaused = self.tasksSuspended || self.tasksThrottled;
+        change();
+        BOOL paused = self.tasksSuspended || self.tasksThrottled;
+        if (paused == wasPaused || self.isFinished) {
+            return;
+        }
+        for (VMWebVideoDownloadSegment *segment in self.segments) {
+            if (segment.isFinished) {
+                continue;
+            }
+            if (paused) {
+                [segment.task suspend];
+            }
+            else {
+                if (segment.task == self.dataTask) {
+                    self.resumeTime = CFAbsoluteTimeGetCurrent();
+                }
+                [segment.task resume];
+            }
+        }
+    };
     
-#if TARGET_OS_IPHONE && __IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_4_0
-    if (self.backgroundTaskId != UIBackgroundTaskInvalid) {
-        [[UIApplication sharedApplication] endBackgroundTask:self.backgroundTaskId];
-        self.backgroundTaskId = UIBackgroundTaskInvalid;
+    @synchronized (self) {
+        NSOperationQueue *delegateQueue = self.dataTask ? (self.ownedSession ?: self.unownedSession).delegateQueue : nil;
+        if (delegateQueue) {
+            [delegateQueue addOperationWithBlock:apply];
+        }
+        else {
+            // Not started yet, the task won't be resumed when it is
+            apply();
+        }
     }
-#endif
 }
 
 - (void)cancel {
     @synchronized (self) {
-        if (self.thread) {
-            [self performSelector:@selector(cancelInternalAndStop) onThread:self.thread withObject:nil waitUntilDone:NO];
+        NSOperationQueue *delegateQueue = self.dataTask ? (self.ownedSession ?: self.unownedSession).delegateQueue : nil;
+        if (delegateQueue) {
+            // Cancel in between two delegate callbacks rather than in the middle of one
+            [delegateQueue addOperationWithBlock:^{
+                [self cancelInternal];
+            }];
         }
         else {
             [self cancelInternal];
@@ -135,22 +296,21 @@
     }
 }
 
-- (void)cancelInternalAndStop {
-    if (self.isFinished) return;
-    [self cancelInternal];
-    CFRunLoopStop(CFRunLoopGetCurrent());
-}
-
 - (void)cancelInternal {
     if (self.isFinished) return;
     [super cancel];
     if (self.cancelBlock) self.cancelBlock();
     
-    if (self.connection) {
-        [self.connection cancel];
+    [self cancelSegmentTasks];
+    [self closeTemporaryFile];
+    [self keepPartialDownloadIfResumable];
+    [self.progressiveFile finishWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+    
+    if (self.dataTask) {
+        [self.dataTask cancel];
         [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:self];
         
-        // As we cancelled the connection, its callback won't be called and thus won't
+        // As we cancelled the task, its callback won't be handled and thus won't
         // maintain the isFinished and isExecuting flags.
         if (self.isExecuting) self.executing = NO;
         if (!self.isFinished) self.finished = YES;
@@ -169,9 +329,23 @@
     self.cancelBlock = nil;
     self.completedBlock = nil;
     self.progressBlock = nil;
-    self.connection = nil;
-    self.videoData = nil;
-    self.thread = nil;
+    self.dataTask = nil;
+    self.mainSegment = nil;
+    self.segments = nil;
+    self.progressiveFile = nil;
+    [self closeTemporaryFile];
+    
+    if (self.ownedSession) {
+        [self.ownedSession invalidateAndCancel];
+        self.ownedSession = nil;
+    }
+    
+#if TARGET_OS_IPHONE && __IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_4_0
+    if (self.backgroundTaskId != UIBackgroundTaskInvalid) {
+        [[UIApplication sharedApplication] endBackgroundTask:self.backgroundTaskId];
+        self.backgroundTaskId = UIBackgroundTaskInvalid;
+    }
+#endif
 }
 
 - (void)setFinished:(BOOL)finished {
@@ -190,86 +364,480 @@
     return YES;
 }
 
-#pragma mark NSURLConnection (delegate)
+#pragma mark Temporary file
+
+- (BOOL)openTemporaryFileTruncating:(BOOL)shouldTruncate {
+    [self closeTemporaryFile];
+    fileDescriptor = open(self.temporaryFileURL.fileSystemRepresentation, O_WRONLY | O_CREAT | (shouldTruncate ? O_TRUNC : 0), 0644);
+    return fileDescriptor >= 0;
+}
 
-- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+- (void)closeTemporaryFile {
+    if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+}
+
+- (BOOL)writeData:(NSData *)data toTemporaryFileAtOffset:(long long)offset {
+    __block BOOL success = (fileDescriptor >= 0);
+    __block off_t position = (off_t)offset;
+    int fd = fileDescriptor;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        const char *cursor = bytes;
+        size_t remaining = byteRange.length;
+        while (success && remaining > 0) {
+            ssize_t written = pwrite(fd, cursor, remaining, position);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                success = NO;
+            }
+            else {
+                cursor += written;
+                remaining -= (size_t)written;
+                position += written;
+            }
+        }
+        *stop = !success;
+    }];
+    return success;
+}
+
+#pragma mark Resuming
+
+- (NSURL *)validatorsFileURL {
+    return [self.temporaryFileURL URLByAppendingPathExtension:@"plist"];
+}
+
+// Returns the length of the partial download that can be resumed, 0 if there is none
+- (long long)resumableLength:(NSString **)validator {
+    // A partial download can only be resumed if we can tell the server which version of the video it belongs to
+    NSDictionary *validators = [NSDictionary dictionaryWithContentsOfURL:[self validatorsFileURL]];
+    NSString *eTag = validators[kETagValidatorKey];
+    NSString *partialValidator = (eTag && ![eTag hasPrefix:@"W/"]) ? eTag : validators[kLastModifiedValidatorKey];
+    if (!partialValidator) {
+        return 0;
+    }
     
-    //'304 Not Modified' is an exceptional one
-    if ((![response respondsToSelector:@selector(statusCode)] || [((NSHTTPURLResponse *)response) statusCode] < 400) && [((NSHTTPURLResponse *)response) statusCode] != 304) {
-        NSInteger expected = response.expectedContentLength > 0 ? (NSInteger)response.expectedContentLength : 0;
-        self.expectedSize = expected;
-        if (self.progressBlock) {
-            self.progressBlock(0, expected);
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:self.temporaryFileURL.path error:nil];
+    if (validator) {
+        *validator = partialValidator;
+    }
+    return [attributes[NSFileSize] longLongValue];
+}
+
+- (NSURLRequest *)requestResumingPartialDownload {
+    self.resumeOffset = 0;
+    self.rangeRequested = NO;
+    self.prefixRangeBounded = NO;
+    if (self.request.cachePolicy != NSURLRequestReloadIgnoringLocalCacheData) {
+        // Let NSURLCache handle the request as is
+        return self.request;
+    }
+    
+    NSString *validator = nil;
+    long long partialSize = [self resumableLength:&validator];
+    // A prefix download doesn't ask for more than the prefix
+    NSString *rangeEnd = self.prefixLength > 0 ? [NSString stringWithFormat:@"%lld", self.prefixLength - 1] : @"";
+    
+    NSMutableURLRequest *request = [self.request mutableCopy];
+    if (partialSize > 0) {
+        // If-Range makes the server send the whole video again if it changed since the partial download
+        self.resumeOffset = partialSize;
+        self.rangeRequested = YES;
+        [request setValue:[NSString stringWithFormat:@"bytes=%lld-%@", partialSize, rangeEnd] forHTTPHeaderField:@"Range"];
+        [request setValue:validator forHTTPHeaderField:@"If-Range"];
+    }
+    else if ((self.options & VMWebVideoDownloaderSegmentedDownload) || self.prefixLength > 0) {
+        // An open ended range tells us the total length and whether the server supports ranges at all
+        self.rangeRequested = YES;
+        [request setValue:[NSString stringWithFormat:@"bytes=0-%@", rangeEnd] forHTTPHeaderField:@"Range"];
+    }
+    self.prefixRangeBounded = (self.rangeRequested && self.prefixLength > 0);
+    self.boundedRangeLength = self.prefixRangeBounded ? self.prefixLength : 0;
+    return request;
+}
+
+- (BOOL)extendToFullVideo {
+    @synchronized (self) {
+        if (self.prefixHandedOut) {
+            return NO;
+        }
+        if (self.fullVideoRequested) {
+            return YES;
         }
+        // From here on segmentDidFinish: won't hand out the prefix, even if the block below is still queued
+        self.fullVideoRequested = YES;
         
-        self.videoData = [[NSMutableData alloc] initWithCapacity:expected];
+        NSOperationQueue *delegateQueue = self.dataTask ? (self.ownedSession ?: self.unownedSession).delegateQueue : nil;
+        if (delegateQueue) {
+            [delegateQueue addOperationWithBlock:^{
+                [self applyFullVideoExtension];
+            }];
+        }
+        else {
+            [self applyFullVideoExtension];
+        }
+    }
+    return YES;
+}
+
+- (void)applyFullVideoExtension {
+    if (self.prefixLength == 0) {
+        return;
+    }
+    self.prefixLength = 0;
+    self.extendedFromPrefix = YES;
+    if (!self.prefixRangeBounded && self.mainSegment && !self.mainSegment.isFinished) {
+        // The response carries the whole video, it is simply read further.
+        // Otherwise the rest is requested once the prefix is in, see segmentDidFinish:.
+        self.mainSegment.limit = LLONG_MAX;
+    }
+}
+
+- (void)addOptions:(VMWebVideoDownloaderOptions)options {
+    void (^add)(void) = ^{
+        VMWebVideoDownloaderOptions addedOptions = options & ~self->_options;
+        if (addedOptions == 0 || self.isFinished) {
+            return;
+        }
+        self->_options |= addedOptions;
+        if ((addedOptions & VMWebVideoDownloaderProgressiveDownload) && self->fileDescriptor >= 0 && !self.progressiveFile) {
+            // The response was already handled, the file is played from what is on disk so far
+            self.progressiveFile = [[VMWebVideoProgressiveFile alloc] initWithFileURL:self.temporaryFileURL expectedLength:(self.expectedSize > 0 ? self.expectedSize : -1)];
+            [self updateProgressiveFile];
+        }
+    };
+    
+    @synchronized (self) {
+        NSOperationQueue *delegateQueue = self.dataTask ? (self.ownedSession ?: self.unownedSession).delegateQueue : nil;
+        if (delegateQueue) {
+            [delegateQueue addOperationWithBlock:add];
+        }
+        else {
+            add();
+        }
+    }
+}
+
+- (long long)contentRangeStartOfResponse:(NSHTTPURLResponse *)response totalLength:(long long *)totalLength {
+    // Content-Range: bytes <first>-<last>/<total or *>
+    NSString *contentRange = response.allHeaderFields[@"Content-Range"];
+    NSScanner *scanner = contentRange ? [NSScanner scannerWithString:contentRange] : nil;
+    long long first = -1, last = -1, total = -1;
+    if (![scanner scanString:@"bytes" intoString:NULL] || ![scanner scanLongLong:&first] ||
+        ![scanner scanString:@"-" intoString:NULL] || ![scanner scanLongLong:&last]) {
+        return -1;
+    }
+    if ([scanner scanString:@"/" intoString:NULL] && [scanner scanLongLong:&total] && totalLength) {
+        *totalLength = total;
+    }
+    return first;
+}
+
+- (NSDictionary *)validatorsOfResponse:(NSHTTPURLResponse *)response {
+    NSMutableDictionary *validators = [NSMutableDictionary dictionary];
+    NSDictionary *headers = response.allHeaderFields;
+    if (headers[kETagValidatorKey]) validators[kETagValidatorKey] = headers[kETagValidatorKey];
+    if (headers[kLastModifiedValidatorKey]) validators[kLastModifiedValidatorKey] = headers[kLastModifiedValidatorKey];
+    return validators;
+}
+
+- (void)storeValidatorsOfResponse:(NSHTTPURLResponse *)response {
+    NSDictionary *validators = [self validatorsOfResponse:response];
+    if (validators.count) {
+        [validators writeToURL:[self validatorsFileURL] atomically:YES];
     }
     else {
-        NSUInteger code = [((NSHTTPURLResponse *)response) statusCode];
-        
-        //This is the case when server returns '304 Not Modified'. It means that remote image is not changed.
-        //In case of 304 we need just cancel the operation and return cached image from the cache.
-        if (code == 304) {
-            [self cancelInternal];
-        } else {
-            [self.connection cancel];
+        // Without validators there is no safe way to resume this response later
+        [[NSFileManager defaultManager] removeItemAtURL:[self validatorsFileURL] error:nil];
+    }
+}
+
+- (void)keepPartialDownloadIfResumable {
+    if (![[NSFileManager defaultManager] fileExistsAtPath:[self validatorsFileURL].path]) {
+        [self removePartialDownload];
+    }
+    else if (self.preallocated) {
+        // Segments leave holes in the preallocated file, only the contiguous prefix can be resumed
+        truncate(self.temporaryFileURL.fileSystemRepresentation, (off_t)[self contiguousLength]);
+    }
+}
+
+- (void)removePartialDownload {
+    [[NSFileManager defaultManager] removeItemAtURL:self.temporaryFileURL error:nil];
+    [[NSFileManager defaultManager] removeItemAtURL:[self validatorsFileURL] error:nil];
+}
+
+#pragma mark Segments
+
+- (VMWebVideoDownloadSegment *)segmentForTask:(NSURLSessionTask *)task {
+    for (VMWebVideoDownloadSegment *segment in self.segments) {
+        if (segment.task == task) {
+            return segment;
         }
-        
-        [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
-        
-        if (self.completedBlock) {
-            self.completedBlock(nil, [NSError errorWithDomain:NSURLErrorDomain code:[((NSHTTPURLResponse *)response) statusCode] userInfo:nil], YES);
+    }
+    return nil;
+}
+
+- (long long)contiguousLength {
+    NSArray *sortedSegments = [self.segments sortedArrayUsingComparator:^NSComparisonResult(VMWebVideoDownloadSegment *segment1, VMWebVideoDownloadSegment *segment2) {
+        return [@(segment1.start) compare:@(segment2.start)];
+    }];
+    long long length = self.resumeOffset;
+    for (VMWebVideoDownloadSegment *segment in sortedSegments) {
+        if (segment.start > length) break;
+        length = MAX(length, segment.offset);
+    }
+    return length;
+}
+
+- (void)splitIntoSegments {
+    long long remaining = self.totalLength - self.mainSegment.start;
+    long long segmentCount = MIN((long long)self.maxSegmentCount, remaining / MAX(self.minimumSegmentLength, (long long)1));
+    if (segmentCount < 2) {
+        return;
+    }
+    
+    // Every segment writes at its own offset, so the file needs its final size up front
+    if (ftruncate(fileDescriptor, (off_t)self.totalLength) != 0) {
+        return;
+    }
+    self.preallocated = YES;
+    
+    long long segmentLength = remaining / segmentCount;
+    self.mainSegment.limit = self.mainSegment.start + segmentLength;
+    for (long long i = 1; i < segmentCount; i++) {
+        long long start = self.mainSegment.start + segmentLength * i;
+        long long limit = (i == segmentCount - 1) ? self.totalLength : start + segmentLength;
+        [self startSegmentFrom:start to:limit];
+    }
+}
+
+- (void)startSegmentFrom:(long long)start to:(long long)limit {
+    NSMutableURLRequest *request = [self.request mutableCopy];
+    NSString *rangeEnd = limit == LLONG_MAX ? @"" : [NSString stringWithFormat:@"%lld", limit - 1];
+    [request setValue:[NSString stringWithFormat:@"bytes=%lld-%@", start, rangeEnd] forHTTPHeaderField:@"Range"];
+    
+    VMWebVideoDownloadSegment *segment = [VMWebVideoDownloadSegment new];
+    segment.start = start;
+    segment.offset = start;
+    segment.limit = limit;
+    segment.task = [(self.ownedSession ?: self.unownedSession) dataTaskWithRequest:request];
+    if (segment.task) {
+        [self.taskObserver operation:self didCreateTask:segment.task];
+    }
+    [self.segments addObject:segment];
+    if (!self.tasksSuspended && !self.tasksThrottled) {
+        [segment.task resume];
+    }
+}
+
+- (void)cancelSegmentTasks {
+    for (VMWebVideoDownloadSegment *segment in self.segments) {
+        if (segment.task != self.dataTask) {
+            [segment.task cancel];
         }
-        CFRunLoopStop(CFRunLoopGetCurrent());
-        [self done];
     }
 }
 
-- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
-    [self.videoData appendData:data];
+- (void)fallBackToSingleStream {
+    // Drop the remaining segments and let a single task fetch everything after the first segment
+    self.singleStreamFallback = YES;
+    for (VMWebVideoDownloadSegment *segment in [self.segments copy]) {
+        if (segment != self.mainSegment) {
+            [segment.task cancel];
+            [self.segments removeObject:segment];
+        }
+    }
     
-    if ((self.options & VMWebVideoDownloaderProgressiveDownload) && self.expectedSize > 0 && self.completedBlock) {
-        //TODO: handle progressive video playing
+    if (!self.mainSegment.isFinished) {
+        // The first task asked for an open ended range, it simply keeps going
+        self.mainSegment.limit = self.totalLength;
+    }
+    else {
+        [self startSegmentFrom:self.mainSegment.offset to:self.totalLength];
+    }
+}
+
+- (void)segmentDidFinish:(VMWebVideoDownloadSegment *)segment {
+    segment.finished = YES;
+    segment.task = nil;
+    for (VMWebVideoDownloadSegment *otherSegment in self.segments) {
+        if (!otherSegment.isFinished) return;
     }
     
-    if (self.progressBlock) {
-        self.progressBlock(self.videoData.length, self.expectedSize);
+    long long length = [self contiguousLength];
+    long long expectedLength = self.totalLength > 0 ? self.totalLength : self.expectedSize;
+    BOOL complete;
+    if (expectedLength > 0) {
+        complete = (length >= expectedLength);
+    }
+    else if (self.prefixRangeBounded) {
+        // The server ran out of video before the end of the range, even if the download was extended since
+        complete = (length < self.boundedRangeLength);
+    }
+    else {
+        complete = (self.prefixLength == 0 || length < self.prefixLength);
+    }
+    if (!complete && self.prefixLength > 0) {
+        BOOL extended;
+        @synchronized (self) {
+            extended = self.fullVideoRequested;
+            self.prefixHandedOut = !extended;
+        }
+        if (!extended) {
+            [self finishPrefix];
+            return;
+        }
+        // A request for the whole video joined before the prefix was handed out, its extension may still be queued
+        [self applyFullVideoExtension];
+    }
+    
+    if (!complete && self.extendedFromPrefix) {
+        // The download stopped at the prefix before it was extended, the rest needs a request of its own.
+        // Without a total length it asks for an open ended range, read until the server closes the connection.
+        // There are no other segments to fall back on, if it fails the download fails.
+        self.prefixRangeBounded = NO;
+        self.singleStreamFallback = YES;
+        [self startSegmentFrom:length to:(expectedLength > 0 ? expectedLength : LLONG_MAX)];
+    }
+    else {
+        [self finish];
+    }
+}
+
+- (void)segment:(VMWebVideoDownloadSegment *)segment didFailWithError:(NSError *)error {
+    if (segment == self.mainSegment || self.singleStreamFallback) {
+        [self failWithError:error];
+    }
+    else {
+        [self fallBackToSingleStream];
+    }
+}
+
+- (void)segment:(VMWebVideoDownloadSegment *)segment didReceiveResponse:(NSURLResponse *)response {
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    if (httpResponse.statusCode == 416 && segment.limit == LLONG_MAX) {
+        // An open ended range starting past the end: the video ended exactly where the prefix did
+        [segment.task cancel];
+        [self segmentDidFinish:segment];
+        return;
+    }
+    
+    long long totalLength = -1;
+    if (httpResponse.statusCode != 206 || [self contentRangeStartOfResponse:httpResponse totalLength:&totalLength] != segment.start) {
+        [segment.task cancel];
+        [self segment:segment didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:httpResponse.statusCode userInfo:nil]];
+    }
+    else if (segment.limit == LLONG_MAX && totalLength > 0) {
+        // The total length the first response didn't tell
+        self.totalLength = totalLength;
+        self.expectedSize = (NSInteger)totalLength;
+        segment.limit = totalLength;
+    }
+}
+
+#pragma mark Progressive download
+
+- (void)updateProgressiveFile {
+    if (!self.progressiveFile) {
+        return;
+    }
+    
+    // With segments, only the bytes before the first hole can be played
+    long long availableLength = self.preallocated ? [self contiguousLength] : self.mainSegment.offset;
+    [self.progressiveFile updateAvailableLength:availableLength];
+    
+    if (!self.partialFileDelivered && self.completedBlock &&
+        (availableLength >= self.progressiveThreshold || availableLength == self.progressiveFile.expectedLength)) {
+        self.partialFileDelivered = YES;
+        self.completedBlock(self.temporaryFileURL, nil, NO);
     }
 }
 
-- (void)connectionDidFinishLoading:(NSURLConnection *)aConnection {
-    VMWebVideoDownloaderCompletedBlock completionBlock = self.completedBlock;
+#pragma mark Completion
+
+- (void)finish {
+    VMWebVideoDownloaderFileCompletedBlock completionBlock = self.completedBlock;
     @synchronized(self) {
-        CFRunLoopStop(CFRunLoopGetCurrent());
-        self.thread = nil;
-        self.connection = nil;
+        self.dataTask = nil;
         [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
     }
     
+    [self closeTemporaryFile];
+    VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageTransfer, self.responseTime);
+    [self.progressiveFile updateAvailableLength:[self contiguousLength]];
+    [self.progressiveFile finishWithError:nil];
+    
     if (![[NSURLCache sharedURLCache] cachedResponseForRequest:_request]) {
         responseFromCached = NO;
     }
     
+    // The validators stay next to the delivered file, so that the cache can store them with the video
+    BOOL deliversFile = !(self.options & VMWebVideoDownloaderIgnoreCachedResponse && responseFromCached);
+    if (!deliversFile) {
+        [[NSFileManager defaultManager] removeItemAtURL:[self validatorsFileURL] error:nil];
+    }
+    
     if (completionBlock) {
-        if (self.options & VMWebVideoDownloaderIgnoreCachedResponse && responseFromCached) {
-            completionBlock(nil, nil, YES);
-        }
-        else {
-            completionBlock([self.videoData copy], nil, YES);
-        }
+        completionBlock(deliversFile ? self.temporaryFileURL : nil, nil, YES);
+    }
+    self.completionBlock = nil;
+    [self done];
+}
+
+- (void)finishPrefix {
+    [self.dataTask cancel];
+    @synchronized(self) {
+        self.dataTask = nil;
+        [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
+    }
+    
+    [self closeTemporaryFile];
+    // The prefix stays with its validators, the next download of the video starts after it
+    [self keepPartialDownloadIfResumable];
+    [self.progressiveFile finishWithError:nil];
+    
+    if (self.completedBlock) {
+        self.completedBlock(nil, nil, YES);
+    }
+    self.completionBlock = nil;
+    [self done];
+}
+
+- (void)finishNotModified {
+    [self.dataTask cancel];
+    @synchronized(self) {
+        self.dataTask = nil;
+        [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
+    }
+    
+    [self closeTemporaryFile];
+    // Nothing was written, a partial download of the video is still good for later
+    [self.progressiveFile finishWithError:nil];
+    
+    if (self.completedBlock) {
+        self.completedBlock(nil, nil, YES);
     }
     self.completionBlock = nil;
     [self done];
 }
 
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+- (void)failWithError:(NSError *)error {
+    [self cancelSegmentTasks];
+    [self.dataTask cancel];
+    
     @synchronized(self) {
-        CFRunLoopStop(CFRunLoopGetCurrent());
-        self.thread = nil;
-        self.connection = nil;
+        self.dataTask = nil;
         [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
     }
     
+    [self closeTemporaryFile];
+    // Keep what we received so far, the next request for this URL only fetches the missing tail
+    [self keepPartialDownloadIfResumable];
+    [self.progressiveFile finishWithError:error];
+    
     if (self.completedBlock) {
         self.completedBlock(nil, error, YES);
     }
@@ -277,14 +845,182 @@
     [self done];
 }
 
-- (NSCachedURLResponse *)connection:(NSURLConnection *)connection willCacheResponse:(NSCachedURLResponse *)cachedResponse {
+- (void)failWithPOSIXError {
+    int code = errno;
+    [self failWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:@{NSURLErrorFailingURLErrorKey : self.request.URL}]];
+}
+
+#pragma mark NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler {
+    [self dataTask:dataTask didReceiveResponse:response];
+    
+    // A task that was cancelled while handling the response ignores the disposition
+    if (completionHandler) {
+        completionHandler(NSURLSessionResponseAllow);
+    }
+}
+
+- (void)dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response {
+    if (dataTask != self.dataTask) {
+        VMWebVideoDownloadSegment *segment = [self segmentForTask:dataTask];
+        if (!segment) {
+            // The segment was dropped, e.g. by a fall back to a single stream
+            [dataTask cancel];
+            return;
+        }
+        [self segment:segment didReceiveResponse:response];
+        return;
+    }
+    
+    [self.scheduler operation:self didReceiveResponseAfter:CFAbsoluteTimeGetCurrent() - self.resumeTime];
+    VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageTimeToFirstByte, self.resumeTime);
+    self.responseTime = VMWebVideoMetricsStartTime();
+    
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    NSInteger statusCode = httpResponse ? httpResponse.statusCode : 200;
+    self.responseValidators = httpResponse ? [self validatorsOfResponse:httpResponse] : nil;
+    
+    // A 206 is only usable if it starts exactly at the byte we asked for
+    long long totalLength = -1;
+    if (statusCode == 206) {
+        if (!self.rangeRequested || [self contentRangeStartOfResponse:httpResponse totalLength:&totalLength] != self.resumeOffset) {
+            statusCode = 416;
+        }
+    }
+    else if (statusCode < 300) {
+        // The server sent the whole video, either because it ignores ranges or because it changed since the partial download
+        self.resumeOffset = 0;
+        self.mainSegment.start = 0;
+        self.mainSegment.offset = 0;
+        self.prefixRangeBounded = NO;
+    }
+    
+    //'304 Not Modified' is an exceptional one
+    if (statusCode < 400 && statusCode != 304) {
+        NSInteger expected = response.expectedContentLength > 0 ? (NSInteger)response.expectedContentLength : 0;
+        if (statusCode == 206 && totalLength <= 0 && self.prefixRangeBounded) {
+            // The body of a bounded range only measures the prefix, not the video
+            expected = 0;
+        }
+        else if (statusCode == 206) {
+            expected = totalLength > 0 ? (NSInteger)totalLength : (expected > 0 ? expected + (NSInteger)self.resumeOffset : 0);
+        }
+        self.totalLength = totalLength;
+        self.expectedSize = expected;
+        self.receivedSize = (NSInteger)self.resumeOffset;
+        if (self.progressBlock) {
+            self.progressBlock(self.receivedSize, expected);
+        }
+        
+        // Stream the body to disk instead of buffering it, so memory use doesn't grow with the video size.
+        // A resumed response only carries the missing tail, which is written after what we already have.
+        if (![self openTemporaryFileTruncating:(self.resumeOffset == 0)]) {
+            [self failWithPOSIXError];
+            return;
+        }
+        if (httpResponse) {
+            [self storeValidatorsOfResponse:httpResponse];
+        }
+        
+        if (self.prefixLength > 0) {
+            // Whatever the server sends past the prefix is dropped
+            self.mainSegment.limit = MAX(self.prefixLength, self.mainSegment.start);
+        }
+        else if ((self.options & VMWebVideoDownloaderSegmentedDownload) && totalLength > 0 && !self.prefixRangeBounded) {
+            [self splitIntoSegments];
+        }
+        
+        if (self.options & VMWebVideoDownloaderProgressiveDownload) {
+            // A resumed download may already have enough of the video on disk to start playing
+            self.progressiveFile = [[VMWebVideoProgressiveFile alloc] initWithFileURL:self.temporaryFileURL expectedLength:(expected > 0 ? expected : -1)];
+            [self updateProgressiveFile];
+        }
+    }
+    else if (statusCode == 304) {
+        // The video didn't change since the validators of the request, the cached copy is still good
+        [self finishNotModified];
+    }
+    else {
+        [self.dataTask cancel];
+        
+        if (statusCode == 416) {
+            // The partial download doesn't match the video on the server anymore, the next attempt starts over
+            [self removePartialDownload];
+        }
+        
+        [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoDownloadStopNotification object:nil];
+        
+        if (self.completedBlock) {
+            self.completedBlock(nil, [NSError errorWithDomain:NSURLErrorDomain code:statusCode userInfo:nil], YES);
+        }
+        [self done];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    VMWebVideoDownloadSegment *segment = [self segmentForTask:dataTask];
+    if (!segment) return;
+    
+    // The first task asked for everything, it is stopped once it reaches the next segment
+    long long room = segment.limit - segment.offset;
+    if ((long long)data.length > room) {
+        data = [data subdataWithRange:NSMakeRange(0, (NSUInteger)room)];
+    }
+    
+    if (![self writeData:data toTemporaryFileAtOffset:segment.offset]) {
+        [self failWithPOSIXError];
+        return;
+    }
+    segment.offset += data.length;
+    self.receivedSize += data.length;
+    VMWebVideoMetricsCount(VMWebVideoMetricsCounterBytesReceived, data.length);
+    [self.scheduler operation:self didReceiveDataOfLength:data.length];
+    if (self.expectedSize > 0) {
+        // Bytes fetched again after falling back to a single stream are not counted twice
+        self.receivedSize = MIN(self.receivedSize, self.expectedSize);
+    }
+    
+    [self updateProgressiveFile];
+    
+    if (self.progressBlock) {
+        self.progressBlock(self.receivedSize, self.expectedSize);
+    }
+    
+    if (segment.offset >= segment.limit) {
+        [dataTask cancel];
+        [self segmentDidFinish:segment];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask willCacheResponse:(NSCachedURLResponse *)proposedResponse completionHandler:(void (^)(NSCachedURLResponse *cachedResponse))completionHandler {
     responseFromCached = NO; // If this method is called, it means the response wasn't read from cache
+    NSCachedURLResponse *cachedResponse = proposedResponse;
     if (self.request.cachePolicy == NSURLRequestReloadIgnoringLocalCacheData) {
         // Prevents caching of responses
-        return nil;
+        cachedResponse = nil;
+    }
+    if (completionHandler) {
+        completionHandler(cachedResponse);
+    }
+}
+
+#pragma mark NSURLSessionTaskDelegate
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+    // Tasks the operation cancelled itself still complete here, they no longer belong to a segment
+    VMWebVideoDownloadSegment *segment = [self segmentForTask:task];
+    if (!segment) return;
+    
+    if (error) {
+        [self segment:segment didFailWithError:error];
+    }
+    else if (segment.limit != LLONG_MAX && segment.offset < segment.limit) {
+        // The server closed the connection before the end of the segment
+        [self segment:segment didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:@{NSURLErrorFailingURLErrorKey : self.request.URL}]];
     }
     else {
-        return cachedResponse;
+        [self segmentDidFinish:segment];
     }
 }
 
@@ -292,31 +1028,28 @@
     return self.options & VMWebVideoDownloaderContinueInBackground;
 }
 
-- (BOOL)connectionShouldUseCredentialStorage:(NSURLConnection __unused *)connection {
-    return self.shouldUseCredentialStorage;
-}
-
-- (void)connection:(NSURLConnection *)connection willSendRequestForAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge{
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition disposition, NSURLCredential *credential))completionHandler {
+    NSURLSessionAuthChallengeDisposition disposition = NSURLSessionAuthChallengePerformDefaultHandling;
+    NSURLCredential *credential = nil;
+    
     if ([challenge.protectionSpace.authenticationMethod isEqualToString:NSURLAuthenticationMethodServerTrust]) {
-        if (!(self.options & VMWebVideoDownloaderAllowInvalidSSLCertificates) &&
-            [challenge.sender respondsToSelector:@selector(performDefaultHandlingForAuthenticationChallenge:)]) {
-            [challenge.sender performDefaultHandlingForAuthenticationChallenge:challenge];
-        } else {
-            NSURLCredential *credential = [NSURLCredential credentialForTrust:challenge.protectionSpace.serverTrust];
-            [[challenge sender] useCredential:credential forAuthenticationChallenge:challenge];
+        if (self.options & VMWebVideoDownloaderAllowInvalidSSLCertificates) {
+            disposition = NSURLSessionAuthChallengeUseCredential;
+            credential = [NSURLCredential credentialForTrust:challenge.protectionSpace.serverTrust];
         }
     } else {
-        if ([challenge previousFailureCount] == 0) {
-            if (self.credential) {
-                [[challenge sender] useCredential:self.credential forAuthenticationChallenge:challenge];
-            } else {
-                [[challenge sender] continueWithoutCredentialForAuthenticationChallenge:challenge];
-            }
-        } else {
-            [[challenge sender] continueWithoutCredentialForAuthenticationChallenge:challenge];
+        if ([challenge previousFailureCount] == 0 && self.credential) {
+            disposition = NSURLSessionAuthChallengeUseCredential;
+            credential = self.credential;
+        } else if ([challenge previousFailureCount] > 0 || !self.shouldUseCredentialStorage) {
+            // Continue without a credential, the default handling would consult the credential storage
+            disposition = NSURLSessionAuthChallengeUseCredential;
         }
     }
+    
+    if (completionHandler) {
+        completionHandler(disposition, credential);
+    }
 }
 
 @end
-
@@ -0,0 +1,76 @@
+//
+//  VMWebVideoFailedURLCache.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Remembers the URLs whose download failed, so that they aren't requested again right away.
+ *
+ * A failed URL is blocked for `initialBackoff`, and every further failure doubles that time up to `maximumBackoff`.
+ * Once the time is up the URL may be tried again. A success forgets the URL, and so does a URL that hasn't failed
+ * again for `maximumBackoff` after its block expired. Lookups are hashed, and the number of URLs is capped at
+ * `countLimit`: the ones that would be unblocked first are dropped to make room.
+ *
+ * All methods are thread safe.
+ */
+@interface VMWebVideoFailedURLCache : NSObject
+
+/**
+ * Returns a cache that is kept in memory only.
+ */
+- (id)init;
+
+/**
+ * Returns a cache that is saved to the given file, so that failed URLs stay blocked across launches.
+ * Saving is done in the background, shortly after the cache changes.
+ */
+- (id)initWithPersistencePath:(NSString *)path;
+
+@property (strong, nonatomic, readonly) NSString *persistencePath;
+
+/**
+ * How long a URL is blocked after its first failure, in seconds. Default: 60.
+ */
+@property (assign, atomic) NSTimeInterval initialBackoff;
+
+/**
+ * The longest a URL is blocked for, in seconds. Default: 1 hour.
+ */
+@property (assign, atomic) NSTimeInterval maximumBackoff;
+
+/**
+ * The maximum number of URLs remembered. Default: 1000.
+ */
+@property (assign, atomic) NSUInteger countLimit;
+
+/**
+ * Returns YES if the URL failed and shouldn't be tried again yet.
+ */
+- (BOOL)isBlockedURL:(NSURL *)url;
+
+/**
+ * Returns YES if the error is a failure of the URL itself: an HTTP error status, or a network error of its request.
+ * Errors that say nothing about the URL aren't: the device being offline, a cancelled or timed out request,
+ * a range that no longer matches, or a local error such as a full disk.
+ */
++ (BOOL)isURLFailureError:(NSError *)error;
+
+/**
+ * Records a failure of the URL, blocking it for twice as long as the previous one.
+ * Only meant for errors that `isURLFailureError:` accepts.
+ */
+- (void)recordFailureOfURL:(NSURL *)url;
+
+/**
+ * Forgets the failures of the URL, e.g. once it was downloaded.
+ */
+- (void)removeURL:(NSURL *)url;
+
+- (void)removeAllURLs;
+
+@end
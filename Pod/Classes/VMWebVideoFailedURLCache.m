@@ -0,0 +1,215 @@
+//
+//  VMWebVideoFailedURLCache.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoFailedURLCache.h"
+#import "VMWebVideoCompat.h"
+
+// Changes are written at most this often
+static const NSTimeInterval kSaveDelay = 1.0;
+
+// When full, the cache is trimmed to this share of countLimit, so that trimming doesn't happen on every failure
+static const double kTrimRatio = 0.9;
+
+@interface VMWebVideoFailedURL : NSObject
+
+@property (assign, nonatomic) NSUInteger failureCount;
+@property (assign, nonatomic) NSTimeInterval retryTime; // Since the reference date, so that it survives restarts
+
+@end
+
+@implementation VMWebVideoFailedURL
+@end
+
+@interface VMWebVideoFailedURLCache ()
+
+// URL strings to VMWebVideoFailedURLs, guarded by @synchronized on itself
+@property (strong, nonatomic) NSMutableDictionary *failedURLs;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t ioQueue;
+@property (assign, nonatomic) BOOL saveScheduled;
+
+@end
+
+@implementation VMWebVideoFailedURLCache
+
+- (id)init {
+    return [self initWithPersistencePath:nil];
+}
+
+- (id)initWithPersistencePath:(NSString *)path {
+    if ((self = [super init])) {
+        _persistencePath = [path copy];
+        _initialBackoff = 60.0;
+        _maximumBackoff = 60.0 * 60.0;
+        _countLimit = 1000;
+        _failedURLs = [NSMutableDictionary new];
+        _ioQueue = dispatch_queue_create("com.vmlabs.VMWebVideoFailedURLCache", DISPATCH_QUEUE_SERIAL);
+        if (path) {
+            [self load];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    VMDispatchQueueRelease(_ioQueue);
+}
+
++ (BOOL)isURLFailureError:(NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) {
+        // POSIX and Cocoa errors come from the device, e.g. the disk is full
+        return NO;
+    }
+    
+    switch (error.code) {
+        case 0:   // The request couldn't be created
+        case 416: // The partial download is dropped and the next request starts over
+        case NSURLErrorCancelled:
+        case NSURLErrorTimedOut:
+        case NSURLErrorNotConnectedToInternet:
+        case NSURLErrorNetworkConnectionLost:
+        case NSURLErrorDataNotAllowed:
+        case NSURLErrorInternationalRoamingOff:
+        case NSURLErrorCallIsActive:
+            return NO;
+        default:
+            return YES;
+    }
+}
+
+- (BOOL)isBlockedURL:(NSURL *)url {
+    NSString *key = url.absoluteString;
+    if (!key) {
+        return NO;
+    }
+    
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    @synchronized (self.failedURLs) {
+        VMWebVideoFailedURL *failedURL = self.failedURLs[key];
+        if (!failedURL) {
+            return NO;
+        }
+        if (now >= failedURL.retryTime + self.maximumBackoff) {
+            // Hasn't failed again for long enough, the next failure starts over
+            [self.failedURLs removeObjectForKey:key];
+            [self scheduleSave];
+            return NO;
+        }
+        return now < failedURL.retryTime;
+    }
+}
+
+- (void)recordFailureOfURL:(NSURL *)url {
+    NSString *key = url.absoluteString;
+    if (!key) {
+        return;
+    }
+    
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    @synchronized (self.failedURLs) {
+        VMWebVideoFailedURL *failedURL = self.failedURLs[key];
+        if (!failedURL || now >= failedURL.retryTime + self.maximumBackoff) {
+            failedURL = [VMWebVideoFailedURL new];
+            self.failedURLs[key] = failedURL;
+        }
+        failedURL.failureCount++;
+        
+        NSTimeInterval backoff = ldexp(self.initialBackoff, (int)MIN(failedURL.failureCount - 1, (NSUInteger)32));
+        failedURL.retryTime = now + MIN(backoff, self.maximumBackoff);
+        
+        if (self.failedURLs.count > self.countLimit) {
+            [self trimWithTime:now];
+        }
+        [self scheduleSave];
+    }
+}
+
+- (void)removeURL:(NSURL *)url {
+    NSString *key = url.absoluteString;
+    if (!key) {
+        return;
+    }
+    
+    @synchronized (self.failedURLs) {
+        if (self.failedURLs[key]) {
+            [self.failedURLs removeObjectForKey:key];
+            [self scheduleSave];
+        }
+    }
+}
+
+- (void)removeAllURLs {
+    @synchronized (self.failedURLs) {
+        [self.failedURLs removeAllObjects];
+        [self scheduleSave];
+    }
+}
+
+// Must be called in @synchronized (self.failedURLs)
+- (void)trimWithTime:(NSTimeInterval)now {
+    NSTimeInterval maximumBackoff = self.maximumBackoff;
+    NSArray *forgottenKeys = [[self.failedURLs keysOfEntriesPassingTest:^BOOL(NSString *key, VMWebVideoFailedURL *failedURL, BOOL *stop) {
+        return now >= failedURL.retryTime + maximumBackoff;
+    }] allObjects];
+    [self.failedURLs removeObjectsForKeys:forgottenKeys];
+    
+    NSUInteger targetCount = (NSUInteger)(self.countLimit * kTrimRatio);
+    if (self.failedURLs.count <= targetCount) {
+        return;
+    }
+    
+    // The URLs that would be unblocked first are the least worth remembering
+    NSArray *keys = [self.failedURLs keysSortedByValueUsingComparator:^NSComparisonResult(VMWebVideoFailedURL *failedURL1, VMWebVideoFailedURL *failedURL2) {
+        if (failedURL1.retryTime < failedURL2.retryTime) return NSOrderedAscending;
+        if (failedURL1.retryTime > failedURL2.retryTime) return NSOrderedDescending;
+        return NSOrderedSame;
+    }];
+    [self.failedURLs removeObjectsForKeys:[keys subarrayWithRange:NSMakeRange(0, keys.count - targetCount)]];
+}
+
+#pragma mark Persistence
+
+- (void)load {
+    // Saved as URL strings to [failureCount, retryTime]
+    NSDictionary *savedURLs = [NSDictionary dictionaryWithContentsOfFile:self.persistencePath];
+    [savedURLs enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSArray *values, BOOL *stop) {
+        if (![key isKindOfClass:[NSString class]] || ![values isKindOfClass:[NSArray class]] || values.count < 2) {
+            return;
+        }
+        VMWebVideoFailedURL *failedURL = [VMWebVideoFailedURL new];
+        failedURL.failureCount = [values[0] unsignedIntegerValue];
+        failedURL.retryTime = [values[1] doubleValue];
+        self.failedURLs[key] = failedURL;
+    }];
+}
+
+// Must be called in @synchronized (self.failedURLs)
+- (void)scheduleSave {
+    if (!self.persistencePath || self.saveScheduled) {
+        return;
+    }
+    
+    self.saveScheduled = YES;
+    __weak VMWebVideoFailedURLCache *wself = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kSaveDelay * NSEC_PER_SEC)), self.ioQueue, ^{
+        [wself save];
+    });
+}
+
+- (void)save {
+    NSMutableDictionary *savedURLs;
+    @synchronized (self.failedURLs) {
+        self.saveScheduled = NO;
+        savedURLs = [NSMutableDictionary dictionaryWithCapacity:self.failedURLs.count];
+        [self.failedURLs enumerateKeysAndObjectsUsingBlock:^(NSString *key, VMWebVideoFailedURL *failedURL, BOOL *stop) {
+            savedURLs[key] = @[@(failedURL.failureCount), @(failedURL.retryTime)];
+        }];
+    }
+    [savedURLs writeToFile:self.persistencePath atomically:YES];
+}
+
+@end
@@ -10,31 +10,38 @@
 #import "VMWebVideoOperation.h"
 #import "VMWebVideoDownloader.h"
 #import "VMVideoCache.h"
+#import "VMWebVideoProgressiveFile.h"
+#import "VMWebVideoFailedURLCache.h"
+#import "VMWebVideoOperationRegistry.h"
 
 typedef NS_OPTIONS(NSUInteger, VMWebVideoOptions) {
     /**
-     * By default, when a URL fail to be downloaded, the URL is blacklisted so the library won't keep trying.
-     * This flag disable this blacklisting.
+     * By default, when a URL fail to be downloaded, the URL is blacklisted for a while so the library won't keep trying,
+     * see `VMWebVideoFailedURLCache`. This flag disable this blacklisting.
      */
     VMWebVideoRetryFailed = 1 << 0,
     
     /**
      * By default, image downloads are started during UI interactions, this flags disable this feature,
      * leading to delayed download on UIScrollView deceleration for instance.
+     * The download is scheduled with `VMWebVideoDownloadPriorityPrefetch`.
      */
     VMWebVideoLowPriority = 1 << 1,
     
     /**
-     * This flag enables progressive download, the image is displayed progressively during download as a browser would do.
-     * By default, the image is only displayed once completely downloaded.
+     * This flag enables progressive download: the completed block is called with the partial file and `finished` set to NO
+     * as soon as the leading bytes needed to start playing are on disk, see `-[VMWebVideoDownloader progressiveThreshold]`.
+     * `VMWebVideoProgressiveFile` tells how much of the file can be read while the download continues.
+     * By default, the video is only delivered once completely downloaded.
      */
     VMWebVideoProgressiveDownload = 1 << 2,
     
     /**
-     * Even if the image is cached, respect the HTTP response cache control, and refresh the image from remote location if needed.
-     * The disk caching will be handled by NSURLCache instead of SDWebImage leading to slight performance degradation.
-     * This option helps deal with images changing behind the same request URL, e.g. Facebook graph api profile pics.
-     * If a cached image is refreshed, the completion block is called once with the cached image and again with the final image.
+     * Even if the video is cached, ask the server whether it changed, with a conditional request carrying the `ETag` and
+     * `Last-Modified` validators stored with it. A 304 answer only refreshes the cache entry, no video bytes are transferred,
+     * and the completion block is called with the cached video. Otherwise the new video replaces the cached one and the
+     * completion block is called with it. If the request fails, the completion block is called with the cached video.
+     * This option helps deal with videos changing behind the same request URL.
      *
      * Use this flag only if you can't make your URLs static with embeded cache busting parameter.
      */
@@ -62,8 +69,15 @@ typedef NS_OPTIONS(NSUInteger, VMWebVideoOptions) {
      * By default, image are loaded in the order they were queued. This flag move them to
      * the front of the queue and is loaded immediately instead of waiting for the current queue to be loaded (which
      * could take a while).
+     * The download is scheduled with `VMWebVideoDownloadPriorityVisible`.
      */
     VMWebVideoHighPriority = 1 << 7,
+    
+    /**
+     * Download large videos with several concurrent range requests instead of a single connection.
+     * See `VMWebVideoDownloaderSegmentedDownload`.
+     */
+    VMWebVideoSegmentedDownload = 1 << 8,
 };
 
 typedef void(^VMWebVideoCompletionBlock)(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, NSURL *videoURL);
@@ -120,6 +134,18 @@ typedef NSString *(^VMWebVideoCacheKeyFilterBlock)(NSURL *url);
 @property (strong, nonatomic, readonly) VMVideoCache *videoCache;
 @property (strong, nonatomic, readonly) VMWebVideoDownloader *videoDownloader;
 
+/**
+ * The URLs that failed to download and are blocked for now. Replace it with one created with
+ * `-[VMWebVideoFailedURLCache initWithPersistencePath:]` to keep them blocked across launches.
+ */
+@property (strong, atomic) VMWebVideoFailedURLCache *failedURLCache;
+
+/**
+ * The requests that are running, by the tags they were made with. Use it to cancel, pause or reprioritize a group of
+ * requests, e.g. those of a screen that went away.
+ */
+@property (strong, nonatomic, readonly) VMWebVideoOperationRegistry *operationRegistry;
+
 /**
  * The cache filter is a block used each time SDWebImageManager need to convert an URL into a cache key. This can
  * be used to remove dynamic part of an image URL.
@@ -165,13 +191,50 @@ typedef NSString *(^VMWebVideoCacheKeyFilterBlock)(NSURL *url);
  *   downloading. This block is thus called repetidly with a partial image. When image is fully downloaded, the
  *   block is called a last time with the full image and the last parameter set to YES.
  *
- * @return Returns an NSObject conforming to SDWebImageOperation. Should be an instance of SDWebImageDownloaderOperation
+ * Simultaneous requests for the same cache key share a single cache lookup, download and store. The options of the
+ * first request are used for the shared download, at the highest priority of the requests. A request that joins adds
+ * `VMWebVideoProgressiveDownload` and `VMWebVideoSegmentedDownload` if it asks for them, and gets the partial file
+ * right away if one was already delivered. Requests with `VMWebVideoRefreshCached` are never shared. Cancelling a request only cancels the download once no other request is waiting for it.
+ *
+ * @return Returns an NSObject conforming to VMWebVideoOperation. Use its `setPriority:` to move the download to another priority class as the video scrolls in or out of view
  */
 - (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
                                          options:(VMWebVideoOptions)options
                                         progress:(VMWebVideoDownloaderProgressBlock)progressBlock
                                        completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock;
 
+/**
+ * Same as `downloadVideoWithURL:options:progress:completed:`, with the request tracked under the given tags in
+ * `operationRegistry`. `tags` is a set of strings, and may be nil.
+ *
+ * Pausing a request with `setSuspended:` pauses the download once every request waiting for it is paused.
+ */
+- (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
+                                         options:(VMWebVideoOptions)options
+                                            tags:(NSSet *)tags
+                                        progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                       completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock;
+
+/**
+ * Downloads only the first `length` bytes of the video, enough to start playing it while the rest downloads.
+ * The prefix is kept as a partial entry of the cache (see `-[VMVideoCache partialLengthForKey:]`), which a later
+ * download of the whole video resumes from.
+ *
+ * Prefix requests are shared and tracked under their tags like the other requests: a prefix request joins any running
+ * load of the video, and cancelling it only cancels the download once no other request is waiting for it. A request for
+ * the whole video gets its own load, and its download turns a running prefix download into a full one.
+ *
+ * The completed block is called once. It gets the file of the video if it is cached or no longer than the prefix,
+ * otherwise a nil file path and no error once the prefix is on disk. `VMWebVideoRefreshCached`,
+ * `VMWebVideoProgressiveDownload` and `VMWebVideoSegmentedDownload` are ignored.
+ */
+- (id <VMWebVideoOperation>)downloadVideoPrefixWithURL:(NSURL *)url
+                                                length:(long long)length
+                                               options:(VMWebVideoOptions)options
+                                                  tags:(NSSet *)tags
+                                              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                             completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock;
+
 /**
  * Saves image to cache for given URL
  *
@@ -212,6 +275,37 @@ typedef NSString *(^VMWebVideoCacheKeyFilterBlock)(NSURL *url);
 - (void)cachedVideoExistsForURL:(NSURL *)url
                      completion:(VMWebVideoCheckCacheCompletionBlock)completionBlock;
 
+/**
+ *  Async check of many urls at once, in a single pass over the cache
+ *
+ *  @param urls             video urls
+ *  @param completionBlock  the block to be executed when the check is finished, with a dictionary mapping each url to an NSNumber, YES if the video is cached
+ *
+ *  @note the completion block is always executed on the main queue
+ */
+- (void)cachedVideosExistForURLs:(NSArray *)urls
+                      completion:(VMWebVideoCheckCacheBatchCompletionBlock)completionBlock;
+
+/**
+ *  Async lookup of the cached files of many urls at once, in a single pass over the cache
+ *
+ *  @param urls             video urls
+ *  @param completionBlock  the block to be executed when the lookup is finished, with a dictionary mapping each cached url to the file URL of its video. Urls that aren't cached are left out.
+ *
+ *  @note the completion block is always executed on the main queue
+ */
+- (NSOperation *)queryCacheForURLs:(NSArray *)urls
+                        completion:(VMVideoCacheQueryFilePathsCompletionBlock)completionBlock;
+
+/**
+ *  Removes the cached videos of many urls at once
+ *
+ *  @param urls             video urls
+ *  @param completionBlock  the block to be executed on the main queue once all of them are removed (optional)
+ */
+- (void)removeCachedVideosForURLs:(NSArray *)urls
+                       completion:(VMWebVideoNoParamsBlock)completionBlock;
+
 
 /**
  *Return the cache key for a given URL
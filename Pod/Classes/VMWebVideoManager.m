@@ -7,22 +7,52 @@
 //
 
 #import "VMWebVideoManager.h"
+#import "VMWebVideoMetrics.h"
 #import <objc/message.h>
 
 @interface VMWebVideoCombinedOperation : NSObject <VMWebVideoOperation>
 
 @property (assign, nonatomic, getter = isCancelled) BOOL cancelled;
 @property (copy, nonatomic) VMWebVideoNoParamsBlock cancelBlock;
+@property (assign, nonatomic) VMWebVideoDownloadPriority priority;
+// Applies a priority change to the download, once there is one
+@property (copy, nonatomic) void (^priorityBlock)(VMWebVideoDownloadPriority priority);
+@property (assign, nonatomic, getter = isSuspended) BOOL suspended;
+@property (copy, nonatomic) void (^suspensionBlock)(BOOL suspended);
+@property (strong, nonatomic) NSURL *url;
+@property (copy, nonatomic) VMWebVideoDownloaderProgressBlock progressBlock;
+@property (copy, nonatomic) VMWebVideoCompletionWithFinishedBlock completedBlock;
+
+@end
+
+/**
+ * The cache lookup, download and store of a cache key, shared by all the operations requesting it at the same time.
+ */
+@interface VMWebVideoLoad : NSObject
+
+@property (strong, nonatomic) NSString *key;
+@property (strong, nonatomic) NSURL *url;
+@property (assign, nonatomic) VMWebVideoOptions options;
+// Greater than 0 for a load of the first bytes of the video only
+@property (assign, nonatomic) long long prefixLength;
+// The combined operations waiting for the result, guarded by the manager's runningLoads
+@property (strong, nonatomic) NSMutableArray *operations;
+@property (assign, nonatomic, getter = isCancelled) BOOL cancelled;
 @property (strong, nonatomic) NSOperation *cacheOperation;
+@property (strong, nonatomic) id <VMWebVideoOperation> downloadOperation;
+// The partial file of a progressive download once it can be played, handed to the operations that join later
+@property (strong, nonatomic) NSURL *partialFilePath;
 
 @end
 
+@implementation VMWebVideoLoad
+@end
+
 @interface VMWebVideoManager ()
 
 @property (strong, nonatomic, readwrite) VMVideoCache *videoCache;
 @property (strong, nonatomic, readwrite) VMWebVideoDownloader *videoDownloader;
-@property (strong, nonatomic) NSMutableArray *failedURLs;
-@property (strong, nonatomic) NSMutableArray *runningOperations;
+@property (strong, nonatomic) NSMutableDictionary *runningLoads;
 
 @end
 
@@ -41,8 +71,13 @@
     if ((self = [super init])) {
         _videoCache = [self createCache];
         _videoDownloader = [VMWebVideoDownloader sharedDownloader];
-        _failedURLs = [NSMutableArray new];
-        _runningOperations = [NSMutableArray new];
+        if (!_videoDownloader.temporaryDirectoryPath) {
+            // Stream downloads next to the cache so finished files can be renamed into place
+            _videoDownloader.temporaryDirectoryPath = _videoCache.temporaryDirectoryPath;
+        }
+        _failedURLCache = [VMWebVideoFailedURLCache new];
+        _operationRegistry = [VMWebVideoOperationRegistry new];
+        _runningLoads = [NSMutableDictionary new];
     }
     return self;
 }
@@ -78,8 +113,84 @@
     }];
 }
 
+- (void)cachedVideosExistForURLs:(NSArray *)urls
+                      completion:(VMWebVideoCheckCacheBatchCompletionBlock)completionBlock {
+    if (!completionBlock) {
+        return;
+    }
+    
+    NSArray *keys = [self cacheKeysForURLs:urls];
+    [self.videoCache videosExistWithKeys:keys completion:^(NSDictionary *keyExistence) {
+        NSMutableDictionary *existence = [NSMutableDictionary dictionaryWithCapacity:urls.count];
+        [urls enumerateObjectsUsingBlock:^(NSURL *url, NSUInteger idx, BOOL *stop) {
+            existence[url] = keyExistence[keys[idx]] ?: @NO;
+        }];
+        completionBlock(existence);
+    }];
+}
+
+- (NSOperation *)queryCacheForURLs:(NSArray *)urls
+                        completion:(VMVideoCacheQueryFilePathsCompletionBlock)completionBlock {
+    if (!completionBlock) {
+        return nil;
+    }
+    
+    NSArray *keys = [self cacheKeysForURLs:urls];
+    return [self.videoCache queryCacheForKeys:keys filePathsCompletion:^(NSDictionary *keyFilePaths) {
+        NSMutableDictionary *filePaths = [NSMutableDictionary dictionaryWithCapacity:keyFilePaths.count];
+        [urls enumerateObjectsUsingBlock:^(NSURL *url, NSUInteger idx, BOOL *stop) {
+            NSURL *filePath = keyFilePaths[keys[idx]];
+            if (filePath) {
+                filePaths[url] = filePath;
+            }
+        }];
+        completionBlock(filePaths);
+    }];
+}
+
+- (void)removeCachedVideosForURLs:(NSArray *)urls
+                       completion:(VMWebVideoNoParamsBlock)completionBlock {
+    [self.videoCache removeVideosForKeys:[self cacheKeysForURLs:urls] completion:completionBlock];
+}
+
+// Keys in the same order as the URLs; the filter may map several URLs to one key
+- (NSArray *)cacheKeysForURLs:(NSArray *)urls {
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:urls.count];
+    for (NSURL *url in urls) {
+        [keys addObject:[self cacheKeyForURL:url] ?: @""];
+    }
+    return keys;
+}
+
+- (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
+                                         options:(VMWebVideoOptions)options
+                                        progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                       completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock {
+    return [self downloadVideoWithURL:url options:options tags:nil progress:progressBlock completed:completedBlock];
+}
+
 - (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
                                          options:(VMWebVideoOptions)options
+                                            tags:(NSSet *)tags
+                                        progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                       completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock {
+    return [self downloadVideoWithURL:url options:options prefixLength:0 tags:tags progress:progressBlock completed:completedBlock];
+}
+
+- (id <VMWebVideoOperation>)downloadVideoPrefixWithURL:(NSURL *)url
+                                                length:(long long)length
+                                               options:(VMWebVideoOptions)options
+                                                  tags:(NSSet *)tags
+                                              progress:(VMWebVideoDownloaderProgressBlock)progressBlock
+                                             completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock {
+    options &= ~(VMWebVideoRefreshCached | VMWebVideoProgressiveDownload | VMWebVideoSegmentedDownload);
+    return [self downloadVideoWithURL:url options:options prefixLength:MAX(length, 1LL) tags:tags progress:progressBlock completed:completedBlock];
+}
+
+- (id <VMWebVideoOperation>)downloadVideoWithURL:(NSURL *)url
+                                         options:(VMWebVideoOptions)options
+                                    prefixLength:(long long)prefixLength
+                                            tags:(NSSet *)tags
                                         progress:(VMWebVideoDownloaderProgressBlock)progressBlock
                                        completed:(VMWebVideoCompletionWithFinishedBlock)completedBlock {
     // Invoking this method without a completedBlock is pointless
@@ -99,12 +210,15 @@
     __block VMWebVideoCombinedOperation *operation = [VMWebVideoCombinedOperation new];
     __weak VMWebVideoCombinedOperation *weakOperation = operation;
     
-    BOOL isFailedUrl = NO;
-    @synchronized (self.failedURLs) {
-        isFailedUrl = [self.failedURLs containsObject:url];
+    VMWebVideoDownloadPriority priority = VMWebVideoDownloadPriorityNearVisible;
+    if (options & VMWebVideoHighPriority) {
+        priority = VMWebVideoDownloadPriorityVisible;
+    } else if (options & VMWebVideoLowPriority) {
+        priority = VMWebVideoDownloadPriorityPrefetch;
     }
+    operation.priority = priority;
     
-    if (!url || (!(options & VMWebVideoRetryFailed) && isFailedUrl)) {
+    if (!url || (!(options & VMWebVideoRetryFailed) && [self.failedURLCache isBlockedURL:url])) {
         dispatch_main_sync_safe(^{
             NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorFileDoesNotExist userInfo:nil];
             completedBlock(nil, error, VMVideoCacheTypeNone, YES, url);
@@ -112,123 +226,384 @@
         return operation;
     }
     
-    @synchronized (self.runningOperations) {
-        [self.runningOperations addObject:operation];
-    }
+    [self.operationRegistry addOperation:operation tags:tags];
+    operation.url = url;
+    operation.progressBlock = progressBlock;
+    operation.completedBlock = completedBlock;
     NSString *key = [self cacheKeyForURL:url];
     
-    operation.cacheOperation = [self.videoCache queryCacheForKey:key filePathCompletion:^(NSURL *videoDataFilePath, VMVideoCacheType cacheType) {
-    
-        if (operation.isCancelled) {
-            @synchronized (self.runningOperations) {
-                [self.runningOperations removeObject:operation];
+    // Requests for a key that is already being loaded wait for that load instead of querying and downloading again.
+    // A refresh has to go to the network, it doesn't join nor can it be joined. A prefix load can't serve a request for
+    // the whole video, which gets a load of its own; the downloader then extends the prefix download.
+    VMWebVideoLoad *load = nil;
+    BOOL joined = NO;
+    VMWebVideoOptions addedOptions = 0;
+    NSURL *partialFilePath = nil;
+    @synchronized (self.runningLoads) {
+        if (!(options & VMWebVideoRefreshCached)) {
+            load = self.runningLoads[key];
+            if (load.prefixLength > 0 && prefixLength == 0) {
+                load = nil;
             }
-            
-            return;
+            joined = (load != nil);
+        }
+        if (joined) {
+            // The load has to deliver what the joining operation asked for too
+            addedOptions = options & (VMWebVideoProgressiveDownload | VMWebVideoSegmentedDownload) & ~load.options;
+            load.options |= addedOptions;
+            partialFilePath = load.partialFilePath;
+        }
+        if (!load) {
+            load = [VMWebVideoLoad new];
+            load.key = key;
+            load.url = url;
+            load.options = options;
+            load.prefixLength = prefixLength;
+            load.operations = [NSMutableArray new];
+            if (!(options & VMWebVideoRefreshCached)) {
+                self.runningLoads[key] = load;
+            }
+        }
+        [load.operations addObject:operation];
+    }
+    
+    __weak VMWebVideoLoad *weakLoad = load;
+    operation.priorityBlock = ^(VMWebVideoDownloadPriority newPriority) {
+        [self updatePriorityOfLoad:weakLoad];
+    };
+    operation.suspensionBlock = ^(BOOL suspended) {
+        [self updateSuspensionOfLoad:weakLoad];
+    };
+    operation.cancelBlock = ^{
+        [self removeOperation:weakOperation fromLoad:weakLoad];
+        [self.operationRegistry removeOperation:weakOperation];
+    };
+    
+    if (joined) {
+        // A visible request raises the priority of a load started by a prefetch, and resumes a suspended one
+        VMWebVideoMetricsCount(VMWebVideoMetricsCounterDownloadJoins, 1);
+        [self updatePriorityOfLoad:load];
+        [self updateSuspensionOfLoad:load];
+        if (addedOptions) {
+            [self updateOptionsOfLoad:load];
+        }
+        if (partialFilePath) {
+            // The partial file was delivered before the operation joined
+            dispatch_main_async_safe(^{
+                if (!operation.isCancelled && operation.completedBlock) {
+                    operation.completedBlock(partialFilePath, nil, VMVideoCacheTypeNone, NO, url);
+                }
+            });
+        }
+        return operation;
+    }
+    
+    CFAbsoluteTime queryStartTime = VMWebVideoMetricsStartTime();
+    load.cacheOperation = [self.videoCache queryCacheForKey:key filePathCompletion:^(NSURL *videoDataFilePath, VMVideoCacheType cacheType) {
+        VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageCacheLookup, queryStartTime);
+        VMWebVideoMetricsCountCacheLookup(cacheType);
+        [self load:load didQueryCacheWithFilePath:videoDataFilePath cacheType:cacheType];
+    }];
+    
+    return operation;
+}
+
+#pragma mark Loads
+
+- (void)load:(VMWebVideoLoad *)load didQueryCacheWithFilePath:(NSURL *)videoDataFilePath cacheType:(VMVideoCacheType)cacheType {
+    if (load.isCancelled) {
+        return;
+    }
+    
+    VMWebVideoOptions options = load.options;
+    NSURL *url = load.url;
+    NSString *key = load.key;
+    
+    if (!videoDataFilePath && load.prefixLength > 0 && [self resumableLengthOfDownloadWithURL:url] >= load.prefixLength) {
+        // The prefix is on disk already
+        [self callCompletedBlocksOfLoad:load withFilePath:nil error:nil cacheType:VMVideoCacheTypeNone finished:YES];
+        return;
+    }
+    
+    if ((!videoDataFilePath || options & VMWebVideoRefreshCached) && (![self.delegate respondsToSelector:@selector(videoManager:shouldDownloadVideoForURL:)] || [self.delegate videoManager:self shouldDownloadVideoForURL:url])) {
+        // download if no video or requested to refresh anyway, and download allowed by delegate.
+        // The priority is the highest one of the operations waiting for the load, it is applied below.
+        VMWebVideoDownloaderOptions downloaderOptions = 0;
+        if (options & VMWebVideoProgressiveDownload) downloaderOptions |= VMWebVideoDownloaderProgressiveDownload;
+        if (options & VMWebVideoContinueInBackground) downloaderOptions |= VMWebVideoDownloaderContinueInBackground;
+        if (options & VMWebVideoHandleCookies) downloaderOptions |= VMWebVideoDownloaderHandleCookies;
+        if (options & VMWebVideoAllowInvalidSSLCertificates) downloaderOptions |= VMWebVideoDownloaderAllowInvalidSSLCertificates;
+        if (options & VMWebVideoSegmentedDownload) downloaderOptions |= VMWebVideoDownloaderSegmentedDownload;
+        NSDictionary *validators = nil;
+        if (videoDataFilePath && options & VMWebVideoRefreshCached) {
+            // force progressive off if video already cached but forced refreshing
+            downloaderOptions &= ~VMWebVideoDownloaderProgressiveDownload;
+            // Only download the video again if it changed since it was cached
+            validators = [self.videoCache validatorsForKey:key];
+        }
+        VMWebVideoDownloadPriority priority = [self priorityOfLoad:load];
+        if (priority == VMWebVideoDownloadPriorityVisible) {
+            downloaderOptions |= VMWebVideoDownloaderHighPriority;
+        } else if (priority == VMWebVideoDownloadPriorityPrefetch) {
+            downloaderOptions |= VMWebVideoDownloaderLowPriority;
         }
         
-        if ((!videoDataFilePath || options & VMWebVideoRefreshCached) && (![self.delegate respondsToSelector:@selector(videoManager:shouldDownloadVideoForURL:)] || [self.delegate videoManager:self shouldDownloadVideoForURL:url])) {
-            if (videoDataFilePath && options & VMWebVideoRefreshCached) {
-                dispatch_main_sync_safe(^{
-                    // If video was found in the cache bug VMWebVideoRefreshCached is provided, notify about the cached video
-                    // AND try to re-download it in order to let a chance to NSURLCache to refresh it from server.
-                    completedBlock(videoDataFilePath, nil, cacheType, YES, url);
-                });
+        VMWebVideoDownloaderProgressBlock progressBlock = ^(NSInteger receivedSize, NSInteger expectedSize) {
+            for (VMWebVideoCombinedOperation *operation in [self operationsOfLoad:load finishing:NO]) {
+                if (operation.progressBlock) operation.progressBlock(receivedSize, expectedSize);
+            }
+        };
+        VMWebVideoDownloaderConditionalCompletedBlock completedBlock = ^(NSURL *videoFileURL, NSDictionary *responseValidators, NSError *error, BOOL finished) {
+            if (finished) {
+                // The partial file is moved or removed once this block returns
+                @synchronized (self.runningLoads) {
+                    load.partialFilePath = nil;
+                }
             }
             
-            // download if no video or requested to refresh anyway, and download allowed by delegate
-            VMWebVideoDownloaderOptions downloaderOptions = 0;
-            if (options & VMWebVideoLowPriority) downloaderOptions |= VMWebVideoDownloaderLowPriority;
-            if (options & VMWebVideoProgressiveDownload) downloaderOptions |= VMWebVideoDownloaderProgressiveDownload;
-            if (options & VMWebVideoRefreshCached) downloaderOptions |= VMWebVideoDownloaderUseNSURLCache;
-            if (options & VMWebVideoContinueInBackground) downloaderOptions |= VMWebVideoDownloaderContinueInBackground;
-            if (options & VMWebVideoHandleCookies) downloaderOptions |= VMWebVideoDownloaderHandleCookies;
-            if (options & VMWebVideoAllowInvalidSSLCertificates) downloaderOptions |= VMWebVideoDownloaderAllowInvalidSSLCertificates;
-            if (options & VMWebVideoHighPriority) downloaderOptions |= VMWebVideoDownloaderHighPriority;
-            if (videoDataFilePath && options & VMWebVideoRefreshCached) {
-                // force progressive off if video already cached but forced refreshing
-                downloaderOptions &= ~VMWebVideoDownloaderProgressiveDownload;
-                // ignore video read from NSURLCache if video if cached but force refreshing
-                downloaderOptions |= VMWebVideoDownloaderIgnoreCachedResponse;
+            if (error && videoDataFilePath) {
+                // The refresh failed, the cached video is still the best we have
+                [self callCompletedBlocksOfLoad:load withFilePath:videoDataFilePath error:nil cacheType:cacheType finished:YES];
             }
-            id <VMWebVideoOperation> subOperation = [self.videoDownloader downloadVideoWithURL:url options:downloaderOptions progress:progressBlock completed:^(NSData *videoData, NSError *error, BOOL finished) {
-                if (weakOperation.isCancelled) {
-                    // Do nothing if the operation was cancelled
-                    // See #699 for more details
-                    // if we would call the completedBlock, there could be a race condition between this block and another completedBlock for the same object, so if this one is called second, we will overwrite the new data
-                }
-                else if (error) {
-                    dispatch_main_sync_safe(^{
-                        if (!weakOperation.isCancelled) {
-                            completedBlock(nil, error, VMVideoCacheTypeNone, finished, url);
-                        }
-                    });
-                    
-                    if (error.code != NSURLErrorNotConnectedToInternet && error.code != NSURLErrorCancelled && error.code != NSURLErrorTimedOut) {
-                        @synchronized (self.failedURLs) {
-                            [self.failedURLs addObject:url];
-                        }
-                    }
-                }
-                else {
-                    
-                    if (options & VMWebVideoRefreshCached && !videoData) {
-                        // video refresh hit the NSURLCache cache, do not call the completion block
-                    }
-                    else {
-                        
-                        if (videoData && finished) {
-                            [self.videoCache storeVideoDataToDisk:videoData forKey:key];
-                        }
-                        
-                        NSURL *path = [self.videoCache videoDataFilePathFromCacheForKey:key];
-                        
-                        dispatch_main_sync_safe(^{
-                            if (!weakOperation.isCancelled) {
-                                completedBlock(path, nil, VMVideoCacheTypeNone, finished, url);
-                            }
-                        });
-                    }
-                }
+            else if (error) {
+                [self callCompletedBlocksOfLoad:load withFilePath:nil error:error cacheType:VMVideoCacheTypeNone finished:finished];
                 
+                if ([VMWebVideoFailedURLCache isURLFailureError:error]) {
+                    [self.failedURLCache recordFailureOfURL:url];
+                }
+            }
+            else if (!videoFileURL && finished && load.prefixLength > 0) {
+                // The prefix is on disk, kept as a partial download
+                [self.failedURLCache removeURL:url];
+                [self callCompletedBlocksOfLoad:load withFilePath:nil error:nil cacheType:VMVideoCacheTypeNone finished:YES];
+            }
+            else if (!videoFileURL && finished) {
+                // 304 Not Modified: the cached video is current, only its freshness and validators change
+                [self.failedURLCache removeURL:url];
+                [self.videoCache refreshVideoForKey:key validators:responseValidators];
+                NSURL *path = videoDataFilePath ?: [self.videoCache videoDataFilePathFromCacheForKey:key];
+                [self callCompletedBlocksOfLoad:load withFilePath:path error:nil cacheType:(path ? VMVideoCacheTypeDisk : VMVideoCacheTypeNone) finished:YES];
+            }
+            else {
                 if (finished) {
-                    @synchronized (self.runningOperations) {
-                        [self.runningOperations removeObject:operation];
-                    }
+                    [self.failedURLCache removeURL:url];
                 }
-            }];
-            operation.cancelBlock = ^{
-                [subOperation cancel];
-                
-                @synchronized (self.runningOperations) {
-                    [self.runningOperations removeObject:weakOperation];
+                if (videoFileURL && finished) {
+                    // The download was streamed to disk, moving it into the cache is a rename, done once for every operation of the load.
+                    // The downloader removes the file when this block returns and calls it on the queue of its session,
+                    // so the file is set aside here and stored without holding that queue.
+                    NSURL *fileURL = [self setAsideDownloadedFile:videoFileURL] ?: videoFileURL;
+                    [self.videoCache storeVideoFileToDiskInBackground:fileURL forKey:key completion:^(NSURL *path, VMVideoCacheType storedCacheType) {
+                        [self callCompletedBlocksOfLoad:load withFilePath:path error:nil cacheType:VMVideoCacheTypeNone finished:YES];
+                    }];
                 }
-            };
-        }
-        else if (videoDataFilePath) {
-            dispatch_main_sync_safe(^{
-                if (!weakOperation.isCancelled) {
-                    completedBlock(videoDataFilePath, nil, cacheType, YES, url);
+                else {
+                    // Progressive download: the partial file, see VMWebVideoProgressiveFile for how much of it is there
+                    NSURL *path = finished ? nil : videoFileURL;
+                    [self callCompletedBlocksOfLoad:load withFilePath:path error:nil cacheType:VMVideoCacheTypeNone finished:finished];
                 }
-            });
-            @synchronized (self.runningOperations) {
-                [self.runningOperations removeObject:operation];
             }
+        };
+        
+        id <VMWebVideoOperation> subOperation;
+        if (load.prefixLength > 0) {
+            subOperation = [self.videoDownloader downloadVideoPrefixWithURL:url length:load.prefixLength options:downloaderOptions progress:progressBlock completed:^(NSURL *videoFileURL, NSError *error, BOOL finished) {
+                completedBlock(videoFileURL, nil, error, finished);
+            }];
         }
         else {
-            // video not in cache and download disallowed by delegate
-            dispatch_main_sync_safe(^{
-                if (!weakOperation.isCancelled) {
-                    completedBlock(nil, nil, VMVideoCacheTypeNone, YES, url);
-                }
-            });
-            @synchronized (self.runningOperations) {
-                [self.runningOperations removeObject:operation];
+            subOperation = [self.videoDownloader downloadVideoToFileWithURL:url options:downloaderOptions validators:validators progress:progressBlock completed:completedBlock];
+        }
+        
+        BOOL cancelled;
+        VMWebVideoOptions currentOptions;
+        @synchronized (self.runningLoads) {
+            load.downloadOperation = subOperation;
+            cancelled = load.isCancelled;
+            currentOptions = load.options;
+        }
+        if (cancelled) {
+            // Every operation was cancelled while the download was being created
+            [subOperation cancel];
+        }
+        else {
+            if ([self priorityOfLoad:load] != priority) {
+                // The priority was changed while the download was being created
+                [self updatePriorityOfLoad:load];
+            }
+            if (currentOptions != options) {
+                // An operation that needs other options joined while the download was being created
+                [self updateOptionsOfLoad:load];
             }
+            [self updateSuspensionOfLoad:load];
         }
-    }];
+    }
+    else if (videoDataFilePath) {
+        [self callCompletedBlocksOfLoad:load withFilePath:videoDataFilePath error:nil cacheType:cacheType finished:YES];
+    }
+    else {
+        // video not in cache and download disallowed by delegate
+        [self callCompletedBlocksOfLoad:load withFilePath:nil error:nil cacheType:VMVideoCacheTypeNone finished:YES];
+    }
+}
+
+// Returns the operations of the load that weren't cancelled. Once the load is finished, it is detached from them
+// and no longer joined by new requests.
+- (NSArray *)operationsOfLoad:(VMWebVideoLoad *)load finishing:(BOOL)finishing {
+    NSArray *operations;
+    @synchronized (self.runningLoads) {
+        operations = [load.operations copy];
+        if (finishing) {
+            [load.operations removeAllObjects];
+            if (self.runningLoads[load.key] == load) {
+                [self.runningLoads removeObjectForKey:load.key];
+            }
+        }
+    }
     
-    return operation;
+    if (finishing) {
+        for (VMWebVideoCombinedOperation *operation in operations) {
+            [self.operationRegistry removeOperation:operation];
+        }
+    }
+    return operations;
+}
+
+// The length of the partial download of a URL the downloader would resume from: it is where the downloader streams
+// the video to, and without a strong validator the server can't be asked for the rest of that version of the video
+- (long long)resumableLengthOfDownloadWithURL:(NSURL *)url {
+    NSURL *temporaryFileURL = [self.videoDownloader temporaryFileURLForURL:url];
+    NSDictionary *validators = [NSDictionary dictionaryWithContentsOfURL:[temporaryFileURL URLByAppendingPathExtension:@"plist"]];
+    NSString *eTag = validators[@"ETag"];
+    if (!(eTag && ![eTag hasPrefix:@"W/"]) && !validators[@"Last-Modified"]) {
+        return 0;
+    }
+    return [[[NSFileManager defaultManager] attributesOfItemAtPath:temporaryFileURL.path error:nil][NSFileSize] longLongValue];
+}
+
+// Moves a finished download next to itself, under a name of its own, so that the downloader doesn't remove it
+// before the cache gets to store it. Returns nil if the file couldn't be moved.
+- (NSURL *)setAsideDownloadedFile:(NSURL *)fileURL {
+    NSURL *setAsideFileURL = [[fileURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    if (![[NSFileManager defaultManager] moveItemAtURL:fileURL toURL:setAsideFileURL error:nil]) {
+        return nil;
+    }
+    // The validators of the response go with it, the cache stores them with the video
+    [[NSFileManager defaultManager] moveItemAtURL:[fileURL URLByAppendingPathExtension:@"plist"] toURL:[setAsideFileURL URLByAppendingPathExtension:@"plist"] error:nil];
+    return setAsideFileURL;
+}
+
+- (void)callCompletedBlocksOfLoad:(VMWebVideoLoad *)load withFilePath:(NSURL *)videoDataFilePath error:(NSError *)error cacheType:(VMVideoCacheType)cacheType finished:(BOOL)finished {
+    NSArray *operations;
+    if (finished) {
+        operations = [self operationsOfLoad:load finishing:YES];
+    }
+    else {
+        // Operations that join from now on get the partial file when they join
+        @synchronized (self.runningLoads) {
+            load.partialFilePath = videoDataFilePath;
+            operations = [load.operations copy];
+        }
+    }
+    CFAbsoluteTime deliveryStartTime = VMWebVideoMetricsStartTime();
+    // Never waits for the main thread, this is called on the queues of the cache and the downloader
+    dispatch_main_async_safe(^{
+        for (VMWebVideoCombinedOperation *operation in operations) {
+            if (!operation.isCancelled && operation.completedBlock) {
+                operation.completedBlock(videoDataFilePath, error, cacheType, finished, operation.url);
+            }
+            if (finished) {
+                // The caller may keep the operation around, it shouldn't keep the blocks alive
+                operation.progressBlock = nil;
+                operation.completedBlock = nil;
+                operation.priorityBlock = nil;
+                operation.suspensionBlock = nil;
+            }
+        }
+        VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStageCallbackDelivery, deliveryStartTime);
+    });
+}
+
+- (void)removeOperation:(VMWebVideoCombinedOperation *)operation fromLoad:(VMWebVideoLoad *)load {
+    if (!operation || !load) {
+        return;
+    }
+    
+    BOOL abandoned = NO;
+    @synchronized (self.runningLoads) {
+        if ([load.operations containsObject:operation]) {
+            [load.operations removeObject:operation];
+            abandoned = (load.operations.count == 0);
+        }
+        if (abandoned) {
+            load.cancelled = YES;
+            if (self.runningLoads[load.key] == load) {
+                [self.runningLoads removeObjectForKey:load.key];
+            }
+        }
+    }
+    
+    if (abandoned) {
+        // Nobody is waiting for the video anymore
+        [load.cacheOperation cancel];
+        [load.downloadOperation cancel];
+    }
+    else {
+        [self updatePriorityOfLoad:load];
+        [self updateSuspensionOfLoad:load];
+    }
+}
+
+- (VMWebVideoDownloadPriority)priorityOfLoad:(VMWebVideoLoad *)load {
+    VMWebVideoDownloadPriority priority = VMWebVideoDownloadPriorityPrefetch;
+    @synchronized (self.runningLoads) {
+        for (VMWebVideoCombinedOperation *operation in load.operations) {
+            priority = MAX(priority, operation.priority);
+        }
+    }
+    return priority;
+}
+
+// Applied to the download of the load rather than by URL, a refresh has a download of its own
+- (void)updatePriorityOfLoad:(VMWebVideoLoad *)load {
+    id <VMWebVideoOperation> downloadOperation = load.downloadOperation;
+    if ([downloadOperation respondsToSelector:@selector(setPriority:)]) {
+        [downloadOperation setPriority:[self priorityOfLoad:load]];
+    }
+}
+
+// Adds the options that operations joined with to the download
+- (void)updateOptionsOfLoad:(VMWebVideoLoad *)load {
+    id <VMWebVideoOperation> downloadOperation = load.downloadOperation;
+    if (![downloadOperation respondsToSelector:@selector(addOptions:)]) {
+        return;
+    }
+    
+    VMWebVideoOptions options;
+    @synchronized (self.runningLoads) {
+        options = load.options;
+    }
+    VMWebVideoDownloaderOptions downloaderOptions = 0;
+    if (options & VMWebVideoProgressiveDownload) downloaderOptions |= VMWebVideoDownloaderProgressiveDownload;
+    if (options & VMWebVideoSegmentedDownload) downloaderOptions |= VMWebVideoDownloaderSegmentedDownload;
+    [(id)downloadOperation addOptions:downloaderOptions];
+}
+
+// The download is suspended while all the operations waiting for it are
+- (void)updateSuspensionOfLoad:(VMWebVideoLoad *)load {
+    id <VMWebVideoOperation> downloadOperation = load.downloadOperation;
+    if (![downloadOperation respondsToSelector:@selector(setSuspended:)]) {
+        return;
+    }
+    
+    BOOL suspended = YES;
+    @synchronized (self.runningLoads) {
+        for (VMWebVideoCombinedOperation *operation in load.operations) {
+            suspended = suspended && operation.isSuspended;
+        }
+        suspended = suspended && load.operations.count > 0;
+    }
+    [downloadOperation setSuspended:suspended];
 }
 
 - (void)saveVideoToCache:(NSData *)video forURL:(NSURL *)url {
@@ -239,15 +614,11 @@
 }
 
 - (void)cancelAll {
-    @synchronized (self.runningOperations) {
-        NSArray *copiedOperations = [self.runningOperations copy];
-        [copiedOperations makeObjectsPerformSelector:@selector(cancel)];
-        [self.runningOperations removeObjectsInArray:copiedOperations];
-    }
+    [self.operationRegistry cancelAllOperations];
 }
 
 - (BOOL)isRunning {
-    return self.runningOperations.count > 0;
+    return self.operationRegistry.count > 0;
 }
 
 @end
@@ -267,12 +638,24 @@
     }
 }
 
+- (void)setPriority:(VMWebVideoDownloadPriority)priority {
+    _priority = priority;
+    if (self.priorityBlock) {
+        self.priorityBlock(priority);
+    }
+}
+
+- (void)setSuspended:(BOOL)suspended {
+    _suspended = suspended;
+    if (self.suspensionBlock) {
+        self.suspensionBlock(suspended);
+    }
+}
+
 - (void)cancel {
     self.cancelled = YES;
-    if (self.cacheOperation) {
-        [self.cacheOperation cancel];
-        self.cacheOperation = nil;
-    }
+    self.priorityBlock = nil;
+    self.suspensionBlock = nil;
     if (self.cancelBlock) {
         self.cancelBlock();
         
@@ -0,0 +1,161 @@
+//
+//  VMWebVideoMetrics.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "VMVideoCache.h"
+
+/**
+ * The stages of a request that are timed.
+ */
+typedef NS_ENUM(NSUInteger, VMWebVideoMetricsStage) {
+    /**
+     * From the cache query of a request to its answer.
+     */
+    VMWebVideoMetricsStageCacheLookup,
+    
+    /**
+     * From the creation of a download to its start, i.e. the time spent waiting for a slot.
+     */
+    VMWebVideoMetricsStageQueueWait,
+    
+    /**
+     * From the start of a download to the response of the server.
+     */
+    VMWebVideoMetricsStageTimeToFirstByte,
+    
+    /**
+     * From the response of the server to the last byte of the video.
+     */
+    VMWebVideoMetricsStageTransfer,
+    
+    /**
+     * Moving or writing a downloaded video into the cache.
+     */
+    VMWebVideoMetricsStageDiskStore,
+    
+    /**
+     * From the end of a request to its completion blocks being called on the main queue.
+     */
+    VMWebVideoMetricsStageCallbackDelivery,
+    
+    VMWebVideoMetricsStageCount
+};
+
+/**
+ * The events that are counted.
+ */
+typedef NS_ENUM(NSUInteger, VMWebVideoMetricsCounter) {
+    VMWebVideoMetricsCounterCacheMiss,
+    VMWebVideoMetricsCounterCacheHitDisk,
+    VMWebVideoMetricsCounterCacheHitMemory,
+    
+    /**
+     * Bytes received from the network.
+     */
+    VMWebVideoMetricsCounterBytesReceived,
+    
+    /**
+     * Bytes stored into the cache.
+     */
+    VMWebVideoMetricsCounterBytesStored,
+    
+    /**
+     * Bytes sent to players by `VMWebVideoServer`.
+     */
+    VMWebVideoMetricsCounterBytesServed,
+    
+    /**
+     * Requests that joined a download already running for the same URL instead of starting their own.
+     */
+    VMWebVideoMetricsCounterDownloadJoins,
+    
+    /**
+     * Videos evicted from the disk cache to make room.
+     */
+    VMWebVideoMetricsCounterEvictions,
+    
+    VMWebVideoMetricsCounterCount
+};
+
+/**
+ * Set through `-[VMWebVideoMetrics setEnabled:]`. Read without synchronization by the instrumented code, so that
+ * disabled metrics cost a single load and branch per event.
+ */
+extern BOOL VMWebVideoMetricsEnabled;
+
+void VMWebVideoMetricsRecordDurationSince(VMWebVideoMetricsStage stage, CFAbsoluteTime startTime);
+void VMWebVideoMetricsAddToCounter(VMWebVideoMetricsCounter counter, int64_t amount);
+
+/**
+ * Returns the time to pass to `VMWebVideoMetricsRecordDuration` at the end of a stage, 0 when metrics are disabled.
+ */
+static inline CFAbsoluteTime VMWebVideoMetricsStartTime(void) {
+    return VMWebVideoMetricsEnabled ? CFAbsoluteTimeGetCurrent() : 0;
+}
+
+/**
+ * Records the duration of a stage started at `startTime`. Does nothing if `startTime` is 0.
+ */
+static inline void VMWebVideoMetricsRecordDuration(VMWebVideoMetricsStage stage, CFAbsoluteTime startTime) {
+    if (VMWebVideoMetricsEnabled && startTime > 0) {
+        VMWebVideoMetricsRecordDurationSince(stage, startTime);
+    }
+}
+
+static inline void VMWebVideoMetricsCount(VMWebVideoMetricsCounter counter, int64_t amount) {
+    if (VMWebVideoMetricsEnabled) {
+        VMWebVideoMetricsAddToCounter(counter, amount);
+    }
+}
+
+static inline void VMWebVideoMetricsCountCacheLookup(VMVideoCacheType cacheType) {
+    switch (cacheType) {
+        case VMVideoCacheTypeDisk:
+            VMWebVideoMetricsCount(VMWebVideoMetricsCounterCacheHitDisk, 1);
+            break;
+        case VMVideoCacheTypeMemory:
+            VMWebVideoMetricsCount(VMWebVideoMetricsCounterCacheHitMemory, 1);
+            break;
+        default:
+            VMWebVideoMetricsCount(VMWebVideoMetricsCounterCacheMiss, 1);
+            break;
+    }
+}
+
+/**
+ * Counters and latency histograms of the whole library, for a host app to sample or export.
+ *
+ * Every event is recorded with atomic increments, without locks or allocations. Durations go into histograms with
+ * power of two buckets of microseconds, so percentiles are approximate to a factor of two.
+ */
+@interface VMWebVideoMetrics : NSObject
+
++ (VMWebVideoMetrics *)sharedMetrics;
+
+/**
+ * Whether events are recorded. Defaults to NO.
+ */
+@property (assign, nonatomic, getter = isEnabled) BOOL enabled;
+
+/**
+ * Returns the current values, as property list types:
+ *
+ * - `counters`: the name of each counter to its value
+ * - `stages`: the name of each stage to its `count`, `total`, `mean`, `max`, `p50`, `p90` and `p99`, in seconds
+ * - `cacheHitRatio`: the share of cache lookups that were hits, absent before the first lookup
+ *
+ * Events recorded while the snapshot is taken may be only partly included.
+ */
+- (NSDictionary *)snapshot;
+
+/**
+ * Sets all counters and histograms back to zero.
+ */
+- (void)reset;
+
+@end
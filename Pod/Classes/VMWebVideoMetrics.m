@@ -0,0 +1,163 @@
+//
+//  VMWebVideoMetrics.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoMetrics.h"
+#import <libkern/OSAtomic.h>
+
+// Bucket i counts durations of less than 2^(i+1) microseconds, the last one everything longer (about 36 minutes)
+#define kBucketCount 32
+
+BOOL VMWebVideoMetricsEnabled = NO;
+
+// OSAtomicAdd64 needs 8 byte alignment on 32 bit devices
+static int64_t counters[VMWebVideoMetricsCounterCount] __attribute__((aligned(8)));
+static int64_t buckets[VMWebVideoMetricsStageCount][kBucketCount] __attribute__((aligned(8)));
+static int64_t totalMicroseconds[VMWebVideoMetricsStageCount] __attribute__((aligned(8)));
+static int64_t maxMicroseconds[VMWebVideoMetricsStageCount] __attribute__((aligned(8)));
+
+static NSString *const kCounterNames[VMWebVideoMetricsCounterCount] = {
+    [VMWebVideoMetricsCounterCacheMiss] = @"cacheMiss",
+    [VMWebVideoMetricsCounterCacheHitDisk] = @"cacheHitDisk",
+    [VMWebVideoMetricsCounterCacheHitMemory] = @"cacheHitMemory",
+    [VMWebVideoMetricsCounterBytesReceived] = @"bytesReceived",
+    [VMWebVideoMetricsCounterBytesStored] = @"bytesStored",
+    [VMWebVideoMetricsCounterBytesServed] = @"bytesServed",
+    [VMWebVideoMetricsCounterDownloadJoins] = @"downloadJoins",
+    [VMWebVideoMetricsCounterEvictions] = @"evictions",
+};
+
+static NSString *const kStageNames[VMWebVideoMetricsStageCount] = {
+    [VMWebVideoMetricsStageCacheLookup] = @"cacheLookup",
+    [VMWebVideoMetricsStageQueueWait] = @"queueWait",
+    [VMWebVideoMetricsStageTimeToFirstByte] = @"timeToFirstByte",
+    [VMWebVideoMetricsStageTransfer] = @"transfer",
+    [VMWebVideoMetricsStageDiskStore] = @"diskStore",
+    [VMWebVideoMetricsStageCallbackDelivery] = @"callbackDelivery",
+};
+
+void VMWebVideoMetricsRecordDurationSince(VMWebVideoMetricsStage stage, CFAbsoluteTime startTime) {
+    if (stage >= VMWebVideoMetricsStageCount) {
+        return;
+    }
+    
+    int64_t microseconds = (int64_t)((CFAbsoluteTimeGetCurrent() - startTime) * 1000000.0);
+    if (microseconds < 0) {
+        // The clock was set back
+        microseconds = 0;
+    }
+    
+    int bucket = 0;
+    if (microseconds > 1) {
+        bucket = MIN(63 - __builtin_clzll((uint64_t)microseconds), kBucketCount - 1);
+    }
+    OSAtomicAdd64(1, &buckets[stage][bucket]);
+    OSAtomicAdd64(microseconds, &totalMicroseconds[stage]);
+    
+    int64_t max;
+    do {
+        max = maxMicroseconds[stage];
+    } while (microseconds > max && !OSAtomicCompareAndSwap64(max, microseconds, &maxMicroseconds[stage]));
+}
+
+void VMWebVideoMetricsAddToCounter(VMWebVideoMetricsCounter counter, int64_t amount) {
+    if (counter < VMWebVideoMetricsCounterCount) {
+        OSAtomicAdd64(amount, &counters[counter]);
+    }
+}
+
+// The upper bound of the bucket holding the given fraction of the samples, in seconds
+static double VMWebVideoMetricsPercentile(const int64_t *stageBuckets, int64_t count, double fraction) {
+    int64_t rank = (int64_t)ceil(count * fraction);
+    int64_t seen = 0;
+    for (int i = 0; i < kBucketCount; i++) {
+        seen += stageBuckets[i];
+        if (seen >= rank) {
+            return (double)(2LL << i) / 1000000.0;
+        }
+    }
+    return (double)(2LL << (kBucketCount - 1)) / 1000000.0;
+}
+
+static void VMWebVideoMetricsClear(volatile int64_t *value) {
+    int64_t old;
+    do {
+        old = *value;
+    } while (!OSAtomicCompareAndSwap64(old, 0, value));
+}
+
+@implementation VMWebVideoMetrics
+
++ (VMWebVideoMetrics *)sharedMetrics {
+    static dispatch_once_t once;
+    static id instance;
+    dispatch_once(&once, ^{
+        instance = [self new];
+    });
+    return instance;
+}
+
+- (BOOL)isEnabled {
+    return VMWebVideoMetricsEnabled;
+}
+
+- (void)setEnabled:(BOOL)enabled {
+    VMWebVideoMetricsEnabled = enabled;
+    OSMemoryBarrier();
+}
+
+- (NSDictionary *)snapshot {
+    NSMutableDictionary *counterValues = [NSMutableDictionary dictionaryWithCapacity:VMWebVideoMetricsCounterCount];
+    for (NSUInteger i = 0; i < VMWebVideoMetricsCounterCount; i++) {
+        counterValues[kCounterNames[i]] = @(OSAtomicAdd64(0, &counters[i]));
+    }
+    
+    NSMutableDictionary *stageValues = [NSMutableDictionary dictionaryWithCapacity:VMWebVideoMetricsStageCount];
+    for (NSUInteger stage = 0; stage < VMWebVideoMetricsStageCount; stage++) {
+        int64_t stageBuckets[kBucketCount];
+        int64_t count = 0;
+        for (int i = 0; i < kBucketCount; i++) {
+            stageBuckets[i] = OSAtomicAdd64(0, &buckets[stage][i]);
+            count += stageBuckets[i];
+        }
+        
+        double total = OSAtomicAdd64(0, &totalMicroseconds[stage]) / 1000000.0;
+        NSMutableDictionary *values = [@{@"count": @(count), @"total": @(total)} mutableCopy];
+        if (count > 0) {
+            values[@"mean"] = @(total / count);
+            values[@"max"] = @(OSAtomicAdd64(0, &maxMicroseconds[stage]) / 1000000.0);
+            values[@"p50"] = @(VMWebVideoMetricsPercentile(stageBuckets, count, 0.5));
+            values[@"p90"] = @(VMWebVideoMetricsPercentile(stageBuckets, count, 0.9));
+            values[@"p99"] = @(VMWebVideoMetricsPercentile(stageBuckets, count, 0.99));
+        }
+        stageValues[kStageNames[stage]] = values;
+    }
+    
+    NSMutableDictionary *snapshot = [@{@"counters": counterValues, @"stages": stageValues} mutableCopy];
+    int64_t hits = [counterValues[kCounterNames[VMWebVideoMetricsCounterCacheHitDisk]] longLongValue] + [counterValues[kCounterNames[VMWebVideoMetricsCounterCacheHitMemory]] longLongValue];
+    int64_t lookups = hits + [counterValues[kCounterNames[VMWebVideoMetricsCounterCacheMiss]] longLongValue];
+    if (lookups > 0) {
+        snapshot[@"cacheHitRatio"] = @((double)hits / lookups);
+    }
+    return snapshot;
+}
+
+- (void)reset {
+    // Concurrent events may survive the reset, which is fine for statistics
+    for (NSUInteger i = 0; i < VMWebVideoMetricsCounterCount; i++) {
+        VMWebVideoMetricsClear(&counters[i]);
+    }
+    for (NSUInteger stage = 0; stage < VMWebVideoMetricsStageCount; stage++) {
+        for (int i = 0; i < kBucketCount; i++) {
+            VMWebVideoMetricsClear(&buckets[stage][i]);
+        }
+        VMWebVideoMetricsClear(&totalMicroseconds[stage]);
+        VMWebVideoMetricsClear(&maxMicroseconds[stage]);
+    }
+}
+
+@end
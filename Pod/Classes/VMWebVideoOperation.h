@@ -9,10 +9,42 @@
 #ifndef VMWebVideo_VMWebVideoOperation_h
 #define VMWebVideo_VMWebVideoOperation_h
 
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, VMWebVideoDownloadPriority) {
+    /**
+     * Bulk downloads nobody is waiting for. They don't start while a visible download is running or waiting.
+     */
+    VMWebVideoDownloadPriorityPrefetch = -1,
+    
+    /**
+     * Videos that are about to be shown, e.g. the next cell. This is the default.
+     */
+    VMWebVideoDownloadPriorityNearVisible = 0,
+    
+    /**
+     * Videos that are on screen right now.
+     */
+    VMWebVideoDownloadPriorityVisible = 1,
+};
+
 @protocol VMWebVideoOperation <NSObject>
 
 - (void)cancel;
 
+@optional
+
+/**
+ * Moves a queued or running download to another priority class.
+ */
+- (void)setPriority:(VMWebVideoDownloadPriority)priority;
+
+/**
+ * Pauses or resumes a download without losing what was downloaded. A paused download keeps its slot in the queue,
+ * and doesn't time out.
+ */
+- (void)setSuspended:(BOOL)suspended;
+
 @end
 
 
@@ -0,0 +1,59 @@
+//
+//  VMWebVideoOperationRegistry.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "VMWebVideoOperation.h"
+
+/**
+ * Keeps track of running operations, optionally tagged, so that they can be controlled in groups, e.g. all the
+ * requests of a screen or of a prefetch batch.
+ *
+ * Operations are tracked by identity, and adding or removing one doesn't scan the others. Adding and removing
+ * doesn't wait for readers either: changes are applied asynchronously, in order, on a private queue.
+ */
+@interface VMWebVideoOperationRegistry : NSObject
+
+/**
+ * Starts tracking the operation under the given tags, which are strings. `tags` may be nil.
+ */
+- (void)addOperation:(id <VMWebVideoOperation>)operation tags:(NSSet *)tags;
+
+/**
+ * Stops tracking the operation, e.g. because it finished.
+ */
+- (void)removeOperation:(id <VMWebVideoOperation>)operation;
+
+/**
+ * The number of operations tracked.
+ */
+- (NSUInteger)count;
+
+- (NSArray *)operations;
+- (NSArray *)operationsWithTag:(NSString *)tag;
+
+/**
+ * Cancels all the operations with the given tag, and stops tracking them.
+ */
+- (void)cancelOperationsWithTag:(NSString *)tag;
+
+/**
+ * Cancels all the operations, and stops tracking them.
+ */
+- (void)cancelAllOperations;
+
+/**
+ * Moves the operations with the given tag to another priority class. Operations that don't implement `setPriority:` are skipped.
+ */
+- (void)setPriority:(VMWebVideoDownloadPriority)priority forOperationsWithTag:(NSString *)tag;
+
+/**
+ * Pauses or resumes the operations with the given tag. Operations that don't implement `setSuspended:` are skipped.
+ */
+- (void)setSuspended:(BOOL)suspended forOperationsWithTag:(NSString *)tag;
+
+@end
@@ -0,0 +1,148 @@
+//
+//  VMWebVideoOperationRegistry.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoOperationRegistry.h"
+#import "VMWebVideoCompat.h"
+
+@interface VMWebVideoOperationRegistry ()
+
+// Operations to the set of their tags, compared by pointer. Read with dispatch_sync and written with barriers on the queue.
+@property (strong, nonatomic) NSMapTable *operationTags;
+// Tags to the operations that have them
+@property (strong, nonatomic) NSMutableDictionary *taggedOperations;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t queue;
+
+@end
+
+@implementation VMWebVideoOperationRegistry
+
+- (id)init {
+    if ((self = [super init])) {
+        _operationTags = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory];
+        _taggedOperations = [NSMutableDictionary new];
+        _queue = dispatch_queue_create("com.vmlabs.VMWebVideoOperationRegistry", DISPATCH_QUEUE_CONCURRENT);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    VMDispatchQueueRelease(_queue);
+}
+
+- (void)addOperation:(id <VMWebVideoOperation>)operation tags:(NSSet *)tags {
+    if (!operation) {
+        return;
+    }
+    
+    tags = [tags copy] ?: [NSSet set];
+    dispatch_barrier_async(self.queue, ^{
+        [self.operationTags setObject:tags forKey:operation];
+        for (NSString *tag in tags) {
+            NSHashTable *operations = self.taggedOperations[tag];
+            if (!operations) {
+                operations = [NSHashTable hashTableWithOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality];
+                self.taggedOperations[tag] = operations;
+            }
+            [operations addObject:operation];
+        }
+    });
+}
+
+- (void)removeOperation:(id <VMWebVideoOperation>)operation {
+    if (!operation) {
+        return;
+    }
+    
+    dispatch_barrier_async(self.queue, ^{
+        [self forgetOperation:operation];
+    });
+}
+
+// Must be called in a barrier on the queue
+- (void)forgetOperation:(id <VMWebVideoOperation>)operation {
+    NSSet *tags = [self.operationTags objectForKey:operation];
+    if (!tags) {
+        return;
+    }
+    
+    [self.operationTags removeObjectForKey:operation];
+    for (NSString *tag in tags) {
+        NSHashTable *operations = self.taggedOperations[tag];
+        [operations removeObject:operation];
+        if (operations.count == 0) {
+            [self.taggedOperations removeObjectForKey:tag];
+        }
+    }
+}
+
+- (NSUInteger)count {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.queue, ^{
+        count = self.operationTags.count;
+    });
+    return count;
+}
+
+- (NSArray *)operations {
+    __block NSArray *operations = nil;
+    dispatch_sync(self.queue, ^{
+        operations = [[self.operationTags keyEnumerator] allObjects];
+    });
+    return operations;
+}
+
+- (NSArray *)operationsWithTag:(NSString *)tag {
+    if (!tag) {
+        return @[];
+    }
+    
+    __block NSArray *operations = nil;
+    dispatch_sync(self.queue, ^{
+        operations = [self.taggedOperations[tag] allObjects] ?: @[];
+    });
+    return operations;
+}
+
+- (void)cancelOperations:(NSArray *)operations {
+    dispatch_barrier_async(self.queue, ^{
+        for (id <VMWebVideoOperation> operation in operations) {
+            [self forgetOperation:operation];
+        }
+    });
+    
+    // Outside of the queue, cancelling may call back into the registry
+    for (id <VMWebVideoOperation> operation in operations) {
+        [operation cancel];
+    }
+}
+
+- (void)cancelOperationsWithTag:(NSString *)tag {
+    [self cancelOperations:[self operationsWithTag:tag]];
+}
+
+- (void)cancelAllOperations {
+    [self cancelOperations:[self operations]];
+}
+
+- (void)setPriority:(VMWebVideoDownloadPriority)priority forOperationsWithTag:(NSString *)tag {
+    for (id <VMWebVideoOperation> operation in [self operationsWithTag:tag]) {
+        if ([operation respondsToSelector:@selector(setPriority:)]) {
+            [operation setPriority:priority];
+        }
+    }
+}
+
+- (void)setSuspended:(BOOL)suspended forOperationsWithTag:(NSString *)tag {
+    for (id <VMWebVideoOperation> operation in [self operationsWithTag:tag]) {
+        if ([operation respondsToSelector:@selector(setSuspended:)]) {
+            [operation setSuspended:suspended];
+        }
+    }
+}
+
+@end
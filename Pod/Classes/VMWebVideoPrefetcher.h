@@ -50,14 +50,34 @@ typedef void(^VMWebVideoPrefetcherCompletionBlock)(NSUInteger noOfFinishedUrls,
 
 /**
  * Maximum number of URLs to prefetch at the same time. Defaults to 3.
+ * This only limits the prefetcher's own requests, the downloader it shares with the rest of the app is left alone.
  */
 @property (nonatomic, assign) NSUInteger maxConcurrentDownloads;
 
+/**
+ * Maximum number of bytes prefetched per minute, 0 for no limit. Defaults to 0.
+ * Once the prefetches of the last minute reach it, the next prefetch waits; running prefetches are not interrupted.
+ */
+@property (nonatomic, assign) unsigned long long maxBytesPerMinute;
+
+/**
+ * When greater than 0, only the first `prefixLength` bytes of each video are prefetched, which is usually enough to start
+ * playing while the rest downloads. The prefix is kept as a partial entry of the cache (see
+ * `-[VMVideoCache partialLengthForKey:]`) that the download of the whole video later resumes from. Defaults to 0.
+ */
+@property (nonatomic, assign) long long prefixLength;
+
 /**
  * SDWebImageOptions for prefetcher. Defaults to SDWebImageLowPriority.
  */
 @property (nonatomic, assign) VMWebVideoOptions options;
 
+/**
+ * Prefetches are tracked under this tag in the manager's `operationRegistry`, so that they can be paused or cancelled
+ * apart from the other requests of the manager. Defaults to "VMWebVideoPrefetcher".
+ */
+@property (nonatomic, copy) NSString *tag;
+
 @property (weak, nonatomic) id <VMWebVideoPrefetcherDelegate> delegate;
 
 /**
@@ -66,18 +86,20 @@ typedef void(^VMWebVideoPrefetcherCompletionBlock)(NSUInteger noOfFinishedUrls,
 + (VMWebVideoPrefetcher *)sharedVideoPrefetcher;
 
 /**
- * Assign list of URLs to let SDWebImagePrefetcher to queue the prefetching,
- * currently one image is downloaded at a time,
- * and skips images for failed downloads and proceed to the next image in the list
+ * Assign list of URLs to let VMWebVideoPrefetcher to queue the prefetching,
+ * up to `maxConcurrentDownloads` videos are downloaded at a time, in the order of the list,
+ * and skips videos for failed downloads and proceed to the next video in the list
+ *
+ * Prefetches of URLs that were in the previous list and are still in the new one are not restarted.
  *
  * @param urls list of URLs to prefetch
  */
 - (void)prefetchURLs:(NSArray *)urls;
 
 /**
- * Assign list of URLs to let SDWebImagePrefetcher to queue the prefetching,
- * currently one image is downloaded at a time,
- * and skips images for failed downloads and proceed to the next image in the list
+ * Assign list of URLs to let VMWebVideoPrefetcher to queue the prefetching,
+ * up to `maxConcurrentDownloads` videos are downloaded at a time, in the order of the list,
+ * and skips videos for failed downloads and proceed to the next video in the list
  *
  * @param urls            list of URLs to prefetch
  * @param progressBlock   block to be called when progress updates;
@@ -89,6 +111,18 @@ typedef void(^VMWebVideoPrefetcherCompletionBlock)(NSUInteger noOfFinishedUrls,
  */
 - (void)prefetchURLs:(NSArray *)urls progress:(VMWebVideoPrefetcherProgressBlock)progressBlock completed:(VMWebVideoPrefetcherCompletionBlock)completionBlock;
 
+/**
+ * Replaces the list of URLs to prefetch with a window that moves, e.g. the videos just ahead of the scroll position,
+ * most important first. Call it as often as the window changes.
+ *
+ * Prefetches of URLs that are still in the window keep going, only those of URLs that left it are cancelled.
+ * URLs already prefetched while they were in the window aren't fetched again. The counters and blocks of
+ * `prefetchURLs:progress:completed:` carry on.
+ *
+ * @param urls the ordered window of URLs to prefetch
+ */
+- (void)updateWindowWithURLs:(NSArray *)urls;
+
 /**
  * Remove and cancel queued list
  */
@@ -8,16 +8,27 @@
 
 #import "VMWebVideoPrefetcher.h"
 
+// Downloaded bytes are counted over a sliding window of this length for maxBytesPerMinute
+static const NSTimeInterval kBudgetInterval = 60.0;
+
 @interface VMWebVideoPrefetcher ()
 
 @property (strong, nonatomic) VMWebVideoManager *manager;
+// The state below is only touched on the main queue
 @property (strong, nonatomic) NSArray *prefetchURLs;
-@property (assign, nonatomic) NSUInteger requestedCount;
+@property (strong, nonatomic) NSMutableDictionary *runningOperations;
+@property (strong, nonatomic) NSMutableSet *prefetchedURLs;
 @property (assign, nonatomic) NSUInteger skippedCount;
 @property (assign, nonatomic) NSUInteger finishedCount;
 @property (assign, nonatomic) NSTimeInterval startedTime;
+@property (assign, nonatomic) BOOL budgetRetryScheduled;
+@property (assign, nonatomic) NSUInteger checkingCacheCount;
 @property (copy, nonatomic) VMWebVideoPrefetcherCompletionBlock completionBlock;
 @property (copy, nonatomic) VMWebVideoPrefetcherProgressBlock progressBlock;
+// Received bytes per prefetch and the times they were received at, guarded by @synchronized on downloadLog.
+// Progress is reported on the download's queue, so it is counted there rather than bounced to the main queue.
+@property (strong, nonatomic) NSMutableArray *downloadLog;
+@property (strong, nonatomic) NSMutableDictionary *receivedSizes;
 
 @end
 
@@ -36,65 +47,208 @@
     if ((self = [super init])) {
         _manager = [VMWebVideoManager new];
         _options = VMWebVideoLowPriority;
-        self.maxConcurrentDownloads = 3;
+        _tag = @"VMWebVideoPrefetcher";
+        _maxConcurrentDownloads = 3;
+        _prefetchURLs = @[];
+        _runningOperations = [NSMutableDictionary new];
+        _prefetchedURLs = [NSMutableSet new];
+        _downloadLog = [NSMutableArray new];
+        _receivedSizes = [NSMutableDictionary new];
     }
     return self;
 }
 
-- (void)setMaxConcurrentDownloads:(NSUInteger)maxConcurrentDownloads {
-    self.manager.videoDownloader.maxConcurrentDownloads = maxConcurrentDownloads;
+#pragma mark Window
+
+- (void)prefetchURLs:(NSArray *)urls {
+    [self prefetchURLs:urls progress:nil completed:nil];
 }
 
-- (NSUInteger)maxConcurrentDownloads {
-    return self.manager.videoDownloader.maxConcurrentDownloads;
+- (void)prefetchURLs:(NSArray *)urls progress:(VMWebVideoPrefetcherProgressBlock)progressBlock completed:(VMWebVideoPrefetcherCompletionBlock)completionBlock {
+    dispatch_main_sync_safe(^{
+        // A new list starts new counters, but prefetches of URLs that are still listed keep going
+        self.startedTime = CFAbsoluteTimeGetCurrent();
+        self.skippedCount = 0;
+        self.finishedCount = 0;
+        self.completionBlock = completionBlock;
+        self.progressBlock = progressBlock;
+        [self.prefetchedURLs removeAllObjects];
+        [self setWindowURLs:urls];
+    });
 }
 
-- (void)startPrefetchingAtIndex:(NSUInteger)index {
-    if (index >= self.prefetchURLs.count) return;
-    self.requestedCount++;
-    [self.manager downloadVideoWithURL:self.prefetchURLs[index] options:self.options progress:nil completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
-        
-        if (!finished) return;
-        self.finishedCount++;
-        
-        if (videoDataFilePath) {
-            if (self.progressBlock) {
-                self.progressBlock(self.finishedCount,[self.prefetchURLs count]);
+- (void)updateWindowWithURLs:(NSArray *)urls {
+    dispatch_main_sync_safe(^{
+        [self setWindowURLs:urls];
+    });
+}
+
+- (void)setWindowURLs:(NSArray *)urls {
+    self.prefetchURLs = [urls copy] ?: @[];
+    NSSet *window = [NSSet setWithArray:self.prefetchURLs];
+    
+    for (NSURL *url in [self.runningOperations allKeys]) {
+        if (![window containsObject:url]) {
+            // Scrolled out of the window
+            [self.runningOperations[url] cancel];
+            [self.runningOperations removeObjectForKey:url];
+            @synchronized (self.downloadLog) {
+                [self.receivedSizes removeObjectForKey:url];
             }
-            NSLog(@"Prefetched %@ out of %@", @(self.finishedCount), @(self.prefetchURLs.count));
         }
-        else {
-            if (self.progressBlock) {
-                self.progressBlock(self.finishedCount,[self.prefetchURLs count]);
-            }
-            NSLog(@"Prefetched %@ out of %@ (Failed)", @(self.finishedCount), @(self.prefetchURLs.count));
-            
-            // Add last failed
-            self.skippedCount++;
+    }
+    [self.prefetchedURLs intersectSet:window];
+    
+    if (self.prefetchURLs.count == 0) {
+        [self finishIfDone];
+        return;
+    }
+    
+    NSMutableArray *pendingURLs = [NSMutableArray array];
+    for (NSURL *url in self.prefetchURLs) {
+        if (!self.runningOperations[url] && ![self.prefetchedURLs containsObject:url]) {
+            [pendingURLs addObject:url];
         }
-        if ([self.delegate respondsToSelector:@selector(videoPrefetcher:didPrefetchURL:finishedCount:totalCount:)]) {
-            [self.delegate videoPrefetcher:self
-                            didPrefetchURL:self.prefetchURLs[index]
-                             finishedCount:self.finishedCount
-                                totalCount:self.prefetchURLs.count
-             ];
+    }
+    if (pendingURLs.count == 0) {
+        [self startPrefetching];
+        return;
+    }
+    
+    // Cached videos are counted as prefetched from one lookup, rather than through one operation each
+    self.checkingCacheCount++;
+    __weak VMWebVideoPrefetcher *wself = self;
+    [self.manager cachedVideosExistForURLs:pendingURLs completion:^(NSDictionary *existence) {
+        [wself didCheckCacheWithExistence:existence];
+    }];
+}
+
+- (void)didCheckCacheWithExistence:(NSDictionary *)existence {
+    self.checkingCacheCount--;
+    for (NSURL *url in self.prefetchURLs) {
+        if ([existence[url] boolValue] && !self.runningOperations[url] && ![self.prefetchedURLs containsObject:url]) {
+            [self recordPrefetchOfURL:url succeeded:YES];
         }
-        
-        if (self.prefetchURLs.count > self.requestedCount) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self startPrefetchingAtIndex:self.requestedCount];
-            });
+    }
+    if (self.checkingCacheCount == 0) {
+        [self startPrefetching];
+    }
+}
+
+- (NSURL *)nextURL {
+    for (NSURL *url in self.prefetchURLs) {
+        if (!self.runningOperations[url] && ![self.prefetchedURLs containsObject:url]) {
+            return url;
         }
-        else if (self.finishedCount == self.requestedCount) {
-            [self reportStatus];
-            if (self.completionBlock) {
-                self.completionBlock(self.finishedCount, self.skippedCount);
-                self.completionBlock = nil;
-            }
+    }
+    return nil;
+}
+
+- (void)startPrefetching {
+    if (self.checkingCacheCount > 0) {
+        // Started once the cache has answered
+        return;
+    }
+    
+    NSURL *url;
+    while (self.runningOperations.count < self.maxConcurrentDownloads && (url = [self nextURL])) {
+        NSTimeInterval budgetDelay = [self delayUntilBudgetAvailable];
+        if (budgetDelay > 0) {
+            [self retryAfterDelay:budgetDelay];
+            break;
         }
+        [self startPrefetchingURL:url];
+    }
+    [self finishIfDone];
+}
+
+- (void)startPrefetchingURL:(NSURL *)url {
+    __weak VMWebVideoPrefetcher *wself = self;
+    id <VMWebVideoOperation> operation = nil;
+    if (self.prefixLength > 0) {
+        operation = [self startPrefetchingPrefixOfURL:url];
+    }
+    else {
+        NSSet *tags = self.tag ? [NSSet setWithObject:self.tag] : nil;
+        operation = [self.manager downloadVideoWithURL:url options:self.options tags:tags progress:^(NSInteger receivedSize, NSInteger expectedSize) {
+            [wself recordReceivedSize:receivedSize forURL:url];
+        } completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
+            if (!finished) return;
+            [wself prefetchOfURL:url didFinishWithFilePath:videoDataFilePath];
+        }];
+    }
+    
+    if (operation && ![self.prefetchedURLs containsObject:url]) {
+        // A cached video may complete before the manager returns, it is then done already
+        self.runningOperations[url] = operation;
+    }
+}
+
+- (id <VMWebVideoOperation>)startPrefetchingPrefixOfURL:(NSURL *)url {
+    // The manager answers from the cache or a partial entry that is long enough, and shares the download
+    __weak VMWebVideoPrefetcher *wself = self;
+    NSSet *tags = self.tag ? [NSSet setWithObject:self.tag] : nil;
+    return [self.manager downloadVideoPrefixWithURL:url length:self.prefixLength options:self.options tags:tags progress:^(NSInteger receivedSize, NSInteger expectedSize) {
+        [wself recordReceivedSize:receivedSize forURL:url];
+    } completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
+        if (!finished) return;
+        [wself prefetchOfURL:url succeeded:(error == nil)];
     }];
 }
 
+- (void)prefetchOfURL:(NSURL *)url didFinishWithFilePath:(NSURL *)videoDataFilePath {
+    [self prefetchOfURL:url succeeded:(videoDataFilePath != nil)];
+}
+
+- (void)prefetchOfURL:(NSURL *)url succeeded:(BOOL)succeeded {
+    [self.runningOperations removeObjectForKey:url];
+    @synchronized (self.downloadLog) {
+        [self.receivedSizes removeObjectForKey:url];
+    }
+    if (![self.prefetchURLs containsObject:url]) {
+        // Finished right as it left the window
+        return;
+    }
+    
+    [self recordPrefetchOfURL:url succeeded:succeeded];
+    [self startPrefetching];
+}
+
+- (void)recordPrefetchOfURL:(NSURL *)url succeeded:(BOOL)succeeded {
+    [self.prefetchedURLs addObject:url];
+    self.finishedCount++;
+    if (succeeded) {
+        NSLog(@"Prefetched %@ out of %@", @(self.finishedCount), @(self.prefetchURLs.count));
+    }
+    else {
+        NSLog(@"Prefetched %@ out of %@ (Failed)", @(self.finishedCount), @(self.prefetchURLs.count));
+        
+        // Add last failed
+        self.skippedCount++;
+    }
+    if (self.progressBlock) {
+        self.progressBlock(self.finishedCount, [self.prefetchURLs count]);
+    }
+    if ([self.delegate respondsToSelector:@selector(videoPrefetcher:didPrefetchURL:finishedCount:totalCount:)]) {
+        [self.delegate videoPrefetcher:self
+                        didPrefetchURL:url
+                         finishedCount:self.finishedCount
+                            totalCount:self.prefetchURLs.count
+         ];
+    }
+}
+
+- (void)finishIfDone {
+    if (self.runningOperations.count > 0 || self.checkingCacheCount > 0 || [self nextURL] || !self.completionBlock) {
+        return;
+    }
+    
+    [self reportStatus];
+    VMWebVideoPrefetcherCompletionBlock completionBlock = self.completionBlock;
+    self.completionBlock = nil;
+    completionBlock(self.finishedCount, self.skippedCount);
+}
+
 - (void)reportStatus {
     NSUInteger total = [self.prefetchURLs count];
     NSLog(@"Finished prefetching (%@ successful, %@ skipped, timeElasped %.2f)", @(total - self.skippedCount), @(self.skippedCount), CFAbsoluteTimeGetCurrent() - self.startedTime);
@@ -106,36 +260,81 @@
     }
 }
 
-- (void)prefetchURLs:(NSArray *)urls {
-    [self prefetchURLs:urls progress:nil completed:nil];
+- (void)cancelPrefetching {
+    dispatch_main_sync_safe(^{
+        for (id <VMWebVideoOperation> operation in [self.runningOperations allValues]) {
+            [operation cancel];
+        }
+        [self.runningOperations removeAllObjects];
+        [self.prefetchedURLs removeAllObjects];
+        self.prefetchURLs = @[];
+        self.skippedCount = 0;
+        self.finishedCount = 0;
+        self.completionBlock = nil;
+        self.progressBlock = nil;
+        @synchronized (self.downloadLog) {
+            [self.receivedSizes removeAllObjects];
+        }
+    });
 }
 
-- (void)prefetchURLs:(NSArray *)urls progress:(VMWebVideoPrefetcherProgressBlock)progressBlock completed:(VMWebVideoPrefetcherCompletionBlock)completionBlock {
-    [self cancelPrefetching]; // Prevent duplicate prefetch request
-    self.startedTime = CFAbsoluteTimeGetCurrent();
-    self.prefetchURLs = urls;
-    self.completionBlock = completionBlock;
-    self.progressBlock = progressBlock;
+#pragma mark Bandwidth budget
+
+- (void)recordReceivedSize:(NSInteger)receivedSize forURL:(NSURL *)url {
+    @synchronized (self.downloadLog) {
+        NSInteger previousSize = [self.receivedSizes[url] integerValue];
+        self.receivedSizes[url] = @(receivedSize);
+        if (receivedSize > previousSize) {
+            [self.downloadLog addObject:@[@(CFAbsoluteTimeGetCurrent()), @(receivedSize - previousSize)]];
+        }
+    }
+}
+
+// Returns 0 if a new prefetch fits in the budget, otherwise how long until enough of the last minute's bytes expire
+- (NSTimeInterval)delayUntilBudgetAvailable {
+    if (self.maxBytesPerMinute == 0) {
+        return 0;
+    }
     
-    if(urls.count == 0){
-        if(completionBlock){
-            completionBlock(0,0);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    @synchronized (self.downloadLog) {
+        unsigned long long bytes = 0;
+        NSUInteger expired = 0;
+        for (NSArray *sample in self.downloadLog) {
+            if (now - [sample[0] doubleValue] > kBudgetInterval) {
+                expired++;
+            }
+            else {
+                bytes += [sample[1] unsignedLongLongValue];
+            }
         }
-    }else{
-        // Starts prefetching from the very first image on the list with the max allowed concurrency
-        NSUInteger listCount = self.prefetchURLs.count;
-        for (NSUInteger i = 0; i < self.maxConcurrentDownloads && self.requestedCount < listCount; i++) {
-            [self startPrefetchingAtIndex:i];
+        [self.downloadLog removeObjectsInRange:NSMakeRange(0, expired)];
+        
+        // Wait until the log drops under the budget, one sample at a time
+        for (NSArray *sample in self.downloadLog) {
+            if (bytes < self.maxBytesPerMinute) {
+                break;
+            }
+            bytes -= [sample[1] unsignedLongLongValue];
+            if (bytes < self.maxBytesPerMinute) {
+                return MAX(kBudgetInterval - (now - [sample[0] doubleValue]), 0.1);
+            }
         }
+        return 0;
     }
 }
 
-- (void)cancelPrefetching {
-    self.prefetchURLs = nil;
-    self.skippedCount = 0;
-    self.requestedCount = 0;
-    self.finishedCount = 0;
-    [self.manager cancelAll];
+- (void)retryAfterDelay:(NSTimeInterval)delay {
+    if (self.budgetRetryScheduled) {
+        return;
+    }
+    
+    self.budgetRetryScheduled = YES;
+    __weak VMWebVideoPrefetcher *wself = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        wself.budgetRetryScheduled = NO;
+        [wself startPrefetching];
+    });
 }
 
 @end
@@ -0,0 +1,70 @@
+//
+//  VMWebVideoProgressiveFile.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Posted on an arbitrary queue when more of a progressive file is available, or when its download ends.
+ * The object is the `VMWebVideoProgressiveFile`.
+ */
+extern NSString *const VMWebVideoProgressiveFileDidChangeNotification;
+
+/**
+ * A file that is still being downloaded with `VMWebVideoDownloaderProgressiveDownload`.
+ *
+ * The bytes from the start of the file up to `availableLength` can be read. Readers either wait for the range they
+ * need with `-waitForAvailableLength:timeout:` or observe `VMWebVideoProgressiveFileDidChangeNotification`.
+ *
+ * The file is moved into the cache once the download is finished, readers should open it as soon as they get its URL.
+ */
+@interface VMWebVideoProgressiveFile : NSObject
+
+/**
+ * Returns the progressive file being downloaded to the given URL, if any.
+ */
++ (VMWebVideoProgressiveFile *)progressiveFileForURL:(NSURL *)fileURL;
+
+- (id)initWithFileURL:(NSURL *)fileURL expectedLength:(long long)expectedLength;
+
+@property (strong, nonatomic, readonly) NSURL *fileURL;
+
+/**
+ * The total length of the video, -1 if unknown.
+ */
+@property (assign, nonatomic, readonly) long long expectedLength;
+
+/**
+ * The number of leading bytes that are on disk.
+ */
+@property (assign, atomic, readonly) long long availableLength;
+
+@property (assign, atomic, readonly, getter = isFinished) BOOL finished;
+
+/**
+ * The error the download failed with, if it did.
+ */
+@property (strong, atomic, readonly) NSError *error;
+
+/**
+ * Blocks the calling thread until at least `length` leading bytes are available, the download ends or the timeout expires.
+ *
+ * @return YES if `length` bytes are available
+ */
+- (BOOL)waitForAvailableLength:(long long)length timeout:(NSTimeInterval)timeout;
+
+/**
+ * Called by the download as the contiguous prefix of the file grows.
+ */
+- (void)updateAvailableLength:(long long)availableLength;
+
+/**
+ * Called by the download when it ends. Wakes up the waiting readers.
+ */
+- (void)finishWithError:(NSError *)error;
+
+@end
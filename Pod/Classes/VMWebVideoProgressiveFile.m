@@ -0,0 +1,111 @@
+//
+//  VMWebVideoProgressiveFile.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoProgressiveFile.h"
+
+NSString *const VMWebVideoProgressiveFileDidChangeNotification = @"VMWebVideoProgressiveFileDidChangeNotification";
+
+// Observers are told about new bytes in steps of at least this size, a notification for every packet would be wasted
+static const long long kNotificationGranularity = 64 * 1024;
+
+@interface VMWebVideoProgressiveFile ()
+
+@property (assign, atomic) long long availableLength;
+@property (assign, atomic, getter = isFinished) BOOL finished;
+@property (strong, atomic) NSError *error;
+@property (assign, nonatomic) long long notifiedLength;
+@property (strong, nonatomic) NSCondition *condition;
+
+@end
+
+@implementation VMWebVideoProgressiveFile
+
++ (NSMapTable *)activeFiles {
+    static dispatch_once_t once;
+    static NSMapTable *activeFiles;
+    dispatch_once(&once, ^{
+        activeFiles = [NSMapTable strongToWeakObjectsMapTable];
+    });
+    return activeFiles;
+}
+
++ (VMWebVideoProgressiveFile *)progressiveFileForURL:(NSURL *)fileURL {
+    if (!fileURL) {
+        return nil;
+    }
+    
+    NSMapTable *activeFiles = [self activeFiles];
+    @synchronized (activeFiles) {
+        return [activeFiles objectForKey:fileURL];
+    }
+}
+
+- (id)initWithFileURL:(NSURL *)fileURL expectedLength:(long long)expectedLength {
+    if ((self = [super init])) {
+        _fileURL = fileURL;
+        _expectedLength = expectedLength;
+        _condition = [NSCondition new];
+        
+        NSMapTable *activeFiles = [[self class] activeFiles];
+        @synchronized (activeFiles) {
+            [activeFiles setObject:self forKey:fileURL];
+        }
+    }
+    return self;
+}
+
+- (BOOL)waitForAvailableLength:(long long)length timeout:(NSTimeInterval)timeout {
+    NSDate *limitDate = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    [self.condition lock];
+    while (self.availableLength < length && !self.isFinished) {
+        if (![self.condition waitUntilDate:limitDate]) {
+            break;
+        }
+    }
+    BOOL available = (self.availableLength >= length);
+    [self.condition unlock];
+    return available;
+}
+
+- (void)updateAvailableLength:(long long)availableLength {
+    [self.condition lock];
+    if (availableLength <= self.availableLength) {
+        [self.condition unlock];
+        return;
+    }
+    self.availableLength = availableLength;
+    [self.condition broadcast];
+    [self.condition unlock];
+    
+    if (availableLength - self.notifiedLength >= kNotificationGranularity || availableLength == self.expectedLength) {
+        self.notifiedLength = availableLength;
+        [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoProgressiveFileDidChangeNotification object:self];
+    }
+}
+
+- (void)finishWithError:(NSError *)error {
+    [self.condition lock];
+    if (self.isFinished) {
+        [self.condition unlock];
+        return;
+    }
+    self.error = error;
+    self.finished = YES;
+    [self.condition broadcast];
+    [self.condition unlock];
+    
+    NSMapTable *activeFiles = [[self class] activeFiles];
+    @synchronized (activeFiles) {
+        if ([activeFiles objectForKey:self.fileURL] == self) {
+            [activeFiles removeObjectForKey:self.fileURL];
+        }
+    }
+    [[NSNotificationCenter defaultCenter] postNotificationName:VMWebVideoProgressiveFileDidChangeNotification object:self];
+}
+
+@end
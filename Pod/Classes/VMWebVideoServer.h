@@ -0,0 +1,65 @@
+//
+//  VMWebVideoServer.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class VMWebVideoManager;
+
+/**
+ * A small HTTP server on the loopback interface that serves videos to players, with `Range` support.
+ *
+ * A request for `-URLForVideoURL:` is answered from the cache if the video is there. Otherwise it is answered from the
+ * progressive download of the video, which is started if needed, and the response streams the bytes as they arrive.
+ * A `HEAD` request never starts a download, without one its response has no length. A download started for a player is
+ * cancelled once its connection closes or times out, unless another connection or request of the manager still reads it.
+ * Every request reads the file on its own, so any number of players can seek independently.
+ *
+ * Bytes go from the file to the socket with `sendfile`, without being copied through the process. The sockets are
+ * non-blocking and served from a single queue, a player waiting for its download doesn't hold a thread.
+ */
+@interface VMWebVideoServer : NSObject
+
+/**
+ * Returns a server that uses the shared manager.
+ */
++ (VMWebVideoServer *)sharedServer;
+
+- (id)initWithManager:(VMWebVideoManager *)manager;
+
+@property (strong, nonatomic, readonly) VMWebVideoManager *manager;
+
+/**
+ * The port to listen on. When 0, the default, a free port is picked when the server starts and the property is set to it.
+ */
+@property (assign, atomic) UInt16 port;
+
+@property (assign, atomic, readonly, getter = isRunning) BOOL running;
+
+/**
+ * How long a response waits for bytes of a running download, and how long an idle connection is kept open, in seconds. Default: 30.
+ */
+@property (assign, nonatomic) NSTimeInterval timeout;
+
+/**
+ * Starts listening on 127.0.0.1. Does nothing if the server is already running.
+ *
+ * @return NO if the socket couldn't be set up, with the POSIX error in `error`
+ */
+- (BOOL)start:(NSError **)error;
+
+/**
+ * Stops accepting connections. Responses in progress are finished.
+ */
+- (void)stop;
+
+/**
+ * Returns the URL to give to a player for the video at the given remote URL, or nil if the server isn't running.
+ */
+- (NSURL *)URLForVideoURL:(NSURL *)url;
+
+@end
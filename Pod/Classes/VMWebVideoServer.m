@@ -0,0 +1,772 @@
+//
+//  VMWebVideoServer.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoServer.h"
+#import "VMWebVideoManager.h"
+#import "VMWebVideoMetrics.h"
+#import <sys/socket.h>
+#import <sys/stat.h>
+#import <sys/uio.h>
+#import <netinet/in.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+// Requests with a longer header are refused
+static const NSUInteger kMaximumRequestHeaderLength = 16 * 1024;
+// sendfile is called for at most this many bytes at once, so a response never waits long for a download to catch up
+static const off_t kSendChunkLength = 512 * 1024;
+
+/**
+ * An open file a response is read from, either a cached video or a progressive download.
+ */
+@interface VMWebVideoServerSource : NSObject
+
+@property (assign, nonatomic) int fileDescriptor;
+@property (strong, nonatomic) VMWebVideoProgressiveFile *progressiveFile;
+
+@end
+
+@implementation VMWebVideoServerSource
+
++ (VMWebVideoServerSource *)sourceWithFileURL:(NSURL *)fileURL progressiveFile:(VMWebVideoProgressiveFile *)progressiveFile {
+    int fileDescriptor = fileURL ? open(fileURL.fileSystemRepresentation, O_RDONLY) : -1;
+    if (fileDescriptor < 0) {
+        return nil;
+    }
+    
+    VMWebVideoServerSource *source = [VMWebVideoServerSource new];
+    source.fileDescriptor = fileDescriptor;
+    source.progressiveFile = progressiveFile;
+    return source;
+}
+
+- (void)dealloc {
+    close(_fileDescriptor);
+}
+
+// -1 while a download of unknown length is running
+- (long long)length {
+    VMWebVideoProgressiveFile *progressiveFile = self.progressiveFile;
+    if (!progressiveFile) {
+        struct stat status;
+        return fstat(self.fileDescriptor, &status) == 0 ? (long long)status.st_size : -1;
+    }
+    if (progressiveFile.isFinished && !progressiveFile.error) {
+        return progressiveFile.availableLength;
+    }
+    return progressiveFile.expectedLength;
+}
+
+@end
+
+@class VMWebVideoServerConnection;
+
+@interface VMWebVideoServer ()
+
+@property (strong, nonatomic, readwrite) VMWebVideoManager *manager;
+@property (assign, atomic, readwrite, getter = isRunning) BOOL running;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_source_t acceptSource;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t acceptQueue;
+// All the connections are served on this queue with non-blocking I/O, none of them holds a thread while it waits
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t connectionQueue;
+// The open connections, only used on the connectionQueue
+@property (strong, nonatomic) NSMutableSet *connections;
+
+- (NSURL *)videoURLForPath:(NSString *)path;
+- (id <VMWebVideoOperation>)sourceForVideoURL:(NSURL *)url startingDownload:(BOOL)startDownload completion:(void (^)(VMWebVideoServerSource *source))completion;
+- (NSData *)responseHeaderWithStatus:(NSInteger)status reason:(NSString *)reason headers:(NSDictionary *)headers keepAlive:(BOOL)keepAlive;
+- (NSString *)contentTypeForVideoURL:(NSURL *)url;
+- (BOOL)parseRange:(NSString *)range length:(long long)length first:(long long *)first last:(long long *)last;
+- (void)connectionDidClose:(VMWebVideoServerConnection *)connection;
+- (void)releaseDownloadOperationOfConnection:(VMWebVideoServerConnection *)connection;
+
+@end
+
+/**
+ * A connection of a player, served one request at a time. Everything happens on the server's connectionQueue:
+ * the socket is read and written when its dispatch sources say it can be, and a response that is ahead of its
+ * download waits for `VMWebVideoProgressiveFileDidChangeNotification`.
+ */
+@interface VMWebVideoServerConnection : NSObject
+
+- (id)initWithSocket:(int)socket server:(VMWebVideoServer *)server;
+
+- (void)open;
+
+@end
+
+@interface VMWebVideoServerConnection ()
+
+@property (weak, nonatomic) VMWebVideoServer *server;
+@property (assign, nonatomic) NSTimeInterval timeout;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_queue_t queue;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_source_t readSource;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_source_t writeSource;
+@property (VMDispatchQueueSetterSementics, nonatomic) dispatch_source_t timeoutTimer;
+@property (assign, nonatomic) BOOL readSourceSuspended;
+@property (assign, nonatomic) BOOL writeSourceSuspended;
+@property (assign, nonatomic, getter = isClosed) BOOL closed;
+// The bytes of requests that weren't handled yet
+@property (strong, nonatomic) NSMutableData *requestBuffer;
+// Set from the moment a request is complete until its response is sent
+@property (assign, nonatomic, getter = isResponding) BOOL responding;
+@property (assign, nonatomic) BOOL awaitingSource;
+@property (assign, nonatomic) BOOL keepAlive;
+// The status line and headers of the response that weren't sent yet
+@property (strong, nonatomic) NSMutableData *responseHeader;
+@property (strong, nonatomic) VMWebVideoServerSource *source;
+@property (assign, nonatomic) long long offset;
+@property (assign, nonatomic) long long end;
+@property (strong, nonatomic) id progressiveFileObserver;
+// The video of the last request, and the download the connection started for it, if any
+@property (strong, nonatomic) NSURL *videoURL;
+@property (strong, nonatomic) id <VMWebVideoOperation> downloadOperation;
+
+@end
+
+@implementation VMWebVideoServerConnection {
+    int _socket;
+}
+
+- (id)initWithSocket:(int)socket server:(VMWebVideoServer *)server {
+    if ((self = [super init])) {
+        _socket = socket;
+        _server = server;
+        _timeout = server.timeout;
+        _queue = server.connectionQueue;
+        _requestBuffer = [NSMutableData data];
+        _keepAlive = YES;
+    }
+    return self;
+}
+
+- (void)open {
+    int socket = _socket;
+    __weak VMWebVideoServerConnection *wself = self;
+    // Both sources hold the socket, it is closed once they are both cancelled
+    __block NSUInteger openSourceCount = 2;
+    void (^sourceCancelled)(void) = ^{
+        if (--openSourceCount == 0) {
+            close(socket);
+        }
+    };
+    
+    self.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)socket, 0, self.queue);
+    dispatch_source_set_event_handler(self.readSource, ^{
+        [wself readAvailableBytes];
+    });
+    dispatch_source_set_cancel_handler(self.readSource, sourceCancelled);
+    
+    self.writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, (uintptr_t)socket, 0, self.queue);
+    dispatch_source_set_event_handler(self.writeSource, ^{
+        [wself sendPendingBytes];
+    });
+    dispatch_source_set_cancel_handler(self.writeSource, sourceCancelled);
+    // Dispatch sources are created suspended, the write source is only resumed while the socket buffer is full
+    self.writeSourceSuspended = YES;
+    
+    self.timeoutTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.queue);
+    dispatch_source_set_event_handler(self.timeoutTimer, ^{
+        [wself timeoutDidExpire];
+    });
+    [self restartTimeout];
+    dispatch_resume(self.timeoutTimer);
+    dispatch_resume(self.readSource);
+}
+
+- (void)close {
+    if (self.isClosed) {
+        return;
+    }
+    self.closed = YES;
+    [self stopObservingProgressiveFile];
+    self.source = nil;
+    [self.server releaseDownloadOperationOfConnection:self];
+    
+    // A suspended source doesn't get cancelled, nor can it be released
+    if (self.readSourceSuspended) {
+        dispatch_resume(self.readSource);
+    }
+    if (self.writeSourceSuspended) {
+        dispatch_resume(self.writeSource);
+    }
+    dispatch_source_cancel(self.readSource);
+    dispatch_source_cancel(self.writeSource);
+    dispatch_source_cancel(self.timeoutTimer);
+    VMDispatchQueueRelease(_readSource);
+    VMDispatchQueueRelease(_writeSource);
+    VMDispatchQueueRelease(_timeoutTimer);
+    self.readSource = nil;
+    self.writeSource = nil;
+    self.timeoutTimer = nil;
+    
+    [self.server connectionDidClose:self];
+}
+
+#pragma mark Timeout
+
+// The connection is closed if it doesn't make any progress for the timeout, be it idle or waiting for a download
+- (void)restartTimeout {
+    dispatch_source_set_timer(self.timeoutTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.timeout * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, (uint64_t)(0.5 * NSEC_PER_SEC));
+}
+
+- (void)timeoutDidExpire {
+    if (self.awaitingSource) {
+        // The download didn't deliver anything in time
+        self.awaitingSource = NO;
+        [self.server releaseDownloadOperationOfConnection:self];
+        [self respondWithStatus:502 reason:@"Bad Gateway" headers:nil];
+        return;
+    }
+    [self close];
+}
+
+#pragma mark Requests
+
+- (void)readAvailableBytes {
+    if (self.isClosed) {
+        return;
+    }
+    
+    uint8_t bytes[4096];
+    while (YES) {
+        ssize_t length = recv(_socket, bytes, sizeof(bytes), 0);
+        if (length > 0) {
+            [self.requestBuffer appendBytes:bytes length:(NSUInteger)length];
+            if (self.requestBuffer.length > kMaximumRequestHeaderLength) {
+                break;
+            }
+            continue;
+        }
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && errno == EAGAIN) {
+            break;
+        }
+        // Closed by the player
+        [self close];
+        return;
+    }
+    
+    [self restartTimeout];
+    [self handleBufferedRequest];
+}
+
+// Handles the next complete request in the buffer, if there is one and no response is in progress
+- (void)handleBufferedRequest {
+    if (self.isResponding || self.isClosed) {
+        return;
+    }
+    
+    NSData *terminator = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSMutableData *buffer = self.requestBuffer;
+    NSRange end = [buffer rangeOfData:terminator options:0 range:NSMakeRange(0, buffer.length)];
+    if (end.location == NSNotFound) {
+        if (buffer.length > kMaximumRequestHeaderLength) {
+            // Requests with a longer header are refused
+            [self close];
+        }
+        return;
+    }
+    
+    NSString *header = [[NSString alloc] initWithData:[buffer subdataWithRange:NSMakeRange(0, end.location)] encoding:NSISOLatin1StringEncoding];
+    [buffer replaceBytesInRange:NSMakeRange(0, NSMaxRange(end)) withBytes:NULL length:0];
+    
+    NSArray *lines = [header componentsSeparatedByString:@"\r\n"];
+    NSArray *requestLine = [lines.firstObject componentsSeparatedByString:@" "];
+    if (requestLine.count < 3) {
+        [self close];
+        return;
+    }
+    
+    NSMutableDictionary *headers = [NSMutableDictionary dictionary];
+    for (NSString *line in [lines subarrayWithRange:NSMakeRange(1, lines.count - 1)]) {
+        NSRange colon = [line rangeOfString:@":"];
+        if (colon.location != NSNotFound) {
+            NSString *name = [[line substringToIndex:colon.location] lowercaseString];
+            headers[name] = [[line substringFromIndex:NSMaxRange(colon)] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        }
+    }
+    
+    // Requests that follow stay in the buffer until the response is sent
+    self.responding = YES;
+    self.readSourceSuspended = YES;
+    dispatch_suspend(self.readSource);
+    [self respondToRequestWithMethod:requestLine[0] path:requestLine[1] headers:headers];
+}
+
+- (void)respondToRequestWithMethod:(NSString *)method path:(NSString *)path headers:(NSDictionary *)headers {
+    self.keepAlive = ![[headers[@"connection"] lowercaseString] isEqualToString:@"close"];
+    BOOL head = [method isEqualToString:@"HEAD"];
+    if (!head && ![method isEqualToString:@"GET"]) {
+        [self respondWithStatus:405 reason:@"Method Not Allowed" headers:nil];
+        return;
+    }
+    
+    VMWebVideoServer *server = self.server;
+    NSURL *videoURL = [server videoURLForPath:path];
+    if (!server || !videoURL.scheme) {
+        [self respondWithStatus:404 reason:@"Not Found" headers:nil];
+        return;
+    }
+    
+    if (![videoURL isEqual:self.videoURL]) {
+        // The player moved on to another video
+        [server releaseDownloadOperationOfConnection:self];
+        self.videoURL = videoURL;
+    }
+    
+    // A HEAD request is answered from what is there, it doesn't start a download
+    self.awaitingSource = YES;
+    __weak VMWebVideoServerConnection *wself = self;
+    id <VMWebVideoOperation> downloadOperation = [server sourceForVideoURL:videoURL startingDownload:!head completion:^(VMWebVideoServerSource *source) {
+        VMWebVideoServerConnection *sself = wself;
+        if (!sself || sself.isClosed || !sself.awaitingSource) {
+            return;
+        }
+        sself.awaitingSource = NO;
+        [sself respondWithSource:source videoURL:videoURL head:head rangeHeader:headers[@"range"]];
+    }];
+    if (downloadOperation) {
+        [server releaseDownloadOperationOfConnection:self];
+        self.downloadOperation = downloadOperation;
+    }
+}
+
+- (void)respondWithSource:(VMWebVideoServerSource *)source videoURL:(NSURL *)videoURL head:(BOOL)head rangeHeader:(NSString *)range {
+    NSMutableDictionary *responseHeaders = [NSMutableDictionary dictionary];
+    responseHeaders[@"Content-Type"] = [self.server contentTypeForVideoURL:videoURL];
+    responseHeaders[@"Accept-Ranges"] = @"bytes";
+    if (!source && head) {
+        // Neither cached nor downloading, the length is unknown until a GET starts the download
+        [self respondWithStatus:200 reason:@"OK" headers:responseHeaders];
+        return;
+    }
+    if (!source) {
+        [self respondWithStatus:502 reason:@"Bad Gateway" headers:nil];
+        return;
+    }
+    
+    long long length = [source length];
+    long long first = 0;
+    long long last = length - 1;
+    BOOL partial = (range != nil && length >= 0);
+    if (partial && ![self.server parseRange:range length:length first:&first last:&last]) {
+        responseHeaders[@"Content-Range"] = [NSString stringWithFormat:@"bytes */%lld", length];
+        [self respondWithStatus:416 reason:@"Range Not Satisfiable" headers:responseHeaders];
+        return;
+    }
+    
+    if (length >= 0) {
+        responseHeaders[@"Content-Length"] = [NSString stringWithFormat:@"%lld", last - first + 1];
+        if (partial) {
+            responseHeaders[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lld-%lld/%lld", first, last, length];
+        }
+    }
+    else if (!head) {
+        // Without a length the end of the body is the end of the connection
+        self.keepAlive = NO;
+    }
+    
+    if (!head) {
+        self.source = source;
+        self.offset = first;
+        self.end = (length >= 0 ? last + 1 : LLONG_MAX);
+    }
+    [self respondWithStatus:(partial ? 206 : 200) reason:(partial ? @"Partial Content" : @"OK") headers:responseHeaders];
+}
+
+- (void)respondWithStatus:(NSInteger)status reason:(NSString *)reason headers:(NSDictionary *)headers {
+    self.responseHeader = [[self.server responseHeaderWithStatus:status reason:reason headers:headers keepAlive:self.keepAlive] mutableCopy];
+    [self sendPendingBytes];
+}
+
+#pragma mark Responses
+
+// Sends as much of the response as the socket takes without blocking
+- (void)sendPendingBytes {
+    if (self.isClosed || !self.isResponding || self.awaitingSource) {
+        return;
+    }
+    
+    NSMutableData *responseHeader = self.responseHeader;
+    while (responseHeader.length > 0) {
+        ssize_t written = send(_socket, responseHeader.bytes, responseHeader.length, 0);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && errno == EAGAIN) {
+            [self waitUntilWritable];
+            return;
+        }
+        if (written < 0) {
+            [self close];
+            return;
+        }
+        [responseHeader replaceBytesInRange:NSMakeRange(0, (NSUInteger)written) withBytes:NULL length:0];
+        [self restartTimeout];
+    }
+    
+    VMWebVideoServerSource *source = self.source;
+    if (source && self.offset < self.end) {
+        VMWebVideoProgressiveFile *progressiveFile = source.progressiveFile;
+        long long available = self.end;
+        if (progressiveFile) {
+            available = MIN(self.end, progressiveFile.availableLength);
+            if (available <= self.offset) {
+                if (progressiveFile.isFinished) {
+                    // Either a download of unknown length is over, or it failed
+                    if (!progressiveFile.error && self.end == LLONG_MAX) {
+                        [self finishResponse];
+                    }
+                    else {
+                        [self close];
+                    }
+                    return;
+                }
+                if (!self.progressiveFileObserver) {
+                    // The bytes could have arrived before the observer was added, they are looked at again once it is
+                    [self observeProgressiveFile:progressiveFile];
+                    [self sendPendingBytes];
+                    return;
+                }
+                [self stopWaitingUntilWritable];
+                return;
+            }
+        }
+        
+        // sendfile is called for at most kSendChunkLength bytes, then the socket is given back to the other connections
+        off_t length = (off_t)MIN(available - self.offset, (long long)kSendChunkLength);
+        int result = sendfile(source.fileDescriptor, _socket, (off_t)self.offset, &length, NULL, 0);
+        // length is the number of bytes sent, even if the call was interrupted or would have blocked
+        self.offset += length;
+        VMWebVideoMetricsCount(VMWebVideoMetricsCounterBytesServed, length);
+        if (result != 0 && errno != EINTR && errno != EAGAIN) {
+            [self close];
+            return;
+        }
+        if (result == 0 && length == 0) {
+            // The file is shorter than it should be, e.g. truncated after a failed download
+            [self close];
+            return;
+        }
+        if (length > 0) {
+            [self restartTimeout];
+        }
+        [self waitUntilWritable];
+        return;
+    }
+    
+    [self finishResponse];
+}
+
+- (void)finishResponse {
+    [self stopObservingProgressiveFile];
+    [self stopWaitingUntilWritable];
+    self.source = nil;
+    self.responseHeader = nil;
+    self.responding = NO;
+    if (!self.keepAlive) {
+        [self close];
+        return;
+    }
+    
+    self.readSourceSuspended = NO;
+    dispatch_resume(self.readSource);
+    [self restartTimeout];
+    // The player may have sent its next request already
+    [self handleBufferedRequest];
+}
+
+- (void)waitUntilWritable {
+    if (self.writeSourceSuspended) {
+        self.writeSourceSuspended = NO;
+        dispatch_resume(self.writeSource);
+    }
+}
+
+- (void)stopWaitingUntilWritable {
+    if (!self.writeSourceSuspended) {
+        self.writeSourceSuspended = YES;
+        dispatch_suspend(self.writeSource);
+    }
+}
+
+- (void)observeProgressiveFile:(VMWebVideoProgressiveFile *)progressiveFile {
+    __weak VMWebVideoServerConnection *wself = self;
+    dispatch_queue_t queue = self.queue;
+    self.progressiveFileObserver = [[NSNotificationCenter defaultCenter] addObserverForName:VMWebVideoProgressiveFileDidChangeNotification object:progressiveFile queue:nil usingBlock:^(NSNotification *note) {
+        dispatch_async(queue, ^{
+            [wself sendPendingBytes];
+        });
+    }];
+}
+
+- (void)stopObservingProgressiveFile {
+    if (self.progressiveFileObserver) {
+        [[NSNotificationCenter defaultCenter] removeObserver:self.progressiveFileObserver];
+        self.progressiveFileObserver = nil;
+    }
+}
+
+@end
+
+@implementation VMWebVideoServer
+
++ (VMWebVideoServer *)sharedServer {
+    static dispatch_once_t once;
+    static id instance;
+    dispatch_once(&once, ^{
+        instance = [[self alloc] initWithManager:[VMWebVideoManager sharedManager]];
+    });
+    return instance;
+}
+
+- (id)init {
+    return [self initWithManager:[VMWebVideoManager sharedManager]];
+}
+
+- (id)initWithManager:(VMWebVideoManager *)manager {
+    if ((self = [super init])) {
+        _manager = manager;
+        _timeout = 30.0;
+        _acceptQueue = dispatch_queue_create("com.vmlabs.VMWebVideoServerAccept", DISPATCH_QUEUE_SERIAL);
+        _connectionQueue = dispatch_queue_create("com.vmlabs.VMWebVideoServerConnection", DISPATCH_QUEUE_SERIAL);
+        _connections = [NSMutableSet new];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+    VMDispatchQueueRelease(_acceptQueue);
+    VMDispatchQueueRelease(_connectionQueue);
+}
+
+#pragma mark Listening
+
+- (BOOL)start:(NSError **)error {
+    @synchronized (self) {
+        if (self.acceptSource) {
+            return YES;
+        }
+        
+        int listeningSocket = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_len = sizeof(address);
+        address.sin_family = AF_INET;
+        address.sin_port = htons(self.port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addressLength = sizeof(address);
+        
+        if (listeningSocket < 0 ||
+            setsockopt(listeningSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0 ||
+            bind(listeningSocket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+            listen(listeningSocket, SOMAXCONN) != 0 ||
+            getsockname(listeningSocket, (struct sockaddr *)&address, &addressLength) != 0 ||
+            fcntl(listeningSocket, F_SETFL, O_NONBLOCK) != 0) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+            }
+            if (listeningSocket >= 0) {
+                close(listeningSocket);
+            }
+            return NO;
+        }
+        self.port = ntohs(address.sin_port);
+        
+        dispatch_source_t acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)listeningSocket, 0, self.acceptQueue);
+        __weak VMWebVideoServer *wself = self;
+        dispatch_source_set_event_handler(acceptSource, ^{
+            [wself acceptConnectionsOnSocket:listeningSocket];
+        });
+        dispatch_source_set_cancel_handler(acceptSource, ^{
+            close(listeningSocket);
+        });
+        dispatch_resume(acceptSource);
+        self.acceptSource = acceptSource;
+        self.running = YES;
+    }
+    return YES;
+}
+
+- (void)stop {
+    @synchronized (self) {
+        if (self.acceptSource) {
+            dispatch_source_cancel(self.acceptSource);
+            VMDispatchQueueRelease(_acceptSource);
+            self.acceptSource = nil;
+        }
+        self.running = NO;
+    }
+}
+
+- (void)acceptConnectionsOnSocket:(int)listeningSocket {
+    int connection;
+    while ((connection = accept(listeningSocket, NULL, NULL)) >= 0) {
+        // Accepted sockets inherit O_NONBLOCK, which the connections rely on
+        fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) | O_NONBLOCK);
+        int yes = 1;
+        setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+        
+        dispatch_async(self.connectionQueue, ^{
+            VMWebVideoServerConnection *serverConnection = [[VMWebVideoServerConnection alloc] initWithSocket:connection server:self];
+            [self.connections addObject:serverConnection];
+            [serverConnection open];
+        });
+    }
+}
+
+- (void)connectionDidClose:(VMWebVideoServerConnection *)connection {
+    [self.connections removeObject:connection];
+}
+
+// Cancels the download a connection started once it no longer needs it. Another open connection reading the same video
+// takes the download over instead; other requests of the manager keep it going, cancelling only drops this one.
+- (void)releaseDownloadOperationOfConnection:(VMWebVideoServerConnection *)connection {
+    id <VMWebVideoOperation> downloadOperation = connection.downloadOperation;
+    if (!downloadOperation) {
+        return;
+    }
+    connection.downloadOperation = nil;
+    
+    for (VMWebVideoServerConnection *otherConnection in self.connections) {
+        if (otherConnection != connection && !otherConnection.isClosed && !otherConnection.downloadOperation &&
+            [otherConnection.videoURL isEqual:connection.videoURL]) {
+            otherConnection.downloadOperation = downloadOperation;
+            return;
+        }
+    }
+    [downloadOperation cancel];
+}
+
+- (NSURL *)URLForVideoURL:(NSURL *)url {
+    if (!url || !self.isRunning) {
+        return nil;
+    }
+    
+    // The whole remote URL is a single path component; the file name keeps the extension players look at
+    NSString *escapedURL = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(NULL, (__bridge CFStringRef)url.absoluteString, NULL, CFSTR(":/?#[]@!$&'()*+,;=%"), kCFStringEncodingUTF8);
+    NSString *fileName = url.pathExtension.length ? [@"video" stringByAppendingPathExtension:url.pathExtension] : @"video";
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/%@/%@", self.port, escapedURL, fileName]];
+}
+
+- (NSURL *)videoURLForPath:(NSString *)path {
+    NSArray *components = [path componentsSeparatedByString:@"/"];
+    if (components.count < 2) {
+        return nil;
+    }
+    NSString *absoluteString = [components[1] stringByRemovingPercentEncoding];
+    return absoluteString ? [NSURL URLWithString:absoluteString] : nil;
+}
+
+- (NSData *)responseHeaderWithStatus:(NSInteger)status reason:(NSString *)reason headers:(NSDictionary *)headers keepAlive:(BOOL)keepAlive {
+    NSMutableString *response = [NSMutableString stringWithFormat:@"HTTP/1.1 %ld %@\r\n", (long)status, reason];
+    for (NSString *name in headers) {
+        [response appendFormat:@"%@: %@\r\n", name, headers[name]];
+    }
+    if (status >= 300) {
+        [response appendString:@"Content-Length: 0\r\n"];
+    }
+    [response appendFormat:@"Connection: %@\r\n\r\n", keepAlive ? @"keep-alive" : @"close"];
+    return [response dataUsingEncoding:NSISOLatin1StringEncoding];
+}
+
+#pragma mark Sources
+
+// Calls the completion block on the connectionQueue, with nil if there is no source. The cache and a running download
+// are looked up right away, a download is only started if `startDownload` is YES, and is waited for without blocking.
+// Returns the request of the download it started, nil if it didn't start one.
+- (id <VMWebVideoOperation>)sourceForVideoURL:(NSURL *)url startingDownload:(BOOL)startDownload completion:(void (^)(VMWebVideoServerSource *source))completion {
+    VMWebVideoManager *manager = self.manager;
+    NSString *key = [manager cacheKeyForURL:url];
+    VMWebVideoServerSource *source = [VMWebVideoServerSource sourceWithFileURL:[manager.videoCache videoDataFilePathFromCacheForKey:key] progressiveFile:nil];
+    if (!source) {
+        // A download that is already running is read while it goes on
+        VMWebVideoProgressiveFile *progressiveFile = [VMWebVideoProgressiveFile progressiveFileForURL:[manager.videoDownloader temporaryFileURLForURL:url]];
+        source = [VMWebVideoServerSource sourceWithFileURL:progressiveFile.fileURL progressiveFile:progressiveFile];
+    }
+    if (source || !startDownload) {
+        completion(source);
+        return nil;
+    }
+    
+    // Otherwise start one, the response begins with the first bytes the download delivers.
+    // The completed block is called on the main thread, once with the partial file and once more when the download ends.
+    __block BOOL delivered = NO;
+    dispatch_queue_t connectionQueue = self.connectionQueue;
+    return [manager downloadVideoWithURL:url options:(VMWebVideoProgressiveDownload | VMWebVideoHighPriority) progress:nil completed:^(NSURL *videoDataFilePath, NSError *error, VMVideoCacheType cacheType, BOOL finished, NSURL *videoURL) {
+        if (delivered) {
+            return;
+        }
+        
+        // The file is opened right away, before a finished download moves it into the cache
+        VMWebVideoProgressiveFile *partialFile = finished ? nil : [VMWebVideoProgressiveFile progressiveFileForURL:videoDataFilePath];
+        if (!finished && !partialFile) {
+            // The download ended in the meantime, the finished call follows
+            return;
+        }
+        VMWebVideoServerSource *downloadSource = [VMWebVideoServerSource sourceWithFileURL:videoDataFilePath progressiveFile:partialFile];
+        delivered = YES;
+        dispatch_async(connectionQueue, ^{
+            completion(downloadSource);
+        });
+    }];
+}
+
+#pragma mark Helpers
+
+- (NSString *)contentTypeForVideoURL:(NSURL *)url {
+    NSString *extension = url.pathExtension.lowercaseString;
+    if ([extension isEqualToString:@"mp4"]) return @"video/mp4";
+    if ([extension isEqualToString:@"m4v"]) return @"video/x-m4v";
+    if ([extension isEqualToString:@"mov"]) return @"video/quicktime";
+    if ([extension isEqualToString:@"3gp"]) return @"video/3gpp";
+    return @"application/octet-stream";
+}
+
+// Parses a single byte range (bytes=first-last, bytes=first- or bytes=-suffixLength) into inclusive bounds
+- (BOOL)parseRange:(NSString *)range length:(long long)length first:(long long *)first last:(long long *)last {
+    NSScanner *scanner = [NSScanner scannerWithString:range];
+    if (![scanner scanString:@"bytes=" intoString:NULL]) {
+        return NO;
+    }
+    
+    // The dash is looked for first, scanLongLong would read a suffix range as a negative number
+    long long start = -1, stop = -1;
+    BOOL hasStart = NO;
+    if (![scanner scanString:@"-" intoString:NULL]) {
+        hasStart = [scanner scanLongLong:&start];
+        if (!hasStart || ![scanner scanString:@"-" intoString:NULL]) {
+            return NO;
+        }
+    }
+    BOOL hasStop = [scanner scanLongLong:&stop];
+    
+    if (!hasStart) {
+        // Suffix range, the last `stop` bytes
+        if (!hasStop || stop <= 0) return NO;
+        start = MAX(length - stop, 0LL);
+        stop = length - 1;
+    }
+    else if (!hasStop || stop >= length) {
+        stop = length - 1;
+    }
+    
+    if (start < 0 || start > stop || start >= length) {
+        return NO;
+    }
+    *first = start;
+    *last = stop;
+    return YES;
+}
+
+@end
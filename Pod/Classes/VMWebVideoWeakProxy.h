@@ -0,0 +1,23 @@
+//
+//  VMWebVideoWeakProxy.h
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Forwards messages to a target it doesn't retain. Used as the delegate of the NSURLSessions we create,
+ * since a session retains its delegate until it is invalidated.
+ *
+ * Once the target is gone, the proxy no longer responds to optional delegate methods and ignores the others.
+ */
+@interface VMWebVideoWeakProxy : NSProxy
+
+@property (weak, nonatomic, readonly) id target;
+
++ (instancetype)proxyWithTarget:(id)target;
+
+@end
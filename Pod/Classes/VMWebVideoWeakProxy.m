@@ -0,0 +1,41 @@
+//
+//  VMWebVideoWeakProxy.m
+//  VMWebVideo
+//
+//  Created by VM Labs on 10/17/26.
+//  Copyright (c) 2026 VM Labs. All rights reserved.
+//
+
+#import "VMWebVideoWeakProxy.h"
+
+@implementation VMWebVideoWeakProxy
+
++ (instancetype)proxyWithTarget:(id)target {
+    VMWebVideoWeakProxy *proxy = [self alloc];
+    proxy->_target = target;
+    return proxy;
+}
+
+- (id)forwardingTargetForSelector:(SEL)selector {
+    return self.target;
+}
+
+- (BOOL)respondsToSelector:(SEL)selector {
+    return [self.target respondsToSelector:selector];
+}
+
+- (BOOL)conformsToProtocol:(Protocol *)protocol {
+    return [self.target conformsToProtocol:protocol];
+}
+
+// Only reached once the target is gone, the message is dropped
+- (NSMethodSignature *)methodSignatureForSelector:(SEL)selector {
+    return [NSObject instanceMethodSignatureForSelector:@selector(init)];
+}
+
+- (void)forwardInvocation:(NSInvocation *)invocation {
+    void *result = NULL;
+    [invocation setReturnValue:&result];
+}
+
+@end